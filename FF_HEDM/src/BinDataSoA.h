@@ -0,0 +1,176 @@
+/**
+ * BinDataSoA.h - Structure-of-arrays copy of the (ring, eta, omega) bins
+ *
+ * Data.bin only stores Spots.bin row numbers, so CompareSpots has to chase
+ * every candidate into the 9-column Spots table to read the four values it
+ * filters on.  DataSoA.bin stores those values next to each other, bin by
+ * bin, in the same order as Data.bin, so the inner loop streams through
+ * contiguous doubles and only touches Spots.bin for the best match.
+ *
+ * Format:
+ *   DataSoA.bin:
+ *     Header: [uint32 magic 'BSOA'][int32 version][int64 nEntries]
+ *             [int64 Data.bin size][int64 mtime s][int64 mtime ns]
+ *             [int64 Data.bin inode]
+ *     Data:   for every bin, in Data.bin order, with n = nData count:
+ *               [double radial deviation x n]   (Spots.bin col 8)
+ *               [double grain radius x n]       (Spots.bin col 3)
+ *               [double eta x n]                (Spots.bin col 6)
+ *               [double omega x n]              (Spots.bin col 2)
+ *
+ * The block of a bin whose nData offset is DataPos starts
+ * BIN_SOA_N_FIELDS * DataPos doubles after the header.  The stamp is taken
+ * from Data.bin once it is complete; if Data.bin no longer has that size,
+ * mtime and inode, or nEntries is not its number of ints, the file is
+ * ignored.  SaveBinData writes it under a temporary name and renames it into
+ * place, so a reader never sees a partial file.
+ */
+
+#ifndef BIN_DATA_SOA_H
+#define BIN_DATA_SOA_H
+
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define BIN_SOA_FN "DataSoA.bin"
+#define BIN_SOA_MAGIC 0x414F5342u /* "BSOA" little-endian */
+#define BIN_SOA_VERSION 2
+#define BIN_SOA_HEADER_BYTES 48
+#define BIN_SOA_STAMP_OFFSET 16
+#define BIN_SOA_N_FIELDS 4
+
+/* Spots.bin columns copied into each bin, in block order */
+static const int BinSoA_cols[BIN_SOA_N_FIELDS] = {8, 3, 6, 2};
+
+typedef struct {
+  const double *values; /* first double after the header */
+  int64_t nEntries;
+  void *rawMap;
+  size_t rawMapSize;
+} BinDataSoA;
+
+/**
+ * Identity of the Data.bin a DataSoA.bin was built from: size, mtime (s and
+ * ns) and inode.
+ * @return 0 on success, -1 if fn cannot be stat'ed
+ */
+static inline int BinSoA_dataStamp(const char *fn, int64_t stamp[4]) {
+  struct stat st;
+  if (stat(fn, &st) != 0)
+    return -1;
+  stamp[0] = (int64_t)st.st_size;
+  stamp[1] = (int64_t)st.st_mtime;
+#if defined(__APPLE__)
+  stamp[2] = (int64_t)st.st_mtimespec.tv_nsec;
+#else
+  stamp[2] = (int64_t)st.st_mtim.tv_nsec;
+#endif
+  stamp[3] = (int64_t)st.st_ino;
+  return 0;
+}
+
+/**
+ * Write the header with a placeholder entry count and stamp.  Call
+ * BinSoA_finishFile once all bins have been appended.
+ */
+static inline int BinSoA_beginFile(FILE *f) {
+  unsigned char header[BIN_SOA_HEADER_BYTES];
+  uint32_t magic = BIN_SOA_MAGIC;
+  int32_t version = BIN_SOA_VERSION;
+  memset(header, 0, sizeof(header));
+  memcpy(header, &magic, sizeof(magic));
+  memcpy(header + 4, &version, sizeof(version));
+  return fwrite(header, sizeof(header), 1, f) == 1 ? 0 : -1;
+}
+
+/**
+ * Append one bin.  scratch must hold at least BIN_SOA_N_FIELDS * nRows
+ * doubles.
+ */
+static inline int BinSoA_appendBin(FILE *f, const double *spots, int nCols,
+                                   const int *rows, int nRows,
+                                   double *scratch) {
+  if (nRows <= 0)
+    return 0;
+  for (int k = 0; k < BIN_SOA_N_FIELDS; k++)
+    for (int i = 0; i < nRows; i++)
+      scratch[(size_t)k * nRows + i] =
+          spots[(size_t)rows[i] * nCols + BinSoA_cols[k]];
+  size_t n = (size_t)BIN_SOA_N_FIELDS * nRows;
+  return fwrite(scratch, sizeof(double), n, f) == n ? 0 : -1;
+}
+
+/**
+ * Patch the entry count and the stamp of the finished Data.bin (see
+ * BinSoA_dataStamp) into the header.
+ */
+static inline int BinSoA_finishFile(FILE *f, int64_t nEntries,
+                                    const int64_t stamp[4]) {
+  if (fseek(f, 8, SEEK_SET) != 0 ||
+      fwrite(&nEntries, sizeof(nEntries), 1, f) != 1 ||
+      fwrite(stamp, sizeof(int64_t), 4, f) != 4)
+    return -1;
+  return fflush(f) == 0 && !ferror(f) ? 0 : -1;
+}
+
+/**
+ * Map <dir>/DataSoA.bin if it exists and was built from <dir>/Data.bin as it
+ * is now, holding nDataEntries rows.
+ * @return 1 if mapped, 0 if absent or stale (soa left empty)
+ */
+static inline int BinSoA_open(BinDataSoA *soa, const char *dir,
+                              int64_t nDataEntries) {
+  char fn[4096], dataFN[4096];
+  int64_t stamp[4], fileStamp[4];
+  snprintf(fn, sizeof(fn), "%s/%s", dir, BIN_SOA_FN);
+  snprintf(dataFN, sizeof(dataFN), "%s/Data.bin", dir);
+  memset(soa, 0, sizeof(*soa));
+  if (BinSoA_dataStamp(dataFN, stamp) != 0)
+    return 0;
+  int fd = open(fn, O_RDONLY);
+  if (fd < 0)
+    return 0;
+  struct stat s;
+  if (fstat(fd, &s) != 0 || (size_t)s.st_size < BIN_SOA_HEADER_BYTES) {
+    close(fd);
+    return 0;
+  }
+  void *map = mmap(0, s.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED)
+    return 0;
+  uint32_t magic;
+  int32_t version;
+  int64_t n;
+  memcpy(&magic, map, sizeof(magic));
+  memcpy(&version, (char *)map + 4, sizeof(version));
+  memcpy(&n, (char *)map + 8, sizeof(n));
+  memcpy(fileStamp, (char *)map + BIN_SOA_STAMP_OFFSET, sizeof(fileStamp));
+  size_t expected =
+      BIN_SOA_HEADER_BYTES + (size_t)n * BIN_SOA_N_FIELDS * sizeof(double);
+  if (magic != BIN_SOA_MAGIC || version != BIN_SOA_VERSION ||
+      n != nDataEntries || (size_t)s.st_size != expected ||
+      memcmp(stamp, fileStamp, sizeof(stamp)) != 0) {
+    printf("Warning: %s does not match Data.bin, ignoring it.\n", fn);
+    munmap(map, s.st_size);
+    return 0;
+  }
+  soa->values = (const double *)((char *)map + BIN_SOA_HEADER_BYTES);
+  soa->nEntries = n;
+  soa->rawMap = map;
+  soa->rawMapSize = s.st_size;
+  return 1;
+}
+
+static inline void BinSoA_close(BinDataSoA *soa) {
+  if (soa->rawMap)
+    munmap(soa->rawMap, soa->rawMapSize);
+  memset(soa, 0, sizeof(*soa));
+}
+
+#endif /* BIN_DATA_SOA_H */
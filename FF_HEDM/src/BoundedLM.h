@@ -0,0 +1,165 @@
+/**
+ * BoundedLM.h - Box-constrained Levenberg-Marquardt core
+ *
+ * Shared by PeakFit2DLM.h (2D pseudo-Voigt peaks, analytic derivatives) and
+ * BoundedLSQ.h (grain fits, forward-difference Jacobian).  The caller
+ * supplies two callbacks: the normal equations J^T J, J^T r and the cost
+ * sum_i r_i^2 at a point, and the cost alone at a trial point.  The core
+ * owns the damping schedule, the bound handling and the stopping tests, so
+ * both solvers behave the same way.
+ *
+ * The damping parameter acts as an adaptive trust region: a step that does
+ * not reduce the cost is rejected and the damping raised.  Parameters on a
+ * bound whose gradient points outwards are held fixed for the iteration and
+ * every trial point is clipped to the box.
+ *
+ * All scratch memory comes from a caller-owned buffer of
+ * BoundedLM_workspaceDoubles(n) doubles, so the core does not allocate.
+ */
+
+#ifndef BOUNDED_LM_H
+#define BOUNDED_LM_H
+
+#include <math.h>
+#include <stddef.h>
+#include <string.h>
+
+#define BOUNDED_LM_FTOL 1e-10
+#define BOUNDED_LM_XTOL 1e-10
+#define BOUNDED_LM_LAMBDA0 1e-3
+#define BOUNDED_LM_LAMBDA_MAX 1e12
+
+/* Return codes */
+#define BOUNDED_LM_CONVERGED 1
+#define BOUNDED_LM_MAXITER 2
+#define BOUNDED_LM_STALLED 3 /* no descent step left at any damping */
+
+/* Fill JtJ (n x n) and Jtr (n) at x and return the cost there. */
+typedef double (*BoundedLM_normalFn)(int n, const double *x, double *JtJ,
+                                     double *Jtr, void *data);
+/* Cost at x. */
+typedef double (*BoundedLM_costFn)(int n, const double *x, void *data);
+
+static inline size_t BoundedLM_workspaceDoubles(int n) {
+  /* JtJ, A (factorised copy), Jtr, masked Jtr, delta, trial x, active */
+  return 2 * (size_t)n * n + 5 * (size_t)n;
+}
+
+/**
+ * Solve A delta = -g in place (A overwritten by its Cholesky factor).
+ * Returns 0 on success, -1 if A is not positive definite.
+ */
+static inline int BoundedLM_cholSolve(int n, double *A, const double *g,
+                                      double *delta) {
+  for (int j = 0; j < n; j++) {
+    double *Aj = A + (size_t)j * n;
+    double s = Aj[j];
+    for (int k = 0; k < j; k++)
+      s -= Aj[k] * Aj[k];
+    if (!(s > 0))
+      return -1;
+    Aj[j] = sqrt(s);
+    for (int i = j + 1; i < n; i++) {
+      double *Ai = A + (size_t)i * n;
+      double t = Ai[j];
+      for (int k = 0; k < j; k++)
+        t -= Ai[k] * Aj[k];
+      Ai[j] = t / Aj[j];
+    }
+  }
+  for (int i = 0; i < n; i++) {
+    const double *Ai = A + (size_t)i * n;
+    double t = -g[i];
+    for (int k = 0; k < i; k++)
+      t -= Ai[k] * delta[k];
+    delta[i] = t / Ai[i];
+  }
+  for (int i = n - 1; i >= 0; i--) {
+    double t = delta[i];
+    for (int k = i + 1; k < n; k++)
+      t -= A[(size_t)k * n + i] * delta[k];
+    delta[i] = t / A[(size_t)i * n + i];
+  }
+  return 0;
+}
+
+/**
+ * Minimize the cost over x (in/out, clipped into [xl, xu]).
+ * @param work   BoundedLM_workspaceDoubles(n) doubles
+ * @param minf   output: final cost
+ * @param nIter  output (may be NULL): iterations done
+ * @return BOUNDED_LM_CONVERGED, BOUNDED_LM_MAXITER or BOUNDED_LM_STALLED
+ */
+static inline int BoundedLM_minimize(int n, double *x, const double *xl,
+                                     const double *xu, int maxIter,
+                                     BoundedLM_normalFn normal,
+                                     BoundedLM_costFn costAt, void *data,
+                                     double *work, double *minf, int *nIter) {
+  size_t nn = (size_t)n * n;
+  double *JtJ = work, *A = work + nn;
+  double *Jtr = A + nn, *gAct = Jtr + n, *delta = gAct + n, *xTry = delta + n;
+  double *active = xTry + n;
+  for (int k = 0; k < n; k++)
+    x[k] = x[k] < xl[k] ? xl[k] : (x[k] > xu[k] ? xu[k] : x[k]);
+  double lambda = BOUNDED_LM_LAMBDA0;
+  double cost = normal(n, x, JtJ, Jtr, data);
+  int rc = BOUNDED_LM_MAXITER, iter;
+  for (iter = 0; iter < maxIter; iter++) {
+    for (int k = 0; k < n; k++)
+      active[k] = (x[k] <= xl[k] && Jtr[k] > 0) ||
+                  (x[k] >= xu[k] && Jtr[k] < 0);
+    int accepted = 0, converged = 0;
+    while (lambda < BOUNDED_LM_LAMBDA_MAX) {
+      for (int a = 0; a < n; a++) {
+        for (int b = 0; b < n; b++)
+          A[(size_t)a * n + b] =
+              (active[a] || active[b]) ? 0 : JtJ[(size_t)a * n + b];
+        double diag = JtJ[(size_t)a * n + a];
+        A[(size_t)a * n + a] =
+            active[a] ? 1.0 : diag + lambda * (diag > 0 ? diag : 1.0);
+        gAct[a] = active[a] ? 0 : Jtr[a];
+      }
+      if (BoundedLM_cholSolve(n, A, gAct, delta) != 0) {
+        lambda *= 10;
+        continue;
+      }
+      double stepNorm = 0, xNorm = 0;
+      for (int k = 0; k < n; k++) {
+        double v = x[k] + delta[k];
+        xTry[k] = v < xl[k] ? xl[k] : (v > xu[k] ? xu[k] : v);
+        stepNorm += (xTry[k] - x[k]) * (xTry[k] - x[k]);
+        xNorm += x[k] * x[k];
+      }
+      if (stepNorm <= BOUNDED_LM_XTOL * BOUNDED_LM_XTOL * (xNorm + 1e-30)) {
+        converged = 1;
+        break;
+      }
+      double costTry = costAt(n, xTry, data);
+      if (costTry < cost) {
+        converged = cost - costTry <= BOUNDED_LM_FTOL * cost;
+        cost = costTry;
+        memcpy(x, xTry, (size_t)n * sizeof(double));
+        lambda = lambda > 1e-12 ? lambda / 10 : lambda;
+        accepted = 1;
+        break;
+      }
+      lambda *= 10;
+    }
+    if (converged) {
+      rc = BOUNDED_LM_CONVERGED;
+      break;
+    }
+    if (!accepted) {
+      rc = BOUNDED_LM_STALLED;
+      break;
+    }
+    if (iter + 1 < maxIter)
+      cost = normal(n, x, JtJ, Jtr, data);
+  }
+  *minf = cost;
+  if (nIter != NULL)
+    *nIter = iter;
+  return rc;
+}
+
+#endif /* BOUNDED_LM_H */
@@ -0,0 +1,136 @@
+/**
+ * BoundedLSQ.h - Box-constrained Levenberg-Marquardt least squares
+ *
+ * Minimizes sum_i r_i(x)^2 subject to xl <= x <= xu for a small number of
+ * parameters (the 3 to 12 of a grain state) and a residual vector computed
+ * by a callback.  The Jacobian is taken by forward differences, so one
+ * iteration costs n + 1 residual evaluations plus one per rejected step,
+ * against the thousands of evaluations Nelder-Mead spends on the same
+ * problem.
+ *
+ * The iteration, damping and bound handling are BoundedLM.h's, shared with
+ * the peak fit; this file supplies the Jacobian and the residual caching.
+ *
+ * Residual callback contract: the number of residuals m is fixed for the
+ * whole fit, so a residual that drops out (e.g. an unmatched spot) must be
+ * reported as 0 rather than omitted.
+ */
+
+#ifndef BOUNDED_LSQ_H
+#define BOUNDED_LSQ_H
+
+#include "BoundedLM.h"
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define BOUNDED_LSQ_MAX_ITER 100
+#define BOUNDED_LSQ_FD_REL 1e-7 /* forward-difference step, relative */
+
+typedef void (*BoundedLSQ_residualFn)(unsigned n, const double *x,
+                                      double *resid, void *data);
+
+static inline double BoundedLSQ_sumSq(int m, const double *r) {
+  double s = 0;
+  for (int i = 0; i < m; i++)
+    s += r[i] * r[i];
+  return s;
+}
+
+typedef struct {
+  BoundedLSQ_residualFn residuals;
+  void *data;
+  int m;
+  const double *xu;
+  double *J;     /* m x n */
+  double *r;     /* residuals at the current point */
+  double *rTry;  /* residuals at xLast, the last trial point */
+  double *rStep; /* residuals at a difference point */
+  double *xStep, *xLast;
+  int haveLast;
+} BoundedLSQ_problem;
+
+/* Forward-difference Jacobian, stepping into the box at a bound.  An accepted
+ * trial point reuses the residuals its cost evaluation computed. */
+static inline double BoundedLSQ_normalCb(int n, const double *x, double *JtJ,
+                                         double *Jtr, void *data) {
+  BoundedLSQ_problem *p = (BoundedLSQ_problem *)data;
+  int m = p->m;
+  if (p->haveLast && memcmp(x, p->xLast, (size_t)n * sizeof(double)) == 0) {
+    double *t = p->r;
+    p->r = p->rTry;
+    p->rTry = t;
+    p->haveLast = 0;
+  } else {
+    p->residuals((unsigned)n, x, p->r, p->data);
+  }
+  memcpy(p->xStep, x, (size_t)n * sizeof(double));
+  for (int k = 0; k < n; k++) {
+    double step = BOUNDED_LSQ_FD_REL * (fabs(x[k]) > 1.0 ? fabs(x[k]) : 1.0);
+    if (x[k] + step > p->xu[k])
+      step = -step;
+    p->xStep[k] = x[k] + step;
+    double h = p->xStep[k] - x[k];
+    p->residuals((unsigned)n, p->xStep, p->rStep, p->data);
+    p->xStep[k] = x[k];
+    for (int i = 0; i < m; i++)
+      p->J[(size_t)i * n + k] = (p->rStep[i] - p->r[i]) / h;
+  }
+  for (int a = 0; a < n; a++) {
+    double ga = 0;
+    for (int i = 0; i < m; i++)
+      ga += p->J[(size_t)i * n + a] * p->r[i];
+    Jtr[a] = ga;
+    for (int b = 0; b <= a; b++) {
+      double s = 0;
+      for (int i = 0; i < m; i++)
+        s += p->J[(size_t)i * n + a] * p->J[(size_t)i * n + b];
+      JtJ[(size_t)a * n + b] = JtJ[(size_t)b * n + a] = s;
+    }
+  }
+  return BoundedLSQ_sumSq(m, p->r);
+}
+
+static inline double BoundedLSQ_costCb(int n, const double *x, void *data) {
+  BoundedLSQ_problem *p = (BoundedLSQ_problem *)data;
+  p->residuals((unsigned)n, x, p->rTry, p->data);
+  memcpy(p->xLast, x, (size_t)n * sizeof(double));
+  p->haveLast = 1;
+  return BoundedLSQ_sumSq(p->m, p->rTry);
+}
+
+/**
+ * Fit x (in/out, clipped into [xl, xu]) to m residuals.
+ * @param minf  output: final sum of squared residuals
+ * @return number of iterations, or -1 on allocation failure (x unchanged)
+ */
+static inline int BoundedLSQ_fit(unsigned n, int m, double *x,
+                                 const double *xl, const double *xu,
+                                 BoundedLSQ_residualFn residuals, void *data,
+                                 double *minf) {
+  int nn = (int)n;
+  size_t nDoubles = (size_t)m * nn + 3 * (size_t)m + 2 * (size_t)nn +
+                    BoundedLM_workspaceDoubles(nn);
+  double *buf = (double *)malloc(nDoubles * sizeof(double));
+  if (buf == NULL)
+    return -1;
+  BoundedLSQ_problem p;
+  p.residuals = residuals;
+  p.data = data;
+  p.m = m;
+  p.xu = xu;
+  p.J = buf;
+  p.r = p.J + (size_t)m * nn;
+  p.rTry = p.r + m;
+  p.rStep = p.rTry + m;
+  p.xStep = p.rStep + m;
+  p.xLast = p.xStep + nn;
+  p.haveLast = 0;
+  int iter;
+  BoundedLM_minimize(nn, x, xl, xu, BOUNDED_LSQ_MAX_ITER, BoundedLSQ_normalCb,
+                     BoundedLSQ_costCb, &p, p.xLast + nn, minf, &iter);
+  free(buf);
+  return iter;
+}
+
+#endif /* BOUNDED_LSQ_H */
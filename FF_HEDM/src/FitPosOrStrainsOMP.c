@@ -53,6 +53,9 @@
 #define CalcNorm2(x, y) sqrt((x) * (x) + (y) * (y))
 #define TestBit(A, k) (A[(k / 32)] & (1 << (k % 32)))
 #include "MIDAS_Limits.h"
+#include "SpotIDIndex.h"
+#include "IndexBestMap.h"
+#include "BoundedLSQ.h"
 #include "midas_version.h"
 #define MAXNOMEGARANGES MAX_N_OMEGA_RANGES
 
@@ -72,6 +75,7 @@ extern double DetParams[4][10];
 static int GlobalDebugFlag = 0;
 double WeightMask = 1.0;
 double WeightFitRMSE = 0.0;
+int GrainFitSolver = 0; // 0: Nelder-Mead, 1: bounded least squares
 
 int BigDetSize = 0;
 int *BigDetector;
@@ -89,6 +93,7 @@ static int g_n_ring_bins = 0;
 static int g_n_eta_bins = 0;
 static int g_n_ome_bins = 0;
 static int gNSpotsBin = 0; // total spots (from Spots.bin)
+static SpotIDIndex gSpotIndex; // SpotID -> row in ExtraInfo.bin / Spots.bin
 
 // check() is now provided by MIDAS_Limits.h
 
@@ -762,8 +767,23 @@ struct OptimizeScratch {
   double *Angles;    // [MaxNSpotsBest] - Added for FitErrorsOrientStrains
   int *SpotLookup;
   int MaxSpnr;
+  // When set, the FitErrors* objectives also write per-spot residuals here:
+  // 2 per spot (dy, dz) for position objectives, 3 per spot for angular
+  // ones.  Unmatched spots get 0.
+  double *resid;
 };
 
+// Residual of the angle between two G-vectors: (gObs x gTheor) / norms, in
+// degrees.  Its length is sin(angle), so near a match it equals the angle
+// but stays smooth through zero for the least-squares Jacobian.
+static inline void GvecAngleResidual(const double GObs[3], double NormGObs,
+                                     const double *GTheor, double resid[3]) {
+  double s = rad2deg / (NormGObs * GTheor[4]);
+  resid[0] = s * (GObs[1] * GTheor[2] - GObs[2] * GTheor[1]);
+  resid[1] = s * (GObs[2] * GTheor[0] - GObs[0] * GTheor[2]);
+  resid[2] = s * (GObs[0] * GTheor[1] - GObs[1] * GTheor[0]);
+}
+
 struct data_FitPosIni {
   int nSpotsComp;
   double **spotsYZO;
@@ -871,6 +891,9 @@ FitErrorsPosSec(double x[3], int nSpotsComp, double spotsYZOIn[nSpotsComp][11],
 
   double PosObs[2], PosTheor[2], Spnr;
   double Error = 0;
+  double *resid = scratch->resid;
+  if (resid != NULL)
+    memset(resid, 0, 2 * nSpotsComp * sizeof(double));
   for (i = 0; i < nSpotsComp; i++) {
     PosObs[0] = SpotsYZOGCorr[i][0];
     PosObs[1] = SpotsYZOGCorr[i][1];
@@ -888,6 +911,12 @@ FitErrorsPosSec(double x[3], int nSpotsComp, double spotsYZOIn[nSpotsComp][11],
           wgt *= exp(-fRMSE * WeightFitRMSE);
         Error += wgt * CalcNorm2((PosObs[0] - PosTheor[0]),
                                  (PosObs[1] - PosTheor[1]));
+        if (resid != NULL) {
+          // Squared by the solver: sqrt keeps the weights linear in the cost
+          double sw = sqrt(wgt);
+          resid[2 * i] = sw * (PosObs[0] - PosTheor[0]);
+          resid[2 * i + 1] = sw * (PosObs[1] - PosTheor[1]);
+        }
         break;
       }
     }
@@ -965,6 +994,9 @@ FitErrorsPosT(double x[12], int nSpotsComp, double spotsYZOIn[nSpotsComp][11],
   int sp;
   double PosObs[2], PosTheor[2], Spnr;
   double Error = 0;
+  double *resid = scratch->resid;
+  if (resid != NULL)
+    memset(resid, 0, 2 * nrMatchedIndexer * sizeof(double));
   for (sp = 0; sp < nrMatchedIndexer; sp++) {
     PosObs[0] = SpotsYZOGCorr[sp][0];
     PosObs[1] = SpotsYZOGCorr[sp][1];
@@ -977,6 +1009,10 @@ FitErrorsPosT(double x[12], int nSpotsComp, double spotsYZOIn[nSpotsComp][11],
         PosTheor[1] = TheorSpotsYZWE[t_idx][1];
         Error +=
             CalcNorm2((PosObs[0] - PosTheor[0]), (PosObs[1] - PosTheor[1]));
+        if (resid != NULL) {
+          resid[2 * sp] = PosObs[0] - PosTheor[0];
+          resid[2 * sp + 1] = PosObs[1] - PosTheor[1];
+        }
       }
     }
   }
@@ -1069,8 +1105,13 @@ static inline double FitErrorsOrientStrainsPos(
   double GObs[3], GTheors[3], NormGObs, NormGTheors, DotGs, Numers, Denoms;
   double *Angles = scratch->Angles;
   double minAngle, Error = 0;
+  double *resid = scratch->resid;
+  if (resid != NULL)
+    memset(resid, 0, 3 * nrMatchedIndexer * sizeof(double));
   for (sp = 0; sp < nrMatchedIndexer; sp++) {
     nTheorSpotsYZWER = 0;
+    int bestTheor = -1;
+    double bestAngle = 0;
     GObs[0] = SpotsYZOGCorr[sp][0];
     GObs[1] = SpotsYZOGCorr[sp][1];
     GObs[2] = SpotsYZOGCorr[sp][2];
@@ -1098,6 +1139,10 @@ static inline double FitErrorsOrientStrainsPos(
             ratio = -1.0;
           if (ratio >= 0.9975640502598242) {
             Angles[nTheorSpotsYZWER] = fabs(acosd(ratio));
+            if (bestTheor == -1 || Angles[nTheorSpotsYZWER] < bestAngle) {
+              bestAngle = Angles[nTheorSpotsYZWER];
+              bestTheor = i;
+            }
             nTheorSpotsYZWER++;
           }
         }
@@ -1113,6 +1158,9 @@ static inline double FitErrorsOrientStrainsPos(
     if (minAngle > 4)
       continue;
     Error += minAngle;
+    if (resid != NULL)
+      GvecAngleResidual(GObs, NormGObs, TheorSpotsYZWE[bestTheor],
+                        resid + 3 * sp);
   }
   return Error;
 }
@@ -1200,8 +1248,13 @@ static inline double FitErrorsOrientStrains(
   double *Angles = scratch->Angles;
   // Angles = malloc(20 * sizeof(*Angles));
   double minAngle, Error = 0;
+  double *resid = scratch->resid;
+  if (resid != NULL)
+    memset(resid, 0, 3 * nrMatchedIndexer * sizeof(double));
   for (sp = 0; sp < nrMatchedIndexer; sp++) {
     nTheorSpotsYZWER = 0;
+    int bestTheor = -1;
+    double bestAngle = 0;
     GObs[0] = SpotsYZOGCorr[sp][0];
     GObs[1] = SpotsYZOGCorr[sp][1];
     GObs[2] = SpotsYZOGCorr[sp][2];
@@ -1229,6 +1282,10 @@ static inline double FitErrorsOrientStrains(
             ratio = -1.0;
           if (ratio >= 0.9975640502598242) {
             Angles[nTheorSpotsYZWER] = fabs(acosd(ratio));
+            if (bestTheor == -1 || Angles[nTheorSpotsYZWER] < bestAngle) {
+              bestAngle = Angles[nTheorSpotsYZWER];
+              bestTheor = i;
+            }
             nTheorSpotsYZWER++;
           }
         }
@@ -1245,6 +1302,9 @@ static inline double FitErrorsOrientStrains(
     if (minAngle > 4)
       continue;
     Error += minAngle;
+    if (resid != NULL)
+      GvecAngleResidual(GObs, NormGObs, TheorSpotsYZWE[bestTheor],
+                        resid + 3 * sp);
   }
   /*
   FreeMemMatrix(hklsIn2, nhkls);
@@ -1324,6 +1384,9 @@ static inline double FitErrorsStrains(
   int sp;
   double PosObs[2], PosTheor[2], Spnr;
   double Error = 0;
+  double *resid = scratch->resid;
+  if (resid != NULL)
+    memset(resid, 0, 2 * nrMatchedIndexer * sizeof(double));
   for (sp = 0; sp < nrMatchedIndexer; sp++) {
     PosObs[0] = SpotsYZOGCorr[sp][0];
     PosObs[1] = SpotsYZOGCorr[sp][1];
@@ -1336,6 +1399,10 @@ static inline double FitErrorsStrains(
         PosTheor[1] = TheorSpotsYZWE[t_idx][1];
         Error +=
             CalcNorm2((PosObs[0] - PosTheor[0]), (PosObs[1] - PosTheor[1]));
+        if (resid != NULL) {
+          resid[2 * sp] = PosObs[0] - PosTheor[0];
+          resid[2 * sp + 1] = PosObs[1] - PosTheor[1];
+        }
       }
     }
   }
@@ -1567,6 +1634,48 @@ static double problem_function_Pos(unsigned n, const double *x, double *grad,
                          Wavelength, wedge, chi, f_data->scratch, f_data);
 }
 
+// Residual callbacks for GrainFitSolver 1: the same objectives, with the
+// per-spot residuals routed into the solver's vector through scratch->resid.
+static void residuals_PosIni(unsigned n, const double *x, double *resid,
+                             void *f_data_trial) {
+  struct data_FitPosIni *f_data = (struct data_FitPosIni *)f_data_trial;
+  f_data->scratch->resid = resid;
+  problem_function_PosIni(n, x, NULL, f_data_trial);
+  f_data->scratch->resid = NULL;
+}
+
+static void residuals_AllAtOnce(unsigned n, const double *x, double *resid,
+                                void *f_data_trial) {
+  struct data_FitPosIni *f_data = (struct data_FitPosIni *)f_data_trial;
+  f_data->scratch->resid = resid;
+  problem_function_AllAtOnce(n, x, NULL, f_data_trial);
+  f_data->scratch->resid = NULL;
+}
+
+static void residuals_OrientIni(unsigned n, const double *x, double *resid,
+                                void *f_data_trial) {
+  struct data_FitOrientIni *f_data = (struct data_FitOrientIni *)f_data_trial;
+  f_data->scratch->resid = resid;
+  problem_function_OrientIni(n, x, NULL, f_data_trial);
+  f_data->scratch->resid = NULL;
+}
+
+static void residuals_StrainIni(unsigned n, const double *x, double *resid,
+                                void *f_data_trial) {
+  struct data_FitStrainIni *f_data = (struct data_FitStrainIni *)f_data_trial;
+  f_data->scratch->resid = resid;
+  problem_function_StrainIni(n, x, NULL, f_data_trial);
+  f_data->scratch->resid = NULL;
+}
+
+static void residuals_Pos(unsigned n, const double *x, double *resid,
+                          void *f_data_trial) {
+  struct data_FitPos *f_data = (struct data_FitPos *)f_data_trial;
+  f_data->scratch->resid = resid;
+  problem_function_Pos(n, x, NULL, f_data_trial);
+  f_data->scratch->resid = NULL;
+}
+
 void FitPositionIni(double X0[12], int nSpotsComp, double **spotsYZO, int nhkls,
                     double **hkls, double Lsd, double Wavelength,
                     int nOmeRanges, double OmegaRanges[MAXNOMEGARANGES][2],
@@ -1615,6 +1724,7 @@ void FitPositionIni(double X0[12], int nSpotsComp, double **spotsYZO, int nhkls,
   f_data.scratch->hklsIn2 = allocMatrix(nhkls, 7);
   f_data.scratch->spotsYZO = allocMatrix(nSpotsComp, 11);
   f_data.scratch->Angles = malloc(MaxNSpotsBest * sizeof(double));
+  f_data.scratch->resid = NULL;
 
   for (i = 0; i < n; i++) {
     x[i] = X0[i];
@@ -1637,12 +1747,17 @@ void FitPositionIni(double X0[12], int nSpotsComp, double **spotsYZO, int nhkls,
   config.xtol_rel = 1e-5;
 
   double minf;
-  run_nlopt_optimization(NLOPT_LN_NELDERMEAD, &config);
-  minf = config.min_function_val;
-  //~ for (i=0;i<n;i++) printf("%f ",x[i]);
-  //~ printf("%10.30f \n", minf);
-  run_nlopt_optimization(NLOPT_LN_NELDERMEAD, &config);
-  minf = config.min_function_val;
+  if (GrainFitSolver == 1) {
+    BoundedLSQ_fit(n, 2 * nSpotsComp, x, xl, xu, residuals_PosIni, trp,
+                   &minf);
+  } else {
+    run_nlopt_optimization(NLOPT_LN_NELDERMEAD, &config);
+    minf = config.min_function_val;
+    //~ for (i=0;i<n;i++) printf("%f ",x[i]);
+    //~ printf("%10.30f \n", minf);
+    run_nlopt_optimization(NLOPT_LN_NELDERMEAD, &config);
+    minf = config.min_function_val;
+  }
   //~ for (i=0;i<n;i++) printf("%f ",x[i]);
   if (GlobalDebugFlag)
     printf("DEBUG OMP FitPositionIni: %10.30f \n", minf);
@@ -1710,6 +1825,7 @@ void FitAllAtOnceFunc(double X0[12], int nSpotsComp, double **spotsYZO,
   f_data.scratch->hklsIn2 = allocMatrix(nhkls, 7);
   f_data.scratch->spotsYZO = allocMatrix(nSpotsComp, 11);
   f_data.scratch->Angles = malloc(MaxNSpotsBest * sizeof(double));
+  f_data.scratch->resid = NULL;
 
   for (i = 0; i < n; i++) {
     x[i] = X0[i];
@@ -1732,10 +1848,15 @@ void FitAllAtOnceFunc(double X0[12], int nSpotsComp, double **spotsYZO,
   config.xtol_rel = 1e-5;
 
   double minf;
-  run_nlopt_optimization(NLOPT_LN_NELDERMEAD, &config);
-  minf = config.min_function_val;
-  run_nlopt_optimization(NLOPT_LN_NELDERMEAD, &config);
-  minf = config.min_function_val;
+  if (GrainFitSolver == 1) {
+    BoundedLSQ_fit(n, 3 * nSpotsComp, x, xl, xu, residuals_AllAtOnce, trp,
+                   &minf);
+  } else {
+    run_nlopt_optimization(NLOPT_LN_NELDERMEAD, &config);
+    minf = config.min_function_val;
+    run_nlopt_optimization(NLOPT_LN_NELDERMEAD, &config);
+    minf = config.min_function_val;
+  }
   if (GlobalDebugFlag)
     printf("DEBUG OMP FitAllAtOnceFunc: %10.30f \n", minf);
   for (i = 0; i < n; i++)
@@ -1802,6 +1923,7 @@ void FitOrientIni(double X0[9], int nSpotsComp, double **spotsYZO, int nhkls,
   f_data.scratch->hklsIn2 = allocMatrix(nhkls, 7);
   f_data.scratch->spotsYZO = allocMatrix(nSpotsComp, 11);
   f_data.scratch->Angles = malloc(MaxNSpotsBest * sizeof(double));
+  f_data.scratch->resid = NULL;
 
   for (i = 0; i < n; i++) {
     x[i] = X0[i];
@@ -1824,12 +1946,17 @@ void FitOrientIni(double X0[9], int nSpotsComp, double **spotsYZO, int nhkls,
   config.xtol_rel = 1e-5;
 
   double minf;
-  run_nlopt_optimization(NLOPT_LN_NELDERMEAD, &config);
-  minf = config.min_function_val;
-  //~ for (i=0;i<n;i++) printf("%f ",x[i]);
-  //~ printf("%10.30f \n", minf);
-  run_nlopt_optimization(NLOPT_LN_NELDERMEAD, &config);
-  minf = config.min_function_val;
+  if (GrainFitSolver == 1) {
+    BoundedLSQ_fit(n, 3 * nSpotsComp, x, xl, xu, residuals_OrientIni, trp,
+                   &minf);
+  } else {
+    run_nlopt_optimization(NLOPT_LN_NELDERMEAD, &config);
+    minf = config.min_function_val;
+    //~ for (i=0;i<n;i++) printf("%f ",x[i]);
+    //~ printf("%10.30f \n", minf);
+    run_nlopt_optimization(NLOPT_LN_NELDERMEAD, &config);
+    minf = config.min_function_val;
+  }
   //~ for (i=0;i<n;i++) printf("%f ",x[i]);
   if (GlobalDebugFlag)
     printf("DEBUG OMP FitOrientIni: %10.30f \n", minf);
@@ -1898,6 +2025,7 @@ void FitStrainIni(double X0[6], int nSpotsComp, double **spotsYZO, int nhkls,
   f_data.scratch->hklsIn2 = allocMatrix(nhkls, 7);
   f_data.scratch->spotsYZO = allocMatrix(nSpotsComp, 11);
   f_data.scratch->Angles = malloc(MaxNSpotsBest * sizeof(double));
+  f_data.scratch->resid = NULL;
 
   for (i = 0; i < n; i++) {
     x[i] = X0[i];
@@ -1920,12 +2048,17 @@ void FitStrainIni(double X0[6], int nSpotsComp, double **spotsYZO, int nhkls,
   config.xtol_rel = 1e-5;
 
   double minf;
-  run_nlopt_optimization(NLOPT_LN_NELDERMEAD, &config);
-  minf = config.min_function_val;
-  //~ for (i=0;i<n;i++) printf("%f ",x[i]);
-  //~ printf("%10.30f \n", minf);
-  run_nlopt_optimization(NLOPT_LN_NELDERMEAD, &config);
-  minf = config.min_function_val;
+  if (GrainFitSolver == 1) {
+    BoundedLSQ_fit(n, 2 * nSpotsComp, x, xl, xu, residuals_StrainIni, trp,
+                   &minf);
+  } else {
+    run_nlopt_optimization(NLOPT_LN_NELDERMEAD, &config);
+    minf = config.min_function_val;
+    //~ for (i=0;i<n;i++) printf("%f ",x[i]);
+    //~ printf("%10.30f \n", minf);
+    run_nlopt_optimization(NLOPT_LN_NELDERMEAD, &config);
+    minf = config.min_function_val;
+  }
   //~ for (i=0;i<n;i++) printf("%f ",x[i]);
   if (GlobalDebugFlag)
     printf("DEBUG OMP FitStrainIni: %10.30f \n", minf);
@@ -1994,6 +2127,7 @@ void FitPosSec(double X0[3], int nSpotsComp, double **spotsYZO, int nhkls,
   f_data.scratch->hklsIn2 = allocMatrix(nhkls, 7);
   f_data.scratch->spotsYZO = allocMatrix(nSpotsComp, 11);
   f_data.scratch->Angles = malloc(MaxNSpotsBest * sizeof(double));
+  f_data.scratch->resid = NULL;
 
   // Pre-calculate invariant data
   double **hklsIn2 = f_data.scratch->hklsIn2;
@@ -2040,12 +2174,17 @@ void FitPosSec(double X0[3], int nSpotsComp, double **spotsYZO, int nhkls,
   config.xtol_rel = 1e-5;
 
   double minf;
-  run_nlopt_optimization(NLOPT_LN_NELDERMEAD, &config);
-  minf = config.min_function_val;
-  //~ for (i=0;i<n;i++) printf("%f ",x[i]);
-  //~ printf("%10.30f \n", minf);
-  run_nlopt_optimization(NLOPT_LN_NELDERMEAD, &config);
-  minf = config.min_function_val;
+  if (GrainFitSolver == 1) {
+    BoundedLSQ_fit(n, 2 * nSpotsComp, x, xl, xu, residuals_Pos, trp,
+                   &minf);
+  } else {
+    run_nlopt_optimization(NLOPT_LN_NELDERMEAD, &config);
+    minf = config.min_function_val;
+    //~ for (i=0;i<n;i++) printf("%f ",x[i]);
+    //~ printf("%10.30f \n", minf);
+    run_nlopt_optimization(NLOPT_LN_NELDERMEAD, &config);
+    minf = config.min_function_val;
+  }
   //~ for (i=0;i<n;i++) printf("%f ",x[i]);
   if (GlobalDebugFlag)
     printf("DEBUG OMP FitPosSec: %10.30f \n", minf);
@@ -2063,6 +2202,35 @@ void FitPosSec(double X0[3], int nSpotsComp, double **spotsYZO, int nhkls,
   free(f_data.scratch);
 }
 
+// Seed IDs from SpotsToIndex.csv (first column), one per line.
+static int *ReadSpotsToIndex(const char *fn, int *nIDs) {
+  *nIDs = 0;
+  FILE *f = fopen(fn, "r");
+  if (f == NULL)
+    return NULL;
+  int cap = 1024, n = 0;
+  int *ids = malloc(cap * sizeof(*ids));
+  char line[1000];
+  while (ids != NULL && fgets(line, sizeof(line), f) != NULL) {
+    if (n == cap) {
+      cap *= 2;
+      int *grown = realloc(ids, cap * sizeof(*ids));
+      if (grown == NULL) {
+        free(ids);
+        ids = NULL;
+        break;
+      }
+      ids = grown;
+    }
+    ids[n] = -1;
+    sscanf(line, "%d", &ids[n]);
+    n++;
+  }
+  fclose(f);
+  *nIDs = n;
+  return ids;
+}
+
 long long int ReadBigDet(char *cwd) {
   int fd;
   struct stat s;
@@ -2145,6 +2313,7 @@ int main(int argc, char *argv[]) {
   gEtaBinSize = cfg.EtaBinSize;
   gOmeBinSize = cfg.OmeBinSize;
   WeightMask = cfg.WeightMask;
+  GrainFitSolver = cfg.GrainFitSolver;
   WeightFitRMSE = cfg.WeightFitRMSE;
   DoDynamicReassignment = cfg.DoDynamicReassignment;
   int FitAllAtOnce = cfg.FitAllAtOnce;
@@ -2208,6 +2377,9 @@ int main(int argc, char *argv[]) {
   check(AllSpots == MAP_FAILED, "mmap %s failed: %s", filename,
         strerror(errno));
   int nSpots = (int)size / (16 * sizeof(double));
+  check(SpotIDIndex_build(&gSpotIndex, AllSpots, nSpots, 16, 4) != 0,
+        "Could not build the SpotID index for %d spots.", nSpots);
+  printf("SpotID index built (max ID %d).\n", gSpotIndex.maxID);
   // Mmap Spots.bin, Data.bin and nData.bin for dynamic spot reassignment
   {
     char binFN[2048];
@@ -2332,18 +2504,26 @@ int main(int argc, char *argv[]) {
         (int)(ceil((double)nSpotsToIndex / (double)nBlocks)) * (blockNr + 1);
     endRowNr = tmp < (nSpotsToIndex - 1) ? tmp : (nSpotsToIndex - 1);
     nSptIDs = endRowNr - startRowNr + 1;
-    SptIDs = malloc(nSptIDs * sizeof(*SptIDs));
-    // Read spotIDs
-    FILE *spotsFile = fopen("SpotsToIndex.csv", "r");
-    int it;
-    for (it = 0; it < startRowNr; it++) {
-      fgets(aline, 1000, spotsFile);
+    // Read all spotIDs once; a seed's IndexBest row is the first row of
+    // SpotsToIndex.csv carrying its ID.
+    int nSeedRows;
+    int *SeedIDs = ReadSpotsToIndex("SpotsToIndex.csv", &nSeedRows);
+    if (SeedIDs == NULL) {
+      printf("Could not read the SpotsToIndex.csv file. Exiting.\n");
+      return 1;
     }
-    for (it = 0; it < nSptIDs; it++) {
-      fgets(aline, 1000, spotsFile);
-      sscanf(aline, "%d", &SptIDs[it]);
+    if (startRowNr + nSptIDs > nSeedRows)
+      nSptIDs = nSeedRows > startRowNr ? nSeedRows - startRowNr : 0;
+    SptIDs = SeedIDs + startRowNr;
+    SpotIDIndex seedRows;
+    if (SpotIDIndex_buildFromIDs(&seedRows, SeedIDs, nSeedRows) != 0) {
+      printf("Could not allocate the seed row table. Exiting.\n");
+      return 1;
     }
-    fclose(spotsFile);
+    IndexBestMap indexBest;
+    int haveIndexBest = IndexBestMap_open(&indexBest, OutputFolder, MaxNHKLS) == 0;
+    if (!haveIndexBest)
+      printf("Nothing was found during indexing, nothing to do.\n");
     int thisRowNr;
     /* Hoist file descriptors before parallel region — pwrite at
        non-overlapping offsets is thread-safe on a single fd */
@@ -2362,48 +2542,18 @@ int main(int argc, char *argv[]) {
       int i, j, k;
       int SpId = SptIDs[thisRowNr];
       double LatCin[6];
-      char *SpFN = "SpotsToIndex.csv";
-      FILE *SpFile = fopen(SpFN, "r");
-      if (SpFile == NULL) {
-        printf("Could not read the SpotsToIndex.csv file while trying %d. "
-               "Exiting.\n",
-               SpId);
-        continue;
-      }
-      int rowNr = 0;
-      int ThisID;
-      int count = 0;
-      char line[5024];
-      while (fgets(line, 5000, SpFile) != NULL) {
-        sscanf(line, "%d", &ThisID);
-        if (ThisID == SpId) {
-          rowNr = count;
-          break;
-        }
-        count++;
-      }
-      fclose(SpFile);
+      int rowNr = SpotIDIndex_lookup(&seedRows, SpId);
+      if (rowNr < 0)
+        rowNr = 0;
       for (i = 0; i < 6; i++)
         LatCin[i] = LatCinT[i];
 
       int nSpID = 0;
-      char InpFN[2048], InpFN2[2048];
-      sprintf(InpFN, "%s/IndexBest.bin", OutputFolder);
-      sprintf(InpFN2, "%s/IndexBestFull.bin", OutputFolder);
-      int inpF = open(InpFN, O_RDONLY);
-      if (inpF == -1) {
-        printf("Nothing was found during indexing, nothing to do.\n");
+      if (!haveIndexBest)
         continue;
-      }
-      size_t offst1 = rowNr;
-      offst1 *= 15 * sizeof(double);
-      double *locArr;
-      locArr = calloc(15, sizeof(*locArr));
-      int rcA = pread(inpF, locArr, 15 * sizeof(double), offst1);
-      close(inpF);
-      if (rcA < (ssize_t)(15 * sizeof(double))) {
-        // Short read or EOF — slot was never written by IndexerOMP
-        free(locArr);
+      const double *locArr = IndexBestMap_best(&indexBest, rowNr);
+      if (locArr == NULL) {
+        // Past the end of IndexBest.bin — slot was never written by IndexerOMP
         char KeyFN[1024];
         sprintf(KeyFN, "%s/Key.bin", ResultFolder);
         int SizeKeyFile = 2 * sizeof(int);
@@ -2447,7 +2597,6 @@ int main(int argc, char *argv[]) {
         printf("No spots found for ID: %d.\n", thisRowNr);
         continue;
       }
-      free(locArr);
       completeness = NrObserved / NrExpected;
       char SpotsCompFN[2048];
       int nSpotsBest = (int)NrObserved, *spotIDS, nSpotsRad = 0;
@@ -2456,17 +2605,11 @@ int main(int argc, char *argv[]) {
         //        thisRowNr, rowNr);
         continue;
       }
-      double *locArr2;
+      double *locArr2Owned;
       spotIDS = malloc(nSpotsBest * sizeof(*spotIDS));
-      locArr2 = calloc((int)NrObserved * 2, sizeof(*locArr2));
-      size_t offst2 = rowNr;
-      offst2 *= MaxNHKLS;
-      offst2 *= 2 * sizeof(double);
-      int inpF2 = open(InpFN2, O_RDONLY);
-      int rcB =
-          pread(inpF2, locArr2, (int)NrObserved * 2 * sizeof(double), offst2);
-      close(inpF2);
-      if (rcB < (ssize_t)((int)NrObserved * 2 * sizeof(double))) {
+      const double *locArr2 =
+          IndexBestMap_full(&indexBest, rowNr, nSpotsBest, &locArr2Owned);
+      if (locArr2Owned != NULL) {
         printf("Warning: short read from IndexBestFull.bin for rowNr %d\n",
                rowNr);
       }
@@ -2474,8 +2617,8 @@ int main(int argc, char *argv[]) {
         spotIDS[i] = (int)locArr2[i * 2 + 0];
 
         // Retrieve RingNr and Check Exclusion
-        size_t spotPos = (size_t)spotIDS[i] - 1;
-        if (spotPos >= nSpots || spotPos < 0)
+        int spotPos = SpotIDIndex_lookup(&gSpotIndex, spotIDS[i]);
+        if (spotPos < 0)
           continue;
 
         int RingNr = (int)AllSpots[spotPos * 16 + 9];
@@ -2498,7 +2641,7 @@ int main(int argc, char *argv[]) {
           }
         }
       }
-      free(locArr2);
+      free(locArr2Owned);
       if (nSpotsRad > 0)
         meanRadius /= nSpotsRad;
       else
@@ -2519,32 +2662,12 @@ int main(int argc, char *argv[]) {
       double **spotsYZO;
       spotsYZO = allocMatrix(nSpotsBest, 11);
       int nSpotsYZO = nSpotsBest;
-      // Idea: spotID always starts from 1 and is increasing in number, so
-      // spotIDS[i] should correspond to AllSpots[(spotIDS[i]-1)*14+...], this
-      // should reduce execution time.
-      size_t spotPosAllSpots;
+      // Resolve each matched SpotID to its ExtraInfo.bin row in O(1).
+      int spotPosAllSpots;
       int nSpotsFound = nSpotsBest;
       for (i = 0; i < nSpotsBest; i++) {
-        spotPosAllSpots = (int)spotIDS[i] - 1;
-        // check if spotPosAllSpots + 1 > nSpots, then print and error and
-        // continue to next spot
-        if (spotPosAllSpots >= nSpots || spotPosAllSpots < 0) {
-          // printf("\n\nData mismatch! Original: %d, Looked for "
-          //        "spotNr %d, nSpots %d, skipping this spot, GrID: %d, "
-          //        "nSpotsBest: %d.\n\n\n",
-          //        (int)spotIDS[i], (int)(spotPosAllSpots + 1), (int)nSpots,
-          //        (int)thisRowNr, (int)nSpotsBest);
-          // fflush(stdout);
-          nSpotsFound--;
-          continue;
-        }
-        if (spotPosAllSpots + 1 != (size_t)AllSpots[spotPosAllSpots * 16 + 4]) {
-          // printf("\n\nData mismatch! Original: %d, Looked for %d, found %d, "
-          //        "skipping this spot, GrID: %d, nSpotsBest: %d.\n\n\n",
-          //        (int)spotIDS[i], (int)(spotPosAllSpots + 1),
-          //        (int)AllSpots[spotPosAllSpots * 16 + 4], (int)thisRowNr,
-          //        (int)nSpotsBest);
-          // fflush(stdout);
+        spotPosAllSpots = SpotIDIndex_lookup(&gSpotIndex, spotIDS[i]);
+        if (spotPosAllSpots < 0) {
           nSpotsFound--;
           continue;
         }
@@ -3106,35 +3229,27 @@ int main(int argc, char *argv[]) {
       close(hoistKeyFD);
 
     FreeMemMatrix(hkls, MaxNHKLS);
-    free(SptIDs);
+    free(SeedIDs);
+    SpotIDIndex_free(&seedRows);
+    if (haveIndexBest)
+      IndexBestMap_close(&indexBest);
     double time = omp_get_wtime() - start_time;
     printf("Finished, time elapsed: %lf seconds.\n", time);
   } else {
     // We have the GrainsFile input, so just read the bin file, get the info and
     // fit strain only! Read SpotsToIndex.csv
     printf("We are tracking grains!\n");
-    int *SptIDs;
-    int nSptIDs = 0;
-    FILE *spotsFile = fopen("SpotsToIndex.csv", "r");
-    if (spotsFile == NULL) {
+    int nSptIDs;
+    int *SptIDs = ReadSpotsToIndex("SpotsToIndex.csv", &nSptIDs);
+    if (SptIDs == NULL) {
       printf("Could not open SpotsToIndex.csv. Exiting.\n");
       exit(EXIT_FAILURE);
     }
-    // Count the number of lines in the file
-    char line[1000];
-    while (fgets(line, sizeof(line), spotsFile)) {
-      nSptIDs++;
-    }
-    rewind(spotsFile);
-
-    // Allocate memory for SptIDs and read all spot IDs
-    SptIDs = malloc(nSptIDs * sizeof(*SptIDs));
-    int it = 0;
-    while (fgets(line, sizeof(line), spotsFile)) {
-      sscanf(line, "%d", &SptIDs[it]);
-      it++;
-    }
-    fclose(spotsFile);
+    int it;
+    IndexBestMap indexBest;
+    int haveIndexBest = IndexBestMap_open(&indexBest, OutputFolder, MaxNHKLS) == 0;
+    if (!haveIndexBest)
+      printf("Nothing was found during indexing, nothing to do.\n");
     /* Hoist Key.bin fd before parallel region */
     char hoistKeyFN2[1024];
     sprintf(hoistKeyFN2, "%s/Key.bin", ResultFolder);
@@ -3162,23 +3277,11 @@ int main(int argc, char *argv[]) {
         }
         continue;
       }
-      char InpFN[2048], InpFN2[2048];
-      sprintf(InpFN, "%s/IndexBest.bin", OutputFolder);
-      sprintf(InpFN2, "%s/IndexBestFull.bin", OutputFolder);
-      int inpF = open(InpFN, O_RDONLY);
-      if (inpF == -1) {
-        printf("Nothing was found during indexing, nothing to do.\n");
+      if (!haveIndexBest)
         continue;
-      }
-      size_t offst1 = it;
-      offst1 *= 15 * sizeof(double);
-      double *locArr;
-      locArr = calloc(15, sizeof(*locArr));
-      int rcA = pread(inpF, locArr, 15 * sizeof(double), offst1);
-      close(inpF);
-      if (rcA < (ssize_t)(15 * sizeof(double))) {
-        // Short read or EOF — slot was never written by IndexerOMP
-        free(locArr);
+      const double *locArr = IndexBestMap_best(&indexBest, it);
+      if (locArr == NULL) {
+        // Past the end of IndexBest.bin — slot was never written by IndexerOMP
         char KeyFN[1024];
         sprintf(KeyFN, "%s/Key.bin", ResultFolder);
         int SizeKeyFile = 2 * sizeof(int);
@@ -3217,20 +3320,13 @@ int main(int argc, char *argv[]) {
         Pos0[i] = locArr[i + 10];
       NrExpected = locArr[13];
       NrObserved = locArr[14];
-      free(locArr);
       completeness = NrObserved / NrExpected;
       int nSpotsBest = (int)NrObserved, *spotIDS, nSpotsRad = 0;
-      double *locArr2;
+      double *locArr2Owned;
       spotIDS = malloc(nSpotsBest * sizeof(*spotIDS));
-      locArr2 = calloc((int)NrObserved * 2, sizeof(*locArr2));
-      size_t offst2 = it;
-      offst2 *= MaxNHKLS;
-      offst2 *= 2 * sizeof(double);
-      int inpF2 = open(InpFN2, O_RDONLY);
-      int rcB =
-          pread(inpF2, locArr2, (int)NrObserved * 2 * sizeof(double), offst2);
-      close(inpF2);
-      if (rcB < (ssize_t)((int)NrObserved * 2 * sizeof(double))) {
+      const double *locArr2 =
+          IndexBestMap_full(&indexBest, it, nSpotsBest, &locArr2Owned);
+      if (locArr2Owned != NULL) {
         printf("Warning: short read from IndexBestFull.bin for grain %d\n", it);
       }
       double thisRadius, meanRadius = 0, MaxRadTot = -100;
@@ -3245,7 +3341,7 @@ int main(int argc, char *argv[]) {
           }
         }
       }
-      free(locArr2);
+      free(locArr2Owned);
       meanRadius /= nSpotsRad;
       if (TakeGrainMax == 1) {
         meanRadius = MaxRadTot;
@@ -3262,26 +3358,27 @@ int main(int argc, char *argv[]) {
       OrientMat2Euler(Orient0_3, Euler0);
       double **spotsYZO;
       spotsYZO = allocMatrix(nSpotsBest, 11);
-      int nSpotsYZO = nSpotsBest;
-      size_t spotPosAllSpots;
+      int nSpotsYZO = 0;
+      int spotPosAllSpots;
       for (i = 0; i < nSpotsBest; i++) {
-        spotPosAllSpots = (int)spotIDS[i] - 1;
-        if (spotPosAllSpots + 1 != (size_t)AllSpots[spotPosAllSpots * 16 + 4]) {
-          printf("Data mismatch! Behavior undefined. Original: %d, Looked for "
-                 "%zu, found %zu\n",
-                 (int)spotIDS[i], spotPosAllSpots + 1,
-                 (size_t)AllSpots[spotPosAllSpots * 16 + 4]);
+        spotPosAllSpots = SpotIDIndex_lookup(&gSpotIndex, spotIDS[i]);
+        if (spotPosAllSpots < 0) {
+          printf("Warning: SpotID %d not found in ExtraInfo.bin, skipping it "
+                 "for grain %d.\n",
+                 spotIDS[i], it);
+          continue;
         }
-        spotsYZO[i][0] = AllSpots[spotPosAllSpots * 16 + 0];
-        spotsYZO[i][1] = AllSpots[spotPosAllSpots * 16 + 1];
-        spotsYZO[i][2] = AllSpots[spotPosAllSpots * 16 + 2];
-        spotsYZO[i][3] = AllSpots[spotPosAllSpots * 16 + 4];
-        spotsYZO[i][4] = AllSpots[spotPosAllSpots * 16 + 8];
-        spotsYZO[i][5] = AllSpots[spotPosAllSpots * 16 + 9];
-        spotsYZO[i][6] = AllSpots[spotPosAllSpots * 16 + 10];
-        spotsYZO[i][7] = AllSpots[spotPosAllSpots * 16 + 5];
-        spotsYZO[i][8] = AllSpots[spotPosAllSpots * 16 + 14];
-        spotsYZO[i][9] = AllSpots[spotPosAllSpots * 16 + 15];
+        spotsYZO[nSpotsYZO][0] = AllSpots[spotPosAllSpots * 16 + 0];
+        spotsYZO[nSpotsYZO][1] = AllSpots[spotPosAllSpots * 16 + 1];
+        spotsYZO[nSpotsYZO][2] = AllSpots[spotPosAllSpots * 16 + 2];
+        spotsYZO[nSpotsYZO][3] = AllSpots[spotPosAllSpots * 16 + 4];
+        spotsYZO[nSpotsYZO][4] = AllSpots[spotPosAllSpots * 16 + 8];
+        spotsYZO[nSpotsYZO][5] = AllSpots[spotPosAllSpots * 16 + 9];
+        spotsYZO[nSpotsYZO][6] = AllSpots[spotPosAllSpots * 16 + 10];
+        spotsYZO[nSpotsYZO][7] = AllSpots[spotPosAllSpots * 16 + 5];
+        spotsYZO[nSpotsYZO][8] = AllSpots[spotPosAllSpots * 16 + 14];
+        spotsYZO[nSpotsYZO][9] = AllSpots[spotPosAllSpots * 16 + 15];
+        nSpotsYZO++;
       }
       double *Ini;
       Ini = malloc(12 * sizeof(*Ini));
@@ -3549,6 +3646,9 @@ int main(int argc, char *argv[]) {
     }
     if (hoistKeyFD2 > 0)
       close(hoistKeyFD2);
+    free(SptIDs);
+    if (haveIndexBest)
+      IndexBestMap_close(&indexBest);
   }
   return 0;
 }
\ No newline at end of file
@@ -16,6 +16,7 @@
 #include "DetectorGeometry.h"
 #include "Panel.h"
 #include "ZarrReader.h"
+#include "SpotsColumnar.h"
 #include "midas_version.h"
 #include <blosc2.h>
 #include <ctype.h>
@@ -651,6 +652,13 @@ int main(int argc, char *argv[]) {
   double Rsample, Hbeam, MinMatchesToAcceptFrac = 0, MinOmeSpotIDsToIndex,
                          MaxOmeSpotIDsToIndex, Width = -1, WidthOrig;
   int UseFriedelPairs = 1;
+  int BinDataSoA = 0;
+  int SpotsColumnarOut = 0;
+  int PruneCandidates = 0, OrderCandidates = 0, VerifyPruning = 0;
+  // OrientCacheQuantum -1: IndexerOMP uses StepsizeOrient / 10
+  double OrientCacheMB = 0, OrientCacheQuantum = -1;
+  int SeedSubTasks = 0;
+  int GrainFitSolver = 0;
   double t_int = 1, t_gap = 0;
   int TopLayer = 0;
   int maxNFrames = 100000, SGnum = 225;
@@ -796,6 +804,50 @@ int main(int argc, char *argv[]) {
         NULL) {
       ReadZarrChunk(arch, count, &UseFriedelPairs, sizeof(int));
     }
+    if (strstr(finfo->name,
+               "analysis/process/analysis_parameters/BinDataSoA/0") != NULL) {
+      ReadZarrChunk(arch, count, &BinDataSoA, sizeof(int));
+    }
+    if (strstr(finfo->name,
+               "analysis/process/analysis_parameters/SpotsColumnar/0") !=
+        NULL) {
+      ReadZarrChunk(arch, count, &SpotsColumnarOut, sizeof(int));
+    }
+    if (strstr(finfo->name,
+               "analysis/process/analysis_parameters/PruneCandidates/0") !=
+        NULL) {
+      ReadZarrChunk(arch, count, &PruneCandidates, sizeof(int));
+    }
+    if (strstr(finfo->name,
+               "analysis/process/analysis_parameters/OrderCandidates/0") !=
+        NULL) {
+      ReadZarrChunk(arch, count, &OrderCandidates, sizeof(int));
+    }
+    if (strstr(finfo->name,
+               "analysis/process/analysis_parameters/VerifyPruning/0") !=
+        NULL) {
+      ReadZarrChunk(arch, count, &VerifyPruning, sizeof(int));
+    }
+    if (strstr(finfo->name,
+               "analysis/process/analysis_parameters/OrientCacheMB/0") !=
+        NULL) {
+      ReadZarrChunk(arch, count, &OrientCacheMB, sizeof(double));
+    }
+    if (strstr(finfo->name,
+               "analysis/process/analysis_parameters/OrientCacheQuantum/0") !=
+        NULL) {
+      ReadZarrChunk(arch, count, &OrientCacheQuantum, sizeof(double));
+    }
+    if (strstr(finfo->name,
+               "analysis/process/analysis_parameters/SeedSubTasks/0") !=
+        NULL) {
+      ReadZarrChunk(arch, count, &SeedSubTasks, sizeof(int));
+    }
+    if (strstr(finfo->name,
+               "analysis/process/analysis_parameters/GrainFitSolver/0") !=
+        NULL) {
+      ReadZarrChunk(arch, count, &GrainFitSolver, sizeof(int));
+    }
     if (strstr(finfo->name,
                "analysis/process/analysis_parameters/EtaBinSize/0") != NULL) {
       ReadZarrChunk(arch, count, &EtaBinSize, sizeof(double));
@@ -1537,7 +1589,40 @@ int main(int argc, char *argv[]) {
                      "ZOrig(NoWedgeCorr) YOrig(DetCor) ZOrig(DetCor) "
                      "OmegaOrig(DetCor) IntegratedIntensity(count) "
                      "RawSumIntensity maskTouched FitRMSE\n");
+  // Optional binary columnar copy of the ExtraInfo table (SpotsColumnar.h)
+  double *spotCols[SPOTS_COLUMNAR_N_COLS] = {NULL};
+  if (SpotsColumnarOut == 1) {
+    for (j = 0; j < SPOTS_COLUMNAR_N_COLS; j++) {
+      spotCols[j] = calloc(nIndices > 0 ? nIndices : 1, sizeof(double));
+      if (spotCols[j] == NULL) {
+        printf("Warning: could not allocate the columnar spot table, "
+               "writing CSVs only.\n");
+        for (k = 0; k <= j; k++) {
+          free(spotCols[k]);
+          spotCols[k] = NULL;
+        }
+        SpotsColumnarOut = 0;
+        break;
+      }
+    }
+  }
   for (i = 0; i < nIndices; i++) {
+    if (SpotsColumnarOut == 1) {
+      double row[SPOTS_COLUMNAR_N_COLS] = {0};
+      row[SPC_SpotID] = SpotsInfo[i][0];
+      if (goodRows[i] == 1) {
+        double full[SPOTS_COLUMNAR_N_COLS] = {
+            YCorrWedge[i],     ZCorrWedge[i],     OmegaCorrWedge[i],
+            SpotsInfo[i][5],   SpotsInfo[i][0],   SpotsInfo[i][4],
+            EtaCorrWedge[i],   TthetaCorrWedge[i], SpotsInfo[i][1],
+            YCorrected[i],     ZCorrected[i],     SpotsInfo[i][2],
+            SpotsInfo[i][3],   SpotsInfo[i][1],   SpotsInfo[i][6],
+            SpotsInfo[i][7],   SpotsInfo[i][8],   SpotsInfo[i][9]};
+        memcpy(row, full, sizeof(row));
+      }
+      for (j = 0; j < SPOTS_COLUMNAR_N_COLS; j++)
+        spotCols[j][i] = SpotsColumnar_round5(row[j]);
+    }
     if (goodRows[i] == 1) {
       fprintf(IndexAll,
               "%12.5f %12.5f %12.5f %12.5f %12.5f %12.5f %12.5f %12.5f\n",
@@ -1575,6 +1660,21 @@ int main(int argc, char *argv[]) {
   fclose(IndexAll);
   fclose(IndexAllNoHeader);
   fclose(ExtraInfo);
+  if (SpotsColumnarOut == 1) {
+    if (SpotsColumnar_write(folder, spotCols, nIndices) == 0)
+      printf("Wrote %s/%s.\n", folder, SPOTS_COLUMNAR_FN);
+    else
+      printf("Warning: could not write %s/%s, consumers will read the CSV.\n",
+             folder, SPOTS_COLUMNAR_FN);
+    for (j = 0; j < SPOTS_COLUMNAR_N_COLS; j++)
+      free(spotCols[j]);
+  } else {
+    // A leftover file from an earlier run would no longer match the CSVs
+    char spotColsFN[4096];
+    snprintf(spotColsFN, sizeof(spotColsFN), "%s/%s", folder,
+             SPOTS_COLUMNAR_FN);
+    remove(spotColsFN);
+  }
   PF = fopen(parfn, "w");
   //~ fprintf(PF,"LatticeConstant %f;\n",LatticeConstant[0]);
   fprintf(PF, "LatticeParameter %f %f %f %f %f %f;\n", LatticeConstant[0],
@@ -1602,6 +1702,23 @@ int main(int argc, char *argv[]) {
     fprintf(PF, "RingRadii %f;\n", RingRadsIdeal[i]);
   }
   fprintf(PF, "UseFriedelPairs %d;\n", UseFriedelPairs);
+  if (BinDataSoA)
+    fprintf(PF, "BinDataSoA %d;\n", BinDataSoA);
+  if (PruneCandidates)
+    fprintf(PF, "PruneCandidates %d;\n", PruneCandidates);
+  if (OrderCandidates)
+    fprintf(PF, "OrderCandidates %d;\n", OrderCandidates);
+  if (VerifyPruning)
+    fprintf(PF, "VerifyPruning %d;\n", VerifyPruning);
+  if (OrientCacheMB > 0) {
+    fprintf(PF, "OrientCacheMB %f;\n", OrientCacheMB);
+    if (OrientCacheQuantum != -1)
+      fprintf(PF, "OrientCacheQuantum %f;\n", OrientCacheQuantum);
+  }
+  if (SeedSubTasks)
+    fprintf(PF, "SeedSubTasks %d;\n", SeedSubTasks);
+  if (GrainFitSolver)
+    fprintf(PF, "GrainFitSolver %d;\n", GrainFitSolver);
   fprintf(PF, "Wedge %f;\n", wedge);
   for (i = 0; i < nOmeRanges; i++) {
     fprintf(PF, "OmegaRange %f %f;\n", OmegaRanges[i][0], OmegaRanges[i][1]);
@@ -0,0 +1,140 @@
+/**
+ * FrameArena.h - Per-thread bump allocator for frame-local scratch memory
+ *
+ * Each worker thread owns one arena.  Allocations are carved from a single
+ * block by bumping an offset and are never freed individually: the whole
+ * arena is reset at the start of the next frame, and FrameArena_mark /
+ * FrameArena_release give back the scratch of one region.  No lock is taken
+ * and glibc malloc is not entered in the steady state.
+ *
+ * When a frame needs more than the block holds, the extra requests are
+ * served from overflow blocks that live until they are released or the
+ * arena is reset; the reset then grows the main block to the high-water
+ * mark, so the arena settles at the size the data actually needs.
+ * highWater is kept for reporting so the initial capacity can be tuned.
+ */
+
+#ifndef FRAME_ARENA_H
+#define FRAME_ARENA_H
+
+#include <stddef.h>
+#include <stdlib.h>
+
+#define FRAME_ARENA_ALIGN 64
+
+typedef struct FrameArenaBlock {
+  struct FrameArenaBlock *next;
+} FrameArenaBlock;
+
+typedef struct {
+  size_t used, frameUsed;
+  FrameArenaBlock *overflow;
+} FrameArenaMark;
+
+typedef struct {
+  char *base;
+  size_t capacity;
+  size_t used;      /* bytes handed out from base since the last reset */
+  size_t frameUsed; /* bytes requested since the last reset, overflow included */
+  size_t highWater; /* largest frameUsed seen */
+  int nOverflows;   /* requests the main block could not serve */
+  FrameArenaBlock *overflow;
+} FrameArena;
+
+static inline size_t FrameArena_round(size_t bytes) {
+  return (bytes + FRAME_ARENA_ALIGN - 1) & ~(size_t)(FRAME_ARENA_ALIGN - 1);
+}
+
+static inline void *FrameArena_block(size_t bytes) {
+  void *p = NULL;
+  return posix_memalign(&p, FRAME_ARENA_ALIGN, bytes) == 0 ? p : NULL;
+}
+
+/**
+ * @return 0 on success, -1 if the block could not be allocated
+ */
+static inline int FrameArena_init(FrameArena *a, size_t capacity) {
+  a->capacity = FrameArena_round(capacity ? capacity : 1);
+  a->used = a->frameUsed = a->highWater = 0;
+  a->nOverflows = 0;
+  a->overflow = NULL;
+  a->base = (char *)FrameArena_block(a->capacity);
+  return a->base ? 0 : -1;
+}
+
+/**
+ * 64-byte aligned, uninitialised memory valid until the next reset (or the
+ * release of an earlier mark).  Returns NULL only if the system is out of
+ * memory.
+ */
+static inline void *FrameArena_alloc(FrameArena *a, size_t bytes) {
+  bytes = FrameArena_round(bytes ? bytes : 1);
+  a->frameUsed += bytes;
+  if (a->frameUsed > a->highWater)
+    a->highWater = a->frameUsed;
+  if (a->used + bytes <= a->capacity) {
+    void *p = a->base + a->used;
+    a->used += bytes;
+    return p;
+  }
+  a->nOverflows++;
+  FrameArenaBlock *b =
+      (FrameArenaBlock *)FrameArena_block(FRAME_ARENA_ALIGN + bytes);
+  if (b == NULL)
+    return NULL;
+  b->next = a->overflow;
+  a->overflow = b;
+  return (char *)b + FRAME_ARENA_ALIGN;
+}
+
+static inline FrameArenaMark FrameArena_mark(const FrameArena *a) {
+  FrameArenaMark m = {a->used, a->frameUsed, a->overflow};
+  return m;
+}
+
+/**
+ * Give back everything allocated after mark, overflow blocks included.
+ */
+static inline void FrameArena_release(FrameArena *a, FrameArenaMark mark) {
+  while (a->overflow != mark.overflow) {
+    FrameArenaBlock *next = a->overflow->next;
+    free(a->overflow);
+    a->overflow = next;
+  }
+  a->used = mark.used;
+  a->frameUsed = mark.frameUsed;
+}
+
+/**
+ * Start a new frame.  If the last frame overflowed, the main block is
+ * regrown to the high-water mark.
+ */
+static inline void FrameArena_reset(FrameArena *a) {
+  while (a->overflow != NULL) {
+    FrameArenaBlock *next = a->overflow->next;
+    free(a->overflow);
+    a->overflow = next;
+  }
+  if (a->highWater > a->capacity) {
+    char *grown = (char *)FrameArena_block(a->highWater);
+    if (grown != NULL) {
+      free(a->base);
+      a->base = grown;
+      a->capacity = a->highWater;
+    }
+  }
+  a->used = a->frameUsed = 0;
+}
+
+static inline void FrameArena_free(FrameArena *a) {
+  while (a->overflow != NULL) {
+    FrameArenaBlock *next = a->overflow->next;
+    free(a->overflow);
+    a->overflow = next;
+  }
+  free(a->base);
+  a->base = NULL;
+  a->capacity = 0;
+}
+
+#endif /* FRAME_ARENA_H */
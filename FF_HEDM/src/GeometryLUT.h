@@ -0,0 +1,135 @@
+/**
+ * GeometryLUT.h - Cached per-pixel corrected ring radius for the peak search
+ *
+ * PeaksFittingOMPZarrRefactor decides which pixels lie on a ring from the
+ * tilt-, distortion- and panel-corrected radius of every pixel.  That map
+ * depends only on the detector geometry, but it was recomputed (seconds for
+ * a large detector) by every block job of every layer.  With GeometryLUTDir
+ * set, the radii are computed once, stored there as float32, and mmapped by
+ * later jobs, so all jobs on a node share one copy through the page cache.
+ *
+ * The file name carries the first 16 hex digits of a SHA-256 (the
+ * MapHeader.h implementation) over every input of the map: the geometry
+ * parameters, the panel list and the residual correction map.  The header
+ * repeats the full hash, so a changed geometry misses the cache instead of reading stale
+ * radii.  Tables are written under a temporary name and renamed into place,
+ * so jobs that start together never see a partial file.
+ *
+ * Format:
+ *   GeometryLUT_<hash16>.bin:
+ *     Header: [uint32 magic 'GLUT'][int32 version][uint8 hash x 32]
+ *             [int32 NrPixels][uint8 reserved x 20]
+ *     Data:   [float32 x NrPixels x NrPixels], R in pixels at
+ *             index a * NrPixels + b
+ */
+
+#ifndef GEOMETRY_LUT_H
+#define GEOMETRY_LUT_H
+
+#include "MapHeader.h"
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define GEOMETRY_LUT_MAGIC 0x54554C47u /* "GLUT" little-endian */
+#define GEOMETRY_LUT_VERSION 1
+#define GEOMETRY_LUT_HEADER_BYTES 64
+
+typedef struct {
+  const float *R; /* NrPixels x NrPixels radii */
+  void *map;      /* mmap of the cache file, or NULL */
+  size_t mapSize;
+  float *owned; /* heap table when the cache could not be mapped */
+} GeometryLUT;
+
+static inline void GeometryLUT_path(char *fn, size_t n, const char *dir,
+                                    const uint8_t hash[32]) {
+  int len = snprintf(fn, n, "%s/GeometryLUT_", dir);
+  for (int i = 0; i < 8 && len > 0 && (size_t)len + 2 < n; i++)
+    len += snprintf(fn + len, n - len, "%02x", hash[i]);
+  snprintf(fn + len, n - len, ".bin");
+}
+
+/**
+ * Map the table in fn if it was written for this hash and detector size.
+ * @return 0 if mapped, -1 if the caller should compute the table
+ */
+static inline int GeometryLUT_open(GeometryLUT *lut, const char *fn,
+                                   const uint8_t hash[32], int nrPixels) {
+  memset(lut, 0, sizeof(*lut));
+  int fd = open(fn, O_RDONLY);
+  if (fd < 0)
+    return -1;
+  struct stat s;
+  size_t expected = GEOMETRY_LUT_HEADER_BYTES +
+                    (size_t)nrPixels * nrPixels * sizeof(float);
+  if (fstat(fd, &s) != 0 || (size_t)s.st_size != expected) {
+    close(fd);
+    return -1;
+  }
+  void *map = mmap(0, expected, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED)
+    return -1;
+  const unsigned char *h = (const unsigned char *)map;
+  uint32_t magic;
+  int32_t version, n;
+  memcpy(&magic, h, 4);
+  memcpy(&version, h + 4, 4);
+  memcpy(&n, h + 40, 4);
+  if (magic != GEOMETRY_LUT_MAGIC || version != GEOMETRY_LUT_VERSION ||
+      n != nrPixels || memcmp(h + 8, hash, 32) != 0) {
+    printf("Warning: %s does not match the current geometry, recomputing.\n",
+           fn);
+    munmap(map, expected);
+    return -1;
+  }
+  lut->map = map;
+  lut->mapSize = expected;
+  lut->R = (const float *)(h + GEOMETRY_LUT_HEADER_BYTES);
+  return 0;
+}
+
+/**
+ * Write R (nrPixels x nrPixels) to fn through a temporary file and rename.
+ * @return 0 on success, -1 on failure (nothing is left behind)
+ */
+static inline int GeometryLUT_write(const char *fn, const uint8_t hash[32],
+                                    int nrPixels, const float *R) {
+  char tmpFN[4096];
+  snprintf(tmpFN, sizeof(tmpFN), "%s.tmp.%ld", fn, (long)getpid());
+  FILE *f = fopen(tmpFN, "wb");
+  if (f == NULL)
+    return -1;
+  unsigned char header[GEOMETRY_LUT_HEADER_BYTES];
+  memset(header, 0, sizeof(header));
+  uint32_t magic = GEOMETRY_LUT_MAGIC;
+  int32_t version = GEOMETRY_LUT_VERSION, n = nrPixels;
+  memcpy(header, &magic, 4);
+  memcpy(header + 4, &version, 4);
+  memcpy(header + 8, hash, 32);
+  memcpy(header + 40, &n, 4);
+  size_t nPx = (size_t)nrPixels * nrPixels;
+  int ok = fwrite(header, sizeof(header), 1, f) == 1 &&
+           fwrite(R, sizeof(float), nPx, f) == nPx;
+  ok = (fclose(f) == 0) && ok;
+  if (ok)
+    ok = rename(tmpFN, fn) == 0;
+  if (!ok)
+    remove(tmpFN);
+  return ok ? 0 : -1;
+}
+
+static inline void GeometryLUT_close(GeometryLUT *lut) {
+  if (lut->map != NULL)
+    munmap(lut->map, lut->mapSize);
+  free(lut->owned);
+  memset(lut, 0, sizeof(*lut));
+}
+
+#endif /* GEOMETRY_LUT_H */
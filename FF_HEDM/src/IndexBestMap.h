@@ -0,0 +1,118 @@
+/**
+ * IndexBestMap.h - Read-only mmap views of IndexerOMP's per-seed results
+ *
+ * FitPosOrStrainsOMP used to open and pread IndexBest.bin and
+ * IndexBestFull.bin once per seed inside its OpenMP loop.  This header maps
+ * both files once per process and hands out pointers into the mapping, so a
+ * worker reads its record without a syscall or a copy.
+ *
+ * Format (written by IndexerOMP at fixed offsets per SpotsToIndex row):
+ *   IndexBest.bin:     [double x 15] per row
+ *                      (IA, OrientMat[9], Pos[3], NrExpected, NrObserved)
+ *   IndexBestFull.bin: [double x 2 x MaxNHKLS] per row
+ *                      (SpotID, radius) pairs, NrObserved of them valid
+ *
+ * Rows past the end of a file (slots IndexerOMP never wrote) are reported
+ * the same way a short pread was before.
+ */
+
+#ifndef INDEX_BEST_MAP_H
+#define INDEX_BEST_MAP_H
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define INDEX_BEST_COLS 15
+
+typedef struct {
+  const double *best; /* IndexBest.bin, NULL if empty */
+  size_t bestSize;
+  const double *full; /* IndexBestFull.bin, NULL if missing or empty */
+  size_t fullSize;
+  size_t fullRowDoubles; /* 2 * MaxNHKLS */
+} IndexBestMap;
+
+static inline const double *IndexBestMap_mapFile(const char *fn,
+                                                 size_t *size) {
+  *size = 0;
+  int fd = open(fn, O_RDONLY);
+  if (fd < 0)
+    return NULL;
+  struct stat s;
+  void *map = MAP_FAILED;
+  if (fstat(fd, &s) == 0 && s.st_size > 0) {
+    map = mmap(0, s.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    if (map != MAP_FAILED)
+      *size = s.st_size;
+  }
+  close(fd);
+  return map == MAP_FAILED ? NULL : (const double *)map;
+}
+
+/**
+ * Map <folder>/IndexBest.bin and <folder>/IndexBestFull.bin.
+ * @return 0 on success, -1 if IndexBest.bin does not exist
+ */
+static inline int IndexBestMap_open(IndexBestMap *m, const char *folder,
+                                    int maxNHKLS) {
+  char fn[4096];
+  memset(m, 0, sizeof(*m));
+  m->fullRowDoubles = 2 * (size_t)maxNHKLS;
+  snprintf(fn, sizeof(fn), "%s/IndexBest.bin", folder);
+  if (access(fn, F_OK) != 0)
+    return -1;
+  m->best = IndexBestMap_mapFile(fn, &m->bestSize);
+  snprintf(fn, sizeof(fn), "%s/IndexBestFull.bin", folder);
+  m->full = IndexBestMap_mapFile(fn, &m->fullSize);
+  /* Workers jump between rows in seed order, not file order. */
+  if (m->full != NULL)
+    madvise((void *)m->full, m->fullSize, MADV_RANDOM);
+  return 0;
+}
+
+/**
+ * The 15-double IndexBest record of row, or NULL if the file ends before it.
+ */
+static inline const double *IndexBestMap_best(const IndexBestMap *m,
+                                              size_t row) {
+  if (m->best == NULL ||
+      (row + 1) * INDEX_BEST_COLS * sizeof(double) > m->bestSize)
+    return NULL;
+  return m->best + row * INDEX_BEST_COLS;
+}
+
+/**
+ * The first nPairs (SpotID, radius) pairs of row in IndexBestFull.bin.
+ * If the file ends early, returns a zero-padded heap copy of what is there
+ * and sets *owned to it (the caller frees it); otherwise *owned is NULL.
+ */
+static inline const double *IndexBestMap_full(const IndexBestMap *m,
+                                              size_t row, int nPairs,
+                                              double **owned) {
+  size_t start = row * m->fullRowDoubles;
+  size_t need = 2 * (size_t)nPairs;
+  *owned = NULL;
+  if (m->full != NULL && (start + need) * sizeof(double) <= m->fullSize)
+    return m->full + start;
+  *owned = (double *)calloc(need > 0 ? need : 1, sizeof(double));
+  size_t avail = m->fullSize / sizeof(double);
+  if (*owned != NULL && m->full != NULL && start < avail)
+    memcpy(*owned, m->full + start,
+           (avail - start < need ? avail - start : need) * sizeof(double));
+  return *owned;
+}
+
+static inline void IndexBestMap_close(IndexBestMap *m) {
+  if (m->best != NULL)
+    munmap((void *)m->best, m->bestSize);
+  if (m->full != NULL)
+    munmap((void *)m->full, m->fullSize);
+  memset(m, 0, sizeof(*m));
+}
+
+#endif /* INDEX_BEST_MAP_H */
@@ -28,6 +28,9 @@
 #include <unistd.h>
 
 #include "MIDAS_Math.h"
+#include "SpotIDIndex.h"
+#include "BinDataSoA.h"
+#include "IndexerOrientCache.h"
 
 // check() - using MIDAS_CHECK_DEFINED guard (cannot include MIDAS_Limits.h due
 // to conflicting MAX_N_SPOTS)
@@ -63,10 +66,14 @@ static inline void check(int test, const char *message, ...) {
 #define N_COL_OBSSPOTS 9
 #define N_COL_GRAINSPOTS 17
 #define N_COL_GRAINMATCHES 16
+// Seeds needing more (orientation, position) trials than this are split into
+// sub-tasks when SeedSubTasks is set; also the target size of one sub-task.
+#define SEED_TASK_TRIALS 200000
 
 // Globals
 RealType *ObsSpotsLab;
 int n_spots = 0;
+SpotIDIndex SpotIndex; // SpotID -> row in ObsSpotsLab
 
 int CalcDiffractionSpots(double Distance, double ExcludePoleAngle,
                          double OmegaRanges[MAX_N_OMEGARANGES][2],
@@ -91,6 +98,8 @@ double pixelsize;
 
 int *data;
 int *ndata;
+// Optional SoA copy of the bins (DataSoA.bin), used by CompareSpots if present
+BinDataSoA BinSoA;
 int SGNum;
 
 // the number of elements of the data arrays above
@@ -118,7 +127,8 @@ int GetBin(int ringno, RealType eta, RealType omega, int **spotRows,
   iRing = ringno - 1;
   iEta = floor((180 + eta) / EtaBinSize);
   iOme = floor((180 + omega) / OmeBinSize);
-  int Pos = iRing * n_eta_bins * n_ome_bins + iEta * n_ome_bins + iOme;
+  long long int Pos = (long long int)iRing * n_eta_bins * n_ome_bins +
+                     (long long int)iEta * n_ome_bins + iOme;
   int nspots = ndata[Pos * 2];
   int DataPos = ndata[Pos * 2 + 1];
   *spotRows = malloc(nspots * sizeof(**spotRows));
@@ -135,19 +145,6 @@ int GetBin(int ringno, RealType eta, RealType omega, int **spotRows,
   return 0;
 }
 
-void FindInMatrix(RealType *aMatrixp, int nrows, int ncols, int SearchColumn,
-                  RealType aVal, int *idx) {
-  int r, LIndex;
-  *idx = -1;
-  for (r = 0; r < nrows; r++) {
-    LIndex = (r * ncols) + SearchColumn;
-    if (aMatrixp[LIndex] == aVal) {
-      *idx = r;
-      break;
-    }
-  }
-}
-
 RealType **allocMatrix(int nrows, int ncols) {
   RealType **arr;
   int i;
@@ -195,6 +192,11 @@ void FreeMemMatrixContiguous(RealType **mat) {
   }
 }
 
+struct CandidateScore {
+  RealType score;
+  int idx;
+};
+
 // Thread-local workspace: all per-spot arrays pre-allocated once per thread.
 struct ThreadWorkspace {
   RealType **AllGrainSpots;
@@ -205,10 +207,18 @@ struct ThreadWorkspace {
   RealType **TheorSpots;
   RealType **BestMatches;
   RealType *OrMat;
+  // SoA scratch for DisplaceTheorSpots, nRowsPerGrain entries each
+  RealType *SpotSoA;
+  RealType *SpotXn, *SpotYn, *SpotZn, *SpotSinOme, *SpotCosOme;
+  RealType *SpotY, *SpotZ, *SpotRingRad, *SpotYd, *SpotZd, *SpotRad;
+  // Candidate orientations ranked by RankCandidateOrientations
+  struct CandidateScore *OrRank;
   int nRowsOutput;
   int nRowsPerGrain;
 };
 
+#define N_SPOT_SOA_ARRAYS 11
+
 struct ThreadWorkspace *init_workspace(int n_hkls_val) {
   struct ThreadWorkspace *ws = calloc(1, sizeof(*ws));
   if (!ws)
@@ -223,12 +233,21 @@ struct ThreadWorkspace *init_workspace(int n_hkls_val) {
   ws->TheorSpots = allocMatrixContiguous(ws->nRowsPerGrain, N_COL_THEORSPOTS);
   ws->BestMatches = allocMatrixContiguous(2, 5);
   ws->OrMat = calloc(MAX_N_OR * 9, sizeof(RealType));
+  ws->SpotSoA = calloc((size_t)N_SPOT_SOA_ARRAYS * ws->nRowsPerGrain,
+                       sizeof(RealType));
+  ws->OrRank = calloc(MAX_N_OR, sizeof(*ws->OrRank));
   if (!ws->AllGrainSpots || !ws->AllGrainSpotsT || !ws->GrainMatchesT ||
       !ws->GrainMatches || !ws->GrainSpots || !ws->TheorSpots ||
-      !ws->BestMatches || !ws->OrMat) {
+      !ws->BestMatches || !ws->OrMat || !ws->SpotSoA || !ws->OrRank) {
     printf("Memory error: could not allocate thread workspace.\n");
     return NULL;
   }
+  RealType **soaArrays[N_SPOT_SOA_ARRAYS] = {
+      &ws->SpotXn, &ws->SpotYn,      &ws->SpotZn, &ws->SpotSinOme,
+      &ws->SpotCosOme, &ws->SpotY,   &ws->SpotZ,  &ws->SpotRingRad,
+      &ws->SpotYd, &ws->SpotZd,      &ws->SpotRad};
+  for (int a = 0; a < N_SPOT_SOA_ARRAYS; a++)
+    *soaArrays[a] = ws->SpotSoA + (size_t)a * ws->nRowsPerGrain;
   return ws;
 }
 
@@ -243,6 +262,8 @@ void free_workspace(struct ThreadWorkspace *ws) {
   FreeMemMatrixContiguous(ws->TheorSpots);
   FreeMemMatrixContiguous(ws->BestMatches);
   free(ws->OrMat);
+  free(ws->SpotSoA);
+  free(ws->OrRank);
   free(ws);
 }
 
@@ -457,11 +478,48 @@ void CalcDiffrSpots_Furnace(RealType OrientMatrix[3][3],
   *nSpotsFracCalc = nSpotsForFracCalc;
 }
 
+// Step to the next trial position along the beam, as a function of the
+// fraction of matched spots at the current one.  Never increases with
+// nMatchesFracCalc, which CompareSpots relies on when pruning.
+int PositionStep(int nMatchesFracCalc, int nTspotsFracCalc) {
+  int nDelta = 1;
+  if (nTspotsFracCalc != 0) {
+    RealType fracMatches = (RealType)nMatchesFracCalc / nTspotsFracCalc;
+    if (fracMatches < 0.5) {
+      nDelta = 5 - round(fracMatches * (5 - 1) / 0.5);
+    }
+  }
+  return nDelta;
+}
+
+// Smallest nMatchesFracCalc that DoIndexing would still accept, given the
+// best fraction found so far.  0 disables pruning.
+int MinMatchesToCompete(RealType MinMatchesToAccept, RealType bestFrac,
+                        int nTspotsFracCalc) {
+  if (nTspotsFracCalc <= 0)
+    return 0;
+  int m = (int)ceil(MinMatchesToAccept);
+  if (m < 0)
+    m = 0;
+  int fromFrac = (int)floor(bestFrac * nTspotsFracCalc) - 1;
+  if (fromFrac > m)
+    m = fromFrac;
+  while (m <= nTspotsFracCalc &&
+         (RealType)m / (RealType)nTspotsFracCalc < bestFrac)
+    m++;
+  return m;
+}
+
+// pruneBelow > 0 enables early termination: once even matching every
+// remaining spot cannot reach pruneBelow fraction-counting matches, and the
+// position step is already determined, the scan stops and *pruned is set.
+// nMatchesFracCalc is then only a lower bound.
 void CompareSpots(RealType **TheorSpots, int nTheorSpots, RealType *ObsSpots,
                   RealType RefRad, RealType MarginRad, RealType MarginRadial,
                   RealType etamargins[], RealType omemargins[], int *nMatch,
                   RealType **GrainSpots, int ringsToRejectCalc[],
-                  int nRingsToRejectCalc, int *nMatchesFracCalc) {
+                  int nRingsToRejectCalc, int *nMatchesFracCalc,
+                  int pruneBelow, int nTspotsFracCalc, int *pruned) {
   int nMatched = 0;
   int nNonMatched = 0;
   int sp;
@@ -474,8 +532,20 @@ void CompareSpots(RealType **TheorSpots, int nTheorSpots, RealType *ObsSpots,
   int iRing;
   int iSpot;
   RealType etamargin, omemargin;
+  int nFracLeft = nTspotsFracCalc;
   *nMatchesFracCalc = 0;
+  if (pruned != NULL)
+    *pruned = 0;
   for (sp = 0; sp < nTheorSpots; sp++) {
+    if (pruneBelow > 0) {
+      int bound = *nMatchesFracCalc + nFracLeft;
+      if (bound < pruneBelow &&
+          PositionStep(*nMatchesFracCalc, nTspotsFracCalc) ==
+              PositionStep(bound, nTspotsFracCalc)) {
+        *pruned = 1;
+        break;
+      }
+    }
     RingNr = (int)TheorSpots[sp][9];
     iRing = RingNr - 1;
     iEta = floor((180 + TheorSpots[sp][12]) / EtaBinSize);
@@ -491,22 +561,61 @@ void CompareSpots(RealType **TheorSpots, int nTheorSpots, RealType *ObsSpots,
         break;
       }
     }
-    long long int Pos =
-        iRing * n_eta_bins * n_ome_bins + iEta * n_ome_bins + iOme;
+    if (!skipRadialFilter)
+      nFracLeft--;
+    long long int Pos = (long long int)iRing * n_eta_bins * n_ome_bins +
+                        (long long int)iEta * n_ome_bins + iOme;
     long long int nspots = ndata[Pos * 2];
     long long int DataPos = ndata[Pos * 2 + 1];
-    for (iSpot = 0; iSpot < nspots; iSpot++) {
-      spotRow = data[DataPos + iSpot];
-      if (fabs(TheorSpots[sp][13] - ObsSpots[spotRow * 9 + 8]) < MarginRadial) {
-        if (skipRadialFilter ||
-            fabs(RefRad - ObsSpots[spotRow * 9 + 3]) < MarginRad) {
-          if (fabs(TheorSpots[sp][12] - ObsSpots[spotRow * 9 + 6]) <
-              etamargin) {
-            diffOme = fabs(TheorSpots[sp][6] - ObsSpots[spotRow * 9 + 2]);
-            if (diffOme < diffOmeBest) {
-              diffOmeBest = diffOme;
-              spotRowBest = spotRow;
-              MatchFound = 1;
+    if (BinSoA.values != NULL) {
+      // Same filters as below, on contiguous per-bin arrays.  Pass 1 finds
+      // the smallest omega difference, pass 2 the first candidate reaching
+      // it, which is the one the sequential strict-< scan would keep.
+      const double *soaRad = BinSoA.values + BIN_SOA_N_FIELDS * DataPos;
+      const double *soaGrainRad = soaRad + nspots;
+      const double *soaEta = soaGrainRad + nspots;
+      const double *soaOme = soaEta + nspots;
+      RealType theorRad = TheorSpots[sp][13];
+      RealType theorEta = TheorSpots[sp][12];
+      RealType theorOme = TheorSpots[sp][6];
+#pragma omp simd reduction(min : diffOmeBest)
+      for (iSpot = 0; iSpot < nspots; iSpot++) {
+        int ok = (fabs(theorRad - soaRad[iSpot]) < MarginRadial) &
+                 (skipRadialFilter |
+                  (fabs(RefRad - soaGrainRad[iSpot]) < MarginRad)) &
+                 (fabs(theorEta - soaEta[iSpot]) < etamargin);
+        RealType diffOme = fabs(theorOme - soaOme[iSpot]);
+        if (ok && diffOme < diffOmeBest)
+          diffOmeBest = diffOme;
+      }
+      if (diffOmeBest < 100000) {
+        for (iSpot = 0; iSpot < nspots; iSpot++) {
+          if (fabs(theorOme - soaOme[iSpot]) == diffOmeBest &&
+              fabs(theorRad - soaRad[iSpot]) < MarginRadial &&
+              (skipRadialFilter ||
+               fabs(RefRad - soaGrainRad[iSpot]) < MarginRad) &&
+              fabs(theorEta - soaEta[iSpot]) < etamargin) {
+            spotRowBest = data[DataPos + iSpot];
+            MatchFound = 1;
+            break;
+          }
+        }
+      }
+    } else {
+      for (iSpot = 0; iSpot < nspots; iSpot++) {
+        spotRow = data[DataPos + iSpot];
+        if (fabs(TheorSpots[sp][13] - ObsSpots[spotRow * 9 + 8]) <
+            MarginRadial) {
+          if (skipRadialFilter ||
+              fabs(RefRad - ObsSpots[spotRow * 9 + 3]) < MarginRad) {
+            if (fabs(TheorSpots[sp][12] - ObsSpots[spotRow * 9 + 6]) <
+                etamargin) {
+              diffOme = fabs(TheorSpots[sp][6] - ObsSpots[spotRow * 9 + 2]);
+              if (diffOme < diffOmeBest) {
+                diffOmeBest = diffOme;
+                spotRowBest = spotRow;
+                MatchFound = 1;
+              }
             }
           }
         }
@@ -723,6 +832,63 @@ void displacement_spot_needed_COM(RealType a, RealType b, RealType c,
   *Displ_z = c - t * zi;
 }
 
+// Split displacement_spot_needed_COM into the part that only depends on the
+// orientation (done once per orientation) and the part that depends on the
+// grain position (done for every trial position by DisplaceTheorSpots).
+void PrepareTheorSpotsSoA(RealType **TheorSpots, int nTspots,
+                          RealType RingRadii[], struct ThreadWorkspace *ws) {
+  for (int sp = 0; sp < nTspots; sp++) {
+    RealType xi = TheorSpots[sp][3];
+    RealType yi = TheorSpots[sp][4];
+    RealType zi = TheorSpots[sp][5];
+    RealType lenInv = 1 / sqrt(xi * xi + yi * yi + zi * zi);
+    RealType OmegaRad = deg2rad * TheorSpots[sp][6];
+    ws->SpotXn[sp] = xi * lenInv;
+    ws->SpotYn[sp] = yi * lenInv;
+    ws->SpotZn[sp] = zi * lenInv;
+    ws->SpotSinOme[sp] = sin(OmegaRad);
+    ws->SpotCosOme[sp] = cos(OmegaRad);
+    ws->SpotY[sp] = yi;
+    ws->SpotZ[sp] = zi;
+    ws->SpotRingRad[sp] = RingRadii[(int)TheorSpots[sp][9]];
+  }
+}
+
+// Fill TheorSpots columns 10-13 (displaced y, z, eta, radial deviation) for a
+// grain at (a, b, c).  Uses the same expressions as
+// displacement_spot_needed_COM and CalcEtaAngle, so results are identical;
+// the first loop is straight-line arithmetic over contiguous arrays and
+// vectorizes, acos stays scalar.
+void DisplaceTheorSpots(RealType a, RealType b, RealType c,
+                        RealType **TheorSpots, int nTspots,
+                        struct ThreadWorkspace *ws) {
+  const RealType *restrict xu = ws->SpotXn;
+  const RealType *restrict yu = ws->SpotYn;
+  const RealType *restrict zu = ws->SpotZn;
+  const RealType *restrict sinOme = ws->SpotSinOme;
+  const RealType *restrict cosOme = ws->SpotCosOme;
+  const RealType *restrict y = ws->SpotY;
+  const RealType *restrict z = ws->SpotZ;
+  RealType *restrict yd = ws->SpotYd;
+  RealType *restrict zd = ws->SpotZd;
+  RealType *restrict rad = ws->SpotRad;
+  int sp;
+#pragma omp simd
+  for (sp = 0; sp < nTspots; sp++) {
+    RealType t = (a * cosOme[sp] - b * sinOme[sp]) / xu[sp];
+    yd[sp] = y[sp] + (((a * sinOme[sp]) + (b * cosOme[sp])) - (t * yu[sp]));
+    zd[sp] = z[sp] + (c - t * zu[sp]);
+    rad[sp] = sqrt(yd[sp] * yd[sp] + zd[sp] * zd[sp]);
+  }
+  for (sp = 0; sp < nTspots; sp++) {
+    RealType eta = rad2deg * acos(zd[sp] / rad[sp]);
+    TheorSpots[sp][10] = yd[sp];
+    TheorSpots[sp][11] = zd[sp];
+    TheorSpots[sp][12] = yd[sp] > 0 ? -eta : eta;
+    TheorSpots[sp][13] = rad[sp] - ws->SpotRingRad[sp];
+  }
+}
+
 void spot_to_gv(RealType xi, RealType yi, RealType zi, RealType Omega,
                 RealType *g1, RealType *g2, RealType *g3) {
   RealType len = sqrt(xi * xi + yi * yi + zi * zi);
@@ -1257,8 +1423,23 @@ struct TParams {
   int nRingsToRejectCalc;
   int IndexBestFD;
   int IndexBestFullFD;
+  int PruneCandidates;
+  int OrderCandidates;
+  int VerifyPruning;
+  RealType OrientCacheMB;
+  RealType OrientCacheQuantum;
+  int SeedSubTasks;
 };
 
+// Candidate orientations and their simulated spots, shared by all threads
+// when OrientCacheMB > 0.
+OrientCache OrientationCache;
+int UseOrientCache = 0;
+
+// Pruning statistics, summed over all threads.
+long long int nPositionsPruned = 0;
+long long int nPruningMismatches = 0;
+
 size_t ReadBigDet(char *cwd) {
   int fd;
   struct stat s;
@@ -1291,6 +1472,12 @@ int ReadParams(char FileName[], struct TParams *Params) {
   Params->NoOfOmegaRanges = 0;
   Params->isGrainsInput = 0;
   Params->nRingsToRejectCalc = 0;
+  Params->PruneCandidates = 0;
+  Params->OrderCandidates = 0;
+  Params->VerifyPruning = 0;
+  Params->OrientCacheMB = 0;
+  Params->OrientCacheQuantum = -1; // StepsizeOrient / 10
+  Params->SeedSubTasks = 0;
   fp = fopen(FileName, "r");
   if (fp == NULL) {
     printf("Cannot open file: %s.\n", FileName);
@@ -1513,6 +1700,42 @@ int ReadParams(char FileName[], struct TParams *Params) {
       sscanf(line, "%s %d", dummy, &(Params->UseFriedelPairs));
       continue;
     }
+    str = "PruneCandidates ";
+    cmpres = strncmp(line, str, strlen(str));
+    if (cmpres == 0) {
+      sscanf(line, "%s %d", dummy, &(Params->PruneCandidates));
+      continue;
+    }
+    str = "OrderCandidates ";
+    cmpres = strncmp(line, str, strlen(str));
+    if (cmpres == 0) {
+      sscanf(line, "%s %d", dummy, &(Params->OrderCandidates));
+      continue;
+    }
+    str = "VerifyPruning ";
+    cmpres = strncmp(line, str, strlen(str));
+    if (cmpres == 0) {
+      sscanf(line, "%s %d", dummy, &(Params->VerifyPruning));
+      continue;
+    }
+    str = "OrientCacheMB ";
+    cmpres = strncmp(line, str, strlen(str));
+    if (cmpres == 0) {
+      sscanf(line, "%s %lf", dummy, &(Params->OrientCacheMB));
+      continue;
+    }
+    str = "OrientCacheQuantum ";
+    cmpres = strncmp(line, str, strlen(str));
+    if (cmpres == 0) {
+      sscanf(line, "%s %lf", dummy, &(Params->OrientCacheQuantum));
+      continue;
+    }
+    str = "SeedSubTasks ";
+    cmpres = strncmp(line, str, strlen(str));
+    if (cmpres == 0) {
+      sscanf(line, "%s %d", dummy, &(Params->SeedSubTasks));
+      continue;
+    }
     str = "OutputFolder ";
     cmpres = strncmp(line, str, strlen(str));
     if (cmpres == 0) {
@@ -1718,72 +1941,218 @@ void MakeFullFileName(char *fullFileName, char *aPath, char *aFileName) {
   }
 }
 
-int DoIndexing(int SpotIDs, struct TParams Params, int offsetLoc, int idNr,
-               int totalIDs, int ringsToRejectCalc[], int nRingsToRejectCalc,
-               struct ThreadWorkspace *ws) {
-  double dif;
-  RealType HalfBeam = Params.Hbeam / 2;
-  RealType MinMatchesToAccept;
+// Candidate orientations about a plane normal and the ideal spots of each,
+// packed into an orientation cache entry.
+OrientCacheEntry *BuildCandidateEntry(const OrientCacheKey *key, double hkl[3],
+                                      RealType hklnormal[3], int ringnr,
+                                      struct TParams *Params,
+                                      int ringsToRejectCalc[],
+                                      int nRingsToRejectCalc,
+                                      struct ThreadWorkspace *ws) {
+  int nOrient, nTspots, nTspotsFracCalc;
+  GenerateCandidateOrientationsF(hkl, hklnormal, Params->StepsizeOrient,
+                                 ws->OrMat, &nOrient, ringnr);
+  OrientCacheEntry *e = OrientCache_entryAlloc(key, nOrient, ws->nRowsPerGrain);
+  if (e == NULL)
+    return NULL;
+  memcpy(e->OrMat, ws->OrMat, (size_t)nOrient * 9 * sizeof(double));
+  for (int or = 0; or < nOrient; or++) {
+    RealType orThis[3][3];
+    for (int j = 0; j < 9; j++)
+      orThis[j / 3][j % 3] = ws->OrMat[or * 9 + j];
+    CalcDiffrSpots_Furnace(
+        orThis, Params->LatticeConstant, Params->Wavelength, Params->Distance,
+        Params->RingRadii, Params->OmegaRanges, Params->BoxSizes,
+        Params->NoOfOmegaRanges, Params->ExcludePoleAngle, ws->TheorSpots,
+        &nTspots, ringsToRejectCalc, nRingsToRejectCalc, &nTspotsFracCalc);
+    double *dst = e->spots + (size_t)e->spotStart[or] * ORIENT_CACHE_SPOT_COLS;
+    for (int sp = 0; sp < nTspots; sp++)
+      for (int k = 0; k < ORIENT_CACHE_SPOT_COLS; k++)
+        *dst++ = ws->TheorSpots[sp][OrientCache_cols[k]];
+    e->spotStart[or + 1] = e->spotStart[or] + nTspots;
+    e->nFracCalc[or] = nTspotsFracCalc;
+  }
+  OrientCache_entryFinish(e);
+  return e;
+}
+
+// Orientation matrix and ideal spots of candidate orIdx: copied from the
+// cache entry if there is one, otherwise simulated.
+void LoadCandidateSpots(struct TParams *Params, const OrientCacheEntry *entry,
+                        const RealType *OrMat, int orIdx,
+                        RealType orThis[3][3], RealType **TheorSpots,
+                        int *nTspots, int *nTspotsFracCalc,
+                        int ringsToRejectCalc[], int nRingsToRejectCalc) {
+  for (int j = 0; j < 9; j++)
+    orThis[j / 3][j % 3] = OrMat[orIdx * 9 + j];
+  if (entry == NULL) {
+    CalcDiffrSpots_Furnace(
+        orThis, Params->LatticeConstant, Params->Wavelength, Params->Distance,
+        Params->RingRadii, Params->OmegaRanges, Params->BoxSizes,
+        Params->NoOfOmegaRanges, Params->ExcludePoleAngle, TheorSpots, nTspots,
+        ringsToRejectCalc, nRingsToRejectCalc, nTspotsFracCalc);
+    return;
+  }
+  int start = entry->spotStart[orIdx];
+  *nTspots = entry->spotStart[orIdx + 1] - start;
+  *nTspotsFracCalc = entry->nFracCalc[orIdx];
+  const double *src = entry->spots + (size_t)start * ORIENT_CACHE_SPOT_COLS;
+  for (int sp = 0; sp < *nTspots; sp++)
+    for (int k = 0; k < ORIENT_CACHE_SPOT_COLS; k++)
+      TheorSpots[sp][OrientCache_cols[k]] = *src++;
+}
+
+int CompareCandidateScores(const void *a, const void *b) {
+  const struct CandidateScore *ca = a, *cb = b;
+  if (ca->score != cb->score)
+    return ca->score > cb->score ? -1 : 1;
+  return ca->idx - cb->idx;
+}
+
+// Score candidate orientations [orStart, orEnd) of one plane normal at a
+// single trial position (the valid one closest to the middle of the beam
+// path) and sort them best-first into ws->OrRank.  Scoring the promising orientations first
+// raises bestFracTillNow early, so PruneCandidates cuts the rest sooner.
+void RankCandidateOrientations(struct TParams *Params,
+                               const OrientCacheEntry *entry,
+                               const RealType *OrMat, int orStart, int orEnd,
+                               RealType xi, RealType yi, RealType zi,
+                               RealType ys, RealType zs, RealType y0,
+                               RealType z0, RealType omega, RealType RefRad,
+                               RealType etamargins[], RealType omemargins[],
+                               int ringsToRejectCalc[], int nRingsToRejectCalc,
+                               struct ThreadWorkspace *ws) {
+  int n_max, n_min, nProbe = 0, found = 0;
   RealType ga, gb, gc;
-  int nTspots, nTspotsFracCalc, nMatchesFracCalc;
-  int bestnMatchesIsp, bestnMatchesRot, bestnMatchesPos;
-  int bestnTspotsIsp, bestnTspotsRot, bestnTspotsPos;
-  int matchNr;
-  int nOrient;
-  RealType hklnormal[3];
-  RealType Displ_y;
-  RealType Displ_z;
-  int or;
-  int sp;
-  int nMatches;
-  int r, c, i, j, k;
+  int nOrient = orEnd - orStart;
+  for (int i = 0; i < nOrient; i++) {
+    ws->OrRank[i].idx = orStart + i;
+    ws->OrRank[i].score = 0;
+  }
+  calc_n_max_min(xi, yi, ys, y0, Params->Rsample, Params->StepsizePos, &n_max,
+                 &n_min);
+  int nMid = (n_min + n_max) / 2;
+  for (int d = 0; d <= n_max - n_min && !found; d++) {
+    for (int sgn = -1; sgn <= 1 && !found; sgn += 2) {
+      nProbe = nMid + sgn * d;
+      if (nProbe < n_min || nProbe > n_max)
+        continue;
+      spot_to_unrotated_coordinates(xi, yi, zi, ys, zs, y0, z0,
+                                    Params->StepsizePos, nProbe, omega, &ga,
+                                    &gb, &gc);
+      if (fabs(gc) <= Params->Hbeam / 2)
+        found = 1;
+    }
+  }
+  if (!found)
+    return;
+  for (int i = 0; i < nOrient; i++) {
+    RealType orThis[3][3];
+    int nTspots, nTspotsFracCalc, nMatches, nMatchesFracCalc;
+    LoadCandidateSpots(Params, entry, OrMat, orStart + i, orThis,
+                       ws->TheorSpots,
+                       &nTspots, &nTspotsFracCalc, ringsToRejectCalc,
+                       nRingsToRejectCalc);
+    PrepareTheorSpotsSoA(ws->TheorSpots, nTspots, Params->RingRadii, ws);
+    DisplaceTheorSpots(ga, gb, gc, ws->TheorSpots, nTspots, ws);
+    CompareSpots(ws->TheorSpots, nTspots, ObsSpotsLab, RefRad,
+                 Params->MarginRad, Params->MarginRadial, etamargins,
+                 omemargins, &nMatches, ws->GrainSpots, ringsToRejectCalc,
+                 nRingsToRejectCalc, &nMatchesFracCalc, 0, nTspotsFracCalc,
+                 NULL);
+    if (nTspotsFracCalc > 0)
+      ws->OrRank[i].score = (RealType)nMatchesFracCalc / nTspotsFracCalc;
+  }
+  qsort(ws->OrRank, nOrient, sizeof(*ws->OrRank), CompareCandidateScores);
+}
+
+// Everything DoIndexing derives from the seed spot before the search.
+struct SeedSetup {
+  int SpotID;
+  int ringnr;
+  RealType ys, zs, omega, RefRad;
+  double hkl[3];
+  int nPlaneNormals;
   RealType y0_vector[MAX_N_STEPS];
   RealType z0_vector[MAX_N_STEPS];
-  int nPlaneNormals;
-  double hkl[3];
-  RealType g1, g2, g3;
-  int isp;
-  RealType xi, yi, zi;
-  int n_max, n_min, n;
-  RealType y0, z0;
-  int orDelta, ispDelta, nDelta;
-  RealType fracMatches;
-  int rownr;
-  int SpotRowNo;
-  int usingFriedelPair;
-
   RealType omemargins[181];
   RealType etamargins[MAX_N_RINGS];
+};
 
-  // Use pre-allocated workspace arrays
-  RealType **AllGrainSpots = ws->AllGrainSpots;
-  RealType **AllGrainSpotsT = ws->AllGrainSpotsT;
-  RealType **GrainMatchesT = ws->GrainMatchesT;
-  RealType **GrainMatches = ws->GrainMatches;
-  RealType **GrainSpots = ws->GrainSpots;
-  RealType **TheorSpots = ws->TheorSpots;
-  RealType **BestMatches = ws->BestMatches;
-  int nRowsOutput = ws->nRowsOutput;
-  int nRowsPerGrain = ws->nRowsPerGrain;
+// Best candidate of a seed, or of one slice of its search.
+struct SeedBest {
+  RealType fracMatches;   // bestFracTillNow
+  RealType internalAngle; // MinInternalAngle
+  int found;
+  int nRows; // rows of AllGrainSpots belonging to the best candidate
+  int bestnMatches, bestnTspots;
+  RealType **GrainMatches;  // 1 x N_COL_GRAINMATCHES
+  RealType **AllGrainSpots; // nRowsAlloc x N_COL_GRAINSPOTS
+  int nRowsAlloc;
+};
+
+void SeedBest_init(struct SeedBest *best, RealType **GrainMatches,
+                   RealType **AllGrainSpots, int nRowsAlloc) {
+  best->fracMatches = -1;
+  best->internalAngle = 1000;
+  best->found = 0;
+  best->nRows = 0;
+  best->bestnMatches = -1;
+  best->bestnTspots = 0;
+  best->GrainMatches = GrainMatches;
+  best->AllGrainSpots = AllGrainSpots;
+  best->nRowsAlloc = nRowsAlloc;
+}
+
+// Fold the result of a later slice into dst, with the same rules the
+// sequential search applies candidate by candidate, so merging slices in
+// search order reproduces the sequential result.
+void SeedBest_merge(struct SeedBest *dst, const struct SeedBest *src) {
+  int r, c;
+  if (src->bestnMatches > dst->bestnMatches) {
+    dst->bestnMatches = src->bestnMatches;
+    dst->bestnTspots = src->bestnTspots;
+  }
+  if (!src->found)
+    return;
+  dst->found = 1;
+  if (src->fracMatches > dst->fracMatches ||
+      (src->fracMatches == dst->fracMatches &&
+       src->internalAngle < dst->internalAngle)) {
+    dst->fracMatches = src->fracMatches;
+    dst->internalAngle = src->internalAngle;
+    dst->nRows = src->nRows;
+    for (c = 0; c < N_COL_GRAINMATCHES; c++)
+      dst->GrainMatches[0][c] = src->GrainMatches[0][c];
+    for (r = 0; r < src->nRows; r++)
+      for (c = 0; c < N_COL_GRAINSPOTS; c++)
+        dst->AllGrainSpots[r][c] = src->AllGrainSpots[r][c];
+    for (r = src->nRows; r < dst->nRowsAlloc; r++)
+      for (c = 0; c < N_COL_GRAINSPOTS; c++)
+        dst->AllGrainSpots[r][c] = 0;
+  }
+}
+
+// Look up the seed spot and generate its candidate plane normals.
+// Returns 1 if the seed cannot be indexed.
+int PrepareSeed(int SpotIDs, struct TParams *Params, struct SeedSetup *seed) {
+  int i;
   for (i = 1; i < 180; i++)
-    omemargins[i] = Params.MarginOme +
-                    (0.5 * Params.StepsizeOrient / fabs(sin(i * deg2rad)));
-  omemargins[0] = omemargins[1];
-  omemargins[180] = omemargins[1];
+    seed->omemargins[i] =
+        Params->MarginOme +
+        (0.5 * Params->StepsizeOrient / fabs(sin(i * deg2rad)));
+  seed->omemargins[0] = seed->omemargins[1];
+  seed->omemargins[180] = seed->omemargins[1];
   for (i = 0; i < MAX_N_RINGS; i++) {
-    if (Params.RingRadii[i] == 0)
-      etamargins[i] = 0;
+    if (Params->RingRadii[i] == 0)
+      seed->etamargins[i] = 0;
     else
-      etamargins[i] = rad2deg * atan(Params.MarginEta / Params.RingRadii[i]) +
-                      0.5 * Params.StepsizeOrient;
+      seed->etamargins[i] =
+          rad2deg * atan(Params->MarginEta / Params->RingRadii[i]) +
+          0.5 * Params->StepsizeOrient;
   }
-  int SpotIDIdx = 0;
-  RealType MinInternalAngle = 1000;
-  matchNr = 0;
-  rownr = 0;
   RealType SpotID = SpotIDs;
-  FindInMatrix(&ObsSpotsLab[0 * 9 + 0], n_spots, N_COL_OBSSPOTS, 4, SpotID,
-               &SpotRowNo);
+  int SpotRowNo = SpotIDIndex_lookup(&SpotIndex, SpotIDs);
   if (SpotRowNo == -1) {
     printf(
         "WARNING: SpotId %lf not found in spots file! Ignoring this spotID.\n",
@@ -1791,34 +2160,36 @@ int DoIndexing(int SpotIDs, struct TParams Params, int offsetLoc, int idNr,
     fflush(stdout);
     return 1;
   }
+  seed->SpotID = SpotIDs;
   RealType ys = ObsSpotsLab[SpotRowNo * 9 + 0];
   RealType zs = ObsSpotsLab[SpotRowNo * 9 + 1];
   RealType omega = ObsSpotsLab[SpotRowNo * 9 + 2];
-  RealType RefRad = ObsSpotsLab[SpotRowNo * 9 + 3];
   RealType eta = ObsSpotsLab[SpotRowNo * 9 + 6];
-  RealType ttheta = ObsSpotsLab[SpotRowNo * 9 + 7];
   int ringnr = (int)ObsSpotsLab[SpotRowNo * 9 + 5];
-  RealType *OrMat = ws->OrMat;
-  hkl[0] = RingHKL[ringnr][0];
-  hkl[1] = RingHKL[ringnr][1];
-  hkl[2] = RingHKL[ringnr][2];
-  long long int SpotID2 = (int)SpotIDs;
-  nPlaneNormals = 0;
-  usingFriedelPair = 0;
-  if (Params.UseFriedelPairs == 1) {
+  seed->ys = ys;
+  seed->zs = zs;
+  seed->omega = omega;
+  seed->RefRad = ObsSpotsLab[SpotRowNo * 9 + 3];
+  seed->ringnr = ringnr;
+  seed->hkl[0] = RingHKL[ringnr][0];
+  seed->hkl[1] = RingHKL[ringnr][1];
+  seed->hkl[2] = RingHKL[ringnr][2];
+  int nPlaneNormals = 0;
+  int usingFriedelPair = 0;
+  if (Params->UseFriedelPairs == 1) {
     usingFriedelPair = 1;
     GenerateIdealSpotsFriedel(ys, zs, RingTtheta[ringnr], eta, omega, ringnr,
-                              Params.RingRadii[ringnr], Params.Rsample,
-                              Params.Hbeam, Params.MarginOme,
-                              Params.MarginRadial, y0_vector, z0_vector,
-                              &nPlaneNormals);
+                              Params->RingRadii[ringnr], Params->Rsample,
+                              Params->Hbeam, Params->MarginOme,
+                              Params->MarginRadial, seed->y0_vector,
+                              seed->z0_vector, &nPlaneNormals);
     if (nPlaneNormals == 0) {
       GenerateIdealSpotsFriedelMixed(
           ys, zs, RingTtheta[ringnr], eta, omega, ringnr,
-          Params.RingRadii[ringnr], Params.Distance, Params.Rsample,
-          Params.Hbeam, Params.StepsizePos, Params.MarginOme,
-          Params.MarginRadial, Params.MarginEta, y0_vector, z0_vector,
-          &nPlaneNormals);
+          Params->RingRadii[ringnr], Params->Distance, Params->Rsample,
+          Params->Hbeam, Params->StepsizePos, Params->MarginOme,
+          Params->MarginRadial, Params->MarginEta, seed->y0_vector,
+          seed->z0_vector, &nPlaneNormals);
     }
   }
   if (nPlaneNormals == 0) {
@@ -1830,160 +2201,335 @@ int DoIndexing(int SpotIDs, struct TParams Params, int offsetLoc, int idNr,
       // fflush(stdout);
       return 1;
     }
-    usingFriedelPair = 0;
     GenerateIdealSpots(ys, zs, RingTtheta[ringnr], eta,
-                       Params.RingRadii[ringnr], Params.Rsample, Params.Hbeam,
-                       Params.StepsizePos, y0_vector, z0_vector,
-                       &nPlaneNormals);
-  }
-  bestnMatchesIsp = -1;
-  bestnTspotsIsp = 0;
-  isp = 0;
-  RealType bestFracTillNow = -1;
-  int bestMatchFound = 0, bestNMatches = -1000;
-  double sttm = omp_get_wtime();
-  while (isp < nPlaneNormals) {
-    y0 = y0_vector[isp];
-    z0 = z0_vector[isp];
-    MakeUnitLength(Params.Distance, y0, z0, &xi, &yi, &zi);
-    spot_to_gv(xi, yi, zi, omega, &g1, &g2, &g3);
-    hklnormal[0] = g1;
-    hklnormal[1] = g2;
-    hklnormal[2] = g3;
-    GenerateCandidateOrientationsF(hkl, hklnormal, Params.StepsizeOrient, OrMat,
-                                   &nOrient, ringnr);
-    bestnMatchesRot = -1;
-    bestnTspotsRot = 0;
-    or = 0;
-    orDelta = 1;
-    while (or < nOrient) {
-      int t;
-      RealType orThis[3][3];
-      for (i = 0; i < 3; i++)
-        for (j = 0; j < 3; j++)
-          orThis[i][j] = OrMat[or * 9 + i * 3 + j];
-      CalcDiffrSpots_Furnace(
-          orThis, Params.LatticeConstant, Params.Wavelength, Params.Distance,
-          Params.RingRadii, Params.OmegaRanges, Params.BoxSizes,
-          Params.NoOfOmegaRanges, Params.ExcludePoleAngle, TheorSpots, &nTspots,
-          ringsToRejectCalc, nRingsToRejectCalc, &nTspotsFracCalc);
-      MinMatchesToAccept = nTspotsFracCalc * Params.MinMatchesToAcceptFrac;
-      bestnMatchesPos = -1;
-      bestnTspotsPos = 0;
-      calc_n_max_min(xi, yi, ys, y0, Params.Rsample, Params.StepsizePos, &n_max,
-                     &n_min);
-      n = n_min;
-      while (n <= n_max) {
-        spot_to_unrotated_coordinates(xi, yi, zi, ys, zs, y0, z0,
-                                      Params.StepsizePos, n, omega, &ga, &gb,
-                                      &gc);
-        if (fabs(gc) > HalfBeam) {
-          n++;
-          continue;
-        }
-        for (sp = 0; sp < nTspots; sp++) {
-          displacement_spot_needed_COM(ga, gb, gc, TheorSpots[sp][3],
-                                       TheorSpots[sp][4], TheorSpots[sp][5],
-                                       TheorSpots[sp][6], &Displ_y, &Displ_z);
-          TheorSpots[sp][10] = TheorSpots[sp][4] + Displ_y;
-          TheorSpots[sp][11] = TheorSpots[sp][5] + Displ_z;
-          CalcEtaAngle(TheorSpots[sp][10], TheorSpots[sp][11],
-                       &TheorSpots[sp][12]);
-          TheorSpots[sp][13] = sqrt(TheorSpots[sp][10] * TheorSpots[sp][10] +
-                                    TheorSpots[sp][11] * TheorSpots[sp][11]) -
-                               Params.RingRadii[(int)TheorSpots[sp][9]];
-        }
-        CompareSpots(TheorSpots, nTspots, ObsSpotsLab, RefRad, Params.MarginRad,
-                     Params.MarginRadial, etamargins, omemargins, &nMatches,
-                     GrainSpots, ringsToRejectCalc, nRingsToRejectCalc,
-                     &nMatchesFracCalc);
-        if (nMatchesFracCalc > bestnMatchesPos) {
-          bestnMatchesPos = nMatchesFracCalc;
-          bestnTspotsPos = nTspotsFracCalc;
-        }
-        double fracMatchesThis = (RealType)((RealType)nMatchesFracCalc) /
-                                 ((RealType)nTspotsFracCalc);
-        if (nMatchesFracCalc >= MinMatchesToAccept &&
-            fracMatchesThis >= bestFracTillNow) {
-          bestMatchFound = 1;
-          for (i = 0; i < 9; i++)
-            GrainMatchesT[0][i] = orThis[i / 3][i % 3];
-          GrainMatchesT[0][9] = ga;
-          GrainMatchesT[0][10] = gb;
-          GrainMatchesT[0][11] = gc;
-          GrainMatchesT[0][12] = (double)nTspots;
-          GrainMatchesT[0][13] = (double)nMatches;
-          GrainMatchesT[0][14] = 1;
-          for (r = 0; r < nTspots; r++) {
-            for (c = 0; c < 15; c++)
-              AllGrainSpotsT[r][c] = GrainSpots[r][c];
-            AllGrainSpotsT[r][15] = 1;
-          }
-          CalcIA(GrainMatchesT, 1, AllGrainSpotsT, Params.Distance, 0);
-          if (fracMatchesThis > bestFracTillNow ||
-              (fracMatchesThis == bestFracTillNow &&
-               GrainMatchesT[0][15] < MinInternalAngle)) {
-            bestFracTillNow = fracMatchesThis;
-            MinInternalAngle = GrainMatchesT[0][15];
-            rownr = nTspots;
-            matchNr = 1;
-            for (i = 0; i < 16; i++)
-              GrainMatches[0][i] = GrainMatchesT[0][i];
-            for (r = 0; r < nTspots; r++)
-              for (c = 0; c < 17; c++)
-                AllGrainSpots[r][c] = AllGrainSpotsT[r][c];
-            for (r = nTspots; r < nRowsOutput; r++)
-              for (c = 0; c < 17; c++)
-                AllGrainSpots[r][c] = 0;
-          }
-        }
-        nDelta = 1;
-        if (nTspotsFracCalc != 0) {
-          fracMatches = (RealType)nMatchesFracCalc / nTspotsFracCalc;
-          if (fracMatches < 0.5) {
-            nDelta = 5 - round(fracMatches * (5 - 1) / 0.5);
+                       Params->RingRadii[ringnr], Params->Rsample,
+                       Params->Hbeam, Params->StepsizePos, seed->y0_vector,
+                       seed->z0_vector, &nPlaneNormals);
+  }
+  seed->nPlaneNormals = nPlaneNormals;
+  return 0;
+}
+
+// Search candidate orientations [orStart, orEnd) about plane normal isp of a
+// seed, at every trial position along the beam, and update best.
+void SearchPlaneNormal(struct TParams *Params, const struct SeedSetup *seed,
+                       int isp, int orStart, int orEnd,
+                       int ringsToRejectCalc[], int nRingsToRejectCalc,
+                       struct SeedBest *best, struct ThreadWorkspace *ws) {
+  RealType HalfBeam = Params->Hbeam / 2;
+  RealType MinMatchesToAccept;
+  RealType ga, gb, gc;
+  int nTspots, nTspotsFracCalc, nMatchesFracCalc;
+  int bestnMatchesRot, bestnMatchesPos;
+  int bestnTspotsRot, bestnTspotsPos;
+  int nOrient;
+  RealType hklnormal[3];
+  int or;
+  int nMatches;
+  int r, c, i;
+  RealType g1, g2, g3;
+  RealType xi, yi, zi;
+  int n_max, n_min, n;
+  int orDelta, nDelta;
+  double hkl[3] = {seed->hkl[0], seed->hkl[1], seed->hkl[2]};
+  RealType ys = seed->ys, zs = seed->zs, omega = seed->omega;
+  RealType RefRad = seed->RefRad;
+  int ringnr = seed->ringnr;
+  RealType *omemargins = (RealType *)seed->omemargins;
+  RealType *etamargins = (RealType *)seed->etamargins;
+  RealType **AllGrainSpotsT = ws->AllGrainSpotsT;
+  RealType **GrainMatchesT = ws->GrainMatchesT;
+  RealType **GrainSpots = ws->GrainSpots;
+  RealType **TheorSpots = ws->TheorSpots;
+  RealType *OrMat = ws->OrMat;
+  // Ranking only changes which of several exactly tied candidates is kept;
+  // VerifyPruning keeps generation order so its output matches exhaustive.
+  int orderCandidates = Params->OrderCandidates && !Params->VerifyPruning;
+  RealType y0 = seed->y0_vector[isp];
+  RealType z0 = seed->z0_vector[isp];
+  MakeUnitLength(Params->Distance, y0, z0, &xi, &yi, &zi);
+  spot_to_gv(xi, yi, zi, omega, &g1, &g2, &g3);
+  hklnormal[0] = g1;
+  hklnormal[1] = g2;
+  hklnormal[2] = g3;
+  OrientCacheEntry *candEntry = NULL;
+  RealType *candOrMat = OrMat;
+  if (UseOrientCache) {
+    OrientCacheKey key;
+    RealType snapped[3];
+    OrientCache_makeKey(ringnr, hklnormal, Params->StepsizeOrient,
+                        Params->OrientCacheQuantum * deg2rad, &key, snapped);
+    for (i = 0; i < 3; i++)
+      hklnormal[i] = snapped[i];
+    int mustBuild;
+    candEntry = OrientCache_acquire(&OrientationCache, &key, &mustBuild);
+    if (mustBuild) {
+      candEntry = BuildCandidateEntry(&key, hkl, hklnormal, ringnr, Params,
+                                      ringsToRejectCalc, nRingsToRejectCalc,
+                                      ws);
+      if (candEntry != NULL)
+        candEntry = OrientCache_insert(&OrientationCache, candEntry);
+      else
+        OrientCache_abandon(&OrientationCache, &key);
+    }
+  }
+  if (candEntry != NULL) {
+    nOrient = candEntry->nOrient;
+    candOrMat = candEntry->OrMat;
+  } else {
+    GenerateCandidateOrientationsF(hkl, hklnormal, Params->StepsizeOrient,
+                                   OrMat, &nOrient, ringnr);
+  }
+  if (orEnd > nOrient)
+    orEnd = nOrient;
+  if (orderCandidates)
+    RankCandidateOrientations(Params, candEntry, candOrMat, orStart, orEnd, xi,
+                              yi, zi, ys, zs, y0, z0, omega, RefRad,
+                              etamargins, omemargins, ringsToRejectCalc,
+                              nRingsToRejectCalc, ws);
+  bestnMatchesRot = -1;
+  bestnTspotsRot = 0;
+  or = orStart;
+  orDelta = 1;
+  while (or < orEnd) {
+    RealType orThis[3][3];
+    int orIdx = orderCandidates ? ws->OrRank[or - orStart].idx : or;
+    LoadCandidateSpots(Params, candEntry, candOrMat, orIdx, orThis, TheorSpots,
+                       &nTspots, &nTspotsFracCalc, ringsToRejectCalc,
+                       nRingsToRejectCalc);
+    PrepareTheorSpotsSoA(TheorSpots, nTspots, Params->RingRadii, ws);
+    MinMatchesToAccept = nTspotsFracCalc * Params->MinMatchesToAcceptFrac;
+    bestnMatchesPos = -1;
+    bestnTspotsPos = 0;
+    calc_n_max_min(xi, yi, ys, y0, Params->Rsample, Params->StepsizePos,
+                   &n_max, &n_min);
+    n = n_min;
+    while (n <= n_max) {
+      spot_to_unrotated_coordinates(xi, yi, zi, ys, zs, y0, z0,
+                                    Params->StepsizePos, n, omega, &ga, &gb,
+                                    &gc);
+      if (fabs(gc) > HalfBeam) {
+        n++;
+        continue;
+      }
+      DisplaceTheorSpots(ga, gb, gc, TheorSpots, nTspots, ws);
+      int pruneBelow = 0, pruned = 0;
+      if (Params->PruneCandidates)
+        pruneBelow = MinMatchesToCompete(MinMatchesToAccept,
+                                         best->fracMatches, nTspotsFracCalc);
+      CompareSpots(TheorSpots, nTspots, ObsSpotsLab, RefRad, Params->MarginRad,
+                   Params->MarginRadial, etamargins, omemargins, &nMatches,
+                   GrainSpots, ringsToRejectCalc, nRingsToRejectCalc,
+                   &nMatchesFracCalc, pruneBelow, nTspotsFracCalc, &pruned);
+      if (pruned) {
+#pragma omp atomic
+        nPositionsPruned++;
+        if (Params->VerifyPruning) {
+          // Rescore exhaustively and check that pruning lost nothing.
+          int nMatchesLowerBound = nMatchesFracCalc;
+          CompareSpots(TheorSpots, nTspots, ObsSpotsLab, RefRad,
+                       Params->MarginRad, Params->MarginRadial, etamargins,
+                       omemargins, &nMatches, GrainSpots, ringsToRejectCalc,
+                       nRingsToRejectCalc, &nMatchesFracCalc, 0,
+                       nTspotsFracCalc, NULL);
+          if (nMatchesFracCalc >= pruneBelow ||
+              PositionStep(nMatchesFracCalc, nTspotsFracCalc) !=
+                  PositionStep(nMatchesLowerBound, nTspotsFracCalc)) {
+#pragma omp atomic
+            nPruningMismatches++;
           }
         }
-        n = n + nDelta;
       }
-      if (bestnMatchesPos > bestnMatchesRot) {
-        bestnMatchesRot = bestnMatchesPos;
-        bestnTspotsRot = bestnTspotsPos;
+      if (nMatchesFracCalc > bestnMatchesPos) {
+        bestnMatchesPos = nMatchesFracCalc;
+        bestnTspotsPos = nTspotsFracCalc;
       }
-      or = or + orDelta;
-    }
-    if (bestnMatchesRot > bestnMatchesIsp) {
-      bestnMatchesIsp = bestnMatchesRot;
-      bestnTspotsIsp = bestnTspotsRot;
-    }
-    ispDelta = 1;
-    // DISABLED: adaptive skipping for debugging
-    // if ((!usingFriedelPair) && (bestnTspotsRot != 0)) {
-    //   fracMatches = (RealType)bestnMatchesRot / bestnTspotsRot;
-    //   if (fracMatches < 0.5)
-    //     ispDelta = 3 - round(fracMatches * (3 - 1) / 0.5);
-    // }
-    isp = isp + ispDelta;
-  }
-  fracMatches = bestFracTillNow;
-  if (fracMatches > 1 || fracMatches < 0 || (int)bestnTspotsIsp == 0 ||
-      (int)bestnMatchesIsp == -1 || bestMatchFound == 0) {
-    // printf("Nothing good found for ID: %d.\n", SpotIDs);
-    // fflush(stdout);
+      double fracMatchesThis = (RealType)((RealType)nMatchesFracCalc) /
+                               ((RealType)nTspotsFracCalc);
+      if (nMatchesFracCalc >= MinMatchesToAccept &&
+          fracMatchesThis >= best->fracMatches) {
+        best->found = 1;
+        for (i = 0; i < 9; i++)
+          GrainMatchesT[0][i] = orThis[i / 3][i % 3];
+        GrainMatchesT[0][9] = ga;
+        GrainMatchesT[0][10] = gb;
+        GrainMatchesT[0][11] = gc;
+        GrainMatchesT[0][12] = (double)nTspots;
+        GrainMatchesT[0][13] = (double)nMatches;
+        GrainMatchesT[0][14] = 1;
+        for (r = 0; r < nTspots; r++) {
+          for (c = 0; c < 15; c++)
+            AllGrainSpotsT[r][c] = GrainSpots[r][c];
+          AllGrainSpotsT[r][15] = 1;
+        }
+        CalcIA(GrainMatchesT, 1, AllGrainSpotsT, Params->Distance, 0);
+        if (fracMatchesThis > best->fracMatches ||
+            (fracMatchesThis == best->fracMatches &&
+             GrainMatchesT[0][15] < best->internalAngle)) {
+          best->fracMatches = fracMatchesThis;
+          best->internalAngle = GrainMatchesT[0][15];
+          best->nRows = nTspots;
+          for (i = 0; i < 16; i++)
+            best->GrainMatches[0][i] = GrainMatchesT[0][i];
+          for (r = 0; r < nTspots; r++)
+            for (c = 0; c < 17; c++)
+              best->AllGrainSpots[r][c] = AllGrainSpotsT[r][c];
+          for (r = nTspots; r < best->nRowsAlloc; r++)
+            for (c = 0; c < 17; c++)
+              best->AllGrainSpots[r][c] = 0;
+        }
+      }
+      nDelta = PositionStep(nMatchesFracCalc, nTspotsFracCalc);
+      n = n + nDelta;
+    }
+    if (bestnMatchesPos > bestnMatchesRot) {
+      bestnMatchesRot = bestnMatchesPos;
+      bestnTspotsRot = bestnTspotsPos;
+    }
+    or = or + orDelta;
+  }
+  OrientCache_release(&OrientationCache, candEntry);
+  if (bestnMatchesRot > best->bestnMatches) {
+    best->bestnMatches = bestnMatchesRot;
+    best->bestnTspots = bestnTspotsRot;
+  }
+}
+
+// Rough number of (orientation, position) trials for one plane normal,
+// used to decide whether a seed is worth splitting into sub-tasks.
+long long int EstimatePlaneNormalTrials(struct TParams *Params,
+                                        const struct SeedSetup *seed, int isp,
+                                        int nOrient) {
+  RealType xi, yi, zi;
+  int n_max, n_min;
+  MakeUnitLength(Params->Distance, seed->y0_vector[isp],
+                 seed->z0_vector[isp], &xi, &yi, &zi);
+  calc_n_max_min(xi, yi, seed->ys, seed->y0_vector[isp], Params->Rsample,
+                 Params->StepsizePos, &n_max, &n_min);
+  return (long long int)nOrient * (n_max - n_min + 1);
+}
+
+// Split an expensive seed into (plane normal x orientation range) OpenMP
+// tasks.  Idle threads pick them up at their next scheduling point (at the
+// latest the barrier at the end of the seed loop), so one slow seed no
+// longer keeps a single thread busy after the others ran out of work.  Each
+// task keeps its own SeedBest; they are merged in search order, so the
+// result does not depend on which thread ran what.
+void SearchSeedTasks(struct TParams *Params, const struct SeedSetup *seed,
+                     int nOrient, int ringsToRejectCalc[],
+                     int nRingsToRejectCalc, struct SeedBest *best,
+                     struct ThreadWorkspace **workspaces, int nRowsPerGrain) {
+  int nPlaneNormals = seed->nPlaneNormals;
+  int *orChunk = malloc(nPlaneNormals * sizeof(*orChunk));
+  int *taskStart = malloc((nPlaneNormals + 1) * sizeof(*taskStart));
+  taskStart[0] = 0;
+  for (int isp = 0; isp < nPlaneNormals; isp++) {
+    long long int trialsPerOrient =
+        EstimatePlaneNormalTrials(Params, seed, isp, 1);
+    if (trialsPerOrient < 1)
+      trialsPerOrient = 1;
+    long long int chunk = SEED_TASK_TRIALS / trialsPerOrient;
+    if (chunk > nOrient)
+      chunk = nOrient;
+    orChunk[isp] = chunk < 1 ? 1 : (int)chunk;
+    taskStart[isp + 1] =
+        taskStart[isp] + (nOrient + orChunk[isp] - 1) / orChunk[isp];
+  }
+  int nTasks = taskStart[nPlaneNormals];
+  struct SeedBest *parts = malloc(nTasks * sizeof(*parts));
+  for (int t = 0; t < nTasks; t++)
+    SeedBest_init(&parts[t], allocMatrixContiguous(1, N_COL_GRAINMATCHES),
+                  allocMatrixContiguous(nRowsPerGrain, N_COL_GRAINSPOTS),
+                  nRowsPerGrain);
+  for (int isp = 0; isp < nPlaneNormals; isp++) {
+    for (int t = taskStart[isp]; t < taskStart[isp + 1]; t++) {
+      int orStart = (t - taskStart[isp]) * orChunk[isp];
+      int orEnd = orStart + orChunk[isp];
+#pragma omp task firstprivate(isp, t, orStart, orEnd)
+      SearchPlaneNormal(Params, seed, isp, orStart, orEnd, ringsToRejectCalc,
+                        nRingsToRejectCalc, &parts[t],
+                        workspaces[omp_get_thread_num()]);
+    }
+  }
+#pragma omp taskwait
+  for (int t = 0; t < nTasks; t++) {
+    SeedBest_merge(best, &parts[t]);
+    FreeMemMatrixContiguous(parts[t].GrainMatches);
+    FreeMemMatrixContiguous(parts[t].AllGrainSpots);
+  }
+  free(parts);
+  free(taskStart);
+  free(orChunk);
+}
+
+int DoIndexing(int SpotIDs, struct TParams Params, int offsetLoc, int idNr,
+               int totalIDs, int ringsToRejectCalc[], int nRingsToRejectCalc,
+               struct ThreadWorkspace **workspaces) {
+  struct ThreadWorkspace *ws = workspaces[omp_get_thread_num()];
+  RealType **BestMatches = ws->BestMatches;
+  int SpotIDIdx = 0;
+  RealType SpotID = SpotIDs;
+  struct SeedSetup *seed = malloc(sizeof(*seed));
+  if (seed == NULL || PrepareSeed(SpotIDs, &Params, seed) != 0) {
+    free(seed);
     return 1;
   }
-  double enTm = omp_get_wtime() - sttm;
-  BestMatches[SpotIDIdx][0] = SpotIDIdx + 1;
-  BestMatches[SpotIDIdx][1] = SpotID;
-  BestMatches[SpotIDIdx][2] = bestnTspotsIsp;
-  BestMatches[SpotIDIdx][3] = bestnMatchesIsp;
-  BestMatches[SpotIDIdx][4] = fracMatches;
-  WriteBestMatchBin(GrainMatches, AllGrainSpots, rownr, Params.IndexBestFD,
-                    Params.IndexBestFullFD, offsetLoc);
-  printf("IDNr: %d, Total: %d, ID: %d, Confidence: %lf, nExp: %lf, nObs: %lf, "
-         "nPlanes: %d, omega: %lf, time: %lfs.\n",
-         idNr, totalIDs, SpotIDs, fracMatches, GrainMatches[0][12],
-         GrainMatches[0][13], nPlaneNormals, omega, enTm);
+  int nPlaneNormals = seed->nPlaneNormals;
+  double sttm = omp_get_wtime();
+  struct SeedBest best;
+  int isp;
+  int useTasks = 0;
+  int nOrient = 0;
+  if (Params.SeedSubTasks) {
+    // Same count GenerateCandidateOrientationsF produces for this ring.
+    RealType nsteps = CalcRotationAngle(seed->ringnr) / Params.StepsizeOrient;
+    nOrient = (int)nsteps;
+    long long int trials = 0;
+    for (isp = 0; isp < nPlaneNormals && trials <= SEED_TASK_TRIALS; isp++)
+      trials += EstimatePlaneNormalTrials(&Params, seed, isp, nOrient);
+    useTasks = trials > SEED_TASK_TRIALS;
+  }
+  if (useTasks) {
+    // The workspace of this thread may be used by sub-tasks while this one
+    // waits, so the best candidate is kept in buffers of its own.
+    SeedBest_init(&best, allocMatrixContiguous(1, N_COL_GRAINMATCHES),
+                  allocMatrixContiguous(ws->nRowsPerGrain, N_COL_GRAINSPOTS),
+                  ws->nRowsPerGrain);
+    SearchSeedTasks(&Params, seed, nOrient, ringsToRejectCalc,
+                    nRingsToRejectCalc, &best, workspaces, ws->nRowsPerGrain);
+  } else {
+    SeedBest_init(&best, ws->GrainMatches, ws->AllGrainSpots,
+                  ws->nRowsOutput);
+    for (isp = 0; isp < nPlaneNormals; isp++)
+      SearchPlaneNormal(&Params, seed, isp, 0, INT_MAX, ringsToRejectCalc,
+                        nRingsToRejectCalc, &best, ws);
+    // DISABLED: adaptive skipping of plane normals (ispDelta) for debugging
+  }
+  RealType fracMatches = best.fracMatches;
+  int rc = 1;
+  if (!(fracMatches > 1 || fracMatches < 0 || (int)best.bestnTspots == 0 ||
+        (int)best.bestnMatches == -1 || best.found == 0)) {
+    double enTm = omp_get_wtime() - sttm;
+    BestMatches[SpotIDIdx][0] = SpotIDIdx + 1;
+    BestMatches[SpotIDIdx][1] = SpotID;
+    BestMatches[SpotIDIdx][2] = best.bestnTspots;
+    BestMatches[SpotIDIdx][3] = best.bestnMatches;
+    BestMatches[SpotIDIdx][4] = fracMatches;
+    WriteBestMatchBin(best.GrainMatches, best.AllGrainSpots, best.nRows,
+                      Params.IndexBestFD, Params.IndexBestFullFD, offsetLoc);
+    printf(
+        "IDNr: %d, Total: %d, ID: %d, Confidence: %lf, nExp: %lf, nObs: %lf, "
+        "nPlanes: %d, omega: %lf, time: %lfs.\n",
+        idNr, totalIDs, SpotIDs, fracMatches, best.GrainMatches[0][12],
+        best.GrainMatches[0][13], nPlaneNormals, seed->omega, enTm);
+    rc = 0;
+  }
+  if (useTasks) {
+    FreeMemMatrixContiguous(best.GrainMatches);
+    FreeMemMatrixContiguous(best.AllGrainSpots);
+  }
+  free(seed);
+  return rc;
 }
 
 int DoIndexingSeed(double orMat[9], double posThis[3], double RefRad,
@@ -2049,7 +2595,7 @@ int DoIndexingSeed(double orMat[9], double posThis[3], double RefRad,
   CompareSpots(TheorSpots, nTspots, ObsSpotsLab, RefRad, Params.MarginRad,
                Params.MarginRadial, etamargins, omemargins, &nMatches,
                GrainSpots, ringsToRejectCalc, nRingsToRejectCalc,
-               &nMatchesFracCalc);
+               &nMatchesFracCalc, 0, nTspotsFrac, NULL);
   double fracMatchesThis =
       (RealType)((RealType)nMatchesFracCalc) / ((RealType)nTspotsFrac);
   int grID = -1;
@@ -2113,6 +2659,8 @@ int ReadBins(char *cwd) {
   printf("nData.bin read\n");
   printf("%lld %d %lld \n", (long long int)size2, (int)sizeof(int),
          (long long int)(size2 / sizeof(int)));
+  if (BinSoA_open(&BinSoA, cwd, (int64_t)(size / sizeof(int))))
+    printf("%s read, comparing spots on SoA bins\n", BIN_SOA_FN);
 }
 
 int ReadSpots(char *cwd) {
@@ -2231,6 +2779,23 @@ int main(int argc, char *argv[]) {
   char *cwdstr = dirname(tmpstr);
   printf("No of hkl's: %d\n", n_hkls);
   n_spots = ReadSpots(cwdstr);
+  check(SpotIDIndex_build(&SpotIndex, ObsSpotsLab, n_spots, N_COL_OBSSPOTS,
+                          4) != 0,
+        "Could not build the SpotID index for %d spots.", n_spots);
+  printf("SpotID index built (max ID %d).\n", SpotIndex.maxID);
+  if (Params.OrientCacheQuantum == -1)
+    Params.OrientCacheQuantum = Params.StepsizeOrient / 10;
+  if (Params.OrientCacheMB > 0 && Params.OrientCacheQuantum <= 0) {
+    printf("Warning: OrientCacheQuantum must be > 0 (got %lf); "
+           "orientation cache disabled.\n",
+           Params.OrientCacheQuantum);
+  } else if (Params.OrientCacheMB > 0) {
+    OrientCache_init(&OrientationCache,
+                     (size_t)(Params.OrientCacheMB * 1024 * 1024));
+    UseOrientCache = 1;
+    printf("Orientation cache: %.0f MB, normal quantum %lf deg.\n",
+           Params.OrientCacheMB, Params.OrientCacheQuantum);
+  }
   printf("Reading binned data from %s...\n", cwdstr);
   int rc = ReadBins(cwdstr);
   printf("Binned data read.\n");
@@ -2248,8 +2813,8 @@ int main(int argc, char *argv[]) {
   printf("No of bins for rings : %d\n", n_ring_bins);
   printf("No of bins for eta   : %d\n", n_eta_bins);
   printf("No of bins for omega : %d\n", n_ome_bins);
-  printf("Total no of bins     : %d\n\n",
-         n_ring_bins * n_eta_bins * n_ome_bins);
+  printf("Total no of bins     : %lld\n\n",
+         (long long int)n_ring_bins * n_eta_bins * n_ome_bins);
   printf("Finished binning.\n\n");
 
   // Open output files once.
@@ -2340,9 +2905,8 @@ int main(int argc, char *argv[]) {
       if (thisSpotID == -1)
         continue; // Skip invalid spots
       int idRow = thisRowNr + startRowNr;
-      struct ThreadWorkspace *ws = workspaces[omp_get_thread_num()];
       DoIndexing(thisSpotID, Params, idRow, thisRowNr, nSpotIDs,
-                 Params.RingsToReject, Params.nRingsToRejectCalc, ws);
+                 Params.RingsToReject, Params.nRingsToRejectCalc, workspaces);
     }
 
     // Free workspaces
@@ -2437,8 +3001,24 @@ int main(int argc, char *argv[]) {
     free(IDsFiles);
   }
   double time = omp_get_wtime() - start_time;
+  if (Params.PruneCandidates) {
+    printf("Pruned %lld trial positions.\n", nPositionsPruned);
+    if (Params.VerifyPruning)
+      printf("Pruning verification: %lld mismatches against exhaustive "
+             "scoring.\n",
+             nPruningMismatches);
+  }
+  if (UseOrientCache) {
+    printf("Orientation cache: %lld hits (%lld waited for another thread), "
+           "%lld misses, %lld evictions.\n",
+           OrientationCache.hits, OrientationCache.waits,
+           OrientationCache.misses, OrientationCache.evictions);
+    OrientCache_destroy(&OrientationCache);
+  }
   close(Params.IndexBestFD);
   close(Params.IndexBestFullFD);
+  SpotIDIndex_free(&SpotIndex);
+  BinSoA_close(&BinSoA);
 
   printf("Finished, time elapsed: %lf seconds.\n", time);
 }
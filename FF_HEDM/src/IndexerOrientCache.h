@@ -0,0 +1,334 @@
+/**
+ * IndexerOrientCache.h - Shared cache of candidate orientations for IndexerOMP
+ *
+ * Seeds on the same ring often produce the same (or, after quantization,
+ * identical) plane normals.  For every plane normal IndexerOMP generates the
+ * candidate orientations about it and simulates the ideal spots of each one.
+ * This cache keeps those results, keyed by (ring, plane normal, orientation
+ * step), so that other seeds and other threads reuse them.
+ *
+ * Key: the unit normal snapped to a grid of `quantum` (radians, > 0) per
+ * component.  Callers generate orientations from the snapped normal, so
+ * entries only depend on their key and results are deterministic regardless
+ * of thread schedule.  (Unsnapped normals of different seeds practically
+ * never repeat, so an exact-match cache would only cost memory.)
+ *
+ * Entry data:
+ *   OrMat:     [double x 9 x nOrient]
+ *   spotStart: [int x (nOrient + 1)]  row range of each orientation in spots
+ *   nFracCalc: [int x nOrient]
+ *   spots:     [double x ORIENT_CACHE_SPOT_COLS x spotStart[nOrient]]
+ *              (TheorSpots columns 3, 4, 5, 6 and 9)
+ *
+ * The cache is bounded by maxBytes.  Entries in use are reference counted;
+ * unreferenced entries sit on an LRU list and eviction takes its head.  An
+ * entry that does not fit is handed back to its creator uncached and freed
+ * on release.  A miss leaves an in-flight placeholder under the key, so
+ * other threads (e.g. the sub-tasks of one seed) wait for the entry instead
+ * of building it again.  All operations take one OpenMP lock; they happen
+ * once per plane normal, not per orientation.
+ */
+
+#ifndef INDEXER_ORIENT_CACHE_H
+#define INDEXER_ORIENT_CACHE_H
+
+#include <math.h>
+#include <omp.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define ORIENT_CACHE_SPOT_COLS 5
+#define ORIENT_CACHE_N_BUCKETS 4096
+
+static const int OrientCache_cols[ORIENT_CACHE_SPOT_COLS] = {3, 4, 5, 6, 9};
+
+typedef struct {
+  int64_t ring; /* 64-bit so the key has no padding and memcmp is safe */
+  int64_t q[3];
+  double step;
+} OrientCacheKey;
+
+typedef struct OrientCacheEntry {
+  OrientCacheKey key;
+  int nOrient;
+  double *OrMat;
+  int *spotStart;
+  int *nFracCalc;
+  double *spots;
+  size_t bytes;
+  int refCount;
+  int cached;   /* 0: owned by the thread that built it */
+  int building; /* placeholder for an entry another thread is building */
+  struct OrientCacheEntry *next;              /* bucket chain */
+  struct OrientCacheEntry *lruPrev, *lruNext; /* only while unreferenced */
+} OrientCacheEntry;
+
+typedef struct {
+  OrientCacheEntry *buckets[ORIENT_CACHE_N_BUCKETS];
+  OrientCacheEntry *lruHead, *lruTail; /* oldest first */
+  size_t bytes;
+  size_t maxBytes;
+  long long hits, misses, evictions, waits;
+  omp_lock_t lock;
+} OrientCache;
+
+static inline void OrientCache_init(OrientCache *c, size_t maxBytes) {
+  memset(c, 0, sizeof(*c));
+  c->maxBytes = maxBytes;
+  omp_init_lock(&c->lock);
+}
+
+/**
+ * Build the key for a plane normal and write the snapped unit normal, which
+ * the caller must then use, to snapped.  quantum must be > 0.
+ */
+static inline void OrientCache_makeKey(int ring, const double normal[3],
+                                       double step, double quantum,
+                                       OrientCacheKey *key,
+                                       double snapped[3]) {
+  memset(key, 0, sizeof(*key));
+  key->ring = ring;
+  key->step = step;
+  double len = sqrt(normal[0] * normal[0] + normal[1] * normal[1] +
+                    normal[2] * normal[2]);
+  double snappedLen = 0;
+  for (int i = 0; i < 3; i++) {
+    key->q[i] = llround(normal[i] / len / quantum);
+    snapped[i] = key->q[i] * quantum;
+    snappedLen += snapped[i] * snapped[i];
+  }
+  snappedLen = sqrt(snappedLen);
+  for (int i = 0; i < 3; i++)
+    snapped[i] /= snappedLen;
+}
+
+static inline uint64_t OrientCache_hash(const OrientCacheKey *key) {
+  uint64_t h = 1469598103934665603ULL;
+  const unsigned char *p = (const unsigned char *)key;
+  for (size_t i = 0; i < sizeof(*key); i++) {
+    h ^= p[i];
+    h *= 1099511628211ULL;
+  }
+  return h;
+}
+
+static inline int OrientCache_keyEqual(const OrientCacheKey *a,
+                                       const OrientCacheKey *b) {
+  return memcmp(a, b, sizeof(*a)) == 0;
+}
+
+/**
+ * Allocate an empty entry able to hold nOrient orientations with at most
+ * maxSpotsPerOrient spots each.  Shrink with OrientCache_entryFinish.
+ */
+static inline OrientCacheEntry *
+OrientCache_entryAlloc(const OrientCacheKey *key, int nOrient,
+                       int maxSpotsPerOrient) {
+  OrientCacheEntry *e = (OrientCacheEntry *)calloc(1, sizeof(*e));
+  if (e == NULL)
+    return NULL;
+  e->key = *key;
+  e->nOrient = nOrient;
+  e->OrMat = (double *)malloc((size_t)(nOrient > 0 ? nOrient : 1) * 9 *
+                              sizeof(double));
+  e->spotStart = (int *)calloc((size_t)nOrient + 1, sizeof(int));
+  e->nFracCalc = (int *)calloc((size_t)(nOrient > 0 ? nOrient : 1),
+                               sizeof(int));
+  e->spots = (double *)malloc(((size_t)nOrient * maxSpotsPerOrient + 1) *
+                              ORIENT_CACHE_SPOT_COLS * sizeof(double));
+  if (!e->OrMat || !e->spotStart || !e->nFracCalc || !e->spots) {
+    free(e->OrMat);
+    free(e->spotStart);
+    free(e->nFracCalc);
+    free(e->spots);
+    free(e);
+    return NULL;
+  }
+  return e;
+}
+
+static inline void OrientCache_entryFinish(OrientCacheEntry *e) {
+  size_t nSpots = (size_t)e->spotStart[e->nOrient];
+  double *shrunk = (double *)realloc(
+      e->spots, (nSpots + 1) * ORIENT_CACHE_SPOT_COLS * sizeof(double));
+  if (shrunk != NULL)
+    e->spots = shrunk;
+  e->bytes = sizeof(*e) + (size_t)e->nOrient * 9 * sizeof(double) +
+             ((size_t)e->nOrient * 2 + 1) * sizeof(int) +
+             (nSpots + 1) * ORIENT_CACHE_SPOT_COLS * sizeof(double);
+}
+
+static inline void OrientCache_entryFree(OrientCacheEntry *e) {
+  if (e == NULL)
+    return;
+  free(e->OrMat);
+  free(e->spotStart);
+  free(e->nFracCalc);
+  free(e->spots);
+  free(e);
+}
+
+/* Caller holds the lock. */
+static inline OrientCacheEntry **OrientCache_find(OrientCache *c,
+                                                  const OrientCacheKey *key) {
+  OrientCacheEntry **link =
+      &c->buckets[OrientCache_hash(key) % ORIENT_CACHE_N_BUCKETS];
+  while (*link != NULL && !OrientCache_keyEqual(&(*link)->key, key))
+    link = &(*link)->next;
+  return link;
+}
+
+/* Caller holds the lock. */
+static inline void OrientCache_lruUnlink(OrientCache *c, OrientCacheEntry *e) {
+  if (e->lruPrev != NULL)
+    e->lruPrev->lruNext = e->lruNext;
+  else
+    c->lruHead = e->lruNext;
+  if (e->lruNext != NULL)
+    e->lruNext->lruPrev = e->lruPrev;
+  else
+    c->lruTail = e->lruPrev;
+  e->lruPrev = e->lruNext = NULL;
+}
+
+/* Caller holds the lock. */
+static inline void OrientCache_lruAppend(OrientCache *c, OrientCacheEntry *e) {
+  e->lruNext = NULL;
+  e->lruPrev = c->lruTail;
+  if (c->lruTail != NULL)
+    c->lruTail->lruNext = e;
+  else
+    c->lruHead = e;
+  c->lruTail = e;
+}
+
+/**
+ * Look up a key.  Returns a referenced entry (release it with
+ * OrientCache_release), waiting if another thread is building it.  On a
+ * miss returns NULL with *mustBuild set: the caller builds the entry and
+ * hands it to OrientCache_insert, or calls OrientCache_abandon on failure.
+ */
+static inline OrientCacheEntry *OrientCache_acquire(OrientCache *c,
+                                                    const OrientCacheKey *key,
+                                                    int *mustBuild) {
+  *mustBuild = 0;
+  for (int waited = 0;; waited = 1) {
+    omp_set_lock(&c->lock);
+    OrientCacheEntry **link = OrientCache_find(c, key);
+    OrientCacheEntry *e = *link;
+    if (e == NULL) {
+      // Placeholder at the chain end, where link points.
+      OrientCacheEntry *p = (OrientCacheEntry *)calloc(1, sizeof(*p));
+      if (p != NULL) {
+        p->key = *key;
+        p->building = 1;
+        *link = p;
+      }
+      c->misses++;
+      omp_unset_lock(&c->lock);
+      *mustBuild = 1;
+      return NULL;
+    }
+    if (!e->building) {
+      if (e->refCount++ == 0)
+        OrientCache_lruUnlink(c, e);
+      c->hits++;
+      omp_unset_lock(&c->lock);
+      return e;
+    }
+    if (!waited)
+      c->waits++;
+    omp_unset_lock(&c->lock);
+#pragma omp taskyield
+  }
+}
+
+/* Caller holds the lock. */
+static inline int OrientCache_evictOne(OrientCache *c) {
+  OrientCacheEntry *victim = c->lruHead;
+  if (victim == NULL)
+    return 0;
+  OrientCache_lruUnlink(c, victim);
+  OrientCacheEntry **link = OrientCache_find(c, &victim->key);
+  *link = victim->next;
+  c->bytes -= victim->bytes;
+  c->evictions++;
+  OrientCache_entryFree(victim);
+  return 1;
+}
+
+/* Caller holds the lock: drop the in-flight placeholder for key, if any. */
+static inline void OrientCache_dropPlaceholder(OrientCache *c,
+                                               const OrientCacheKey *key) {
+  OrientCacheEntry **link = OrientCache_find(c, key);
+  if (*link != NULL && (*link)->building) {
+    OrientCacheEntry *p = *link;
+    *link = p->next;
+    free(p);
+  }
+}
+
+/**
+ * Publish the entry built after a miss and return it referenced.  If it
+ * cannot be made to fit, it is returned uncached (threads waiting for it
+ * then build their own).
+ */
+static inline OrientCacheEntry *OrientCache_insert(OrientCache *c,
+                                                   OrientCacheEntry *e) {
+  omp_set_lock(&c->lock);
+  OrientCache_dropPlaceholder(c, &e->key);
+  e->refCount = 1;
+  while (c->bytes + e->bytes > c->maxBytes && OrientCache_evictOne(c))
+    ;
+  if (c->bytes + e->bytes <= c->maxBytes) {
+    uint64_t b = OrientCache_hash(&e->key) % ORIENT_CACHE_N_BUCKETS;
+    e->cached = 1;
+    e->next = c->buckets[b];
+    c->buckets[b] = e;
+    c->bytes += e->bytes;
+  }
+  omp_unset_lock(&c->lock);
+  return e;
+}
+
+/**
+ * Give up on building the entry for key after a miss.
+ */
+static inline void OrientCache_abandon(OrientCache *c,
+                                       const OrientCacheKey *key) {
+  omp_set_lock(&c->lock);
+  OrientCache_dropPlaceholder(c, key);
+  omp_unset_lock(&c->lock);
+}
+
+static inline void OrientCache_release(OrientCache *c, OrientCacheEntry *e) {
+  if (e == NULL)
+    return;
+  if (!e->cached) {
+    OrientCache_entryFree(e);
+    return;
+  }
+  omp_set_lock(&c->lock);
+  if (--e->refCount == 0)
+    OrientCache_lruAppend(c, e);
+  omp_unset_lock(&c->lock);
+}
+
+static inline void OrientCache_destroy(OrientCache *c) {
+  for (int b = 0; b < ORIENT_CACHE_N_BUCKETS; b++) {
+    OrientCacheEntry *e = c->buckets[b];
+    while (e != NULL) {
+      OrientCacheEntry *next = e->next;
+      OrientCache_entryFree(e);
+      e = next;
+    }
+    c->buckets[b] = NULL;
+  }
+  c->lruHead = c->lruTail = NULL;
+  c->bytes = 0;
+  omp_destroy_lock(&c->lock);
+}
+
+#endif /* INDEXER_ORIENT_CACHE_H */
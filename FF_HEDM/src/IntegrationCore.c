@@ -8,8 +8,15 @@
 //
 
 #include "IntegrationCore.h"
-#include <string.h>
+#include "MapHeader.h"
+#include <fcntl.h>
 #include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 void integration_apply_map(
     struct MapPixelData **const *pxList,
@@ -82,3 +89,204 @@ void integration_apply_map(
     }
   }
 }
+
+// ── CSR-packed map ──────────────────────────────────────────────────
+
+// Scalars at the start of the block that follows the MapHeader.
+#define MAP_CSR_FIXED_BYTES 40
+
+static size_t map_csr_block_size(int nBins, long long nEntries) {
+  return MAP_CSR_FIXED_BYTES + (size_t)(nBins + 1) * sizeof(int64_t) +
+         (size_t)nBins * sizeof(double) + (size_t)nEntries * sizeof(int32_t) +
+         (size_t)nEntries * 4 * sizeof(float);
+}
+
+// Point the fields of m into a block laid out as in MapCSR.bin.
+static void map_csr_attach(struct IntegrationMapCSR *m, void *block,
+                           size_t blockSize, int mapped) {
+  char *b = (char *)block;
+  int32_t ints[4];
+  int64_t nEntries;
+  memcpy(ints, b, sizeof(ints));
+  memcpy(&m->BC_y, b + 16, sizeof(double));
+  memcpy(&m->BC_z, b + 24, sizeof(double));
+  memcpy(&nEntries, b + 32, sizeof(nEntries));
+  m->nBins = ints[0];
+  m->NrPixelsY = ints[1];
+  m->NrPixelsZ = ints[2];
+  m->gradientApplied = ints[3];
+  m->nEntries = nEntries;
+  char *p = b + MAP_CSR_FIXED_BYTES;
+  m->binStart = (const int64_t *)p;
+  p += (size_t)(m->nBins + 1) * sizeof(int64_t);
+  m->areaSum = (const double *)p;
+  p += (size_t)m->nBins * sizeof(double);
+  m->pixIdx = (const int32_t *)p;
+  p += (size_t)nEntries * sizeof(int32_t);
+  m->w00 = (const float *)p;
+  m->w10 = m->w00 + nEntries;
+  m->w01 = m->w10 + nEntries;
+  m->w11 = m->w01 + nEntries;
+  m->block = block;
+  m->blockSize = blockSize;
+  m->mapped = mapped;
+}
+
+int integration_map_csr_build(struct IntegrationMapCSR *m,
+                              const struct MapPixelData *entries,
+                              const int *nPx, int nBins, int NrPixelsY,
+                              int NrPixelsZ, double BC_y, double BC_z,
+                              int GradientCorrection)
+{
+  memset(m, 0, sizeof(*m));
+  long long nEntries = 0;
+  for (int b = 0; b < nBins; b++)
+    nEntries += nPx[2 * b];
+  size_t blockSize = map_csr_block_size(nBins, nEntries);
+  char *block = malloc(blockSize);
+  if (block == NULL)
+    return -1;
+  int32_t ints[4] = {nBins, NrPixelsY, NrPixelsZ, GradientCorrection ? 1 : 0};
+  int64_t n64 = nEntries;
+  memcpy(block, ints, sizeof(ints));
+  memcpy(block + 16, &BC_y, sizeof(double));
+  memcpy(block + 24, &BC_z, sizeof(double));
+  memcpy(block + 32, &n64, sizeof(n64));
+  map_csr_attach(m, block, blockSize, 0);
+
+  int64_t *binStart = (int64_t *)m->binStart;
+  double *areaSum = (double *)m->areaSum;
+  int32_t *pixIdx = (int32_t *)m->pixIdx;
+  float *w00 = (float *)m->w00, *w10 = (float *)m->w10;
+  float *w01 = (float *)m->w01, *w11 = (float *)m->w11;
+  binStart[0] = 0;
+  for (int b = 0; b < nBins; b++)
+    binStart[b + 1] = binStart[b] + nPx[2 * b];
+
+  // Same read position, clamping and weights as integration_apply_map.
+#pragma omp parallel for schedule(dynamic, 64)
+  for (int b = 0; b < nBins; b++) {
+    const struct MapPixelData *e = entries + nPx[2 * b + 1];
+    double sum_area = 0.0;
+    for (int k = 0; k < nPx[2 * b]; k++) {
+      int64_t p = binStart[b] + k;
+      double read_y = e[k].y, read_z = e[k].z;
+      if (GradientCorrection && e[k].deltaR != 0.0f) {
+        double dy = e[k].y - BC_y;
+        double dz = e[k].z - BC_z;
+        double R = sqrt(dy * dy + dz * dz);
+        if (R > 1.0) {
+          read_y -= e[k].deltaR * dy / R;
+          read_z -= e[k].deltaR * dz / R;
+        }
+      }
+      int iy = (int)floorf(read_y);
+      int iz = (int)floorf(read_z);
+      double fy = read_y - iy, fz = read_z - iz;
+      if (iy < 0) { iy = 0; fy = 0; }
+      if (iy >= NrPixelsY - 1) { iy = NrPixelsY - 2; fy = 1; }
+      if (iz < 0) { iz = 0; fz = 0; }
+      if (iz >= NrPixelsZ - 1) { iz = NrPixelsZ - 2; fz = 1; }
+      pixIdx[p] = (int32_t)((size_t)iz * NrPixelsY + iy);
+      w00[p] = (float)((1 - fy) * (1 - fz) * e[k].frac);
+      w10[p] = (float)(fy * (1 - fz) * e[k].frac);
+      w01[p] = (float)((1 - fy) * fz * e[k].frac);
+      w11[p] = (float)(fy * fz * e[k].frac);
+      sum_area += e[k].areaWeight;
+    }
+    areaSum[b] = sum_area;
+  }
+  return 0;
+}
+
+int integration_map_csr_write(const char *fn, const struct MapHeader *mapHdr,
+                              const struct IntegrationMapCSR *m)
+{
+  struct MapHeader hdr = *mapHdr;
+  hdr.version = MAP_HEADER_VERSION_CSR;
+  // Other integrator jobs may have fn mapped: write a new file and rename it
+  // into place instead of truncating the one they read.
+  char tmpFN[4096];
+  snprintf(tmpFN, sizeof(tmpFN), "%s.tmp.%ld", fn, (long)getpid());
+  FILE *f = fopen(tmpFN, "wb");
+  if (f == NULL)
+    return -1;
+  int ok = map_header_write(f, &hdr) == 0 &&
+           fwrite(m->block, 1, m->blockSize, f) == m->blockSize;
+  if (fclose(f) != 0)
+    ok = 0;
+  if (ok)
+    ok = rename(tmpFN, fn) == 0;
+  if (!ok) {
+    remove(tmpFN);
+    return -1;
+  }
+  return 0;
+}
+
+int integration_map_csr_load(struct IntegrationMapCSR *m, const char *fn,
+                             const struct MapHeader *mapHdr, int nBins,
+                             int NrPixelsY, int NrPixelsZ, double BC_y,
+                             double BC_z, int GradientCorrection)
+{
+  memset(m, 0, sizeof(*m));
+  int fd = open(fn, O_RDONLY);
+  if (fd < 0)
+    return 0;
+  struct stat s;
+  struct MapHeader hdr;
+  if (fstat(fd, &s) != 0 ||
+      (size_t)s.st_size < MAP_HEADER_SIZE + MAP_CSR_FIXED_BYTES ||
+      !map_header_read_fd(fd, &hdr) || hdr.version != MAP_HEADER_VERSION_CSR ||
+      !map_header_validate(&hdr, mapHdr)) {
+    close(fd);
+    return 0;
+  }
+  void *base = mmap(0, s.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (base == MAP_FAILED)
+    return 0;
+  size_t blockSize = (size_t)s.st_size - MAP_HEADER_SIZE;
+  map_csr_attach(m, (char *)base + MAP_HEADER_SIZE, blockSize, 1);
+  int ok = m->nBins == nBins && m->NrPixelsY == NrPixelsY &&
+           m->NrPixelsZ == NrPixelsZ &&
+           m->gradientApplied == (GradientCorrection ? 1 : 0) &&
+           (!m->gradientApplied || (m->BC_y == BC_y && m->BC_z == BC_z)) &&
+           m->nEntries >= 0 &&
+           blockSize == map_csr_block_size(nBins, m->nEntries) &&
+           m->binStart[0] == 0 && m->binStart[nBins] == m->nEntries;
+  // Bins index pixIdx and the weights through binStart: it must not step back
+  for (int b = 0; ok && b < nBins; b++)
+    ok = m->binStart[b] <= m->binStart[b + 1];
+  if (!ok) {
+    munmap(base, s.st_size);
+    memset(m, 0, sizeof(*m));
+    return 0;
+  }
+  return 1;
+}
+
+void integration_map_csr_free(struct IntegrationMapCSR *m)
+{
+  if (m->block != NULL) {
+    if (m->mapped)
+      munmap((char *)m->block - MAP_HEADER_SIZE,
+             m->blockSize + MAP_HEADER_SIZE);
+    else
+      free(m->block);
+  }
+  memset(m, 0, sizeof(*m));
+}
+
+void integration_apply_map_csr(const struct IntegrationMapCSR *m,
+                               const double *image, const double *dark,
+                               double *profiles_out, double *norm_out)
+{
+  for (long long b = 0; b < m->nBins; b++) {
+    double sum_weighted = integration_map_csr_bin(m, b, image);
+    if (dark != NULL)
+      sum_weighted -= integration_map_csr_bin(m, b, dark);
+    profiles_out[b] = sum_weighted;
+    norm_out[b] = m->areaSum[b];
+  }
+}
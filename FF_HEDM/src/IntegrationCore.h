@@ -35,4 +35,94 @@ void integration_apply_map(
     double *profiles_out,
     double *norm_out);
 
+// ── CSR-packed map (MapCSR.bin) ─────────────────────────────────────
+//
+// integration_apply_map walks per-bin AoS MapPixelData and redoes the
+// gradient shift, floor/clamp and bilinear weights for every entry of every
+// frame.  None of that depends on the image, so for repeated frames the map
+// is packed once into CSR form: bin b owns entries [binStart[b],
+// binStart[b+1]); entry p reads the 2x2 pixel block whose top-left pixel is
+// pixIdx[p] with weights w00..w11[p] (bilinear weight x frac).  The
+// per-frame kernel is then a flat gather-multiply-add.
+//
+// MapCSR.bin (MapHeader version MAP_HEADER_VERSION_CSR, same param_hash as
+// the Map.bin it was packed from), then:
+//   [int32 nBins][int32 NrPixelsY][int32 NrPixelsZ][int32 gradientApplied]
+//   [double BC_y][double BC_z][int64 nEntries]
+//   [int64 binStart x (nBins + 1)]
+//   [double areaSum x nBins]          (sum of areaWeight per bin)
+//   [int32 pixIdx x nEntries]
+//   [float w00 x nEntries][float w10 x nEntries]
+//   [float w01 x nEntries][float w11 x nEntries]
+// Weights are float32, so profiles agree with the AoS path to float
+// precision; sums are accumulated in double.
+
+#include <stdint.h>
+
+#define MAP_CSR_FN "MapCSR.bin"
+
+struct MapHeader;
+
+struct IntegrationMapCSR {
+  int nBins;
+  int NrPixelsY, NrPixelsZ;
+  int gradientApplied; // read positions include the deltaR shift
+  double BC_y, BC_z;
+  long long nEntries;
+  const int64_t *binStart;
+  const double *areaSum;
+  const int32_t *pixIdx;
+  const float *w00, *w10, *w01, *w11;
+  void *block; // everything after the MapHeader (heap or mmap)
+  size_t blockSize;
+  int mapped;
+};
+
+// Pack a flat Map.bin/nMap.bin pair (nPx[2 * bin] = count, nPx[2 * bin + 1]
+// = first entry) into m.  Returns 0 on success, -1 on allocation failure.
+int integration_map_csr_build(struct IntegrationMapCSR *m,
+                              const struct MapPixelData *entries,
+                              const int *nPx, int nBins, int NrPixelsY,
+                              int NrPixelsZ, double BC_y, double BC_z,
+                              int GradientCorrection);
+
+// Write m to fn (through a temporary file and rename), tagged with the
+// parameter hash of mapHdr.
+// Returns 0 on success, -1 on failure.
+int integration_map_csr_write(const char *fn, const struct MapHeader *mapHdr,
+                              const struct IntegrationMapCSR *m);
+
+// Map fn if it was packed from a Map.bin with header mapHdr and for the same
+// detector size, bin count, beam center and gradient setting.
+// Returns 1 if loaded, 0 if absent or stale (m left empty).
+int integration_map_csr_load(struct IntegrationMapCSR *m, const char *fn,
+                             const struct MapHeader *mapHdr, int nBins,
+                             int NrPixelsY, int NrPixelsZ, double BC_y,
+                             double BC_z, int GradientCorrection);
+
+void integration_map_csr_free(struct IntegrationMapCSR *m);
+
+// Sum of image * weight over the entries of one bin.
+static inline double integration_map_csr_bin(const struct IntegrationMapCSR *m,
+                                             long long bin,
+                                             const double *image) {
+  const int64_t p0 = m->binStart[bin], p1 = m->binStart[bin + 1];
+  const int32_t *idx = m->pixIdx;
+  const float *w00 = m->w00, *w10 = m->w10, *w01 = m->w01, *w11 = m->w11;
+  const size_t rowStride = (size_t)m->NrPixelsY;
+  double sum = 0.0;
+#pragma omp simd reduction(+ : sum)
+  for (int64_t p = p0; p < p1; p++) {
+    const double *px = image + idx[p];
+    sum += px[0] * w00[p] + px[1] * w10[p] + px[rowStride] * w01[p] +
+           px[rowStride + 1] * w11[p];
+  }
+  return sum;
+}
+
+// CSR counterpart of integration_apply_map over all bins of m.
+void integration_apply_map_csr(const struct IntegrationMapCSR *m,
+                               const double *image, const double *dark,
+                               double *profiles_out, double *norm_out);
+
 #endif /* INTEGRATION_CORE_H */
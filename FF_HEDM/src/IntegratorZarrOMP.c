@@ -11,6 +11,7 @@
 
 #include "FileReader.h"
 // CalibPeakFit.h removed — peak fitting unified in PeakFit.h
+#include "IntegrationCore.h"
 #include "MapHeader.h"
 #include "PeakFit.h"
 #include "PeakFitIO.h"
@@ -93,6 +94,37 @@ struct data *pxList;
 int *nPxList;
 int *binMaskFlag; // per-bin contamination flags from maskMap.bin (NULL if
                   // absent)
+struct MapHeader MapBinHeader; // header of Map.bin (if MapBinHasHeader)
+int MapBinHasHeader = 0;
+struct IntegrationMapCSR MapCSR; // packed form of Map.bin used per frame
+
+// Load MapCSR.bin from resultFolder, or pack Map.bin in memory and cache it
+// there for the next run.  Only done when Map.bin has a parameter header,
+// since that is what ties the cache to the map.
+void LoadMapCSR(char *resultFolder, int nBins, int NrPixelsY, int NrPixelsZ,
+                double BC_y, double BC_z, int GradientCorrection) {
+  char fn[4096];
+  sprintf(fn, "%s/%s", resultFolder, MAP_CSR_FN);
+  if (MapBinHasHeader &&
+      integration_map_csr_load(&MapCSR, fn, &MapBinHeader, nBins, NrPixelsY,
+                               NrPixelsZ, BC_y, BC_z, GradientCorrection)) {
+    printf("Read %s: %lld pixel-bin entries.\n", fn, MapCSR.nEntries);
+    return;
+  }
+  double t0 = omp_get_wtime();
+  int rc = integration_map_csr_build(
+      &MapCSR, (const struct MapPixelData *)pxList, nPxList, nBins, NrPixelsY,
+      NrPixelsZ, BC_y, BC_z, GradientCorrection);
+  check(rc != 0, "Could not allocate the packed pixel map.");
+  printf("Packed Map.bin: %lld pixel-bin entries in %lf s.\n",
+         MapCSR.nEntries, omp_get_wtime() - t0);
+  if (MapBinHasHeader) {
+    if (integration_map_csr_write(fn, &MapBinHeader, &MapCSR) == 0)
+      printf("Wrote %s.\n", fn);
+    else
+      printf("Warning: could not write %s.\n", fn);
+  }
+}
 
 int ReadBins(char *resultFolder) {
   int fd;
@@ -115,6 +147,8 @@ int ReadBins(char *resultFolder) {
   if (has_header) {
     data_offset = MAP_HEADER_SIZE;
     map_header_print("Map.bin", &map_hdr);
+    MapBinHeader = map_hdr;
+    MapBinHasHeader = 1;
   } else {
     printf("WARNING: Map.bin has no parameter header (legacy format).\n");
     printf("  Consider regenerating with latest DetectorMapper.\n");
@@ -338,6 +372,110 @@ static inline void rawToDouble(const char *raw, double *out, int nPixels,
   }
 }
 
+// ─────────────────────────────────────────────────────────────────
+// Frame pipeline (PipelineFrames > 0): decode and integrate a window of
+// frames in parallel, one whole frame per thread, ahead of the frame loop,
+// which then only copies the per-bin sums and writes output in frame order.
+// ─────────────────────────────────────────────────────────────────
+struct FramePipeline {
+  int nSlots;     // frames per window
+  size_t nBins;
+  double *slots;  // nSlots x nBins raw (unnormalized) bin intensities
+  long *nNeg1, *nNeg2; // per slot: mapped pixels with value -1 / -2
+  int nThreads;
+  char **raw;     // per thread: one compressed-frame decode buffer
+  double **image; // per thread: dark-subtracted frame
+  blosc2_context **dctx;
+};
+
+void FramePipelineInit(struct FramePipeline *fp, int nSlots, size_t nBins,
+                       int nThreads, size_t nPixels, int bytesPerPx) {
+  fp->nSlots = nSlots;
+  fp->nBins = nBins;
+  fp->nThreads = nThreads;
+  fp->slots = malloc((size_t)nSlots * nBins * sizeof(*fp->slots));
+  fp->nNeg1 = calloc(nSlots, sizeof(*fp->nNeg1));
+  fp->nNeg2 = calloc(nSlots, sizeof(*fp->nNeg2));
+  fp->raw = malloc(nThreads * sizeof(*fp->raw));
+  fp->image = malloc(nThreads * sizeof(*fp->image));
+  fp->dctx = malloc(nThreads * sizeof(*fp->dctx));
+  check(fp->slots == NULL || fp->raw == NULL || fp->image == NULL ||
+            fp->dctx == NULL,
+        "Could not allocate %d pipeline frames.", nSlots);
+  // A context per thread; blosc1_decompress serializes on a global one.
+  blosc2_dparams dparams = BLOSC2_DPARAMS_DEFAULTS;
+  dparams.nthreads = 1;
+  for (int t = 0; t < nThreads; t++) {
+    fp->raw[t] = malloc(nPixels * bytesPerPx);
+    fp->image[t] = malloc(nPixels * sizeof(double));
+    fp->dctx[t] = blosc2_create_dctx(dparams);
+    check(fp->raw[t] == NULL || fp->image[t] == NULL || fp->dctx[t] == NULL,
+          "Could not allocate pipeline buffers for thread %d.", t);
+  }
+}
+
+void FramePipelineFree(struct FramePipeline *fp) {
+  for (int t = 0; t < fp->nThreads; t++) {
+    free(fp->raw[t]);
+    free(fp->image[t]);
+    blosc2_free_ctx(fp->dctx[t]);
+  }
+  free(fp->raw);
+  free(fp->image);
+  free(fp->dctx);
+  free(fp->slots);
+  free(fp->nNeg1);
+  free(fp->nNeg2);
+}
+
+// Decode, dark-subtract and integrate frames [first, first + nSlots) into
+// the slots (frame f goes to slot f - first).
+void FramePipelineFill(struct FramePipeline *fp, int first, int nFrames,
+                       ZarrFrameStream *frames, int dType,
+                       int bytesPerPx, int NrPixelsY, int NrPixelsZ,
+                       const double *AverageDark) {
+  int last = first + fp->nSlots < nFrames ? first + fp->nSlots : nFrames;
+  int nPixels = NrPixelsY * NrPixelsZ;
+#pragma omp parallel for num_threads(fp->nThreads) schedule(dynamic, 1)
+  for (int f = first; f < last; f++) {
+    int t = omp_get_thread_num();
+    int s = f - first;
+    double *image = fp->image[t];
+    size_t csz = 0;
+    const char *compressed = ZarrFrameStream_acquire(frames, f, &csz);
+    int dsz = compressed == NULL
+                  ? -1
+                  : blosc2_decompress_ctx(fp->dctx[t], compressed,
+                                          (int32_t)csz, fp->raw[t],
+                                          nPixels * bytesPerPx);
+    ZarrFrameStream_release(frames, f);
+    check(dsz <= 0,
+          "Error: Failed to decompress frame data at index %d! dsize: %d", f,
+          dsz);
+    rawToDouble(fp->raw[t], image, nPixels, dType);
+    for (int j = 0; j < nPixels; j++)
+      image[j] -= AverageDark[j];
+    long neg1 = 0, neg2 = 0;
+    for (size_t b = 0; b < fp->nBins; b++) {
+      int npx = nPxList[2 * b + 0];
+      int dp = nPxList[2 * b + 1];
+      for (int l = 0; l < npx; l++) {
+        size_t tp = (size_t)pxList[dp + l].z * NrPixelsY + pxList[dp + l].y;
+        double val = image[tp];
+        if (val == -1.0)
+          neg1++;
+        else if (val == -2.0)
+          neg2++;
+      }
+    }
+    fp->nNeg1[s] = neg1;
+    fp->nNeg2[s] = neg2;
+    double *out = fp->slots + (size_t)s * fp->nBins;
+    for (size_t b = 0; b < fp->nBins; b++)
+      out[b] = integration_map_csr_bin(&MapCSR, b, image);
+  }
+}
+
 // MakeSquare removed — now midas_make_square() in ImageUtils.h
 
 // ─────────────────────────────────────────────────────────────────
@@ -633,6 +771,7 @@ int main(int argc, char **argv) {
   double BC_y = 0, BC_z = 0;
   int NrPixelsY = 2048, NrPixelsZ = 2048, Normalize = 1;
   int GradientCorrection = 0;
+  int PipelineFrames = 0; /* frames decoded+integrated ahead, 0 = off */
   double *dIdR = NULL; /* radial gradient image (pre-computed per frame) */
   int nEtaBins, nRBins;
   char aline[4096], dummy[4096], *str;
@@ -922,7 +1061,6 @@ int main(int argc, char **argv) {
   struct zip_stat *finfo = NULL;
   finfo = calloc(16384, sizeof(int));
   zip_stat_init(finfo);
-  int count = 0;
   resultFolder = NULL;
   int locImTransOpt, locTemp = -1, locPres = -1, locI = -1, locI0 = -1;
   nDarks = 0;
@@ -930,165 +1068,92 @@ int main(int argc, char **argv) {
   bytesPerPx = 2;
   int darkLoc = -1, dataLoc = -1, floodLoc = -1;
   double *Temperature, *Pressure, *I, *I0;
-  while ((zip_stat_index(arch, count, 0, finfo)) == 0) {
-    if (strstr(finfo->name,
-               "analysis/process/analysis_parameters/ResultFolder/0") != NULL) {
-      ReadZarrString(arch, count, &resultFolder, 4096);
-    }
-    if (strstr(finfo->name, "analysis/process/analysis_parameters/GapFile/0") !=
-        NULL) {
-      ReadZarrString(arch, count, &GapFN, 4096);
-    }
-    if (strstr(finfo->name,
-               "analysis/process/analysis_parameters/BadPxFile/0") != NULL) {
-      ReadZarrString(arch, count, &BadPxFN, 4096);
-    }
-    if (strstr(finfo->name,
-               "analysis/process/analysis_parameters/Wavelength/0") != NULL) {
-      ReadZarrChunk(arch, count, &Lam, sizeof(double));
-    }
-    if (strstr(finfo->name, "analysis/process/analysis_parameters/X/0") !=
-        NULL) {
-      ReadZarrChunk(arch, count, &X, sizeof(double));
-    }
-    if (strstr(finfo->name, "analysis/process/analysis_parameters/Y/0") !=
-        NULL) {
-      ReadZarrChunk(arch, count, &Y, sizeof(double));
-    }
-    if (strstr(finfo->name, "analysis/process/analysis_parameters/Z/0") !=
-        NULL) {
-      ReadZarrChunk(arch, count, &Z, sizeof(double));
-    }
-    if (strstr(finfo->name, "analysis/process/analysis_parameters/U/0") !=
-        NULL) {
-      ReadZarrChunk(arch, count, &U, sizeof(double));
-    }
-    if (strstr(finfo->name, "analysis/process/analysis_parameters/V/0") !=
-        NULL) {
-      ReadZarrChunk(arch, count, &V, sizeof(double));
-    }
-    if (strstr(finfo->name, "analysis/process/analysis_parameters/W/0") !=
-        NULL) {
-      ReadZarrChunk(arch, count, &W, sizeof(double));
-    }
-    if (strstr(finfo->name, "analysis/process/analysis_parameters/SHpL/0") !=
-        NULL) {
-      ReadZarrChunk(arch, count, &SHpL, sizeof(double));
-    }
-    if (strstr(finfo->name, "analysis/process/analysis_parameters/Polariz/0") !=
-        NULL) {
-      ReadZarrChunk(arch, count, &Polariz, sizeof(double));
-    }
-    if (strstr(finfo->name, "measurement/process/scan_parameters/start/0") !=
-        NULL) {
-      ReadZarrChunk(arch, count, &omeStart, sizeof(double));
-      haveOmegas = 1;
-    }
-    if (strstr(finfo->name, "measurement/process/scan_parameters/step/0") !=
-        NULL) {
-      ReadZarrChunk(arch, count, &omeStep, sizeof(double));
-    }
-    if (strstr(finfo->name,
-               "analysis/process/analysis_parameters/EtaBinSize/0") != NULL) {
-      ReadZarrChunk(arch, count, &EtaBinSize, sizeof(double));
-    }
-    if (strstr(finfo->name,
-               "analysis/process/analysis_parameters/RBinSize/0") != NULL) {
-      ReadZarrChunk(arch, count, &RBinSize, sizeof(double));
-    }
-    if (strstr(finfo->name,
-               "analysis/process/analysis_parameters/QBinSize/0") != NULL) {
-      ReadZarrChunk(arch, count, &QBinSize, sizeof(double));
-    }
-    if (strstr(finfo->name,
-               "analysis/process/analysis_parameters/QMin/0") != NULL) {
-      ReadZarrChunk(arch, count, &QMin, sizeof(double));
-    }
-    if (strstr(finfo->name,
-               "analysis/process/analysis_parameters/QMax/0") != NULL) {
-      ReadZarrChunk(arch, count, &QMax, sizeof(double));
-    }
-    if (strstr(finfo->name, "analysis/process/analysis_parameters/RMax/0") !=
-        NULL) {
-      ReadZarrChunk(arch, count, &RMax, sizeof(double));
-    }
-    if (strstr(finfo->name, "analysis/process/analysis_parameters/RMin/0") !=
-        NULL) {
-      ReadZarrChunk(arch, count, &RMin, sizeof(double));
-    }
-    if (strstr(finfo->name, "analysis/process/analysis_parameters/EtaMax/0") !=
-        NULL) {
-      ReadZarrChunk(arch, count, &EtaMax, sizeof(double));
-    }
-    if (strstr(finfo->name, "analysis/process/analysis_parameters/EtaMin/0") !=
-        NULL) {
-      ReadZarrChunk(arch, count, &EtaMin, sizeof(double));
-    }
-    if (strstr(finfo->name, "analysis/process/analysis_parameters/Lsd/0") !=
-        NULL) {
-      ReadZarrChunk(arch, count, &Lsd, sizeof(double));
-    }
-    if (strstr(finfo->name,
-               "analysis/process/analysis_parameters/PixelSizeY/0") != NULL) {
-      ReadZarrChunk(arch, count, &px, sizeof(double));
-    }
-    if (strstr(finfo->name,
-               "analysis/process/analysis_parameters/PixelSizeZ/0") != NULL) {
-      ReadZarrChunk(arch, count, &px, sizeof(double));
-    }
-    if (strstr(finfo->name,
-               "analysis/process/analysis_parameters/PixelSize/0") != NULL) {
-      ReadZarrChunk(arch, count, &px, sizeof(double));
-    }
-    if (strstr(finfo->name,
-               "analysis/process/analysis_parameters/OmegaSumFrames/0") !=
-        NULL) {
-      ReadZarrChunk(arch, count, &chunkFiles, sizeof(int));
-    }
-    if (strstr(finfo->name,
-               "analysis/process/analysis_parameters/SaveIndividualFrames/0") !=
-        NULL) {
-      ReadZarrChunk(arch, count, &individualSave, sizeof(int));
-    }
-    if (strstr(finfo->name,
-               "analysis/process/analysis_parameters/SkipFrame/0") != NULL) {
-      ReadZarrChunk(arch, count, &skipFrame, sizeof(int));
-      printf("SkipFrame: %d\n", skipFrame);
-    }
-    if (strstr(finfo->name,
-               "analysis/process/analysis_parameters/Normalize/0") != NULL) {
-      ReadZarrChunk(arch, count, &Normalize, sizeof(int));
-    }
-    if (strstr(finfo->name,
-               "analysis/process/analysis_parameters/DoPeakFit/0") != NULL) {
-      ReadZarrChunk(arch, count, &doPeakFit, sizeof(int));
-    }
-    if (strstr(finfo->name,
-               "analysis/process/analysis_parameters/FitROIPadding/0") !=
-        NULL) {
-      ReadZarrChunk(arch, count, &fitROIPadding, sizeof(int));
-    }
-    if (strstr(finfo->name,
-               "analysis/process/analysis_parameters/SumImages/0") != NULL) {
-      ReadZarrChunk(arch, count, &sumImages, sizeof(int));
-    }
-    if (strstr(finfo->name,
-               "analysis/process/analysis_parameters/GapIntensity/0") != NULL) {
-      double tmpGap;
-      ReadZarrChunk(arch, count, &tmpGap, sizeof(double));
-      GapIntensity = (long long int)tmpGap;
-    }
-    if (strstr(finfo->name,
-               "analysis/process/analysis_parameters/BadPxIntensity/0") !=
-        NULL) {
-      double tmpBad;
-      ReadZarrChunk(arch, count, &tmpBad, sizeof(double));
-      BadPxIntensity = (long long int)tmpBad;
-    }
-    if (strstr(finfo->name, "exchange/data/.zarray") != NULL) {
+  ZarrIndex *zidx = ZarrIndex_build(arch);
+  if (zidx == NULL) {
+    fprintf(stderr, "ERROR: Could not index zip archive '%s'\n", DataFN);
+    return 1;
+  }
+  ZarrIndex_readString(arch, zidx, ZARR_ANALYSIS_PARAMS "ResultFolder",
+                       &resultFolder, 4096);
+  ZarrIndex_readString(arch, zidx, ZARR_ANALYSIS_PARAMS "GapFile", &GapFN,
+                       4096);
+  ZarrIndex_readString(arch, zidx, ZARR_ANALYSIS_PARAMS "BadPxFile", &BadPxFN,
+                       4096);
+  ZarrIndex_readDouble(arch, zidx, ZARR_ANALYSIS_PARAMS "Wavelength", &Lam);
+  ZarrIndex_readDouble(arch, zidx, ZARR_ANALYSIS_PARAMS "X", &X);
+  ZarrIndex_readDouble(arch, zidx, ZARR_ANALYSIS_PARAMS "Y", &Y);
+  ZarrIndex_readDouble(arch, zidx, ZARR_ANALYSIS_PARAMS "Z", &Z);
+  ZarrIndex_readDouble(arch, zidx, ZARR_ANALYSIS_PARAMS "U", &U);
+  ZarrIndex_readDouble(arch, zidx, ZARR_ANALYSIS_PARAMS "V", &V);
+  ZarrIndex_readDouble(arch, zidx, ZARR_ANALYSIS_PARAMS "W", &W);
+  ZarrIndex_readDouble(arch, zidx, ZARR_ANALYSIS_PARAMS "SHpL", &SHpL);
+  ZarrIndex_readDouble(arch, zidx, ZARR_ANALYSIS_PARAMS "Polariz", &Polariz);
+  if (ZarrIndex_readDouble(arch, zidx, ZARR_SCAN_PARAMS "start", &omeStart))
+    haveOmegas = 1;
+  ZarrIndex_readDouble(arch, zidx, ZARR_SCAN_PARAMS "step", &omeStep);
+  ZarrIndex_readDouble(arch, zidx, ZARR_ANALYSIS_PARAMS "EtaBinSize",
+                       &EtaBinSize);
+  ZarrIndex_readDouble(arch, zidx, ZARR_ANALYSIS_PARAMS "RBinSize", &RBinSize);
+  ZarrIndex_readDouble(arch, zidx, ZARR_ANALYSIS_PARAMS "QBinSize", &QBinSize);
+  ZarrIndex_readDouble(arch, zidx, ZARR_ANALYSIS_PARAMS "QMin", &QMin);
+  ZarrIndex_readDouble(arch, zidx, ZARR_ANALYSIS_PARAMS "QMax", &QMax);
+  ZarrIndex_readDouble(arch, zidx, ZARR_ANALYSIS_PARAMS "RMax", &RMax);
+  ZarrIndex_readDouble(arch, zidx, ZARR_ANALYSIS_PARAMS "RMin", &RMin);
+  ZarrIndex_readDouble(arch, zidx, ZARR_ANALYSIS_PARAMS "EtaMax", &EtaMax);
+  ZarrIndex_readDouble(arch, zidx, ZARR_ANALYSIS_PARAMS "EtaMin", &EtaMin);
+  ZarrIndex_readDouble(arch, zidx, ZARR_ANALYSIS_PARAMS "Lsd", &Lsd);
+  // PixelSizeY, PixelSizeZ and PixelSize all set px; the later entry wins,
+  // as in the old archive scan.
+  const char *pxKeys[3] = {ZARR_ANALYSIS_PARAMS "PixelSizeY",
+                           ZARR_ANALYSIS_PARAMS "PixelSizeZ",
+                           ZARR_ANALYSIS_PARAMS "PixelSize"};
+  int locPx = -1;
+  for (int k = 0; k < 3; k++) {
+    int loc = ZarrIndex_chunk(zidx, pxKeys[k]);
+    if (loc > locPx)
+      locPx = loc;
+  }
+  if (locPx >= 0)
+    ReadZarrChunk(arch, locPx, &px, sizeof(double));
+  ZarrIndex_readInt(arch, zidx, ZARR_ANALYSIS_PARAMS "OmegaSumFrames",
+                    &chunkFiles);
+  ZarrIndex_readInt(arch, zidx, ZARR_ANALYSIS_PARAMS "SaveIndividualFrames",
+                    &individualSave);
+  if (ZarrIndex_readInt(arch, zidx, ZARR_ANALYSIS_PARAMS "SkipFrame",
+                        &skipFrame))
+    printf("SkipFrame: %d\n", skipFrame);
+  ZarrIndex_readInt(arch, zidx, ZARR_ANALYSIS_PARAMS "Normalize", &Normalize);
+  ZarrIndex_readInt(arch, zidx, ZARR_ANALYSIS_PARAMS "PipelineFrames",
+                    &PipelineFrames);
+  ZarrIndex_readInt(arch, zidx, ZARR_ANALYSIS_PARAMS "DoPeakFit", &doPeakFit);
+  ZarrIndex_readInt(arch, zidx, ZARR_ANALYSIS_PARAMS "FitROIPadding",
+                    &fitROIPadding);
+  ZarrIndex_readInt(arch, zidx, ZARR_ANALYSIS_PARAMS "SumImages", &sumImages);
+  double tmpGap;
+  if (ZarrIndex_readDouble(arch, zidx, ZARR_ANALYSIS_PARAMS "GapIntensity",
+                           &tmpGap))
+    GapIntensity = (long long int)tmpGap;
+  double tmpBad;
+  if (ZarrIndex_readDouble(arch, zidx, ZARR_ANALYSIS_PARAMS "BadPxIntensity",
+                           &tmpBad))
+    BadPxIntensity = (long long int)tmpBad;
+
+  // The dtype in exchange/data/.zarray and scan_parameters/datatype both set
+  // the pixel type; they are applied in archive order so the later one wins.
+  int locDataZarray = ZarrIndex_find(zidx, "exchange/data/.zarray");
+  int locDatatype = ZarrIndex_find(zidx, ZARR_SCAN_PARAMS "datatype/0");
+  int typeLocs[2] = {locDataZarray, locDatatype};
+  if (locDatatype < locDataZarray) {
+    typeLocs[0] = locDatatype;
+    typeLocs[1] = locDataZarray;
+  }
+  for (int t = 0; t < 2; t++) {
+    if (typeLocs[t] < 0)
+      continue;
+    if (typeLocs[t] == locDataZarray) {
       char *s = NULL;
       size_t sSize;
-      ReadZarrRaw(arch, count, &s, &sSize);
+      ReadZarrRaw(arch, locDataZarray, &s, &sSize);
       char *ptr = strstr(s, "shape");
       if (ptr != NULL) {
         char *ptrt = strstr(ptr, "[");
@@ -1136,114 +1201,11 @@ int main(int argc, char **argv) {
         }
       }
       free(s);
-    }
-    if (strstr(finfo->name, "exchange/dark/.zarray") != NULL) {
-      char *s = NULL;
-      size_t sSize;
-      ReadZarrRaw(arch, count, &s, &sSize);
-      char *ptr = strstr(s, "shape");
-      if (ptr != NULL) {
-        char *ptrt = strstr(ptr, "[");
-        char *ptr2 = strstr(ptrt, "]");
-        int loc = (int)(ptr2 - ptrt);
-        char ptr3[2048];
-        strncpy(ptr3, ptrt, loc + 1);
-        if (3 == sscanf(ptr3,
-                        "%*[^0123456789]%d%*[^0123456789]%d%*[^0123456789]%d",
-                        &nDarks, &NrPixelsZ, &NrPixelsY)) {
-          printf("nDarks: %d nrPixelsZ: %d nrPixelsY: %d\n", nDarks, NrPixelsZ,
-                 NrPixelsY);
-        } else {
-          free(s);
-          return 1;
-        }
-      } else {
-        free(s);
-        return 1;
-      }
-      free(s);
-    }
-    if (strstr(finfo->name, "exchange/flood/.zarray") != NULL) {
-      char *s = NULL;
-      size_t sSize;
-      ReadZarrRaw(arch, count, &s, &sSize);
-      char *ptr = strstr(s, "shape");
-      if (ptr != NULL) {
-        char *ptrt = strstr(ptr, "[");
-        char *ptr2 = strstr(ptrt, "]");
-        int loc = (int)(ptr2 - ptrt);
-        char ptr3[2048];
-        strncpy(ptr3, ptrt, loc + 1);
-        if (3 == sscanf(ptr3,
-                        "%*[^0123456789]%d%*[^0123456789]%d%*[^0123456789]%d",
-                        &nFloods, &NrPixelsZ, &NrPixelsY)) {
-          printf("nFloods: %d nrPixelsZ: %d nrPixelsY: %d\n", nFloods,
-                 NrPixelsZ, NrPixelsY);
-        } else {
-          free(s);
-          return 1;
-        }
-      } else {
-        free(s);
-        return 1;
-      }
-      free(s);
-    }
-    if (strstr(finfo->name, "exchange/data/0.0.0") != NULL) {
-      dataLoc = count;
-    }
-    if (strstr(finfo->name, "exchange/dark/0.0.0") != NULL) {
-      darkLoc = count;
-    }
-    if (strstr(finfo->name, "exchange/flood/0.0.0") != NULL) {
-      floodLoc = count;
-    }
-    if (strstr(finfo->name,
-               "analysis/process/analysis_parameters/ImTransOpt/.zarray") !=
-        NULL) {
-      char *s = NULL;
-      size_t sSize;
-      ReadZarrRaw(arch, count, &s, &sSize);
-      char *ptr = strstr(s, "shape");
-      if (ptr != NULL) {
-        char *ptrt = strstr(ptr, "[");
-        char *ptr2 = strstr(ptrt, "]");
-        int loc = (int)(ptr2 - ptrt);
-        char ptr3[2048];
-        strncpy(ptr3, ptrt, loc + 1);
-        sscanf(ptr3, "%*[^0123456789]%d", &NrTransOpt);
-      } else {
-        free(s);
-        return 1;
-      }
-      printf("nImTransOpt: %d\n", NrTransOpt);
-      free(s);
-    }
-    if (strstr(finfo->name,
-               "analysis/process/analysis_parameters/ImTransOpt/0") != NULL) {
-      locImTransOpt = count;
-    }
-    if (strstr(finfo->name,
-               "measurement/process/scan_parameters/Temperature/0") != NULL) {
-      locTemp = count;
-    }
-    if (strstr(finfo->name, "measurement/process/scan_parameters/Pressure/0") !=
-        NULL) {
-      locPres = count;
-    }
-    if (strstr(finfo->name, "measurement/process/scan_parameters/I/0") !=
-        NULL) {
-      locI = count;
-    }
-    if (strstr(finfo->name, "measurement/process/scan_parameters/I0/0") !=
-        NULL) {
-      locI0 = count;
-    }
-    if (strstr(finfo->name, "measurement/process/scan_parameters/datatype/0") !=
-        NULL) {
+    } else {
       char *typeName = NULL;
       size_t typeSize;
-      if (ReadZarrRaw(arch, count, &typeName, &typeSize) >= 0 && typeName) {
+      if (ReadZarrRaw(arch, locDatatype, &typeName, &typeSize) >= 0 &&
+          typeName) {
         if (strcasecmp(typeName, "uint32") == 0) {
           bytesPerPx = 4;
           dType = 4;
@@ -1264,8 +1226,70 @@ int main(int argc, char **argv) {
         free(typeName);
       }
     }
-    count++;
   }
+  const char *shapeArrays[2] = {"exchange/dark/.zarray",
+                                "exchange/flood/.zarray"};
+  int *shapeFirstDim[2] = {&nDarks, &nFloods};
+  for (int k = 0; k < 2; k++) {
+    int locZarray = ZarrIndex_find(zidx, shapeArrays[k]);
+    if (locZarray < 0)
+      continue;
+    char *s = NULL;
+    size_t sSize;
+    ReadZarrRaw(arch, locZarray, &s, &sSize);
+    char *ptr = strstr(s, "shape");
+    if (ptr != NULL) {
+      char *ptrt = strstr(ptr, "[");
+      char *ptr2 = strstr(ptrt, "]");
+      int loc = (int)(ptr2 - ptrt);
+      char ptr3[2048];
+      strncpy(ptr3, ptrt, loc + 1);
+      if (3 == sscanf(ptr3,
+                      "%*[^0123456789]%d%*[^0123456789]%d%*[^0123456789]%d",
+                      shapeFirstDim[k], &NrPixelsZ, &NrPixelsY)) {
+        printf("%s: %d nrPixelsZ: %d nrPixelsY: %d\n",
+               k == 0 ? "nDarks" : "nFloods", *shapeFirstDim[k], NrPixelsZ,
+               NrPixelsY);
+      } else {
+        free(s);
+        return 1;
+      }
+    } else {
+      free(s);
+      return 1;
+    }
+    free(s);
+  }
+  dataLoc = ZarrIndex_find(zidx, "exchange/data/0.0.0");
+  darkLoc = ZarrIndex_find(zidx, "exchange/dark/0.0.0");
+  floodLoc = ZarrIndex_find(zidx, "exchange/flood/0.0.0");
+  int locTransOptZarray =
+      ZarrIndex_find(zidx, ZARR_ANALYSIS_PARAMS "ImTransOpt/.zarray");
+  if (locTransOptZarray >= 0) {
+    char *s = NULL;
+    size_t sSize;
+    ReadZarrRaw(arch, locTransOptZarray, &s, &sSize);
+    char *ptr = strstr(s, "shape");
+    if (ptr != NULL) {
+      char *ptrt = strstr(ptr, "[");
+      char *ptr2 = strstr(ptrt, "]");
+      int loc = (int)(ptr2 - ptrt);
+      char ptr3[2048];
+      strncpy(ptr3, ptrt, loc + 1);
+      sscanf(ptr3, "%*[^0123456789]%d", &NrTransOpt);
+    } else {
+      free(s);
+      return 1;
+    }
+    printf("nImTransOpt: %d\n", NrTransOpt);
+    free(s);
+  }
+  locImTransOpt = ZarrIndex_chunk(zidx, ZARR_ANALYSIS_PARAMS "ImTransOpt");
+  locTemp = ZarrIndex_chunk(zidx, ZARR_SCAN_PARAMS "Temperature");
+  locPres = ZarrIndex_chunk(zidx, ZARR_SCAN_PARAMS "Pressure");
+  locI = ZarrIndex_chunk(zidx, ZARR_SCAN_PARAMS "I");
+  locI0 = ZarrIndex_chunk(zidx, ZARR_SCAN_PARAMS "I0");
+  ZarrIndex_free(zidx);
   if (chunkFiles == 0)
     chunkFiles = 1;
 
@@ -1372,33 +1396,13 @@ int main(int argc, char **argv) {
   AverageDark = calloc(nPixels, sizeof(*AverageDark));
   ImageInT = malloc(nPixels * sizeof(*ImageInT));
   // printf("nFrames: %d nrPixelsZ: %d nrPixelsY: %d, dataLoc: %d\n", nFrames,
-  // NrPixelsZ, NrPixelsY,dataLoc); Now we read the size of data for each file
-  // pointer.
-  size_t *sizeArr;
-  sizeArr = calloc(nFrames * 2, sizeof(*sizeArr)); // Number StartLoc
-  size_t cntr = 0;
+  // NrPixelsZ, NrPixelsY,dataLoc);
   if (dataLoc < 0) {
     printf("Error: Missing primary data chunk 0.0.0! Cannot proceed with "
            "integrations.\n");
     zip_close(arch);
     return 1;
   }
-  printf("Reading compressed image data.\n");
-  for (iter = 0; iter < nFrames; iter++) {
-    zip_stat_index(arch, dataLoc + iter, 0, finfo);
-    sizeArr[iter * 2 + 0] = finfo->size;
-    sizeArr[iter * 2 + 1] = cntr;
-    cntr += finfo->size;
-  }
-  // allocate arr
-  char *allData;
-  allData = calloc(cntr + 1, sizeof(*allData));
-  for (iter = 0; iter < nFrames; iter++) {
-    zip_file_t *fLoc = NULL;
-    fLoc = zip_fopen_index(arch, dataLoc + iter, 0);
-    zip_fread(fLoc, &allData[sizeArr[iter * 2 + 1]], sizeArr[iter * 2 + 0]);
-    zip_fclose(fLoc);
-  }
   omeStart += skipFrame * omeStep;
   // Dark file reading from here.
   size_t pxSize = sizeof(uint16_t);
@@ -1582,8 +1586,6 @@ integration_start:
          "the file: %d\n",
          nEtaBins, nRBins, (int)nFrames);
   long long int Pos;
-  int dataPos;
-  struct data ThisVal;
   char outfn[4096];
   char outfn2[4096];
   FILE *out, *out2;
@@ -1630,6 +1632,33 @@ integration_start:
   int32_t dsz = NrPixelsY * NrPixelsZ * bytesPerPx;
   double presThis = 0, tempThis = 0, iThis = 0, i0This = 0;
   double t_integration = 0, t_0;
+  struct FramePipeline pipe;
+  double *pipeSlot = NULL;
+  int pipelined = 0;
+#ifndef FLOAT32_ACCUM
+  // FLOAT32_ACCUM keeps the AoS loop, whose accumulation it measures.
+  LoadMapCSR(resultFolder, nRBins * nEtaBins, NrPixelsY, NrPixelsZ, BC_y, BC_z,
+             GradientCorrection);
+  // Frames are only decoded here in zarr mode; the kernel benchmark needs the
+  // frame-0 image.
+  pipelined = PipelineFrames > 0 && !useParamFile && benchmarkIters <= 1;
+  if (pipelined) {
+    if (PipelineFrames > nFrames)
+      PipelineFrames = nFrames;
+    FramePipelineInit(&pipe, PipelineFrames, bigArrSize, nCPUs,
+                      (size_t)NrPixelsY * NrPixelsZ, bytesPerPx);
+    printf("Pipelining %d frames at a time over %d threads.\n",
+           PipelineFrames, nCPUs);
+  }
+#endif
+  // Compressed frames are read by a background thread a bounded window ahead
+  // of the decoder instead of buffering the whole dataset up front.
+  ZarrFrameStream *frames = NULL;
+  if (!useParamFile) {
+    frames = ZarrFrameStream_open(DataFN, dataLoc, nFrames,
+                                  pipelined ? 2 * PipelineFrames : 2);
+    check(frames == NULL, "Error: Could not stream frames from %s", DataFN);
+  }
   for (i = 0; i < nFrames; i++) {
     if (chunkFiles > 0) {
       if ((i % chunkFiles) == 0) {
@@ -1654,17 +1683,27 @@ integration_start:
       tempThis += Temperature[i];
       iThis += I[i];
       i0This = I0[i];
-      dsz = NrPixelsY * NrPixelsZ * bytesPerPx; // Reset buffer capacity
-      dsz = blosc1_decompress(&allData[sizeArr[i * 2 + 1]], locData, dsz);
-      if (dsz <= 0) {
-        printf(
-            "Error: Failed to decompress frame data at index %d! dsize: %d\n",
-            i, dsz);
-        exit(1);
-      }
-      rawToDouble(locData, ImageInT, nPixels, dType);
-      for (j = 0; j < NrPixelsY * NrPixelsZ; j++) {
-        Image[j] = (double)ImageInT[j] - AverageDark[j];
+      if (pipelined) {
+        if (i % pipe.nSlots == 0)
+          FramePipelineFill(&pipe, i, nFrames, frames, dType,
+                            bytesPerPx, NrPixelsY, NrPixelsZ, AverageDark);
+        pipeSlot = pipe.slots + (size_t)(i % pipe.nSlots) * bigArrSize;
+      } else {
+        dsz = NrPixelsY * NrPixelsZ * bytesPerPx; // Reset buffer capacity
+        const char *compressed = ZarrFrameStream_acquire(frames, i, NULL);
+        dsz = compressed == NULL ? -1
+                                 : blosc1_decompress(compressed, locData, dsz);
+        ZarrFrameStream_release(frames, i);
+        if (dsz <= 0) {
+          printf("Error: Failed to decompress frame data at index %d! dsize: "
+                 "%d\n",
+                 i, dsz);
+          exit(1);
+        }
+        rawToDouble(locData, ImageInT, nPixels, dType);
+        for (j = 0; j < NrPixelsY * NrPixelsZ; j++) {
+          Image[j] = (double)ImageInT[j] - AverageDark[j];
+        }
       }
     }
 
@@ -1687,7 +1726,11 @@ integration_start:
     }
     memset(IntArrPerFrame, 0, bigArrSize * sizeof(double));
     // Diagnostic: count mapped pixels with value -1 or -2
-    {
+    if (pipeSlot != NULL) {
+      printf("  Pixel diagnostic (mapped only): "
+             "val=-1: %ld in map; val=-2: %ld in map\n",
+             pipe.nNeg1[i % pipe.nSlots], pipe.nNeg2[i % pipe.nSlots]);
+    } else {
       long neg1_total = 0, neg2_total = 0;
       for (j = 0; j < nRBins; j++) {
         for (k = 0; k < nEtaBins; k++) {
@@ -1707,19 +1750,26 @@ integration_start:
              neg1_total, neg2_total);
     }
     t_0 = omp_get_wtime();
-#pragma omp parallel for schedule(dynamic, 64) private(j, k, l, Pos, nPixels, dataPos, Intensity,    \
-                                     totArea, ThisVal, testPos, ThisInt,       \
+#pragma omp parallel for schedule(dynamic, 64) private(j, k, l, Pos, nPixels,  \
+                                     Intensity, totArea, testPos, ThisInt,     \
                                      RMean, EtaMean)
     for (j = 0; j < nRBins; j++) {
       RMean = (RBinsLow[j] + RBinsHigh[j]) / 2;
       for (k = 0; k < nEtaBins; k++) {
         Pos = j * nEtaBins + k;
         nPixels = nPxList[2 * Pos + 0];
-        dataPos = nPxList[2 * Pos + 1];
         Intensity = 0;
         totArea = 0;
+#ifndef FLOAT32_ACCUM
+        if (pipeSlot != NULL)
+          Intensity = pipeSlot[Pos];
+        else
+          Intensity = integration_map_csr_bin(&MapCSR, Pos, Image);
+        totArea = MapCSR.areaSum[Pos];
+#else
+        int dataPos = nPxList[2 * Pos + 1];
         for (l = 0; l < nPixels; l++) {
-          ThisVal = pxList[dataPos + l];
+          struct data ThisVal = pxList[dataPos + l];
           double read_y = ThisVal.y, read_z = ThisVal.z;
           if (GradientCorrection && ThisVal.deltaR != 0.0f) {
             double dy = ThisVal.y - BC_y;
@@ -1745,6 +1795,7 @@ integration_start:
           Intensity += pixVal * ThisVal.frac;
           totArea += ThisVal.areaWeight;
         }
+#endif
         if (Intensity != 0) {
           if (Normalize == 1) {
             Intensity /= totArea;
@@ -1786,18 +1837,22 @@ integration_start:
         memset(IntArrPerFrame, 0, bigArrSize * sizeof(double));
         double bm_t0 = omp_get_wtime();
 #pragma omp parallel for schedule(dynamic, 64) private(j, k, l, Pos, nPixels,  \
-                                         dataPos, Intensity, totArea, ThisVal, \
-                                         testPos, ThisInt, RMean, EtaMean)
+                                         Intensity, totArea, testPos, ThisInt, \
+                                         RMean, EtaMean)
         for (j = 0; j < nRBins; j++) {
           RMean = (RBinsLow[j] + RBinsHigh[j]) / 2;
           for (k = 0; k < nEtaBins; k++) {
             Pos = j * nEtaBins + k;
             nPixels = nPxList[2 * Pos + 0];
-            dataPos = nPxList[2 * Pos + 1];
             Intensity = 0;
             totArea = 0;
+#ifndef FLOAT32_ACCUM
+            Intensity = integration_map_csr_bin(&MapCSR, Pos, Image);
+            totArea = MapCSR.areaSum[Pos];
+#else
+            int dataPos = nPxList[2 * Pos + 1];
             for (l = 0; l < nPixels; l++) {
-              ThisVal = pxList[dataPos + l];
+              struct data ThisVal = pxList[dataPos + l];
               double read_y = ThisVal.y, read_z = ThisVal.z;
               int iy = (int)floorf(read_y);
               int iz = (int)floorf(read_z);
@@ -1814,6 +1869,7 @@ integration_start:
               Intensity += pixVal * ThisVal.frac;
               totArea += ThisVal.areaWeight;
             }
+#endif
             if (Intensity != 0 && Normalize == 1) {
               Intensity /= totArea;
             }
@@ -2131,6 +2187,9 @@ integration_start:
     }
   }
   printf("Time for integration: %f seconds.\n", t_integration);
+  if (pipelined)
+    FramePipelineFree(&pipe);
+  ZarrFrameStream_close(frames);
   if (haveOmegas == 1) {
     hsize_t dimome[1] = {nFrames};
     H5LTmake_dataset_double(file_id, "/Omegas", 1, dimome, omeArr);
@@ -425,6 +425,7 @@ int midas_parse_params(const char *filename, MIDASConfig *cfg) {
     if (param_double(aline, "WeightFitRMSE", &cfg->WeightFitRMSE)) continue;
     if (param_int(aline, "DoDynamicReassignment", &cfg->DoDynamicReassignment)) continue;
     if (param_int(aline, "FitAllAtOnce", &cfg->FitAllAtOnce)) continue;
+    if (param_int(aline, "GrainFitSolver", &cfg->GrainFitSolver)) continue;
 
     // ── NF/Sample parameters ──
     if (param_double(aline, "ExcludePoleAngle", &cfg->MinEta)) continue;
@@ -469,6 +470,7 @@ int midas_parse_params(const char *filename, MIDASConfig *cfg) {
     if (param_double(aline, "GlobalPosition", &cfg->GlobalPosition)) continue;
     if (param_str(aline, "OutDirPath", cfg->OutDirPath, sizeof(cfg->OutDirPath))) continue;
     if (param_int(aline, "NoSaveAll", &cfg->NoSaveAll)) continue;
+    if (param_int(aline, "BinDataSoA", &cfg->BinDataSoA)) continue;
     if (param_double(aline, "GridSize", &cfg->GridSize)) continue;
     if (param_double(aline, "EdgeLength", &cfg->EdgeLength)) continue;
     if (param_int(aline, "GridPoints", &cfg->GridPoints)) continue;
@@ -219,6 +219,7 @@ typedef struct {
   double WeightMask, WeightFitRMSE;
   int    DoDynamicReassignment;
   int    FitAllAtOnce;
+  int    GrainFitSolver; // 0=Nelder-Mead (default), 1=bounded least squares
 
   // ── NF/Sample parameters ──
   double MinEta;
@@ -258,6 +259,7 @@ typedef struct {
   double GlobalPosition;
   char   OutDirPath[MAX_LINE_LENGTH];
   int    NoSaveAll;
+  int    BinDataSoA;
   double GridSize;
   double EdgeLength;
   int    GridPoints;
@@ -39,6 +39,8 @@
 /* Magic = "MAP0" in little-endian */
 #define MAP_HEADER_MAGIC 0x3050414D
 #define MAP_HEADER_VERSION 3
+/* MapCSR.bin (see IntegrationCore.h); Map.bin / nMap.bin stay at version 3 */
+#define MAP_HEADER_VERSION_CSR 4
 #define MAP_HEADER_SIZE 64
 
 #pragma pack(push, 1)
@@ -87,7 +89,8 @@ static const uint32_t mh_sha256_k[64] = {
 #define MH_SIG0(x) (MH_ROTR(x, 7) ^ MH_ROTR(x, 18) ^ ((x) >> 3))
 #define MH_SIG1(x) (MH_ROTR(x, 17) ^ MH_ROTR(x, 19) ^ ((x) >> 10))
 
-static void mh_sha256_transform(MH_SHA256_CTX *ctx, const uint8_t data[]) {
+static inline void mh_sha256_transform(MH_SHA256_CTX *ctx,
+                                       const uint8_t data[]) {
   uint32_t a, b, c, d, e, f, g, h, t1, t2, m[64];
   int i;
   for (i = 0; i < 16; ++i)
@@ -125,7 +128,7 @@ static void mh_sha256_transform(MH_SHA256_CTX *ctx, const uint8_t data[]) {
   ctx->state[7] += h;
 }
 
-static void mh_sha256_init(MH_SHA256_CTX *ctx) {
+static inline void mh_sha256_init(MH_SHA256_CTX *ctx) {
   ctx->datalen = 0;
   ctx->bitlen = 0;
   ctx->state[0] = 0x6a09e667;
@@ -138,8 +141,8 @@ static void mh_sha256_init(MH_SHA256_CTX *ctx) {
   ctx->state[7] = 0x5be0cd19;
 }
 
-static void mh_sha256_update(MH_SHA256_CTX *ctx, const uint8_t *data,
-                             size_t len) {
+static inline void mh_sha256_update(MH_SHA256_CTX *ctx, const uint8_t *data,
+                                    size_t len) {
   size_t i;
   for (i = 0; i < len; ++i) {
     ctx->data[ctx->datalen] = data[i];
@@ -152,7 +155,7 @@ static void mh_sha256_update(MH_SHA256_CTX *ctx, const uint8_t *data,
   }
 }
 
-static void mh_sha256_final(MH_SHA256_CTX *ctx, uint8_t hash[32]) {
+static inline void mh_sha256_final(MH_SHA256_CTX *ctx, uint8_t hash[32]) {
   uint32_t i = ctx->datalen;
   if (i < 56) {
     ctx->data[i++] = 0x80;
@@ -197,15 +200,14 @@ static void mh_sha256_final(MH_SHA256_CTX *ctx, uint8_t hash[32]) {
  * qMode: 0 = equal-R bins, 1 = equal-Q bins.
  * Wavelength: in Å (only used and hashed when qMode=1).
  */
-static void map_header_compute(struct MapHeader *hdr, double Lsd, double yCen,
-                               double zCen, double pxY, double pxZ, double tx,
-                               double ty, double tz, double p0, double p1,
-                               double p2, double p3, double p4, double p6, double RhoD,
-                               double RBinSize, double EtaBinSize, double RMin,
-                               double RMax, double EtaMin, double EtaMax,
-                               int NrPixelsY, int NrPixelsZ, int NrTransOpt,
-                               const int TransOpt[10], int qMode,
-                               double Wavelength) {
+static inline void
+map_header_compute(struct MapHeader *hdr, double Lsd, double yCen, double zCen,
+                   double pxY, double pxZ, double tx, double ty, double tz,
+                   double p0, double p1, double p2, double p3, double p4,
+                   double p6, double RhoD, double RBinSize, double EtaBinSize,
+                   double RMin, double RMax, double EtaMin, double EtaMax,
+                   int NrPixelsY, int NrPixelsZ, int NrTransOpt,
+                   const int TransOpt[10], int qMode, double Wavelength) {
   memset(hdr, 0, sizeof(*hdr));
   hdr->magic = MAP_HEADER_MAGIC;
   hdr->version = MAP_HEADER_VERSION;
@@ -243,7 +245,7 @@ static void map_header_compute(struct MapHeader *hdr, double Lsd, double yCen,
  * Write header to an open FILE* (must be called before writing data).
  * Returns 0 on success, -1 on error.
  */
-static int map_header_write(FILE *f, const struct MapHeader *hdr) {
+static inline int map_header_write(FILE *f, const struct MapHeader *hdr) {
   if (fwrite(hdr, MAP_HEADER_SIZE, 1, f) != 1)
     return -1;
   return 0;
@@ -257,7 +259,7 @@ static int map_header_write(FILE *f, const struct MapHeader *hdr) {
  *
  * Note: this uses pread so the file offset is unchanged.
  */
-static int map_header_read_fd(int fd, struct MapHeader *hdr) {
+static inline int map_header_read_fd(int fd, struct MapHeader *hdr) {
   ssize_t n = pread(fd, hdr, MAP_HEADER_SIZE, 0);
   if (n != MAP_HEADER_SIZE)
     return 0;
@@ -270,16 +272,16 @@ static int map_header_read_fd(int fd, struct MapHeader *hdr) {
  * Validate that two headers have matching parameter hashes.
  * Returns 1 if match, 0 if mismatch.
  */
-static int map_header_validate(const struct MapHeader *file_hdr,
-                               const struct MapHeader *expected) {
+static inline int map_header_validate(const struct MapHeader *file_hdr,
+                                      const struct MapHeader *expected) {
   return memcmp(file_hdr->param_hash, expected->param_hash, 32) == 0;
 }
 
 /**
  * Print header info to stdout for diagnostics.
  */
-static void map_header_print(const char *filename,
-                             const struct MapHeader *hdr) {
+static inline void map_header_print(const char *filename,
+                                    const struct MapHeader *hdr) {
   printf("  %s header: magic=0x%08X ver=%u hash=", filename, hdr->magic,
          hdr->version);
   for (int i = 0; i < 8; i++)
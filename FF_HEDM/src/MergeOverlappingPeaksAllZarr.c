@@ -29,6 +29,9 @@
 #include <sys/types.h>
 #include <time.h>
 #include <zip.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 
 #define deg2rad (M_PI / 180.0)
 #define rad2deg (180.0 / M_PI)
@@ -472,14 +475,14 @@ static int shash_find_nearest(SpatialHash *sh, double qy, double qz,
       uint32_t h = shash_key(cx0 + dx, cy0 + dy);
       for (SHashEntry *e = sh->buckets[h]; e != NULL; e = e->next) {
         int j = e->idx;
-        if (skipFlags && skipFlags[j])
-          continue;
         // Early reject: peaks on different rings can't match
         if (radiusCol >= 0 &&
             fabs(PeakArray[j][radiusCol] - qRadius) > radiusTol)
           continue;
         double d = CalcNorm2(PeakArray[j][yCol] - qy, PeakArray[j][zCol] - qz);
-        if (d < best) {
+        // skipFlags is only read for candidates, so concurrent merge groups
+        // never read each other's flags
+        if (d < best && !(skipFlags && skipFlags[j])) {
           best = d;
           bestIdx = j;
         }
@@ -490,6 +493,178 @@ static int shash_find_nearest(SpatialHash *sh, double qy, double qz,
   return bestIdx;
 }
 
+// --- Parallel merge support ---
+
+// Peaks of one frame, read and sorted ahead of the (sequential) merge.
+typedef struct {
+  int nSpots;      // rows kept by ReadSortFiles
+  double **ids;    // nSpots rows of N_PS_COLS, sorted by eta
+  double *idsFlat; // backing store of ids
+  int nPx;         // entries in px
+  PeakPixels *px;  // per-peak pixel lists, NULL without pixel overlap
+} MergeFrame;
+
+// Upper bound on the memory of the frames read ahead in one batch.
+#define MERGE_BATCH_BYTES (1LL << 30)
+
+static int MergeFrame_read(MergeFrame *f, const ConsolidatedPeakReader *psReader,
+                           const ConsolidatedPixelReader *pxReader,
+                           int frameIdx) {
+  memset(f, 0, sizeof(*f));
+  int n = psReader->nPeaks[frameIdx];
+  if (n > nOverlapsMaxPerImage)
+    n = nOverlapsMaxPerImage;
+  int nAlloc = n > 0 ? n : 1;
+  struct InputData *myData = malloc(nAlloc * sizeof(*myData));
+  f->idsFlat = malloc((size_t)nAlloc * N_PS_COLS * sizeof(double));
+  f->ids = malloc(nAlloc * sizeof(*f->ids));
+  if (!myData || !f->idsFlat || !f->ids) {
+    free(myData);
+    return -1;
+  }
+  for (int i = 0; i < nAlloc; i++)
+    f->ids[i] = f->idsFlat + (size_t)i * N_PS_COLS;
+  f->nSpots = ReadSortFiles(psReader, frameIdx, f->ids, myData);
+  free(myData);
+  if (pxReader != NULL) {
+    int nPxPeaks = pxReader->nPeaks[frameIdx];
+    f->px = calloc(nPxPeaks > 0 ? nPxPeaks : 1, sizeof(PeakPixels));
+    if (!f->px)
+      return -1;
+    int pxNrPixels = 0;
+    f->nPx = ReadPixelFile(pxReader, frameIdx, f->px, &pxNrPixels);
+    if (f->nPx < 0)
+      f->nPx = 0;
+  }
+  return 0;
+}
+
+static void MergeFrame_free(MergeFrame *f) {
+  free(f->ids);
+  free(f->idsFlat);
+  if (f->px) {
+    FreePeakPixels(f->px, f->nPx);
+    free(f->px);
+  }
+  memset(f, 0, sizeof(*f));
+}
+
+// Read frames [firstIdx, firstIdx + count) in parallel, count chosen so the
+// batch stays within MERGE_BATCH_BYTES (at least one frame) and at most
+// maxFrames.  Returns count, or -1 if a frame could not be read.
+static int ReadFrameBatch(MergeFrame *batch, int maxFrames, int firstIdx,
+                          int lastIdx, const ConsolidatedPeakReader *psReader,
+                          const ConsolidatedPixelReader *pxReader) {
+  int count = 0;
+  long long bytes = 0;
+  while (count < maxFrames && firstIdx + count <= lastIdx) {
+    long long frameBytes = (long long)psReader->nPeaks[firstIdx + count] *
+                           (N_PS_COLS * sizeof(double) + sizeof(struct InputData));
+    if (count > 0 && bytes + frameBytes > MERGE_BATCH_BYTES)
+      break;
+    bytes += frameBytes;
+    count++;
+  }
+  int failed = 0;
+#pragma omp parallel for schedule(dynamic) reduction(| : failed)
+  for (int b = 0; b < count; b++)
+    failed |= MergeFrame_read(&batch[b], psReader, pxReader, firstIdx + b) != 0;
+  return failed ? -1 : count;
+}
+
+static inline int MergeRoot(int *parent, int i) {
+  while (parent[i] != i) {
+    parent[i] = parent[parent[i]];
+    i = parent[i];
+  }
+  return i;
+}
+
+// Distance merge of one frame.  The result is the serial greedy pass over
+// the current peaks in index order: current i merges with its nearest free
+// new peak if no free current peak is closer to that new peak.  Current
+// peaks only interact through a shared candidate (a new peak within
+// `radius` on the same ring), so peaks are grouped with union-find over
+// shared candidates, and the groups -- spatial tiles sized by the peak
+// clusters themselves -- run in parallel, each in index order.  matchOf[i]
+// receives the merged new peak or -1; the merge flags are set as before.
+// The work arrays hold nSpots entries, groupCount and fill nSpots + 1.
+static void MatchByDistance(double **CurrentIDs, int nSpots, double **NewIDs,
+                            int nSpotsNew, SpatialHash *shCur,
+                            SpatialHash *shNew, double radius,
+                            int *TempIDsCurrent, int *TempIDsNew, int *matchOf,
+                            int *parent, int *groupStart, int *groupMembers,
+                            int *groupCount, int *fill) {
+  for (int i = 0; i < nSpots; i++)
+    parent[i] = i;
+  double cs = shCur->cellSize;
+  for (int j = 0; j < nSpotsNew; j++) {
+    double qy = NewIDs[j][3], qz = NewIDs[j][4], qr = NewIDs[j][6];
+    int cx0 = (int)floor(qy / cs), cy0 = (int)floor(qz / cs);
+    int first = -1;
+    for (int dx = -1; dx <= 1; dx++) {
+      for (int dy = -1; dy <= 1; dy++) {
+        uint32_t h = shash_key(cx0 + dx, cy0 + dy);
+        for (SHashEntry *e = shCur->buckets[h]; e != NULL; e = e->next) {
+          int i = e->idx;
+          if (fabs(CurrentIDs[i][6] - qr) > radius)
+            continue;
+          if (CalcNorm2(CurrentIDs[i][8] - qy, CurrentIDs[i][9] - qz) >= radius)
+            continue;
+          if (first < 0) {
+            first = i;
+            continue;
+          }
+          int a = MergeRoot(parent, first), b = MergeRoot(parent, i);
+          if (a != b)
+            parent[a > b ? a : b] = a < b ? a : b;
+        }
+      }
+    }
+  }
+  // Counting sort of the current peaks by group; members stay in index
+  // order and groups are numbered by their lowest member.
+  int nGroups = 0;
+  for (int i = 0; i < nSpots; i++) {
+    int r = MergeRoot(parent, i);
+    parent[i] = r;
+    if (r == i)
+      groupStart[i] = nGroups++;
+  }
+  memset(groupCount, 0, (nGroups + 1) * sizeof(int));
+  for (int i = 0; i < nSpots; i++)
+    groupCount[groupStart[parent[i]] + 1]++;
+  for (int g = 0; g < nGroups; g++)
+    groupCount[g + 1] += groupCount[g];
+  memcpy(fill, groupCount, (nGroups + 1) * sizeof(int));
+  for (int i = 0; i < nSpots; i++)
+    groupMembers[fill[groupStart[parent[i]]]++] = i;
+
+#pragma omp parallel for schedule(dynamic, 64)
+  for (int g = 0; g < nGroups; g++) {
+    for (int m = groupCount[g]; m < groupCount[g + 1]; m++) {
+      int i = groupMembers[m];
+      double minLen;
+      matchOf[i] = -1;
+      int BestID = shash_find_nearest(shNew, CurrentIDs[i][8], CurrentIDs[i][9],
+                                      radius, NewIDs, 3, 4, 6, CurrentIDs[i][6],
+                                      radius, TempIDsNew, &minLen);
+      if (BestID < 0)
+        continue;
+      // Mutual-best check: is current peak i the closest to BestID?
+      double revDist;
+      int revBest = shash_find_nearest(
+          shCur, NewIDs[BestID][3], NewIDs[BestID][4], minLen, CurrentIDs, 8,
+          9, 6, NewIDs[BestID][6], radius, TempIDsCurrent, &revDist);
+      if (revBest >= 0 && revBest != i)
+        continue; // another current peak is closer
+      matchOf[i] = BestID;
+      TempIDsCurrent[i] = 1;
+      TempIDsNew[BestID] = 1;
+    }
+  }
+}
+
 int main(int argc, char *argv[]) {
   printf("Version: %s\n", MIDAS_VERSION_STRING);
   if (argc < 2) {
@@ -602,13 +777,9 @@ int main(int argc, char *argv[]) {
   int FileNr = StartNr;
   int nSpots, nSpotsNew;
   double **NewIDs, **CurrentIDs, **TempIDs;
-  NewIDs = allocMatrix(nOverlapsMaxPerImage, N_PS_COLS);
   CurrentIDs = allocMatrix(nOverlapsMaxPerImage, 19);
   TempIDs = allocMatrix(nOverlapsMaxPerImage, 19);
 
-  // Pre-allocate reusable buffer for ReadSortFiles (avoids malloc/free per frame)
-  struct InputData *MyData = malloc(nOverlapsMaxPerImage * sizeof(*MyData));
-
   // Pool allocator for ConstituentNode (avoids ~766K individual mallocs)
   // Max nodes = nOverlapsMaxPerImage * (EndNr - StartNr + 1) but cap at 2M
   int cnPoolCap = 2000000;
@@ -648,8 +819,17 @@ int main(int argc, char *argv[]) {
     }
   }
 
-  nSpots = ReadSortFiles(&psReader, FileNr - 1, NewIDs,
-                         MyData);
+  // Frames are read, sorted and their pixel lists decoded in parallel
+  // batches ahead of the merge, which is sequential across frames.
+  const ConsolidatedPixelReader *pxRead =
+      (UsePixelOverlap && NrPixels > 0 && hasPxReader) ? &pxReader : NULL;
+  MergeFrame firstFrame;
+  if (MergeFrame_read(&firstFrame, &psReader, pxRead, FileNr - 1) != 0) {
+    printf("Error: Could not read the peaks of frame %d.\n", FileNr);
+    return 1;
+  }
+  NewIDs = firstFrame.ids;
+  nSpots = firstFrame.nSpots;
   for (i = 0; i < nSpots; i++) {
     CurrentIDs[i][0] = NewIDs[i][0];                // SpotID
     CurrentIDs[i][1] = NewIDs[i][1];                // IntegratedIntensity
@@ -682,8 +862,7 @@ int main(int argc, char *argv[]) {
   FILE *OutFile;
   OutFile = fopen(OutFileName, "w");
   fprintf(OutFile, "%s", header);
-  double diffLen, yThis, zThis, minLen, yFwd, zFwd, diffLenFwd;
-  int *TempIDsCurrent, *TempIDsNew, BestID, IDFound;
+  int *TempIDsCurrent, *TempIDsNew, BestID;
   TempIDsCurrent = malloc(nOverlapsMaxPerImage * sizeof(*TempIDsCurrent));
   TempIDsNew = malloc(nOverlapsMaxPerImage * sizeof(*TempIDsNew));
   memset(TempIDsCurrent, 0, nOverlapsMaxPerImage * sizeof(*TempIDsCurrent));
@@ -691,28 +870,39 @@ int main(int argc, char *argv[]) {
 
   // Pixel-overlap resources (allocated only when UsePixelOverlap is set)
   int *labelMap = NULL;
-  PeakPixels *curPixels = NULL;
+  PeakPixels *curPixels = NULL; // taken over from the frame that owns them
   PeakPixels *newPixels = NULL;
   int nCurPx = 0, nNewPx = 0;
   if (UsePixelOverlap && NrPixels > 0) {
     labelMap = calloc((size_t)NrPixels * NrPixels, sizeof(int));
-    curPixels = calloc(nOverlapsMaxPerImage, sizeof(PeakPixels));
-    newPixels = calloc(nOverlapsMaxPerImage, sizeof(PeakPixels));
-    if (!labelMap || !curPixels || !newPixels) {
+    if (!labelMap) {
       printf("Error: Could not allocate pixel-overlap resources.\n");
       return 1;
     }
-    // Read first frame's pixel data
-    int pxNrPixels = 0;
-    if (hasPxReader) {
-      nCurPx = ReadPixelFile(&pxReader, StartNr - 1, curPixels,
-                             &pxNrPixels);
-    } else {
-      nCurPx = 0;
-    }
+    // First frame's pixel data
+    curPixels = firstFrame.px;
+    nCurPx = firstFrame.nPx;
+    firstFrame.px = NULL;
     printf("Pixel-overlap mode enabled. Label map size: %d x %d\n", NrPixels,
            NrPixels);
   }
+  int *matchOf = malloc(nOverlapsMaxPerImage * sizeof(*matchOf));
+  int *groupParent = malloc(nOverlapsMaxPerImage * sizeof(*groupParent));
+  int *groupStart = malloc(nOverlapsMaxPerImage * sizeof(*groupStart));
+  int *groupMembers = malloc(nOverlapsMaxPerImage * sizeof(*groupMembers));
+  int *groupCount = malloc((nOverlapsMaxPerImage + 1) * sizeof(*groupCount));
+  int *groupFill = malloc((nOverlapsMaxPerImage + 1) * sizeof(*groupFill));
+  int maxBatch = 1;
+#ifdef _OPENMP
+  maxBatch = 4 * omp_get_max_threads();
+#endif
+  MergeFrame *batch = calloc(maxBatch, sizeof(*batch));
+  int batchFirst = 0, batchCount = 0;
+  if (!matchOf || !groupParent || !groupStart || !groupMembers ||
+      !groupCount || !groupFill || !batch) {
+    printf("Error: Could not allocate merge buffers.\n");
+    return 1;
+  }
 
   // Initialize spatial hashes for distance-based merge
   SpatialHash shNew, shCur;
@@ -736,19 +926,25 @@ int main(int argc, char *argv[]) {
     }
   } else { // If there are multiple files:
     for (FileNr = (StartNr + 1); FileNr <= EndNr; FileNr++) {
-      nSpotsNew =
-          ReadSortFiles(&psReader, FileNr - 1, NewIDs,
-                        MyData);
+      if (FileNr - 1 >= batchFirst + batchCount) {
+        batchFirst = FileNr - 1;
+        batchCount = ReadFrameBatch(batch, maxBatch, batchFirst, EndNr - 1,
+                                    &psReader, pxRead);
+        if (batchCount < 0) {
+          printf("Error: Could not read the peaks of frames from %d.\n",
+                 FileNr);
+          return 1;
+        }
+      }
+      MergeFrame *frame = &batch[FileNr - 1 - batchFirst];
+      NewIDs = frame->ids;
+      nSpotsNew = frame->nSpots;
       fflush(stdout);
 
-      // Read new frame pixel data if in pixel-overlap mode
+      // New frame pixel data if in pixel-overlap mode
       if (UsePixelOverlap && labelMap && hasPxReader) {
-        int pxNrPixels = 0;
-        FreePeakPixels(newPixels, nNewPx);
-        nNewPx = ReadPixelFile(&pxReader, FileNr - 1,
-                               newPixels, &pxNrPixels);
-        if (nNewPx < 0)
-          nNewPx = 0;
+        newPixels = frame->px;
+        nNewPx = frame->nPx;
       }
 
       if (UsePixelOverlap && labelMap && nCurPx > 0 && nNewPx > 0) {
@@ -756,46 +952,45 @@ int main(int argc, char *argv[]) {
         // Build label map from current frame's pixel data
         BuildLabelMap(labelMap, NrPixels, curPixels, nCurPx);
 
-        // Forward pass: for each new peak, find best current peak
+        // Forward pass: for each new peak, find best current peak.  The
+        // label map is only read here, so new peaks run in parallel.
         int *newToCur =
             calloc(nSpotsNew, sizeof(int)); // 0-based current idx + 1, or 0
         int *newToCurCount = calloc(nSpotsNew, sizeof(int));
-        for (j = 0; j < nSpotsNew; j++) {
-          if (TempIDsNew[j] == 1)
-            continue;
-          if (j < nNewPx) {
-            int overlapCount = 0;
-            int bestCurIdx = FindBestOverlap(labelMap, NrPixels, &newPixels[j],
-                                             &overlapCount);
-            if (bestCurIdx >= 0 && bestCurIdx < nSpots) {
-              newToCur[j] = bestCurIdx + 1; // store 1-based
-              newToCurCount[j] = overlapCount;
-            }
+        int nFwd = nSpotsNew < nNewPx ? nSpotsNew : nNewPx;
+#pragma omp parallel for schedule(dynamic, 256)
+        for (int jn = 0; jn < nFwd; jn++) {
+          int overlapCount = 0;
+          int bestCurIdx = FindBestOverlap(labelMap, NrPixels, &newPixels[jn],
+                                           &overlapCount);
+          if (bestCurIdx >= 0 && bestCurIdx < nSpots) {
+            newToCur[jn] = bestCurIdx + 1; // store 1-based
+            newToCurCount[jn] = overlapCount;
           }
         }
 
         // Clear current label map
         ClearLabelMap(labelMap, NrPixels, curPixels, nCurPx);
 
-        // For each current peak, find the best new peak that mapped to it
+        // For each current peak, the new peak with the largest overlap among
+        // those that mapped to it (lowest index on ties), in one pass.
+        for (i = 0; i < nSpots; i++)
+          matchOf[i] = -1;
+        for (j = 0; j < nSpotsNew; j++) {
+          if (newToCur[j] == 0)
+            continue;
+          int c = newToCur[j] - 1;
+          if (matchOf[c] < 0 || newToCurCount[j] > newToCurCount[matchOf[c]])
+            matchOf[c] = j;
+        }
         for (i = 0; i < nSpots; i++) {
-          BestID = -1;
-          int bestOverlap = 0;
-          for (j = 0; j < nSpotsNew; j++) {
-            if (TempIDsNew[j] == 1)
-              continue;
-            if (newToCur[j] == i + 1 && newToCurCount[j] > bestOverlap) {
-              bestOverlap = newToCurCount[j];
-              BestID = j;
-            }
-          }
+          BestID = matchOf[i];
           if (BestID >= 0) {
             // Verify mutual best: is current peak i the best match for new peak
             // BestID? We've already established that new peak BestID's best
             // current is i. Now check that no other new peak with a higher
             // overlap also chose i. Since we picked the new peak with the
             // highest overlap for i, this IS the mutual best.
-            IDFound = 1;
             TempIDsCurrent[i] = 1;
             TempIDsNew[BestID] = 1;
             CurrentIDs[i][1] += NewIDs[BestID][1];
@@ -851,33 +1046,13 @@ int main(int argc, char *argv[]) {
           shash_insert(&shCur, CurrentIDs[i][8], CurrentIDs[i][9], i);
         }
 
+        MatchByDistance(CurrentIDs, nSpots, NewIDs, nSpotsNew, &shCur, &shNew,
+                        MarginOmegaOverlap, TempIDsCurrent, TempIDsNew,
+                        matchOf, groupParent, groupStart, groupMembers,
+                        groupCount, groupFill);
         for (i = 0; i < nSpots; i++) {
-          IDFound = 0;
-          yThis = CurrentIDs[i][8];
-          zThis = CurrentIDs[i][9];
-          // Forward: find nearest new peak within MarginOmegaOverlap
-          // Also filter by ring radius (col 6) to avoid cross-ring matches
-          double rThis = CurrentIDs[i][6]; // Radius of current peak
-          BestID = shash_find_nearest(&shNew, yThis, zThis, MarginOmegaOverlap,
-                                      NewIDs, 3, 4, 6, rThis,
-                                      MarginOmegaOverlap, TempIDsNew, &minLen);
-          if (BestID >= 0) {
-            IDFound = 1;
-            // Mutual-best check: is current peak i the closest to BestID?
-            yFwd = NewIDs[BestID][3];
-            zFwd = NewIDs[BestID][4];
-            double rFwd = NewIDs[BestID][6];
-            double revDist;
-            int revBest = shash_find_nearest(
-                &shCur, yFwd, zFwd, minLen, CurrentIDs, 8, 9, 6, rFwd,
-                MarginOmegaOverlap, TempIDsCurrent, &revDist);
-            if (revBest >= 0 && revBest != i) {
-              IDFound = 0; // another current peak is closer
-            }
-          }
-          if (IDFound == 1) { // Mutual best pair found — merge
-            TempIDsCurrent[i] = 1;
-            TempIDsNew[BestID] = 1;
+          BestID = matchOf[i];
+          if (BestID >= 0) { // Mutual best pair found — merge
             CurrentIDs[i][1] += NewIDs[BestID][1];
             CurrentIDs[i][2] += (NewIDs[BestID][2] * NewIDs[BestID][1]);
             CurrentIDs[i][3] += (NewIDs[BestID][3] * NewIDs[BestID][1]);
@@ -1025,14 +1200,18 @@ int main(int argc, char *argv[]) {
 
       // Swap pixel data: new -> current for next iteration
       if (UsePixelOverlap && labelMap) {
-        // Free old current pixels, swap in new
-        FreePeakPixels(curPixels, nCurPx);
-        PeakPixels *tmpPP = curPixels;
-        curPixels = newPixels;
-        newPixels = tmpPP;
-        nCurPx = nNewPx;
+        // Free old current pixels, take over the new frame's
+        if (curPixels) {
+          FreePeakPixels(curPixels, nCurPx);
+          free(curPixels);
+        }
+        curPixels = frame->px;
+        nCurPx = frame->nPx;
+        frame->px = NULL;
+        newPixels = NULL;
         nNewPx = 0;
       }
+      MergeFrame_free(frame);
     }
   }
   // Final flush of peaks that were never merged with a later frame (the
@@ -1066,7 +1245,14 @@ int main(int argc, char *argv[]) {
   printf("Total spots: %d\n", SpotIDNr - 1);
   fclose(MergeMapFile);
   printf("MergeMap written to: %s\n", MergeMapFileName);
-  FreeMemMatrix(NewIDs, nOverlapsMaxPerImage);
+  MergeFrame_free(&firstFrame);
+  free(batch);
+  free(matchOf);
+  free(groupParent);
+  free(groupStart);
+  free(groupMembers);
+  free(groupCount);
+  free(groupFill);
   FreeMemMatrix(CurrentIDs, nOverlapsMaxPerImage);
   FreeMemMatrix(TempIDs, nOverlapsMaxPerImage);
   free(TempIDsCurrent);
@@ -1074,7 +1260,6 @@ int main(int argc, char *argv[]) {
   shash_free(&shNew);
   shash_free(&shCur);
   free(cnPool);
-  free(MyData);
   free(constituents);
   free(tmpConstituents);
   // Free pixel-overlap resources
@@ -1082,10 +1267,6 @@ int main(int argc, char *argv[]) {
     FreePeakPixels(curPixels, nCurPx);
     free(curPixels);
   }
-  if (newPixels) {
-    FreePeakPixels(newPixels, nNewPx);
-    free(newPixels);
-  }
   free(labelMap);
   // Free consolidated readers
   ConsolidatedPeakReader_close(&psReader);
@@ -0,0 +1,166 @@
+/**
+ * PeakFit2DLM.h - Bounded Levenberg-Marquardt fit of 2D pseudo-Voigt peaks
+ *
+ * Alternative to the Nelder-Mead fit in PeaksFittingOMPZarrRefactor.c.  It
+ * minimizes the same objective, sum over pixels of (bg + sum_j f_j - z)^2,
+ * with the same parameter layout and bounds, but uses analytic derivatives
+ * of the model so each iteration costs one pass over the pixels instead of
+ * the hundreds of objective evaluations Nelder-Mead needs for a multi-peak
+ * region.
+ *
+ * Parameters (n = 1 + 8 * nPeaks):
+ *   x[0]           background
+ *   x[1 + 8j + 0]  Imax       x[1 + 8j + 4]  sigmaGR
+ *   x[1 + 8j + 1]  R          x[1 + 8j + 5]  sigmaLR
+ *   x[1 + 8j + 2]  Eta        x[1 + 8j + 6]  sigmaGEta
+ *   x[1 + 8j + 3]  Mu         x[1 + 8j + 7]  sigmaLEta
+ *
+ * Model of peak j at pixel (r, e), dR = r - R, dE = e - Eta:
+ *   L = 1 / ((1 + dR^2/sLR^2) (1 + dE^2/sLEta^2))
+ *   G = exp(-(dR^2/sGR^2 + dE^2/sGEta^2) / 2)
+ *   f = Imax (Mu L + (1 - Mu) G)
+ *
+ * The iteration, damping and bound handling are BoundedLM.h's; this file
+ * supplies the model's normal equations and cost.
+ *
+ * All scratch memory comes from a caller-owned buffer of
+ * PVoigtLM_workspaceDoubles(nPeaks) doubles, so a fit does not allocate.
+ */
+
+#ifndef PEAK_FIT_2D_LM_H
+#define PEAK_FIT_2D_LM_H
+
+#include "BoundedLM.h"
+#include <math.h>
+#include <stddef.h>
+#include <string.h>
+
+#define PVOIGT_LM_MAX_ITER 200
+
+/* Return codes */
+#define PVOIGT_LM_CONVERGED BOUNDED_LM_CONVERGED
+#define PVOIGT_LM_MAXITER BOUNDED_LM_MAXITER
+#define PVOIGT_LM_STALLED BOUNDED_LM_STALLED
+
+static inline size_t PVoigtLM_workspaceDoubles(int nPeaks) {
+  int n = 1 + 8 * nPeaks;
+  /* BoundedLM workspace plus one Jacobian row */
+  return BoundedLM_workspaceDoubles(n) + (size_t)n;
+}
+
+/**
+ * Residual sum of squares at x.
+ */
+static inline double PVoigtLM_cost(int nPeaks, const double *x, int nPx,
+                                   const double *Rs, const double *Etas,
+                                   const double *z) {
+  double cost = 0;
+  for (int i = 0; i < nPx; i++) {
+    double model = x[0];
+    for (int j = 0; j < nPeaks; j++) {
+      const double *p = x + 1 + 8 * j;
+      double dR = Rs[i] - p[1], dE = Etas[i] - p[2];
+      double R2 = dR * dR, E2 = dE * dE;
+      double L = 1.0 / ((R2 / (p[5] * p[5]) + 1.0) *
+                        (E2 / (p[7] * p[7]) + 1.0));
+      double G = exp(-0.5 * (R2 / (p[4] * p[4]) + E2 / (p[6] * p[6])));
+      model += p[0] * (p[3] * L + (1 - p[3]) * G);
+    }
+    double d = model - z[i];
+    cost += d * d;
+  }
+  return cost;
+}
+
+/**
+ * Accumulate J^T J and J^T r at x.  Returns the cost.
+ */
+static inline double PVoigtLM_normalEquations(int nPeaks, const double *x,
+                                              int nPx, const double *Rs,
+                                              const double *Etas,
+                                              const double *z, double *JtJ,
+                                              double *Jtr, double *row) {
+  int n = 1 + 8 * nPeaks;
+  memset(JtJ, 0, (size_t)n * n * sizeof(double));
+  memset(Jtr, 0, (size_t)n * sizeof(double));
+  double cost = 0;
+  for (int i = 0; i < nPx; i++) {
+    double model = x[0];
+    row[0] = 1.0;
+    for (int j = 0; j < nPeaks; j++) {
+      const double *p = x + 1 + 8 * j;
+      double *d = row + 1 + 8 * j;
+      double I = p[0], mu = p[3];
+      double dR = Rs[i] - p[1], dE = Etas[i] - p[2];
+      double R2 = dR * dR, E2 = dE * dE;
+      double iGR2 = 1.0 / (p[4] * p[4]), iLR2 = 1.0 / (p[5] * p[5]);
+      double iGE2 = 1.0 / (p[6] * p[6]), iLE2 = 1.0 / (p[7] * p[7]);
+      double aR = R2 * iLR2 + 1.0, aE = E2 * iLE2 + 1.0;
+      double L = 1.0 / (aR * aE);
+      double G = exp(-0.5 * (R2 * iGR2 + E2 * iGE2));
+      double IL = I * mu * L, IG = I * (1 - mu) * G;
+      model += IL + IG;
+      d[0] = mu * L + (1 - mu) * G;
+      d[1] = 2.0 * IL * dR * iLR2 / aR + IG * dR * iGR2;
+      d[2] = 2.0 * IL * dE * iLE2 / aE + IG * dE * iGE2;
+      d[3] = I * (L - G);
+      d[4] = IG * R2 * iGR2 / p[4];
+      d[5] = 2.0 * IL * R2 * iLR2 / (aR * p[5]);
+      d[6] = IG * E2 * iGE2 / p[6];
+      d[7] = 2.0 * IL * E2 * iLE2 / (aE * p[7]);
+    }
+    double r = model - z[i];
+    cost += r * r;
+    for (int a = 0; a < n; a++) {
+      double ra = row[a];
+      Jtr[a] += ra * r;
+      double *JtJa = JtJ + (size_t)a * n;
+      for (int b = 0; b <= a; b++)
+        JtJa[b] += ra * row[b];
+    }
+  }
+  for (int a = 0; a < n; a++)
+    for (int b = 0; b < a; b++)
+      JtJ[(size_t)b * n + a] = JtJ[(size_t)a * n + b];
+  return cost;
+}
+
+typedef struct {
+  int nPeaks, nPx;
+  const double *Rs, *Etas, *z;
+  double *row;
+} PVoigtLM_problem;
+
+static inline double PVoigtLM_normalCb(int n, const double *x, double *JtJ,
+                                       double *Jtr, void *data) {
+  (void)n;
+  PVoigtLM_problem *p = (PVoigtLM_problem *)data;
+  return PVoigtLM_normalEquations(p->nPeaks, x, p->nPx, p->Rs, p->Etas, p->z,
+                                  JtJ, Jtr, p->row);
+}
+
+static inline double PVoigtLM_costCb(int n, const double *x, void *data) {
+  (void)n;
+  PVoigtLM_problem *p = (PVoigtLM_problem *)data;
+  return PVoigtLM_cost(p->nPeaks, x, p->nPx, p->Rs, p->Etas, p->z);
+}
+
+/**
+ * Fit x (in/out, inside [xl, xu]) to the pixels.
+ * @param work  PVoigtLM_workspaceDoubles(nPeaks) doubles
+ * @param minf  output: final residual sum of squares
+ * @return PVOIGT_LM_CONVERGED, PVOIGT_LM_MAXITER or PVOIGT_LM_STALLED
+ */
+static inline int PVoigtLM_fit(int nPeaks, double *x, const double *xl,
+                               const double *xu, int nPx, const double *Rs,
+                               const double *Etas, const double *z,
+                               double *work, double *minf) {
+  int n = 1 + 8 * nPeaks;
+  PVoigtLM_problem p = {nPeaks, nPx, Rs, Etas, z,
+                        work + BoundedLM_workspaceDoubles(n)};
+  return BoundedLM_minimize(n, x, xl, xu, PVOIGT_LM_MAX_ITER,
+                            PVoigtLM_normalCb, PVoigtLM_costCb, &p, work, minf,
+                            NULL);
+}
+
+#endif /* PEAK_FIT_2D_LM_H */
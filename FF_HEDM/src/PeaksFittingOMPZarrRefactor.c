@@ -14,6 +14,9 @@
 #include "DetectorGeometry.h"
 #include "ZarrReader.h"
 #include "PeaksFittingConsolidatedIO.h"
+#include "PeakFit2DLM.h"
+#include "FrameArena.h"
+#include "GeometryLUT.h"
 #include "midas_version.h"
 #include <blosc2.h>
 #include <ctype.h>
@@ -43,6 +46,8 @@
 #include "MIDAS_Limits.h"
 #define MAXNHKLS MAX_N_HKLS
 #define MAX_OVERLAPS_PER_IMAGE 10000
+#define FRAME_STREAM_WINDOW_PER_THREAD 2 // compressed frames kept in flight
+#define LM_MAX_PEAKS 32 // larger regions fall back to Nelder-Mead
 
 static DGResidualCorr g_residualCorr = {NULL, 0, 0};
 #define DEFAULT_WIDTH 1000
@@ -167,6 +172,8 @@ typedef struct {
   double *Thresholds;
   int doPeakFit;
   int localMaximaOnly;
+  int peakFitSolver; // 0: Nelder-Mead, 1: Levenberg-Marquardt (PeakFit2DLM.h)
+  char *geometryLUTDir; // cache directory for GeometryLUT.h, NULL = disabled
 } AnalysisParams;
 
 // Structure for peak info
@@ -202,8 +209,6 @@ typedef struct {
 // Structure to hold all temporary buffers for a single thread
 typedef struct {
   double *imgCorrBC;
-  int *boolImage;
-  int *connectedComponents;
   int *positions;
   int *positionTrackers;
   int *usefulPixels;
@@ -227,11 +232,15 @@ typedef struct {
   double *imageTemp2;  // Transform scratch buffer 2
   double *fitRs;       // R-coordinates for fit2DPeaks
   double *fitEtas;     // Eta-coordinates for fit2DPeaks
-  // --- Hoisted DFS stack buffers (Fix 3) ---
-  int *dfsStackX; // DFS stack X coordinates
-  int *dfsStackY; // DFS stack Y coordinates
+  // --- Run-length labelling buffers ---
+  int *ccRuns;      // (row, first column, last column) per run
+  int *ccRunParent; // union-find parent, then label, per run
+  double *colMax;   // 3x3 maxima scratch, NrPixels + 2
   // --- Pre-allocated peak fit buffers (Fix 5) ---
   double *fitPeakBuf; // Single block for all 6 peak-param arrays
+  double *fitParamBuf; // x, xl, xu for fit2DPeaks
+  double *fitLMBuf;    // PeakFit2DLM workspace (peakFitSolver 1 only)
+  FrameArena arena;    // frame-local scratch, reset per frame
 } ThreadWorkspace;
 
 // Global variables
@@ -455,8 +464,6 @@ static void errorCheck(int test, const char *message, ...) {
 void freeWorkspace(ThreadWorkspace *ws) {
   if (ws) {
     free(ws->imgCorrBC);
-    free(ws->boolImage);
-    free(ws->connectedComponents);
     free(ws->positions);
     free(ws->positionTrackers);
     free(ws->usefulPixels);
@@ -480,21 +487,33 @@ void freeWorkspace(ThreadWorkspace *ws) {
     free(ws->imageTemp2);
     free(ws->fitRs);
     free(ws->fitEtas);
-    free(ws->dfsStackX);
-    free(ws->dfsStackY);
+    free(ws->ccRuns);
+    free(ws->ccRunParent);
+    free(ws->colMax);
     free(ws->fitPeakBuf);
+    free(ws->fitParamBuf);
+    free(ws->fitLMBuf);
+    FrameArena_free(&ws->arena);
   }
 }
 
+// Initial size of a thread's FrameArena.
+static size_t frameArenaBytes(const AnalysisParams *params) {
+  size_t maxPx = params->maxNrPx > 0 ? (size_t)params->maxNrPx : 1;
+  return 2 * maxPx * sizeof(int16_t) +
+         maxPx * (2 * sizeof(int) + sizeof(double)) +
+         4 * FRAME_ARENA_ALIGN;
+}
+
 // Allocates all memory needed by a single thread's workspace.
 // Returns SUCCESS or an error code.
 ErrorCode allocateWorkspace(ThreadWorkspace *ws, const ImageMetadata *metadata,
                             const AnalysisParams *params) {
+  // Buffers that are not needed (fitLMBuf) must stay NULL for freeWorkspace
+  memset(ws, 0, sizeof(*ws));
   size_t nrPixelsSq = (size_t)metadata->NrPixels * metadata->NrPixels;
 
   ws->imgCorrBC = calloc(nrPixelsSq, sizeof(double));
-  ws->boolImage = calloc(nrPixelsSq, sizeof(int));
-  ws->connectedComponents = calloc(nrPixelsSq, sizeof(int));
 
   // Use the constants defined in the new code
   ws->positions = calloc(
@@ -526,21 +545,34 @@ ErrorCode allocateWorkspace(ThreadWorkspace *ws, const ImageMetadata *metadata,
   ws->imageTemp2 = calloc(nrPixelsSq, sizeof(double));
   ws->fitRs = malloc((size_t)params->maxNrPx * sizeof(double));
   ws->fitEtas = malloc((size_t)params->maxNrPx * sizeof(double));
-  // DFS stack buffers (Fix 3): allocated once per thread
-  ws->dfsStackX = malloc(nrPixelsSq * sizeof(int));
-  ws->dfsStackY = malloc(nrPixelsSq * sizeof(int));
+  // Run-length labelling: at most one run per two pixels of a row
+  size_t maxRuns = (size_t)metadata->NrPixels * ((metadata->NrPixels + 1) / 2);
+  ws->ccRuns = malloc(maxRuns * 3 * sizeof(int));
+  ws->ccRunParent = malloc(maxRuns * sizeof(int));
+  ws->colMax = malloc(((size_t)metadata->NrPixels + 2) * sizeof(double));
   // Peak fit parameter cache (Fix 5): 8 arrays of maxNPeaks doubles
   ws->fitPeakBuf = malloc((size_t)params->maxNPeaks * 8 * sizeof(double));
+  ws->fitParamBuf =
+      malloc((size_t)3 * (1 + 8 * params->maxNPeaks) * sizeof(double));
+  if (params->peakFitSolver == 1) {
+    int lmPeaks =
+        params->maxNPeaks < LM_MAX_PEAKS ? params->maxNPeaks : LM_MAX_PEAKS;
+    ws->fitLMBuf = malloc(PVoigtLM_workspaceDoubles(lmPeaks) * sizeof(double));
+  }
+  // Frame scratch: the pixel coordinate lists of one region plus the
+  // maxima kept when a region has more than maxNPeaks.  The arena grows to
+  // whatever a frame really needs (see the high-water report).
+  FrameArena_init(&ws->arena, frameArenaBytes(params));
 
   // Check if any allocation failed
-  if (!ws->imgCorrBC || !ws->boolImage || !ws->connectedComponents ||
-      !ws->positions || !ws->positionTrackers || !ws->usefulPixels ||
+  if (!ws->imgCorrBC || !ws->positions || !ws->positionTrackers || !ws->usefulPixels ||
       !ws->maximaPositions || !ws->maximaValues || !ws->z ||
       !ws->integratedIntensity || !ws->imax || !ws->yCenArray ||
       !ws->zCenArray || !ws->rads || !ws->etas || !ws->nrPx || !ws->otherInfo ||
       !ws->locData || !ws->imageAsym_d || !ws->image_d || !ws->imageTemp1 ||
-      !ws->imageTemp2 || !ws->fitRs || !ws->fitEtas || !ws->dfsStackX ||
-      !ws->dfsStackY || !ws->fitPeakBuf) {
+      !ws->imageTemp2 || !ws->fitRs || !ws->fitEtas || !ws->ccRuns ||
+      !ws->ccRunParent || !ws->colMax || !ws->fitPeakBuf || !ws->fitParamBuf ||
+      (params->peakFitSolver == 1 && !ws->fitLMBuf) || !ws->arena.base) {
     // Free any successful allocations here before returning
     freeWorkspace(ws);
     return ERROR_MEMORY_ALLOCATION;
@@ -553,138 +585,170 @@ ErrorCode allocateWorkspace(ThreadWorkspace *ws, const ImageMetadata *metadata,
  * CONNECTED COMPONENTS ANALYSIS
  */
 
-// Direction vectors for 8-connected neighbors
-const int dx[] = {+1, 0, -1, 0, +1, -1, +1, -1};
-const int dy[] = {0, +1, 0, -1, +1, +1, -1, -1};
-
 /**
- * Iterative implementation of depth-first search for connected components
- * Replaces the recursive implementation to avoid stack overflow.
- * (Fix 3): Uses pre-allocated stack buffers from ThreadWorkspace instead of
- * malloc/free per call.
+ * Union-find root of run r, halving the path on the way.
  */
-static inline void depthFirstSearchIterative(int startX, int startY, int label,
-                                             int nrPixels, int *boolImage,
-                                             int *connectedComponents,
-                                             int *positions,
-                                             int *positionTrackers, int *stackX,
-                                             int *stackY) {
-  int stackSize = 0;
-
-  // Push the starting point
-  stackX[stackSize] = startX;
-  stackY[stackSize] = startY;
-  stackSize++;
-
-  while (stackSize > 0) {
-    // Pop from stack
-    stackSize--;
-    int x = stackX[stackSize];
-    int y = stackY[stackSize];
-
-    if (x < 0 || x >= nrPixels || y < 0 || y >= nrPixels)
-      continue;
-    if (connectedComponents[x * nrPixels + y] != 0 ||
-        boolImage[x * nrPixels + y] == 0)
-      continue;
-
-    connectedComponents[x * nrPixels + y] = label;
-    positions[label * nrPixels * 4 + positionTrackers[label]] =
-        (x * nrPixels) + y;
-    positionTrackers[label]++;
-
-    // Push all neighbors onto stack
-    for (int direction = 0; direction < 8; direction++) {
-      int newX = x + dx[direction];
-      int newY = y + dy[direction];
-
-      if (newX >= 0 && newX < nrPixels && newY >= 0 && newY < nrPixels &&
-          connectedComponents[newX * nrPixels + newY] == 0 &&
-          boolImage[newX * nrPixels + newY] == 1) {
-        stackX[stackSize] = newX;
-        stackY[stackSize] = newY;
-        stackSize++;
-      }
-    }
+static inline int runRoot(int *runParent, int r) {
+  while (runParent[r] != r) {
+    runParent[r] = runParent[runParent[r]];
+    r = runParent[r];
   }
+  return r;
 }
 
 /**
- * Find connected components in binary image
+ * Label the 8-connected regions of the non-zero pixels of img.
+ * Each row is split into runs of consecutive non-zero pixels; runs of
+ * adjacent rows that overlap (diagonals included) are merged with
+ * union-find, keeping the earliest run as the root.  The work after the
+ * row scan is proportional to the number of runs and signal pixels.
+ *
+ * Labels start at 1 and follow the raster order of each region's first
+ * pixel.  positions[label * nrPixels * 4 + k] lists the pixels of a region
+ * in raster order, positionTrackers[label] their number.  Regions past
+ * MAX_OVERLAPS_PER_IMAGE - 1, and pixels past nrPixels * 4 in one region,
+ * are not stored; positionTrackers still counts the latter, so a region
+ * with more than nrPixels * 4 pixels is incomplete and must be skipped.
+ *
+ * @param runs       3 * maxRuns ints (row, first column, last column)
+ * @param runParent  maxRuns ints, maxRuns = nrPixels * ((nrPixels + 1) / 2)
  */
-static inline int findConnectedComponents(int *boolImage, int nrPixels,
-                                          int *connectedComponents,
+static inline int findConnectedComponents(const double *img, int nrPixels,
                                           int *positions, int *positionTrackers,
-                                          int *stackX, int *stackY) {
-  // Initialize the connected components map
-  memset(connectedComponents, 0, nrPixels * nrPixels * sizeof(int));
-
-  int component = 0;
+                                          int *runs, int *runParent) {
+  int nRuns = 0, prevFirst = 0, prevEnd = 0;
   for (int i = 0; i < nrPixels; i++) {
-    for (int j = 0; j < nrPixels; j++) {
-      if (connectedComponents[i * nrPixels + j] == 0 &&
-          boolImage[i * nrPixels + j] == 1) {
-        depthFirstSearchIterative(i, j, ++component, nrPixels, boolImage,
-                                  connectedComponents, positions,
-                                  positionTrackers, stackX, stackY);
+    const double *row = img + (size_t)i * nrPixels;
+    int rowFirst = nRuns;
+    int j = 0;
+    while (j < nrPixels) {
+      while (j < nrPixels && row[j] == 0)
+        j++;
+      if (j == nrPixels)
+        break;
+      int start = j;
+      while (j < nrPixels && row[j] != 0)
+        j++;
+      int end = j - 1;
+      runs[nRuns * 3 + 0] = i;
+      runs[nRuns * 3 + 1] = start;
+      runs[nRuns * 3 + 2] = end;
+      runParent[nRuns] = nRuns;
+      // Merge with the runs of the previous row that touch [start-1, end+1]
+      while (prevFirst < prevEnd && runs[prevFirst * 3 + 2] < start - 1)
+        prevFirst++;
+      for (int p = prevFirst; p < prevEnd && runs[p * 3 + 1] <= end + 1; p++) {
+        int a = runRoot(runParent, p), b = runRoot(runParent, nRuns);
+        if (a < b)
+          runParent[b] = a;
+        else if (b < a)
+          runParent[a] = b;
       }
+      nRuns++;
     }
+    prevFirst = rowFirst;
+    prevEnd = nRuns;
   }
-  return component;
+
+  // Parents always precede their runs, so one forward pass points every run
+  // at its root and a second numbers the roots in raster order.  The label
+  // is kept as -label in runParent.
+  for (int r = 0; r < nRuns; r++)
+    runParent[r] = runParent[runParent[r]];
+  int component = 0;
+  for (int r = 0; r < nRuns; r++)
+    runParent[r] = runParent[r] == r ? -(++component) : runParent[runParent[r]];
+
+  int maxPx = nrPixels * 4;
+  for (int r = 0; r < nRuns; r++) {
+    int label = -runParent[r];
+    if (label >= MAX_OVERLAPS_PER_IMAGE)
+      continue;
+    int *pos = positions + (size_t)label * maxPx;
+    int rowOffset = runs[r * 3 + 0] * nrPixels;
+    for (int j = runs[r * 3 + 1]; j <= runs[r * 3 + 2]; j++) {
+      if (positionTrackers[label] < maxPx)
+        pos[positionTrackers[label]] = rowOffset + j;
+      positionTrackers[label]++;
+    }
+  }
+  return component < MAX_OVERLAPS_PER_IMAGE ? component
+                                            : MAX_OVERLAPS_PER_IMAGE - 1;
 }
 
 /**
  * Find regional maxima in a connected component.
- * (Fix 4): Uses imgCorrBC for O(1) direct neighbor lookup instead of
- * O(N) linear scan through the pixel list.
+ * pixelPositions lists the region in raster order (see
+ * findConnectedComponents), so it splits into row segments of consecutive
+ * columns.  For each segment the 3x3 maximum filter is split into a
+ * branch-free (vectorizable) column maximum over the three image rows and a
+ * maximum over three adjacent columns; a pixel is a maximum when no
+ * neighbour is brighter.  There is no per-neighbour bounds check: the rows
+ * above/below the image reuse the pixel's own row and the columns outside it
+ * are 0 pads.
+ * @param colMax  nrPixels + 2 doubles of scratch
  */
 static inline unsigned findRegionalMaxima(double *z, int *pixelPositions,
                                           int nrPixelsThisRegion,
                                           int *maximaPositions,
                                           double *maximaValues, double intSat,
                                           int nrPixels, double *mask,
-                                          double *imgCorrBC, int *maskTouched) {
+                                          double *imgCorrBC, int *maskTouched,
+                                          double *colMax) {
   unsigned nPeaks = 0;
 
-  for (int i = 0; i < nrPixelsThisRegion; i++) {
-    // Skip saturated pixels
-    if (z[i] > intSat) {
-      return 0; // Saturated peak removed
-    }
-
-    int xThis = pixelPositions[i * 2 + 0];
-    int yThis = pixelPositions[i * 2 + 1];
+  double zMax = 0;
+  for (int i = 0; i < nrPixelsThisRegion; i++)
+    zMax = z[i] > zMax ? z[i] : zMax;
+  if (zMax > intSat)
+    return 0; // Saturated peak removed
 
-    // Flag if we touched the mask, but don't reject the peak entirely
-    if (mask[xThis + nrPixels * yThis] == 1) {
-      if (maskTouched)
+  // Flag if we touched the mask, but don't reject the peak entirely
+  if (maskTouched) {
+    for (int i = 0; i < nrPixelsThisRegion; i++) {
+      if (mask[pixelPositions[i * 2 + 0] +
+               nrPixels * pixelPositions[i * 2 + 1]] == 1) {
         *maskTouched = 1;
-    }
-
-    // Check if this is a local maximum using O(1) direct image lookup
-    int isRegionalMax = 1;
-    double zThis = z[i];
-
-    for (int j = 0; j < 8 && isRegionalMax; j++) {
-      int xNext = xThis + dx[j];
-      int yNext = yThis + dy[j];
-
-      if (xNext >= 0 && xNext < nrPixels && yNext >= 0 && yNext < nrPixels) {
-        int neighborIdx = xNext * nrPixels + yNext;
-        // If the neighbor is part of the region (non-zero intensity after
-        // correction) and has higher intensity, this pixel is not a maximum.
-        if (imgCorrBC[neighborIdx] > 0 && imgCorrBC[neighborIdx] > zThis) {
-          isRegionalMax = 0;
-        }
+        break;
       }
     }
+  }
 
-    if (isRegionalMax) {
-      maximaPositions[nPeaks * 2 + 0] = xThis;
-      maximaPositions[nPeaks * 2 + 1] = yThis;
-      maximaValues[nPeaks] = zThis;
-      nPeaks++;
+  // colMax[1 + y] holds column y; the two pads stay 0 (outside the image).
+  colMax[0] = 0;
+  colMax[nrPixels + 1] = 0;
+  int i = 0;
+  while (i < nrPixelsThisRegion) {
+    int xThis = pixelPositions[i * 2 + 0];
+    int y0 = pixelPositions[i * 2 + 1];
+    int len = 1;
+    while (i + len < nrPixelsThisRegion &&
+           pixelPositions[(i + len) * 2 + 0] == xThis &&
+           pixelPositions[(i + len) * 2 + 1] == y0 + len)
+      len++;
+
+    const double *mid = imgCorrBC + (size_t)xThis * nrPixels;
+    const double *up = xThis > 0 ? mid - nrPixels : mid;
+    const double *down = xThis < nrPixels - 1 ? mid + nrPixels : mid;
+    int c0 = y0 > 0 ? y0 - 1 : 0;
+    int c1 = y0 + len < nrPixels ? y0 + len : nrPixels - 1;
+    for (int c = c0; c <= c1; c++) {
+      double m = up[c] > mid[c] ? up[c] : mid[c];
+      colMax[1 + c] = down[c] > m ? down[c] : m;
+    }
+    double *cm = colMax + 1;
+    for (int k = 0; k < len; k++) {
+      int y = y0 + k;
+      double m = cm[y - 1] > cm[y] ? cm[y - 1] : cm[y];
+      m = cm[y + 1] > m ? cm[y + 1] : m;
+      if (m <= mid[y]) {
+        maximaPositions[nPeaks * 2 + 0] = xThis;
+        maximaPositions[nPeaks * 2 + 1] = y;
+        maximaValues[nPeaks] = mid[y];
+        nPeaks++;
+      }
     }
+    i += len;
   }
 
   // If no peaks found, use the middle pixel
@@ -845,6 +909,9 @@ static inline void calculateIntegratedIntensity(int nPeaks, double *x,
  *          Stage 2 polishes jointly using SBPLX (handles high-dim well).
  * (Fix 2): Adaptive timeout scales with nPeaks.
  * (Item 6): Rs/Etas buffers are passed in from the ThreadWorkspace.
+ * With lmWork (PVoigtLM_workspaceDoubles(nPeaks) doubles) the same objective
+ * is minimized by the analytic-Jacobian Levenberg-Marquardt in PeakFit2DLM.h
+ * instead of Nelder-Mead.
  */
 int fit2DPeaks(unsigned nPeaks, int nrPixelsThisRegion, double *z,
                int *usefulPixels, double *maximaValues, int *maximaPositions,
@@ -852,12 +919,12 @@ int fit2DPeaks(unsigned nPeaks, int nrPixelsThisRegion, double *z,
                double *ZCEN, double *RCens, double *EtaCens, double yCen,
                double zCen, double thresh, int *nrPx, double *otherInfo,
                int nrPixels, double *retVal, double *Rs, double *Etas,
-               double *fitPeakBuf) {
+               double *fitPeakBuf, double *fitParamBuf, double *lmWork) {
   // Total parameters: 1 background + 8 per peak
   unsigned n = 1 + (8 * nPeaks);
-  double *x = malloc(n * sizeof(double));
-  double *xl = malloc(n * sizeof(double));
-  double *xu = malloc(n * sizeof(double));
+  double *x = fitParamBuf;
+  double *xl = fitParamBuf + n;
+  double *xu = fitParamBuf + 2 * n;
 
   // Initialize background parameter
   x[0] = thresh / 2; // Initial background level
@@ -1044,23 +1111,28 @@ int fit2DPeaks(unsigned nPeaks, int nrPixelsThisRegion, double *z,
   int rc = 0;
   double minf = 0;
 
-  // Create and configure NLopt optimizer
-  NLoptConfig config = {0};
-  config.dimension = n;
-  config.lower_bounds = xl;
-  config.upper_bounds = xu;
-  config.objective_function = peakFittingObjectiveFunction;
-  config.obj_data = &f_data;
-  config.initial_guess = x;
-  config.max_evaluations =
-      5000 *
-      (int)nPeaks; // Scale with nPeaks for high-dimensional multi-peak fits
-  config.max_time_seconds = 30;
-  config.ftol_rel = 1e-5;
-  config.xtol_rel = 1e-5;
-
-  rc = run_nlopt_optimization(NLOPT_LN_NELDERMEAD, &config);
-  minf = config.min_function_val;
+  if (lmWork != NULL) {
+    rc = PVoigtLM_fit((int)nPeaks, x, xl, xu, nrPixelsThisRegion, Rs, Etas, z,
+                      lmWork, &minf);
+  } else {
+    // Create and configure NLopt optimizer
+    NLoptConfig config = {0};
+    config.dimension = n;
+    config.lower_bounds = xl;
+    config.upper_bounds = xu;
+    config.objective_function = peakFittingObjectiveFunction;
+    config.obj_data = &f_data;
+    config.initial_guess = x;
+    config.max_evaluations =
+        5000 *
+        (int)nPeaks; // Scale with nPeaks for high-dimensional multi-peak fits
+    config.max_time_seconds = 30;
+    config.ftol_rel = 1e-5;
+    config.xtol_rel = 1e-5;
+
+    rc = run_nlopt_optimization(NLOPT_LN_NELDERMEAD, &config);
+    minf = config.min_function_val;
+  }
 
   // Extract results
   for (int i = 0; i < nPeaks; i++) {
@@ -1092,9 +1164,6 @@ int fit2DPeaks(unsigned nPeaks, int nrPixelsThisRegion, double *z,
 
   // Return (no free needed — Rs/Etas are workspace-owned)
   *retVal = sqrt(minf); // RMS error
-  free(x);
-  free(xl);
-  free(xu);
   return rc;
 }
 
@@ -1378,7 +1447,7 @@ static ErrorCode readImageCorrections(zip_t *archive, int darkLoc, int floodLoc,
 /**
  * Process a single image frame using a pre-allocated workspace for efficiency.
  */
-static ErrorCode processImageFrame(int fileNr, char *allData, size_t *sizeArr,
+static ErrorCode processImageFrame(int fileNr, const char *compressed,
                                    ImageMetadata *metadata,
                                    AnalysisParams *params, double *dark,
                                    double *flood, double *mask,
@@ -1399,8 +1468,11 @@ static ErrorCode processImageFrame(int fileNr, char *allData, size_t *sizeArr,
       metadata->NrPixelsY * metadata->NrPixelsZ * metadata->bytesPerPx;
 
   // Decompress the image data
-  int32_t decompressedSize =
-      blosc1_decompress(&allData[sizeArr[fileNr * 2 + 1]], locData, dsz);
+  if (compressed == NULL) {
+    printf("Could not read frame %d\n", fileNr);
+    return ERROR_FILE_OPEN;
+  }
+  int32_t decompressedSize = blosc1_decompress(compressed, locData, dsz);
   if (decompressedSize <= 0) {
     printf("Blosc decompression failed for frame %d\n", fileNr);
     return ERROR_BLOSC_OPERATION;
@@ -1442,19 +1514,14 @@ static ErrorCode processImageFrame(int fileNr, char *allData, size_t *sizeArr,
   // NOTE: All large analysis arrays are now used from the workspace `ws`.
   // NO ALLOCATIONS or FREES are performed in this function for these buffers.
 
-  for (int i = 0; i < metadata->NrPixels * metadata->NrPixels; i++) {
-    ws->boolImage[i] = (imgCorrBC[i] != 0) ? 1 : 0;
-  }
-
   memset(ws->positionTrackers, 0, MAX_OVERLAPS_PER_IMAGE * sizeof(int));
   int nrOfRegions = findConnectedComponents(
-      ws->boolImage, metadata->NrPixels, ws->connectedComponents, ws->positions,
-      ws->positionTrackers, ws->dfsStackX, ws->dfsStackY);
+      imgCorrBC, metadata->NrPixels, ws->positions, ws->positionTrackers,
+      ws->ccRuns, ws->ccRunParent);
 
-  // --- Pixel temp arrays for building per-peak coord lists ---
-  int pxTmpCap = 4096;
-  int16_t *pxTmpY = (int16_t *)malloc(pxTmpCap * sizeof(int16_t));
-  int16_t *pxTmpZ = (int16_t *)malloc(pxTmpCap * sizeof(int16_t));
+  // Everything below that is frame-local comes from the thread's arena.
+  FrameArena *arena = &ws->arena;
+  FrameArena_reset(arena);
 
   int spotIdStart = 1;
   int totalValidRegions = 0;
@@ -1462,8 +1529,10 @@ static ErrorCode processImageFrame(int fileNr, char *allData, size_t *sizeArr,
   for (int regNr = 1; regNr <= nrOfRegions; regNr++) {
     int nrPixelsThisRegion = ws->positionTrackers[regNr];
 
+    // Regions over NrPixels * 4 pixels were not stored in full
     if (nrPixelsThisRegion <= params->minNrPx ||
-        nrPixelsThisRegion >= params->maxNrPx) {
+        nrPixelsThisRegion >= params->maxNrPx ||
+        nrPixelsThisRegion > metadata->NrPixels * 4) {
       continue;
     }
     totalValidRegions++;
@@ -1493,21 +1562,20 @@ static ErrorCode processImageFrame(int fileNr, char *allData, size_t *sizeArr,
     unsigned nPeaks = findRegionalMaxima(
         ws->z, ws->usefulPixels, nrPixelsThisRegion, ws->maximaPositions,
         ws->maximaValues, params->IntSat, metadata->NrPixels, mask, imgCorrBC,
-        &maskTouchedLocal);
+        &maskTouchedLocal, ws->colMax);
 
     if (nPeaks == 0)
       continue;
 
     if (nPeaks > params->maxNPeaks) {
       // Logic to limit number of peaks
-      // This small, temporary allocation is acceptable.
-      int *tempPositions = calloc(nPeaks * 2, sizeof(int));
-      double *tempValues = calloc(nPeaks, sizeof(double));
+      FrameArenaMark mark = FrameArena_mark(arena);
+      int *tempPositions =
+          FrameArena_alloc(arena, (size_t)nPeaks * 2 * sizeof(int));
+      double *tempValues =
+          FrameArena_alloc(arena, (size_t)nPeaks * sizeof(double));
       if (!tempPositions || !tempValues) {
-        if (tempPositions)
-          free(tempPositions);
-        if (tempValues)
-          free(tempValues);
+        FrameArena_release(arena, mark);
         continue;
       }
       for (int i = 0; i < params->maxNPeaks; i++) {
@@ -1530,8 +1598,7 @@ static ErrorCode processImageFrame(int fileNr, char *allData, size_t *sizeArr,
         ws->maximaPositions[i * 2 + 0] = tempPositions[i * 2 + 0];
         ws->maximaPositions[i * 2 + 1] = tempPositions[i * 2 + 1];
       }
-      free(tempPositions);
-      free(tempValues);
+      FrameArena_release(arena, mark);
     }
 
     double retVal = 0;
@@ -1594,7 +1661,9 @@ static ErrorCode processImageFrame(int fileNr, char *allData, size_t *sizeArr,
           ws->maximaPositions, ws->integratedIntensity, ws->imax, ws->yCenArray,
           ws->zCenArray, ws->rads, ws->etas, params->Ycen, params->Zcen, thresh,
           ws->nrPx, ws->otherInfo, metadata->NrPixels, &retVal, ws->fitRs,
-          ws->fitEtas, ws->fitPeakBuf);
+          ws->fitEtas, ws->fitPeakBuf, ws->fitParamBuf,
+          (params->peakFitSolver == 1 && nPeaks <= LM_MAX_PEAKS) ? ws->fitLMBuf
+                                                               : NULL);
       // Apportion raw sum intensity by IMax for overlapping peaks
       if (nPeaks == 1) {
         ws->rawSumIntensity[0] = rawSumForRegion;
@@ -1614,10 +1683,14 @@ static ErrorCode processImageFrame(int fileNr, char *allData, size_t *sizeArr,
     }
 
     // Build pixel coordinate arrays for this region
-    if (nrPixelsThisRegion > pxTmpCap) {
-      pxTmpCap = nrPixelsThisRegion * 2;
-      pxTmpY = (int16_t *)realloc(pxTmpY, pxTmpCap * sizeof(int16_t));
-      pxTmpZ = (int16_t *)realloc(pxTmpZ, pxTmpCap * sizeof(int16_t));
+    FrameArenaMark pxMark = FrameArena_mark(arena);
+    int16_t *pxTmpY =
+        FrameArena_alloc(arena, nrPixelsThisRegion * sizeof(int16_t));
+    int16_t *pxTmpZ =
+        FrameArena_alloc(arena, nrPixelsThisRegion * sizeof(int16_t));
+    if (!pxTmpY || !pxTmpZ) {
+      FrameArena_release(arena, pxMark);
+      continue;
     }
     for (int i = 0; i < nrPixelsThisRegion; i++) {
       int pos = ws->positions[regNr * metadata->NrPixels * 4 + i];
@@ -1661,12 +1734,10 @@ static ErrorCode processImageFrame(int fileNr, char *allData, size_t *sizeArr,
 
       FrameAccum_addPeak(acc, peakRow, pxTmpY, pxTmpZ, nrPixelsThisRegion);
     }
+    FrameArena_release(arena, pxMark);
     spotIdStart += nPeaks;
   }
 
-  free(pxTmpY);
-  free(pxTmpZ);
-
   double t3 = omp_get_wtime();
   printf("FrameNr: %d, NrOfRegions: %d, Filtered regions: %d, Number of peaks: "
          "%d, Total time: %lf\n",
@@ -1698,13 +1769,13 @@ static ErrorCode getZarrDimension(const char *buffer, int *dimension) {
  * Read a datatype string from Zarr and determine the pixel value type
  * This is our new function to support dynamic pixel value types
  */
-static ErrorCode readZarrDataType(zip_t *archive, PixelValueType *pixelType) {
+static ErrorCode readZarrDataType(zip_t *archive, const ZarrIndex *zidx,
+                                  PixelValueType *pixelType) {
   // Default to uint16
   *pixelType = PX_TYPE_UINT16;
 
   // Look up the datatype data chunk by explicit name
-  int dataIdx = (int)zip_name_locate(
-      archive, "measurement/process/scan_parameters/datatype/0", 0);
+  int dataIdx = ZarrIndex_find(zidx, ZARR_SCAN_PARAMS "datatype/0");
   if (dataIdx < 0) {
     // If we didn't find the datatype entry, just use the default
     printf("No datatype specified, using default uint16\n");
@@ -1807,6 +1878,9 @@ static void printAllParameters(const ImageMetadata *metadata,
   printf("  maxNPeaks          : %d\n", params->maxNPeaks);
   printf("  doPeakFit (params) : %d\n", params->doPeakFit);
   printf("  localMaximaOnly    : %d\n", params->localMaximaOnly);
+  printf("  peakFitSolver      : %d\n", params->peakFitSolver);
+  printf("  geometryLUTDir     : %s\n",
+         params->geometryLUTDir ? params->geometryLUTDir : "(none)");
 
   printf("  nImTransOpt        : %d\n", params->nImTransOpt);
   if (params->TransOpt != NULL && params->nImTransOpt > 0) {
@@ -1847,8 +1921,8 @@ static ErrorCode parseZarrMetadata(const char *dataFile,
     return ERROR_ZIP_OPEN;
   }
 
-  struct zip_stat *fileInfo = calloc(16384, sizeof(struct zip_stat));
-  if (!fileInfo) {
+  ZarrIndex *zidx = ZarrIndex_build(archive);
+  if (!zidx) {
     zip_close(archive);
     return ERROR_MEMORY_ALLOCATION;
   }
@@ -1905,6 +1979,8 @@ static ErrorCode parseZarrMetadata(const char *dataFile,
   params->LayerNr = 1;
   params->makeMap = 0;
   params->maxNPeaks = 400;
+  params->peakFitSolver = 0;
+  params->geometryLUTDir = NULL;
   params->BadPxIntensity = 0;
   params->nImTransOpt = 0;
   params->nRingsThresh = 0;
@@ -1913,7 +1989,7 @@ static ErrorCode parseZarrMetadata(const char *dataFile,
   params->Thresholds = NULL;
 
   // Try to read dynamic pixel type - new functionality
-  readZarrDataType(archive, &metadata->pixelType);
+  readZarrDataType(archive, zidx, &metadata->pixelType);
 
   // Track locations of various data chunks
   int darkLoc = -1;
@@ -1939,47 +2015,51 @@ static ErrorCode parseZarrMetadata(const char *dataFile,
   int nGapsY = 0;
   int nGapsZ = 0;
 
-  // Parse all files in the archive
-  int count = 0;
-  while (zip_stat_index(archive, count, 0, fileInfo) == 0) {
-    // Handle main data array metadata
-    if (strstr(fileInfo->name, "exchange/data/.zarray") != NULL) {
-      char *buffer = calloc(fileInfo->size + 1, sizeof(char));
-      if (!buffer) {
+  // Look up every entry by name instead of scanning the archive
+  const char *shapeArrays[4] = {"exchange/data", "exchange/dark",
+                                "exchange/flood", "exchange/mask"};
+  int *shapeFirstDim[4] = {&metadata->nFrames, &metadata->nDarks,
+                           &metadata->nFloods, &metadata->nMasks};
+  for (int k = 0; k < 4; k++) {
+    char name[MAX_BUFFER_SIZE];
+    snprintf(name, sizeof(name), "%s/.zarray", shapeArrays[k]);
+    int loc = ZarrIndex_find(zidx, name);
+    if (loc < 0)
+      continue;
+    char *buffer = NULL;
+    size_t bufferSize;
+    if (ReadZarrRaw(archive, loc, &buffer, &bufferSize) != ZR_SUCCESS) {
+      ZarrIndex_free(zidx);
+      zip_close(archive);
+      return ERROR_MEMORY_ALLOCATION;
+    }
+
+    // Parse shape
+    char *ptr = strstr(buffer, "shape");
+    if (ptr != NULL) {
+      char *ptrt = strstr(ptr, "[");
+      char *ptr2 = strstr(ptrt, "]");
+      int shapeLen = (int)(ptr2 - ptrt);
+      char ptr3[MAX_BUFFER_SIZE];
+      strncpy(ptr3, ptrt, shapeLen + 1);
+      if (3 != sscanf(ptr3,
+                      "%*[^0123456789]%d%*[^0123456789]%d%*[^0123456789]%d",
+                      shapeFirstDim[k], &metadata->NrPixelsZ,
+                      &metadata->NrPixelsY)) {
+        free(buffer);
+        ZarrIndex_free(zidx);
         zip_close(archive);
-        free(fileInfo);
-        return ERROR_MEMORY_ALLOCATION;
+        return ERROR_INVALID_PARAMETERS;
       }
-
-      zip_file_t *file = zip_fopen_index(archive, count, 0);
-      zip_fread(file, buffer, fileInfo->size);
-      zip_fclose(file);
-
-      // Parse shape
-      char *ptr = strstr(buffer, "shape");
-      if (ptr != NULL) {
-        char *ptrt = strstr(ptr, "[");
-        char *ptr2 = strstr(ptrt, "]");
-        int loc = (int)(ptr2 - ptrt);
-        char ptr3[MAX_BUFFER_SIZE];
-        strncpy(ptr3, ptrt, loc + 1);
-
-        if (3 == sscanf(ptr3,
-                        "%*[^0123456789]%d%*[^0123456789]%d%*[^0123456789]%d",
-                        &metadata->nFrames, &metadata->NrPixelsZ,
-                        &metadata->NrPixelsY)) {
-          printf("nFrames: %d nrPixelsZ: %d nrPixelsY: %d\n", metadata->nFrames,
-                 metadata->NrPixelsZ, metadata->NrPixelsY);
-          original_nFrames_for_omega =
-              metadata->nFrames; // Capture original nFrames
-        } else {
-          free(buffer);
-          zip_close(archive);
-          free(fileInfo);
-          return ERROR_INVALID_PARAMETERS;
-        }
+      if (k == 0) {
+        printf("nFrames: %d nrPixelsZ: %d nrPixelsY: %d\n", metadata->nFrames,
+               metadata->NrPixelsZ, metadata->NrPixelsY);
+        original_nFrames_for_omega =
+            metadata->nFrames; // Capture original nFrames
       }
+    }
 
+    if (k == 0) {
       // Parse data type string from .zarray to set bytesPerPx and pixelType
       // This is the authoritative source for the actual on-disk data format
       ptr = strstr(buffer, "dtype");
@@ -2043,354 +2123,127 @@ static ErrorCode parseZarrMetadata(const char *dataFile,
       printf("BytesPerPx: %zu, nFrames: %d, nrPixelsZ: %d nrPixelsY: %d\n",
              metadata->bytesPerPx, metadata->nFrames, metadata->NrPixelsZ,
              metadata->NrPixelsY);
-
-      free(buffer);
     }
-
-    // Handle dark array metadata
-    if (strstr(fileInfo->name, "exchange/dark/.zarray") != NULL) {
-      char *buffer = calloc(fileInfo->size + 1, sizeof(char));
-      if (!buffer) {
-        zip_close(archive);
-        free(fileInfo);
-        return ERROR_MEMORY_ALLOCATION;
-      }
-      zip_file_t *file = zip_fopen_index(archive, count, 0);
-      zip_fread(file, buffer, fileInfo->size);
-      zip_fclose(file);
-      char *ptr = strstr(buffer, "shape");
-      if (ptr != NULL) {
-        char *ptrt = strstr(ptr, "[");
-        char *ptr2 = strstr(ptrt, "]");
-        int loc = (int)(ptr2 - ptrt);
-        char ptr3[MAX_BUFFER_SIZE];
-        strncpy(ptr3, ptrt, loc + 1);
-        if (3 != sscanf(ptr3,
-                        "%*[^0123456789]%d%*[^0123456789]%d%*[^0123456789]%d",
-                        &metadata->nDarks, &metadata->NrPixelsZ,
-                        &metadata->NrPixelsY)) {
-          free(buffer);
-          zip_close(archive);
-          free(fileInfo);
-          return ERROR_INVALID_PARAMETERS;
-        }
-      }
-      free(buffer);
-    }
-
-    // Handle flood array metadata
-    if (strstr(fileInfo->name, "exchange/flood/.zarray") != NULL) {
-      char *buffer = calloc(fileInfo->size + 1, sizeof(char));
-      if (!buffer) {
-        zip_close(archive);
-        free(fileInfo);
-        return ERROR_MEMORY_ALLOCATION;
-      }
-      zip_file_t *file = zip_fopen_index(archive, count, 0);
-      zip_fread(file, buffer, fileInfo->size);
-      zip_fclose(file);
-      char *ptr = strstr(buffer, "shape");
-      if (ptr != NULL) {
-        char *ptrt = strstr(ptr, "[");
-        char *ptr2 = strstr(ptrt, "]");
-        int loc = (int)(ptr2 - ptrt);
-        char ptr3[MAX_BUFFER_SIZE];
-        strncpy(ptr3, ptrt, loc + 1);
-        if (3 != sscanf(ptr3,
-                        "%*[^0123456789]%d%*[^0123456789]%d%*[^0123456789]%d",
-                        &metadata->nFloods, &metadata->NrPixelsZ,
-                        &metadata->NrPixelsY)) {
-          free(buffer);
-          zip_close(archive);
-          free(fileInfo);
-          return ERROR_INVALID_PARAMETERS;
-        }
-      }
-      free(buffer);
-    }
-
-    // Handle mask array metadata
-    if (strstr(fileInfo->name, "exchange/mask/.zarray") != NULL) {
-      char *buffer = calloc(fileInfo->size + 1, sizeof(char));
-      if (!buffer) {
-        zip_close(archive);
-        free(fileInfo);
-        return ERROR_MEMORY_ALLOCATION;
-      }
-      zip_file_t *file = zip_fopen_index(archive, count, 0);
-      zip_fread(file, buffer, fileInfo->size);
-      zip_fclose(file);
-      char *ptr = strstr(buffer, "shape");
-      if (ptr != NULL) {
-        char *ptrt = strstr(ptr, "[");
-        char *ptr2 = strstr(ptrt, "]");
-        int loc = (int)(ptr2 - ptrt);
-        char ptr3[MAX_BUFFER_SIZE];
-        strncpy(ptr3, ptrt, loc + 1);
-        if (3 != sscanf(ptr3,
-                        "%*[^0123456789]%d%*[^0123456789]%d%*[^0123456789]%d",
-                        &metadata->nMasks, &metadata->NrPixelsZ,
-                        &metadata->NrPixelsY)) {
-          free(buffer);
-          zip_close(archive);
-          free(fileInfo);
-          return ERROR_INVALID_PARAMETERS;
-        }
-      }
+    free(buffer);
+  }
+
+  // Track data locations
+  dataLoc = ZarrIndex_find(zidx, "exchange/data/0.0.0");
+  darkLoc = ZarrIndex_find(zidx, "exchange/dark/0.0.0");
+  maskLoc = ZarrIndex_find(zidx, "exchange/mask/0.0.0");
+  if (maskLoc >= 0)
+    printf("Mask is found.\n");
+  floodLoc = ZarrIndex_find(zidx, "exchange/flood/0.0.0");
+  locOmegaCenterData = ZarrIndex_find(zidx, ZARR_SCAN_PARAMS "omegaCenter/0");
+
+  // Panel parameters parsing
+  ZarrIndex_readInt(archive, zidx, ZARR_ANALYSIS_PARAMS "NPanelsY", &NPanelsY);
+  ZarrIndex_readInt(archive, zidx, ZARR_ANALYSIS_PARAMS "NPanelsZ", &NPanelsZ);
+  ZarrIndex_readInt(archive, zidx, ZARR_ANALYSIS_PARAMS "PanelSizeY",
+                    &PanelSizeY);
+  ZarrIndex_readInt(archive, zidx, ZARR_ANALYSIS_PARAMS "PanelSizeZ",
+                    &PanelSizeZ);
+  ZarrIndex_readString(archive, zidx, ZARR_ANALYSIS_PARAMS "PanelShiftsFile",
+                       &PanelShiftsFile, 4096);
+  ZarrIndex_readString(archive, zidx,
+                       ZARR_ANALYSIS_PARAMS "ResidualCorrectionMap",
+                       &ResidualCorrMapFN, 4096);
+  ZarrIndex_readString(archive, zidx, ZARR_ANALYSIS_PARAMS "GeometryLUTDir",
+                       &params->geometryLUTDir, 4096);
+  locPanelGapsY = ZarrIndex_chunk(zidx, ZARR_ANALYSIS_PARAMS "PanelGapsY");
+  locPanelGapsZ = ZarrIndex_chunk(zidx, ZARR_ANALYSIS_PARAMS "PanelGapsZ");
+
+  // Read various scalar parameters
+  ZarrIndex_readDouble(archive, zidx, ZARR_SCAN_PARAMS "start",
+                       &metadata->omegaStart);
+  ZarrIndex_readDouble(archive, zidx, ZARR_SCAN_PARAMS "step",
+                       &metadata->omegaStep);
+  if (ZarrIndex_readInt(archive, zidx, ZARR_SCAN_PARAMS "doPeakFit",
+                        &metadata->doPeakFit))
+    params->doPeakFit = metadata->doPeakFit;
+  ZarrIndex_readInt(archive, zidx, ZARR_ANALYSIS_PARAMS "LocalMaximaOnly",
+                    &params->localMaximaOnly);
+  if (ZarrIndex_readString(archive, zidx, ZARR_ANALYSIS_PARAMS "ResultFolder",
+                           resultFolder, 4096))
+    printf("ResultFolder: %s\n", *resultFolder);
+  ZarrIndex_readInt(archive, zidx, ZARR_ANALYSIS_PARAMS "MaxNPeaks",
+                    &params->maxNPeaks);
+  ZarrIndex_readInt(archive, zidx, ZARR_ANALYSIS_PARAMS "PeakFitSolver",
+                    &params->peakFitSolver);
+  ZarrIndex_readInt(archive, zidx, ZARR_ANALYSIS_PARAMS "SkipFrame",
+                    &metadata->skipFrame);
+  ZarrIndex_readDouble(archive, zidx, ZARR_ANALYSIS_PARAMS "zDiffThresh",
+                       &params->zDiffThresh);
+  ZarrIndex_readDouble(archive, zidx, ZARR_ANALYSIS_PARAMS "tx", &params->tx);
+  ZarrIndex_readDouble(archive, zidx, ZARR_ANALYSIS_PARAMS "ty", &params->ty);
+  ZarrIndex_readDouble(archive, zidx, ZARR_ANALYSIS_PARAMS "tz", &params->tz);
+  double *distortion[15] = {
+      &params->p0,  &params->p1,  &params->p2,  &params->p3,  &params->p4,
+      &params->p5,  &params->p6,  &params->p7,  &params->p8,  &params->p9,
+      &params->p10, &params->p11, &params->p12, &params->p13, &params->p14};
+  for (int k = 0; k < 15; k++) {
+    char path[MAX_BUFFER_SIZE];
+    snprintf(path, sizeof(path), ZARR_ANALYSIS_PARAMS "p%d", k);
+    ZarrIndex_readDouble(archive, zidx, path, distortion[k]);
+  }
+  ZarrIndex_readInt(archive, zidx, ZARR_ANALYSIS_PARAMS "MinNrPx",
+                    &params->minNrPx);
+  ZarrIndex_readInt(archive, zidx, ZARR_ANALYSIS_PARAMS "MaxNrPx",
+                    &params->maxNrPx);
+  ZarrIndex_readInt(archive, zidx, ZARR_ANALYSIS_PARAMS "DoFullImage",
+                    &params->DoFullImage);
+  ZarrIndex_readDouble(archive, zidx,
+                       ZARR_ANALYSIS_PARAMS "ReferenceRingCurrent",
+                       &params->bc);
+  ZarrIndex_readDouble(archive, zidx, ZARR_ANALYSIS_PARAMS "YCen",
+                       &params->Ycen);
+  ZarrIndex_readDouble(archive, zidx, ZARR_ANALYSIS_PARAMS "ZCen",
+                       &params->Zcen);
+  ZarrIndex_readDouble(archive, zidx,
+                       ZARR_ANALYSIS_PARAMS "UpperBoundThreshold",
+                       &params->IntSat);
+  ZarrIndex_readDouble(archive, zidx, ZARR_ANALYSIS_PARAMS "PixelSize",
+                       &params->px);
+  ZarrIndex_readDouble(archive, zidx, ZARR_ANALYSIS_PARAMS "Width",
+                       &params->Width);
+  ZarrIndex_readInt(archive, zidx, ZARR_ANALYSIS_PARAMS "LayerNr",
+                    &params->LayerNr);
+  ZarrIndex_readDouble(archive, zidx, ZARR_ANALYSIS_PARAMS "Wavelength",
+                       &params->Wavelength);
+  ZarrIndex_readDouble(archive, zidx, ZARR_ANALYSIS_PARAMS "Lsd",
+                       &params->Lsd);
+  if (ZarrIndex_readDouble(archive, zidx, ZARR_ANALYSIS_PARAMS "BadPxIntensity",
+                           &params->BadPxIntensity))
+    params->makeMap = 1;
+  // RhoD and its alias MaxRingRad: the later entry wins, as in the old scan
+  int locRhoD = ZarrIndex_chunk(zidx, ZARR_ANALYSIS_PARAMS "RhoD");
+  int locMaxRingRad = ZarrIndex_chunk(zidx, ZARR_ANALYSIS_PARAMS "MaxRingRad");
+  int locRho = locRhoD > locMaxRingRad ? locRhoD : locMaxRingRad;
+  if (locRho >= 0)
+    ReadZarrChunk(archive, locRho, &params->RhoD, sizeof(double));
+
+  // Track locations for arrays to read later
+  locImTransOpt = ZarrIndex_chunk(zidx, ZARR_ANALYSIS_PARAMS "ImTransOpt");
+  locRingThresh = ZarrIndex_chunk(zidx, ZARR_ANALYSIS_PARAMS "RingThresh");
+  locOmegaRanges = ZarrIndex_chunk(zidx, ZARR_ANALYSIS_PARAMS "OmegaRanges");
+
+  // Read array dimensions
+  const char *dimArrays[5] = {"PanelGapsY", "PanelGapsZ", "RingThresh",
+                              "OmegaRanges", "ImTransOpt"};
+  int *dims[5] = {&nGapsY, &nGapsZ, &params->nRingsThresh, &nOmegaRanges,
+                  &params->nImTransOpt};
+  for (int k = 0; k < 5; k++) {
+    char name[MAX_BUFFER_SIZE];
+    snprintf(name, sizeof(name), ZARR_ANALYSIS_PARAMS "%s/.zarray",
+             dimArrays[k]);
+    int loc = ZarrIndex_find(zidx, name);
+    char *buffer = NULL;
+    size_t bufferSize;
+    if (loc >= 0 && ReadZarrRaw(archive, loc, &buffer, &bufferSize) ==
+                        ZR_SUCCESS) {
+      getZarrDimension(buffer, dims[k]);
       free(buffer);
     }
-
-    // Track data locations
-    if (strstr(fileInfo->name, "exchange/data/0.0.0") != NULL)
-      dataLoc = count;
-    if (strstr(fileInfo->name, "exchange/dark/0.0.0") != NULL)
-      darkLoc = count;
-    if (strstr(fileInfo->name, "exchange/mask/0.0.0") != NULL) {
-      printf("Mask is found.\n");
-      maskLoc = count;
-    }
-    if (strstr(fileInfo->name, "exchange/flood/0.0.0") != NULL)
-      floodLoc = count;
-    if (strcmp(fileInfo->name,
-               "measurement/process/scan_parameters/omegaCenter/0") == 0)
-      locOmegaCenterData = count;
-
-    // Panel parameters parsing
-    if (strstr(fileInfo->name,
-               "analysis/process/analysis_parameters/NPanelsY/0") != NULL)
-      ReadZarrChunk(archive, count, &NPanelsY, sizeof(int));
-    if (strstr(fileInfo->name,
-               "analysis/process/analysis_parameters/NPanelsZ/0") != NULL)
-      ReadZarrChunk(archive, count, &NPanelsZ, sizeof(int));
-    if (strstr(fileInfo->name,
-               "analysis/process/analysis_parameters/PanelSizeY/0") != NULL)
-      ReadZarrChunk(archive, count, &PanelSizeY, sizeof(int));
-    if (strstr(fileInfo->name,
-               "analysis/process/analysis_parameters/PanelSizeZ/0") != NULL)
-      ReadZarrChunk(archive, count, &PanelSizeZ, sizeof(int));
-    if (strstr(fileInfo->name,
-               "analysis/process/analysis_parameters/PanelShiftsFile/0") !=
-        NULL)
-      ReadZarrString(archive, count, &PanelShiftsFile, 4096);
-    if (strstr(fileInfo->name,
-               "analysis/process/analysis_parameters/ResidualCorrectionMap/0") !=
-        NULL)
-      ReadZarrString(archive, count, &ResidualCorrMapFN, 4096);
-    if (strstr(fileInfo->name,
-               "analysis/process/analysis_parameters/PanelGapsY/0") != NULL)
-      locPanelGapsY = count;
-    if (strstr(fileInfo->name,
-               "analysis/process/analysis_parameters/PanelGapsZ/0") != NULL)
-      locPanelGapsZ = count;
-    if (strstr(fileInfo->name,
-               "analysis/process/analysis_parameters/PanelGapsY/.zarray") !=
-        NULL) {
-      char *buffer = calloc(fileInfo->size + 1, sizeof(char));
-      if (buffer) {
-        zip_file_t *f = zip_fopen_index(archive, count, 0);
-        zip_fread(f, buffer, fileInfo->size);
-        zip_fclose(f);
-        getZarrDimension(buffer, &nGapsY);
-        free(buffer);
-      }
-    }
-    if (strstr(fileInfo->name,
-               "analysis/process/analysis_parameters/PanelGapsZ/.zarray") !=
-        NULL) {
-      char *buffer = calloc(fileInfo->size + 1, sizeof(char));
-      if (buffer) {
-        zip_file_t *f = zip_fopen_index(archive, count, 0);
-        zip_fread(f, buffer, fileInfo->size);
-        zip_fclose(f);
-        getZarrDimension(buffer, &nGapsZ);
-        free(buffer);
-      }
-    }
-
-    // Read various scalar parameters
-    if (strstr(fileInfo->name, "measurement/process/scan_parameters/start/0") !=
-        NULL)
-      ReadZarrChunk(archive, count, &metadata->omegaStart, sizeof(double));
-    if (strstr(fileInfo->name, "measurement/process/scan_parameters/step/0") !=
-        NULL)
-      ReadZarrChunk(archive, count, &metadata->omegaStep, sizeof(double));
-    if (strstr(fileInfo->name,
-               "measurement/process/scan_parameters/doPeakFit/0") != NULL) {
-      ReadZarrChunk(archive, count, &metadata->doPeakFit, sizeof(int));
-      params->doPeakFit = metadata->doPeakFit;
-    }
-    if (strstr(fileInfo->name,
-               "analysis/process/analysis_parameters/LocalMaximaOnly/0") !=
-        NULL)
-      ReadZarrChunk(archive, count, &params->localMaximaOnly, sizeof(int));
-    if (strstr(fileInfo->name,
-               "analysis/process/analysis_parameters/ResultFolder/0") != NULL) {
-      ReadZarrString(archive, count, resultFolder, 4096);
-      printf("ResultFolder: %s\n", *resultFolder);
-    }
-    if (strstr(fileInfo->name,
-               "analysis/process/analysis_parameters/MaxNPeaks/0") != NULL)
-      ReadZarrChunk(archive, count, &params->maxNPeaks, sizeof(int));
-    if (strstr(fileInfo->name,
-               "analysis/process/analysis_parameters/SkipFrame/0") != NULL)
-      ReadZarrChunk(archive, count, &metadata->skipFrame, sizeof(int));
-    if (strstr(fileInfo->name,
-               "analysis/process/analysis_parameters/zDiffThresh/0") != NULL)
-      ReadZarrChunk(archive, count, &params->zDiffThresh, sizeof(double));
-    if (strstr(fileInfo->name, "analysis/process/analysis_parameters/tx/0") !=
-        NULL)
-      ReadZarrChunk(archive, count, &params->tx, sizeof(double));
-    if (strstr(fileInfo->name, "analysis/process/analysis_parameters/ty/0") !=
-        NULL)
-      ReadZarrChunk(archive, count, &params->ty, sizeof(double));
-    if (strstr(fileInfo->name, "analysis/process/analysis_parameters/tz/0") !=
-        NULL)
-      ReadZarrChunk(archive, count, &params->tz, sizeof(double));
-    if (strstr(fileInfo->name, "analysis/process/analysis_parameters/p0/0") !=
-        NULL)
-      ReadZarrChunk(archive, count, &params->p0, sizeof(double));
-    if (strstr(fileInfo->name, "analysis/process/analysis_parameters/p1/0") !=
-        NULL)
-      ReadZarrChunk(archive, count, &params->p1, sizeof(double));
-    if (strstr(fileInfo->name, "analysis/process/analysis_parameters/p2/0") !=
-        NULL)
-      ReadZarrChunk(archive, count, &params->p2, sizeof(double));
-    if (strstr(fileInfo->name, "analysis/process/analysis_parameters/p3/0") !=
-        NULL)
-      ReadZarrChunk(archive, count, &params->p3, sizeof(double));
-    if (strstr(fileInfo->name, "analysis/process/analysis_parameters/p4/0") !=
-        NULL)
-      ReadZarrChunk(archive, count, &params->p4, sizeof(double));
-    if (strstr(fileInfo->name, "analysis/process/analysis_parameters/p5/0") !=
-        NULL)
-      ReadZarrChunk(archive, count, &params->p5, sizeof(double));
-    if (strstr(fileInfo->name, "analysis/process/analysis_parameters/p6/0") !=
-        NULL)
-      ReadZarrChunk(archive, count, &params->p6, sizeof(double));
-    if (strstr(fileInfo->name, "analysis/process/analysis_parameters/p7/0") !=
-        NULL)
-      ReadZarrChunk(archive, count, &params->p7, sizeof(double));
-    if (strstr(fileInfo->name, "analysis/process/analysis_parameters/p8/0") !=
-        NULL)
-      ReadZarrChunk(archive, count, &params->p8, sizeof(double));
-    if (strstr(fileInfo->name, "analysis/process/analysis_parameters/p9/0") !=
-        NULL)
-      ReadZarrChunk(archive, count, &params->p9, sizeof(double));
-    if (strstr(fileInfo->name, "analysis/process/analysis_parameters/p10/0") !=
-        NULL)
-      ReadZarrChunk(archive, count, &params->p10, sizeof(double));
-    if (strstr(fileInfo->name, "analysis/process/analysis_parameters/p11/0") !=
-        NULL)
-      ReadZarrChunk(archive, count, &params->p11, sizeof(double));
-    if (strstr(fileInfo->name, "analysis/process/analysis_parameters/p12/0") !=
-        NULL)
-      ReadZarrChunk(archive, count, &params->p12, sizeof(double));
-    if (strstr(fileInfo->name, "analysis/process/analysis_parameters/p13/0") !=
-        NULL)
-      ReadZarrChunk(archive, count, &params->p13, sizeof(double));
-    if (strstr(fileInfo->name, "analysis/process/analysis_parameters/p14/0") !=
-        NULL)
-      ReadZarrChunk(archive, count, &params->p14, sizeof(double));
-    if (strstr(fileInfo->name,
-               "analysis/process/analysis_parameters/MinNrPx/0") != NULL)
-      ReadZarrChunk(archive, count, &params->minNrPx, sizeof(int));
-    if (strstr(fileInfo->name,
-               "analysis/process/analysis_parameters/MaxNrPx/0") != NULL)
-      ReadZarrChunk(archive, count, &params->maxNrPx, sizeof(int));
-    if (strstr(fileInfo->name,
-               "analysis/process/analysis_parameters/DoFullImage/0") != NULL)
-      ReadZarrChunk(archive, count, &params->DoFullImage, sizeof(int));
-    if (strstr(fileInfo->name,
-               "analysis/process/analysis_parameters/ReferenceRingCurrent/0") !=
-        NULL)
-      ReadZarrChunk(archive, count, &params->bc, sizeof(double));
-    if (strstr(fileInfo->name, "analysis/process/analysis_parameters/YCen/0") !=
-        NULL)
-      ReadZarrChunk(archive, count, &params->Ycen, sizeof(double));
-    if (strstr(fileInfo->name, "analysis/process/analysis_parameters/ZCen/0") !=
-        NULL)
-      ReadZarrChunk(archive, count, &params->Zcen, sizeof(double));
-    if (strstr(fileInfo->name,
-               "analysis/process/analysis_parameters/UpperBoundThreshold/0") !=
-        NULL)
-      ReadZarrChunk(archive, count, &params->IntSat, sizeof(double));
-    if (strstr(fileInfo->name,
-               "analysis/process/analysis_parameters/PixelSize/0") != NULL)
-      ReadZarrChunk(archive, count, &params->px, sizeof(double));
-    if (strstr(fileInfo->name,
-               "analysis/process/analysis_parameters/Width/0") != NULL)
-      ReadZarrChunk(archive, count, &params->Width, sizeof(double));
-    if (strstr(fileInfo->name,
-               "analysis/process/analysis_parameters/LayerNr/0") != NULL)
-      ReadZarrChunk(archive, count, &params->LayerNr, sizeof(int));
-    if (strstr(fileInfo->name,
-               "analysis/process/analysis_parameters/Wavelength/0") != NULL)
-      ReadZarrChunk(archive, count, &params->Wavelength, sizeof(double));
-    if (strstr(fileInfo->name, "analysis/process/analysis_parameters/Lsd/0") !=
-        NULL)
-      ReadZarrChunk(archive, count, &params->Lsd, sizeof(double));
-    if (strstr(fileInfo->name,
-               "analysis/process/analysis_parameters/BadPxIntensity/0") !=
-        NULL) {
-      ReadZarrChunk(archive, count, &params->BadPxIntensity, sizeof(double));
-      params->makeMap = 1;
-    }
-    if (strstr(fileInfo->name, "analysis/process/analysis_parameters/RhoD/0") !=
-            NULL ||
-        strstr(fileInfo->name,
-               "analysis/process/analysis_parameters/MaxRingRad/0") != NULL) {
-      ReadZarrChunk(archive, count, &params->RhoD, sizeof(double));
-    }
-
-    // Track locations for arrays to read later
-    if (strstr(fileInfo->name,
-               "analysis/process/analysis_parameters/ImTransOpt/0") != NULL)
-      locImTransOpt = count;
-    if (strstr(fileInfo->name,
-               "analysis/process/analysis_parameters/RingThresh/0.0") != NULL)
-      locRingThresh = count;
-    if (strstr(fileInfo->name,
-               "analysis/process/analysis_parameters/OmegaRanges/0.0") != NULL)
-      locOmegaRanges = count;
-
-    // Read array dimensions
-    if (strstr(fileInfo->name,
-               "analysis/process/analysis_parameters/RingThresh/.zarray") !=
-        NULL) {
-      char *buffer = calloc(fileInfo->size + 1, sizeof(char));
-      if (buffer) {
-        zip_file_t *f = zip_fopen_index(archive, count, 0);
-        zip_fread(f, buffer, fileInfo->size);
-        zip_fclose(f);
-        getZarrDimension(buffer, &params->nRingsThresh);
-        free(buffer);
-      }
-    }
-    if (strstr(fileInfo->name,
-               "analysis/process/analysis_parameters/OmegaRanges/.zarray") !=
-        NULL) {
-      char *buffer = calloc(fileInfo->size + 1, sizeof(char));
-      if (buffer) {
-        zip_file_t *f = zip_fopen_index(archive, count, 0);
-        zip_fread(f, buffer, fileInfo->size);
-        zip_fclose(f);
-        getZarrDimension(buffer, &nOmegaRanges);
-        free(buffer);
-      }
-    }
-    if (strstr(fileInfo->name,
-               "analysis/process/analysis_parameters/ImTransOpt/.zarray") !=
-        NULL) {
-      char *buffer = calloc(fileInfo->size + 1, sizeof(char));
-      if (buffer) {
-        zip_file_t *f = zip_fopen_index(archive, count, 0);
-        zip_fread(f, buffer, fileInfo->size);
-        zip_fclose(f);
-        getZarrDimension(buffer, &params->nImTransOpt);
-        free(buffer);
-      }
-    }
-    count++;
   }
 
   // Generate Panels
@@ -2507,7 +2360,7 @@ static ErrorCode parseZarrMetadata(const char *dataFile,
     free(ResidualCorrMapFN);
   }
 
-  free(fileInfo);
+  ZarrIndex_free(zidx);
   zip_close(archive);
 
   return SUCCESS;
@@ -2558,61 +2411,104 @@ static ErrorCode calculateRingRadii(AnalysisParams *params,
   return SUCCESS;
 }
 
-/**
- * Read frame data from Zarr archive
- */
-static ErrorCode readFrameData(const char *dataFile, int dataLoc, int nFrames,
-                               size_t **sizeArr, char **allData) {
-  int errorp = 0;
-  zip_t *archive = zip_open(dataFile, 0, &errorp);
-  if (!archive)
-    return ERROR_ZIP_OPEN;
-
-  *sizeArr = calloc((size_t)nFrames * 2, sizeof(size_t));
-  if (!(*sizeArr)) {
-    zip_close(archive);
-    return ERROR_MEMORY_ALLOCATION;
-  }
-
-  size_t totalSize = 0;
-  for (int i = 0; i < nFrames; i++) {
-    zip_stat_t fileStat;
-    zip_stat_init(&fileStat);
-    if (zip_stat_index(archive, dataLoc + i, 0, &fileStat) != 0) {
-      free(*sizeArr);
-      *sizeArr = NULL;
-      zip_close(archive);
-      return ERROR_ZIP_OPEN;
-    }
-    (*sizeArr)[i * 2 + 0] = fileStat.size;
-    (*sizeArr)[i * 2 + 1] = totalSize;
-    totalSize += fileStat.size;
-  }
-
-  *allData = calloc(totalSize + 1, sizeof(char));
-  if (!(*allData)) {
-    free(*sizeArr);
-    *sizeArr = NULL;
-    zip_close(archive);
-    return ERROR_MEMORY_ALLOCATION;
-  }
+// Tilt-, distortion- and panel-corrected radius of pixel (a, b), in pixels
+// on the global Lsd plane.
+static double correctedPixelRadius(const AnalysisParams *p, double TRs[3][3],
+                                   int a, int b) {
+  double pixY = (double)a, pixZ = (double)b;
+  double dLsd = 0, dP2 = 0;
+  if (nPanels > 0) {
+    int pIdx = GetPanelIndex(pixY, pixZ, nPanels, panels);
+    if (pIdx >= 0) {
+      dLsd = panels[pIdx].dLsd;
+      dP2 = panels[pIdx].dP2;
+    }
+  }
+  double panelLsd = p->Lsd + dLsd;
+  double panelP2 = p->p2 + dP2;
+  double Yc = (-a + p->Ycen) * p->px, Zc = (b - p->Zcen) * p->px;
+  double ABC[3] = {0, Yc, Zc}, ABCPr[3];
+  matrixVectorMultiply(TRs, ABC, ABCPr);
+  double XYZ[3] = {panelLsd + ABCPr[0], ABCPr[1], ABCPr[2]};
+  double Rad = (panelLsd / XYZ[0]) * sqrt(XYZ[1] * XYZ[1] + XYZ[2] * XYZ[2]);
+  double Eta = calcEtaAngle(XYZ[1], XYZ[2]);
+  double RNorm = Rad / p->RhoD;
+  double EtaT = 90 - Eta;
+  // Item 4: replace pow() with multiplies
+  double RNorm2 = RNorm * RNorm;
+  double RNorm4 = RNorm2 * RNorm2;
+  // Item 5: pre-convert to radians for trig
+  double EtaT_rad = EtaT * DEG2RAD;
+  double RNorm3 = RNorm2 * RNorm;
+  double dipole = p->p7 * RNorm4 * cos(EtaT_rad + p->p8 * DEG2RAD);
+  double trefoil = p->p9 * RNorm3 * cos(3.0 * EtaT_rad + p->p10 * DEG2RAD);
+  double RNorm5 = RNorm4 * RNorm;
+  double RNorm6 = RNorm4 * RNorm2;
+  double pentafoil = p->p11 * RNorm5 * cos(5.0 * EtaT_rad + p->p12 * DEG2RAD);
+  double hexafoil = p->p13 * RNorm6 * cos(6.0 * EtaT_rad + p->p14 * DEG2RAD);
+  double DistortFunc =
+      (p->p0 * RNorm2 * cos(2.0 * EtaT_rad + p->p6 * DEG2RAD)) +
+      (p->p1 * RNorm4 * cos(4.0 * EtaT_rad + p->p3 * DEG2RAD)) +
+      (panelP2 * RNorm2) + p->p4 * RNorm4 * RNorm2 +
+      p->p5 * RNorm4 + dipole + trefoil + pentafoil + hexafoil + 1.0;
+  double Rt = Rad * DistortFunc / p->px;
+  Rt += dg_residual_corr_lookup(&g_residualCorr, (double)a, (double)b);
+  Rt = Rt * (p->Lsd / panelLsd); // re-project to global Lsd plane
+  return Rt;
+}
 
-  for (int i = 0; i < nFrames; i++) {
-    zip_file_t *file = zip_fopen_index(archive, dataLoc + i, 0);
-    if (!file) {
-      free(*sizeArr);
-      *sizeArr = NULL;
-      free(*allData);
-      *allData = NULL;
-      zip_close(archive);
-      return ERROR_FILE_OPEN;
-    }
-    zip_fread(file, &(*allData)[(*sizeArr)[i * 2 + 1]], (*sizeArr)[i * 2 + 0]);
-    zip_fclose(file);
+// Corrected radius of every pixel through the GeometryLUTDir cache: mapped
+// if a table for this geometry exists, otherwise computed (as float32, so
+// hits and misses give the same thresholds) and stored for the next job.
+static void loadGeometryLUT(const AnalysisParams *p, double TRs[3][3],
+                            int nrPixels, GeometryLUT *lut) {
+  // The scalars as text, then the panel list and the residual map as raw
+  // bytes; their lengths follow from the counts in the text.
+  char key[1024];
+  snprintf(
+      key, sizeof(key),
+      "NrPixels=%d|Lsd=%.17g|BC=%.17g,%.17g|px=%.17g|RhoD=%.17g|"
+      "tilts=%.17g,%.17g,%.17g|p=%.17g,%.17g,%.17g,%.17g,%.17g,%.17g,%.17g,"
+      "%.17g,%.17g,%.17g,%.17g,%.17g,%.17g,%.17g,%.17g|panels=%d|"
+      "residual=%d,%d",
+      nrPixels, p->Lsd, p->Ycen, p->Zcen, p->px, p->RhoD, p->tx, p->ty, p->tz,
+      p->p0, p->p1, p->p2, p->p3, p->p4, p->p5, p->p6, p->p7, p->p8, p->p9,
+      p->p10, p->p11, p->p12, p->p13, p->p14, nPanels,
+      g_residualCorr.map != NULL ? g_residualCorr.NrPixelsY : 0,
+      g_residualCorr.map != NULL ? g_residualCorr.NrPixelsZ : 0);
+  MH_SHA256_CTX ctx;
+  mh_sha256_init(&ctx);
+  mh_sha256_update(&ctx, (const uint8_t *)key, strlen(key));
+  for (int i = 0; i < nPanels; i++) {
+    double f[6] = {panels[i].yMin, panels[i].yMax, panels[i].zMin,
+                   panels[i].zMax, panels[i].dLsd, panels[i].dP2};
+    mh_sha256_update(&ctx, (const uint8_t *)f, sizeof(f));
+  }
+  if (g_residualCorr.map != NULL)
+    mh_sha256_update(&ctx, (const uint8_t *)g_residualCorr.map,
+                     (size_t)g_residualCorr.NrPixelsY *
+                         g_residualCorr.NrPixelsZ * sizeof(double));
+  uint8_t hash[32];
+  mh_sha256_final(&ctx, hash);
+  char fn[MAX_FILENAME_LENGTH];
+  GeometryLUT_path(fn, sizeof(fn), p->geometryLUTDir, hash);
+  if (GeometryLUT_open(lut, fn, hash, nrPixels) == 0) {
+    printf("Using geometry LUT %s\n", fn);
+    return;
   }
-
-  zip_close(archive);
-  return SUCCESS;
+  float *R = malloc((size_t)nrPixels * nrPixels * sizeof(float));
+  if (R == NULL)
+    return; // caller computes per pixel
+#pragma omp parallel for
+  for (int a = 0; a < nrPixels; a++)
+    for (int b = 0; b < nrPixels; b++)
+      R[(size_t)a * nrPixels + b] = (float)correctedPixelRadius(p, TRs, a, b);
+  lut->owned = R;
+  lut->R = R;
+  if (GeometryLUT_write(fn, hash, nrPixels, R) == 0)
+    printf("Wrote geometry LUT %s\n", fn);
+  else
+    printf("Warning: Could not write geometry LUT %s\n", fn);
 }
 
 /**
@@ -2696,50 +2592,16 @@ int main(int argc, char *argv[]) {
     for (int a = 0; a < metadata.NrPixels * metadata.NrPixels; a++)
       goodCoords[a] = params.Thresholds[0];
   } else {
+    GeometryLUT lut;
+    memset(&lut, 0, sizeof(lut));
+    if (params.geometryLUTDir != NULL && params.geometryLUTDir[0] != '\0')
+      loadGeometryLUT(&params, TRs, metadata.NrPixels, &lut);
 #pragma omp parallel for
     for (int a = 0; a < metadata.NrPixels; a++) {
       for (int b = 0; b < metadata.NrPixels; b++) {
-        double pixY = (double)a, pixZ = (double)b;
-        double dLsd = 0, dP2 = 0;
-        if (nPanels > 0) {
-          int pIdx = GetPanelIndex(pixY, pixZ, nPanels, panels);
-          if (pIdx >= 0) {
-            dLsd = panels[pIdx].dLsd;
-            dP2 = panels[pIdx].dP2;
-          }
-        }
-        double panelLsd = params.Lsd + dLsd;
-        double panelP2 = params.p2 + dP2;
-        double Yc = (-a + params.Ycen) * params.px,
-               Zc = (b - params.Zcen) * params.px;
-        double ABC[3] = {0, Yc, Zc}, ABCPr[3];
-        matrixVectorMultiply(TRs, ABC, ABCPr);
-        double XYZ[3] = {panelLsd + ABCPr[0], ABCPr[1], ABCPr[2]};
-        double Rad =
-            (panelLsd / XYZ[0]) * sqrt(XYZ[1] * XYZ[1] + XYZ[2] * XYZ[2]);
-        double Eta = calcEtaAngle(XYZ[1], XYZ[2]);
-        double RNorm = Rad / params.RhoD;
-        double EtaT = 90 - Eta;
-        // Item 4: replace pow() with multiplies
-        double RNorm2 = RNorm * RNorm;
-        double RNorm4 = RNorm2 * RNorm2;
-        // Item 5: pre-convert to radians for trig
-        double EtaT_rad = EtaT * DEG2RAD;
-        double RNorm3 = RNorm2 * RNorm;
-        double dipole = params.p7 * RNorm4 * cos(EtaT_rad + params.p8 * DEG2RAD);
-        double trefoil = params.p9 * RNorm3 * cos(3.0 * EtaT_rad + params.p10 * DEG2RAD);
-        double RNorm5 = RNorm4 * RNorm;
-        double RNorm6 = RNorm4 * RNorm2;
-        double pentafoil = params.p11 * RNorm5 * cos(5.0 * EtaT_rad + params.p12 * DEG2RAD);
-        double hexafoil = params.p13 * RNorm6 * cos(6.0 * EtaT_rad + params.p14 * DEG2RAD);
-        double DistortFunc =
-            (params.p0 * RNorm2 * cos(2.0 * EtaT_rad + params.p6 * DEG2RAD)) +
-            (params.p1 * RNorm4 * cos(4.0 * EtaT_rad + params.p3 * DEG2RAD)) +
-            (panelP2 * RNorm2) + params.p4 * RNorm4 * RNorm2 +
-            params.p5 * RNorm4 + dipole + trefoil + pentafoil + hexafoil + 1.0;
-        double Rt = Rad * DistortFunc / params.px;
-        Rt += dg_residual_corr_lookup(&g_residualCorr, (double)a, (double)b);
-        Rt = Rt * (params.Lsd / panelLsd); // re-project to global Lsd plane
+        double Rt = lut.R != NULL
+                        ? lut.R[(size_t)a * metadata.NrPixels + b]
+                        : correctedPixelRadius(&params, TRs, a, b);
         for (int r = 0; r < params.nRingsThresh; r++) {
           if (Rt > ringRads[r] - params.Width &&
               Rt < ringRads[r] + params.Width) {
@@ -2748,6 +2610,7 @@ int main(int argc, char *argv[]) {
         }
       }
     }
+    GeometryLUT_close(&lut);
   }
 
   int startFileNr =
@@ -2771,18 +2634,16 @@ int main(int argc, char *argv[]) {
   double *flood =
       calloc((size_t)metadata.NrPixels * metadata.NrPixels, sizeof(double));
 
-  int darkLoc = -1, floodLoc = -1, maskLoc = -1, count = 0;
-  struct zip_stat fileInfo;
-  zip_stat_init(&fileInfo);
-  while (zip_stat_index(archive, count, 0, &fileInfo) == 0) {
-    if (strstr(fileInfo.name, "exchange/dark/0.0.0") != NULL)
-      darkLoc = count;
-    if (strstr(fileInfo.name, "exchange/mask/0.0.0") != NULL)
-      maskLoc = count;
-    if (strstr(fileInfo.name, "exchange/flood/0.0.0") != NULL)
-      floodLoc = count;
-    count++;
+  ZarrIndex *zidx = ZarrIndex_build(archive);
+  if (!zidx) {
+    zip_close(archive);
+    return ERROR_MEMORY_ALLOCATION;
   }
+  int darkLoc = ZarrIndex_find(zidx, "exchange/dark/0.0.0");
+  int maskLoc = ZarrIndex_find(zidx, "exchange/mask/0.0.0");
+  int floodLoc = ZarrIndex_find(zidx, "exchange/flood/0.0.0");
+  int dataLoc = ZarrIndex_find(zidx, "exchange/data/0.0.0");
+  ZarrIndex_free(zidx);
   darkLoc += metadata.skipFrame;
 
   error = readImageCorrections(archive, darkLoc, floodLoc, maskLoc, &metadata,
@@ -2793,33 +2654,16 @@ int main(int argc, char *argv[]) {
     return error;
   }
 
-  // Re-find dataLoc as archive was closed and re-opened implicitly in other
-  // functions
-  int dataLoc = -1;
-  count = 0;
-  archive = zip_open(dataFile, 0, &errorp);
-  if (!archive) {
-    fprintf(stderr,
-            "ERROR: Could not re-open zip archive '%s' (error code: %d)\n",
-            dataFile, errorp);
-    return ERROR_ZIP_OPEN;
-  }
-  zip_stat_init(&fileInfo);
-  while (zip_stat_index(archive, count, 0, &fileInfo) == 0) {
-    if (strstr(fileInfo.name, "exchange/data/0.0.0") != NULL)
-      dataLoc = count;
-    count++;
-  }
-  zip_close(archive);
   dataLoc += metadata.skipFrame;
 
-  size_t *sizeArr = NULL;
-  char *allData = NULL;
-  error =
-      readFrameData(dataFile, dataLoc, metadata.nFrames, &sizeArr, &allData);
-  if (error != SUCCESS) { /* cleanup and exit */
-    return error;
-  }
+  // Only this block's frames are read, a bounded window ahead of the
+  // workers, instead of buffering the whole compressed dataset up front.
+  ZarrFrameStream *frames =
+      ZarrFrameStream_open(dataFile, dataLoc + startFileNr,
+                           endFileNr - startFileNr,
+                           FRAME_STREAM_WINDOW_PER_THREAD * numProcs);
+  if (frames == NULL)
+    return ERROR_ZIP_OPEN;
 
   // --- Allocate per-frame accumulators (no file I/O during parallel) ---
   int nLocal = endFileNr - startFileNr;
@@ -2830,6 +2674,8 @@ int main(int argc, char *argv[]) {
 
   // --- HIGHLY EFFICIENT PARALLEL PROCESSING LOOP ---
   int nrFilesDone = 0;
+  size_t arenaHighWater = 0;
+  int arenaOverflows = 0;
 #pragma omp parallel num_threads(numProcs) shared(nrFilesDone)
   {
     // 1. Each thread declares its own workspace struct.
@@ -2857,10 +2703,13 @@ int main(int argc, char *argv[]) {
                   (double)current_original_frame_idx * metadata.omegaStep;
         }
 
+        const char *compressed =
+            ZarrFrameStream_acquire(frames, fileNr - startFileNr, NULL);
         ErrorCode threadError = processImageFrame(
-            fileNr, allData, sizeArr, &metadata, &params, dark, flood, mask,
+            fileNr, compressed, &metadata, &params, dark, flood, mask,
             goodCoords, omega, &frameAccs[fileNr - startFileNr],
             &ws); // Pass workspace pointer
+        ZarrFrameStream_release(frames, fileNr - startFileNr);
 
         // Item 10: atomic is cheaper than critical for a simple increment
         if (threadError == SUCCESS) {
@@ -2870,9 +2719,19 @@ int main(int argc, char *argv[]) {
       }
 
       // 4. After its work is done, each thread frees its workspace.
+#pragma omp critical
+      {
+        if (ws.arena.highWater > arenaHighWater)
+          arenaHighWater = ws.arena.highWater;
+        arenaOverflows += ws.arena.nOverflows;
+      }
       freeWorkspace(&ws);
     }
   } // --- End of parallel region ---
+  printf("Frame arena high-water mark: %zu bytes per thread (initial %zu, "
+         "%d requests overflowed)\n",
+         arenaHighWater, FrameArena_round(frameArenaBytes(&params)),
+         arenaOverflows);
 
   // --- Write consolidated output files (single serial pass) ---
   printf("Writing consolidated peak files...\n");
@@ -2889,8 +2748,7 @@ int main(int argc, char *argv[]) {
   free(flood);
   free(mask);
   free(goodCoords);
-  free(sizeArr);
-  free(allData);
+  ZarrFrameStream_close(frames);
   if (ringRads)
     free(ringRads);
   if (params.TransOpt)
@@ -2899,6 +2757,7 @@ int main(int argc, char *argv[]) {
     free(params.RingNrs);
   if (params.Thresholds)
     free(params.Thresholds);
+  free(params.geometryLUTDir);
   if (resultFolder)
     free(resultFolder);
   if (metadata.omegaCenter)
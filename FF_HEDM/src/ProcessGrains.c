@@ -17,6 +17,7 @@
 //
 
 #include "ZarrReader.h"
+#include "SpotsColumnar.h"
 #include "midas_version.h"
 #include <blosc2.h>
 #include <ctype.h>
@@ -765,8 +766,12 @@ int main(int argc, char *argv[]) {
     MakeHash = 1;
   }
 
-  // Count-then-allocate for InputMatrix
-  int nInputLines = countCSVLines("InputAllExtraInfoFittingAll.csv");
+  // Count-then-allocate for InputMatrix; prefer the columnar copy
+  // (SpotsColumnar.h) when FitSetupParamsAllZarr wrote one.
+  SpotsColumnar spotCols;
+  int useColumnar = SpotsColumnar_open(&spotCols, SPOTS_COLUMNAR_CSV_FN) == 0;
+  int nInputLines = useColumnar ? (int)spotCols.nRows
+                                : countCSVLines("InputAllExtraInfoFittingAll.csv");
   if (nInputLines < 0) {
     printf("Could not open InputAllExtraInfoFittingAll.csv. Exiting.\n");
     return 1;
@@ -774,24 +779,41 @@ int main(int argc, char *argv[]) {
 
   double **InputMatrix;
   InputMatrix = allocMatrix(nInputLines, 10);
-  char *inputallfn = "InputAllExtraInfoFittingAll.csv";
-  FILE *inpfile = fopen(inputallfn, "r");
-  if (inpfile == NULL) {
-    printf("Could not open %s. Exiting.\n", inputallfn);
-    return 1;
+  // InputMatrix column k comes from table column inputCols[k]
+  static const int inputCols[10] = {
+      SPC_Omega, SPC_SpotID, SPC_YOrigDetCor, SPC_ZOrigDetCor, SPC_Eta,
+      SPC_RingNumber, SPC_YLab, SPC_ZLab, SPC_Ttheta, SPC_OmegaOrigDetCor};
+  const double *inputColPtrs[10];
+  FILE *inpfile = NULL;
+  if (useColumnar) {
+    for (i = 0; i < 10; i++)
+      inputColPtrs[i] = SpotsColumnar_col(&spotCols, inputCols[i]);
+  } else {
+    char *inputallfn = "InputAllExtraInfoFittingAll.csv";
+    inpfile = fopen(inputallfn, "r");
+    if (inpfile == NULL) {
+      printf("Could not open %s. Exiting.\n", inputallfn);
+      return 1;
+    }
+    setvbuf(inpfile, NULL, _IOFBF, 1 << 20);
+    fgets(aline, 2000, inpfile);
   }
-  setvbuf(inpfile, NULL, _IOFBF, 1 << 20);
   int counterIF = 0;
-  fgets(aline, 2000, inpfile);
   int currentRing = 0;
-  while (fgets(aline, 2000, inpfile) != NULL) {
-    sscanf(aline, "%lf %lf %lf %s %lf %lf %lf %lf %s %s %s %lf %lf %lf",
-           &InputMatrix[counterIF][6], &InputMatrix[counterIF][7],
-           &InputMatrix[counterIF][0], dummy, &InputMatrix[counterIF][1],
-           &InputMatrix[counterIF][5], &InputMatrix[counterIF][4],
-           &InputMatrix[counterIF][8], dummy, dummy, dummy,
-           &InputMatrix[counterIF][2], &InputMatrix[counterIF][3],
-           &InputMatrix[counterIF][9]);
+  while (useColumnar ? counterIF < nInputLines
+                     : fgets(aline, 2000, inpfile) != NULL) {
+    if (useColumnar) {
+      for (i = 0; i < 10; i++)
+        InputMatrix[counterIF][i] = inputColPtrs[i][counterIF];
+    } else {
+      sscanf(aline, "%lf %lf %lf %s %lf %lf %lf %lf %s %s %s %lf %lf %lf",
+             &InputMatrix[counterIF][6], &InputMatrix[counterIF][7],
+             &InputMatrix[counterIF][0], dummy, &InputMatrix[counterIF][1],
+             &InputMatrix[counterIF][5], &InputMatrix[counterIF][4],
+             &InputMatrix[counterIF][8], dummy, dummy, dummy,
+             &InputMatrix[counterIF][2], &InputMatrix[counterIF][3],
+             &InputMatrix[counterIF][9]);
+    }
     if ((int)InputMatrix[counterIF][1] != counterIF + 1) {
       printf("IDs dont match.\nExiting\n");
       return (1);
@@ -814,7 +836,10 @@ int main(int argc, char *argv[]) {
     }
     counterIF++;
   }
-  fclose(inpfile);
+  if (useColumnar)
+    SpotsColumnar_close(&spotCols);
+  else
+    fclose(inpfile);
   IDHash[nRings - 1][2] = counterIF;
   if (MakeHash == 1) {
     FILE *hklf = fopen("hkls.csv", "r");
@@ -10,15 +10,24 @@
 //
 //
 
+#include <errno.h>
+#include <fcntl.h>
 #include <limits.h>
 #include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include <time.h>
+#include <unistd.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 #include "midas_version.h"
 #include "MIDAS_ParamParser.h"
+#include "BinDataSoA.h"
+#include "SpotsColumnar.h"
 
 #define deg2rad (M_PI / 180.0)
 #define rad2deg (180.0 / M_PI)
@@ -27,6 +36,9 @@
 #define MAX_N_RINGS                                                            \
   500 // max nr of rings that can be stored (applies to the arrays ringttheta,
       // ringhkl, etc)
+// Cap on the per-thread bin histograms (ints per eta x omega bin of a ring);
+// fine bins run on fewer threads instead of growing past this.
+#define BIN_HIST_MAX_BYTES (1LL << 30)
 
 // Count lines in a CSV file (excluding header)
 static int countCSVLines(const char *filename) {
@@ -60,12 +72,44 @@ void CalcDistanceIdealRing(double *ObsSpotsLab, int nspots, int nCols,
   }
 }
 
-int main(int arc, char *argv[]) {
-	printf("Version: %s\n", MIDAS_VERSION_STRING);
-  clock_t start, end;
-  double diftotal;
-  start = clock();
+// Binning geometry shared by the counting and the scatter pass.
+typedef struct {
+  const double *RingRadii;
+  double omemargin0, etamargin0, rotationstep;
+  double etabinsize, omebinsize;
+  int n_eta_bins, n_ome_bins;
+} BinGrid;
+
+static inline int WrapBin(int i, int n) {
+  i = i % n;
+  return i < 0 ? i + n : i;
+}
+
+// Unwrapped eta and omega bin ranges (inclusive) covered by one spot.
+static inline void SpotBinRange(const BinGrid *g, const double *spot,
+                                int *iEtaMin, int *iEtaMax, int *iOmeMin,
+                                int *iOmeMax) {
+  int ringnr = (int)spot[5];
+  double eta = spot[6];
+  double omega = spot[2];
+  double omemargin =
+      g->omemargin0 + (0.5 * g->rotationstep / fabs(sin(eta * deg2rad)));
+  double omemin = 180 + omega - omemargin;
+  double omemax = 180 + omega + omemargin;
+  *iOmeMin = floor(omemin / g->omebinsize);
+  *iOmeMax = floor(omemax / g->omebinsize);
+  double etamargin = rad2deg * atan(g->etamargin0 / g->RingRadii[ringnr]) +
+                     0.5 * g->rotationstep;
+  double etamin = 180 + eta - etamargin;
+  double etamax = 180 + eta + etamargin;
+  *iEtaMin = floor(etamin / g->etabinsize);
+  *iEtaMax = floor(etamax / g->etabinsize);
+}
 
+// Parse InputAll.csv and InputAllExtraInfoFittingAll.csv into ObsSpots
+// (N_COL_OBSSPOTS columns) and AllSpots (16 columns).
+static int ReadSpotsCSV(int *nSpotsOut, double **ObsSpotsOut,
+                        double **AllSpotsOut) {
   // Count lines first to avoid massive upfront allocation
   int nSpots = countCSVLines("InputAll.csv");
   if (nSpots < 0) {
@@ -139,6 +183,66 @@ int main(int arc, char *argv[]) {
            "something. Exiting\n");
     return 1;
   }
+  *nSpotsOut = nSpots;
+  *ObsSpotsOut = ObsSpots;
+  *AllSpotsOut = AllSpots;
+  return 0;
+}
+
+// Same tables from the mmapped columnar copy (SpotsColumnar.h).
+static int ReadSpotsColumnar(const SpotsColumnar *t, int *nSpotsOut,
+                             double **ObsSpotsOut, double **AllSpotsOut) {
+  if (t->nRows <= 0 || t->nRows > INT_MAX) {
+    printf("No spots found in %s. Exiting.\n", SPOTS_COLUMNAR_FN);
+    return 1;
+  }
+  int nSpots = (int)t->nRows;
+  printf("Read %d spots from %s.\n", nSpots, SPOTS_COLUMNAR_FN);
+  double *ObsSpots = malloc((size_t)nSpots * N_COL_OBSSPOTS * sizeof(double));
+  double *AllSpots = malloc((size_t)nSpots * 16 * sizeof(double));
+  if (ObsSpots == NULL || AllSpots == NULL) {
+    printf("Memory error: could not allocate ObsSpots/AllSpots.\n");
+    free(ObsSpots);
+    free(AllSpots);
+    return 1;
+  }
+  // AllSpots drops the two intensity columns, like the CSV reader
+  static const int allCols[16] = {
+      SPC_YLab,        SPC_ZLab,        SPC_Omega,         SPC_GrainRadius,
+      SPC_SpotID,      SPC_RingNumber,  SPC_Eta,           SPC_Ttheta,
+      SPC_OmegaIni,    SPC_YOrig,       SPC_ZOrig,         SPC_YOrigDetCor,
+      SPC_ZOrigDetCor, SPC_OmegaOrigDetCor, SPC_MaskTouched, SPC_FitRMSE};
+  for (int c = 0; c < 16; c++) {
+    const double *col = SpotsColumnar_col(t, allCols[c]);
+    for (int i = 0; i < nSpots; i++)
+      AllSpots[(size_t)i * 16 + c] = col[i];
+    if (c < 8)
+      for (int i = 0; i < nSpots; i++)
+        ObsSpots[(size_t)i * N_COL_OBSSPOTS + c] = col[i];
+  }
+  *nSpotsOut = nSpots;
+  *ObsSpotsOut = ObsSpots;
+  *AllSpotsOut = AllSpots;
+  return 0;
+}
+
+int main(int arc, char *argv[]) {
+	printf("Version: %s\n", MIDAS_VERSION_STRING);
+  clock_t start, end;
+  double diftotal;
+  start = clock();
+
+  int nSpots;
+  double *ObsSpots, *AllSpots;
+  SpotsColumnar spotCols;
+  if (SpotsColumnar_open(&spotCols, SPOTS_COLUMNAR_CSV_FN) == 0) {
+    int rc = ReadSpotsColumnar(&spotCols, &nSpots, &ObsSpots, &AllSpots);
+    SpotsColumnar_close(&spotCols);
+    if (rc != 0)
+      return 1;
+  } else if (ReadSpotsCSV(&nSpots, &ObsSpots, &AllSpots) != 0) {
+    return 1;
+  }
   char *ParamFN = "paramstest.txt";
   MIDASConfig cfg;
   if (midas_parse_params(ParamFN, &cfg) != 0) {
@@ -154,17 +258,18 @@ int main(int arc, char *argv[]) {
   for (int i = 0; i < NrOfRings; i++) RingRadiiUser[i] = cfg.RingRadii[i];
   double etabinsize = cfg.EtaBinSize, omebinsize = cfg.OmeBinSize;
   int nosaveall = cfg.NoSaveAll;
-  printf("Read Parameters:\n\tNoSaveAll: %d\n\tMarginOme: %lf\n\tMarginEta: "
-         "%lf\n\tEtaBinSize: %lf\n\tStepSizeOrient: %lf\n\tOmeBinSize: "
-         "%lf\n\tNrOfRings: %d\n\tNoRingNumbers: %d\n",
-         nosaveall, omemargin0, etamargin0, etabinsize, rotationstep,
-         omebinsize, NrOfRings, NoRingNumbers);
+  int writesoa = cfg.BinDataSoA;
+  printf("Read Parameters:\n\tNoSaveAll: %d\n\tBinDataSoA: %d\n\tMarginOme: "
+         "%lf\n\tMarginEta: %lf\n\tEtaBinSize: %lf\n\tStepSizeOrient: "
+         "%lf\n\tOmeBinSize: %lf\n\tNrOfRings: %d\n\tNoRingNumbers: %d\n",
+         nosaveall, writesoa, omemargin0, etamargin0, etabinsize,
+         rotationstep, omebinsize, NrOfRings, NoRingNumbers);
   for (int iter = 0; iter < NrOfRings; iter++)
     printf("\tRingRadiiUser[%d]: %lf\n", iter, RingRadiiUser[iter]);
   for (int iter = 0; iter < NoRingNumbers; iter++)
     printf("\tRingNumbers[%d]: %d\n", iter, RingNumbers[iter]);
 
-  int i, j, k, t;
+  int i, t;
 
   for (i = 0; i < MAX_N_RINGS; i++) {
     RingRadii[i] = 0;
@@ -213,7 +318,6 @@ int main(int arc, char *argv[]) {
   int n_ring_bins;
   int n_eta_bins;
   int n_ome_bins;
-  int iEta, iOme, iEta0, iOme0;
   int rowno;
   double EtaBinSize = etabinsize;
   double OmeBinSize = omebinsize;
@@ -227,111 +331,255 @@ int main(int arc, char *argv[]) {
   n_ome_bins = ceil(360.0 / omebinsize);
   printf("nRings: %d, nEtas: %d, nOmes: %d\n", n_ring_bins, n_eta_bins,
          n_ome_bins);
-  printf("Total bins: %d\n", n_ring_bins * n_eta_bins * n_ome_bins);
-
-  // Flat arrays for per-ring processing (same ring-by-ring pattern as Scanning)
-  int **data_ring;    // [eta*ome] -> dynamic int array
-  int *ndata_ring;    // [eta*ome] -> count
-  int *maxndata_ring; // [eta*ome] -> capacity
+  printf("Total bins: %lld\n",
+         (long long int)n_ring_bins * n_eta_bins * n_ome_bins);
   long long int ring_eo = (long long int)n_eta_bins * n_ome_bins;
+  BinGrid grid = {RingRadii,  omemargin0, etamargin0, rotationstep,
+                  etabinsize, omebinsize, n_eta_bins, n_ome_bins};
+
+  // Rows of each ring, in row order, so every ring pass only visits its own
+  // spots.
+  int *ringStart = calloc(n_ring_bins + 1, sizeof(*ringStart));
+  int *ringRows = malloc((size_t)nSpots * sizeof(*ringRows));
+  if (ringStart == NULL || ringRows == NULL) {
+    printf("Memory error: could not allocate ring lists.\n");
+    return 1;
+  }
+  for (rowno = 0; rowno < nSpots; rowno++) {
+    int iRing = (int)ObsSpots[rowno * N_COL_OBSSPOTS + 5] - 1;
+    if (iRing >= 0 && iRing < n_ring_bins && RingRadii[iRing + 1] != 0)
+      ringStart[iRing + 1]++;
+  }
+  for (i = 0; i < n_ring_bins; i++)
+    ringStart[i + 1] += ringStart[i];
+  {
+    int *fill = malloc((n_ring_bins + 1) * sizeof(*fill));
+    if (fill == NULL) {
+      printf("Memory error: could not allocate ring lists.\n");
+      return 1;
+    }
+    memcpy(fill, ringStart, (n_ring_bins + 1) * sizeof(*fill));
+    for (rowno = 0; rowno < nSpots; rowno++) {
+      int iRing = (int)ObsSpots[rowno * N_COL_OBSSPOTS + 5] - 1;
+      if (iRing >= 0 && iRing < n_ring_bins && RingRadii[iRing + 1] != 0)
+        ringRows[fill[iRing]++] = rowno;
+    }
+    free(fill);
+  }
 
+  // nData.bin has a fixed size, map it whole; Data.bin grows ring by ring.
   char *DataFN = "Data.bin";
   char *nDataFN = "nData.bin";
-  FILE *DataFile = fopen(DataFN, "wb");
-  FILE *nDataFile = fopen(nDataFN, "wb");
-  setvbuf(DataFile, NULL, _IOFBF, 1 << 20);
-  setvbuf(nDataFile, NULL, _IOFBF, 1 << 20);
-  long long int TotNumberOfBins = 0;
-  int localCounter = 0;
+  int DataFD = open(DataFN, O_RDWR | O_CREAT | O_TRUNC, 0644);
+  int nDataFD = open(nDataFN, O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if (DataFD < 0 || nDataFD < 0) {
+    printf("Could not create %s / %s. Exiting.\n", DataFN, nDataFN);
+    return 1;
+  }
+  size_t nDataBytes = (size_t)n_ring_bins * ring_eo * 2 * sizeof(int);
+  int *nDataMap = NULL;
+  if (nDataBytes > 0) {
+    if (ftruncate(nDataFD, nDataBytes) != 0) {
+      printf("Could not size %s: %s. Exiting.\n", nDataFN, strerror(errno));
+      return 1;
+    }
+    nDataMap = mmap(0, nDataBytes, PROT_READ | PROT_WRITE, MAP_SHARED,
+                    nDataFD, 0);
+    if (nDataMap == MAP_FAILED) {
+      printf("mmap %s failed: %s. Exiting.\n", nDataFN, strerror(errno));
+      return 1;
+    }
+  }
+  int nThreads = 1;
+#ifdef _OPENMP
+  nThreads = omp_get_max_threads();
+#endif
+  // Per-thread histograms are ring_eo ints each; use fewer threads rather
+  // than more memory when the bins are fine.
+  long long int histThreads = BIN_HIST_MAX_BYTES / (ring_eo * sizeof(int));
+  if (histThreads < 1)
+    histThreads = 1;
+  if (histThreads < nThreads)
+    nThreads = (int)histThreads;
+  printf("Binning with %d threads.\n", nThreads);
+  int *hist = malloc((size_t)nThreads * ring_eo * sizeof(*hist));
+  if (hist == NULL) {
+    printf("Memory error: could not allocate bin histograms.\n");
+    return 1;
+  }
+  long long int pageSize = sysconf(_SC_PAGESIZE);
+  long long int localCounter = 0;
+  // Optional SoA copy of the bins for IndexerOMP's CompareSpots
+  // Written under a temporary name and renamed once stamped with Data.bin
+  FILE *SoAFile = NULL;
+  double *soaScratch = NULL;
+  int soaScratchSize = 0;
+  char soaTmpFN[256];
+  snprintf(soaTmpFN, sizeof(soaTmpFN), "%s.tmp.%ld", BIN_SOA_FN,
+           (long)getpid());
+  if (writesoa == 1) {
+    SoAFile = fopen(soaTmpFN, "wb");
+    if (SoAFile != NULL)
+      setvbuf(SoAFile, NULL, _IOFBF, 1 << 20);
+    if (SoAFile == NULL || BinSoA_beginFile(SoAFile) != 0) {
+      printf("Warning: could not write %s, IndexerOMP will use Data.bin.\n",
+             BIN_SOA_FN);
+      if (SoAFile)
+        fclose(SoAFile);
+      SoAFile = NULL;
+      remove(soaTmpFN);
+      remove(BIN_SOA_FN);
+    }
+  } else {
+    // A leftover file from an earlier run would no longer match the bins
+    remove(BIN_SOA_FN);
+  }
 
   for (i = 0; i < n_ring_bins; i++) {
-    // Allocate flat arrays for this ring
-    data_ring = malloc(ring_eo * sizeof(int *));
-    ndata_ring = calloc(ring_eo, sizeof(int));
-    maxndata_ring = calloc(ring_eo, sizeof(int));
-    if (!data_ring || !ndata_ring || !maxndata_ring) {
-      printf("Memory error: memory full during ring %d allocation.\n", i);
+    const int *rows = ringRows + ringStart[i];
+    int nRows = ringStart[i + 1] - ringStart[i];
+    int *nDataRing = nDataMap + (size_t)i * ring_eo * 2;
+    int nT = nRows < nThreads ? (nRows > 0 ? nRows : 1) : nThreads;
+
+    // Pass 1: each thread counts the bin entries of a contiguous block of
+    // rows, so that the scatter below keeps rows in order inside a bin.
+#pragma omp parallel num_threads(nT)
+    {
+      int t = 0;
+#ifdef _OPENMP
+      t = omp_get_thread_num();
+#endif
+      int *h = hist + (size_t)t * ring_eo;
+      memset(h, 0, ring_eo * sizeof(*h));
+      int r0 = (int)((long long int)nRows * t / nT);
+      int r1 = (int)((long long int)nRows * (t + 1) / nT);
+      for (int r = r0; r < r1; r++) {
+        int eta0, eta1, ome0, ome1;
+        SpotBinRange(&grid, &ObsSpots[(size_t)rows[r] * N_COL_OBSSPOTS],
+                     &eta0, &eta1, &ome0, &ome1);
+        for (int e = eta0; e <= eta1; e++) {
+          long long int eBase = (long long int)WrapBin(e, n_eta_bins) * n_ome_bins;
+          for (int o = ome0; o <= ome1; o++)
+            h[eBase + WrapBin(o, n_ome_bins)]++;
+        }
+      }
+    }
+
+    // Totals per bin, then their prefix sum gives every bin's offset.
+#pragma omp parallel for num_threads(nThreads) schedule(static)
+    for (long long int b = 0; b < ring_eo; b++) {
+      int total = 0;
+      for (int t = 0; t < nT; t++)
+        total += hist[(size_t)t * ring_eo + b];
+      nDataRing[b * 2] = total;
+    }
+    long long int ringTotal = 0;
+    for (long long int b = 0; b < ring_eo; b++) {
+      nDataRing[b * 2 + 1] = (int)(localCounter + ringTotal);
+      ringTotal += nDataRing[b * 2];
+    }
+    if (localCounter + ringTotal > INT_MAX) {
+      printf("Too many bin entries (%lld) for the int32 offsets in %s; "
+             "increase EtaBinSize/OmeBinSize. Exiting.\n",
+             localCounter + ringTotal, nDataFN);
       return 1;
     }
-    for (long long int idx = 0; idx < ring_eo; idx++) {
-      data_ring[idx] = NULL;
+    if (ringTotal == 0)
+      continue;
+
+    // Turn the histograms into per-thread write cursors (ring-relative).
+#pragma omp parallel for num_threads(nThreads) schedule(static)
+    for (long long int b = 0; b < ring_eo; b++) {
+      int pos = nDataRing[b * 2 + 1] - (int)localCounter;
+      for (int t = 0; t < nT; t++) {
+        int n = hist[(size_t)t * ring_eo + b];
+        hist[(size_t)t * ring_eo + b] = pos;
+        pos += n;
+      }
     }
 
-    // Bin spots for this ring
-    for (rowno = 0; rowno < nSpots; rowno++) {
-      int ringnr = (int)ObsSpots[rowno * N_COL_OBSSPOTS + 5];
-      double eta = ObsSpots[rowno * N_COL_OBSSPOTS + 6];
-      double omega = ObsSpots[rowno * N_COL_OBSSPOTS + 2];
-      int iRing = ringnr - 1;
-      if (iRing != i)
-        continue;
-      if (RingRadii[ringnr] == 0)
-        continue;
-      double omemargin =
-          omemargin0 + (0.5 * rotationstep / fabs(sin(eta * deg2rad)));
-      double omemin = 180 + omega - omemargin;
-      double omemax = 180 + omega + omemargin;
-      int iOmeMin = floor(omemin / omebinsize);
-      int iOmeMax = floor(omemax / omebinsize);
-      double etamargin =
-          rad2deg * atan(etamargin0 / RingRadii[ringnr]) + 0.5 * rotationstep;
-      double etamin = 180 + eta - etamargin;
-      double etamax = 180 + eta + etamargin;
-      int iEtaMin = floor(etamin / etabinsize);
-      int iEtaMax = floor(etamax / etabinsize);
-      for (iEta0 = iEtaMin; iEta0 <= iEtaMax; iEta0++) {
-        iEta = iEta0 % n_eta_bins;
-        if (iEta < 0)
-          iEta = iEta + n_eta_bins;
-        for (iOme0 = iOmeMin; iOme0 <= iOmeMax; iOme0++) {
-          iOme = iOme0 % n_ome_bins;
-          if (iOme < 0)
-            iOme = iOme + n_ome_bins;
-          long long int binIdx = (long long int)iEta * n_ome_bins + iOme;
-          int iSpot = ndata_ring[binIdx];
-          int maxnspot = maxndata_ring[binIdx];
-          if (iSpot >= maxnspot) {
-            // Geometric growth
-            maxnspot = (maxnspot == 0) ? 8 : maxnspot * 2;
-            int *newarray =
-                realloc(data_ring[binIdx], maxnspot * sizeof(*newarray));
-            if (newarray == NULL) {
-              printf("Memory error: memory full?\n");
-              return 1;
-            }
-            data_ring[binIdx] = newarray;
-            maxndata_ring[binIdx] = maxnspot;
-          }
-          data_ring[binIdx][iSpot] = rowno;
-          ndata_ring[binIdx]++;
-          TotNumberOfBins++;
+    // Pass 2: scatter row numbers straight into this ring's part of Data.bin.
+    size_t byteStart = (size_t)localCounter * sizeof(int);
+    size_t byteEnd = (size_t)(localCounter + ringTotal) * sizeof(int);
+    size_t mapStart = byteStart - byteStart % pageSize;
+    if (ftruncate(DataFD, byteEnd) != 0) {
+      printf("Could not size %s: %s. Exiting.\n", DataFN, strerror(errno));
+      return 1;
+    }
+    char *dataMap = mmap(0, byteEnd - mapStart, PROT_READ | PROT_WRITE,
+                         MAP_SHARED, DataFD, mapStart);
+    if (dataMap == MAP_FAILED) {
+      printf("mmap %s failed: %s. Exiting.\n", DataFN, strerror(errno));
+      return 1;
+    }
+    int *dataRing = (int *)(dataMap + (byteStart - mapStart));
+#pragma omp parallel num_threads(nT)
+    {
+      int t = 0;
+#ifdef _OPENMP
+      t = omp_get_thread_num();
+#endif
+      int *cursor = hist + (size_t)t * ring_eo;
+      int r0 = (int)((long long int)nRows * t / nT);
+      int r1 = (int)((long long int)nRows * (t + 1) / nT);
+      for (int r = r0; r < r1; r++) {
+        int eta0, eta1, ome0, ome1;
+        SpotBinRange(&grid, &ObsSpots[(size_t)rows[r] * N_COL_OBSSPOTS],
+                     &eta0, &eta1, &ome0, &ome1);
+        for (int e = eta0; e <= eta1; e++) {
+          long long int eBase = (long long int)WrapBin(e, n_eta_bins) * n_ome_bins;
+          for (int o = ome0; o <= ome1; o++)
+            dataRing[cursor[eBase + WrapBin(o, n_ome_bins)]++] = rows[r];
         }
       }
     }
 
-    // Write ring data and free immediately
-    for (j = 0; j < n_eta_bins; j++) {
-      for (k = 0; k < n_ome_bins; k++) {
-        long long int binIdx = (long long int)j * n_ome_bins + k;
-        int localNDataVal = ndata_ring[binIdx];
-        int nDataStore2[2];
-        nDataStore2[0] = localNDataVal;
-        nDataStore2[1] = localCounter;
-        fwrite(nDataStore2, sizeof(int), 2, nDataFile);
-        if (localNDataVal > 0) {
-          fwrite(data_ring[binIdx], sizeof(int), localNDataVal, DataFile);
-          localCounter += localNDataVal;
-          free(data_ring[binIdx]);
+    if (SoAFile != NULL) {
+      for (long long int b = 0; b < ring_eo; b++) {
+        int nInBin = nDataRing[b * 2];
+        if (nInBin == 0)
+          continue;
+        if (nInBin > soaScratchSize) {
+          soaScratchSize = nInBin;
+          soaScratch = realloc(soaScratch, (size_t)BIN_SOA_N_FIELDS *
+                                               soaScratchSize *
+                                               sizeof(*soaScratch));
+          if (soaScratch == NULL) {
+            printf("Memory error: could not allocate soaScratch.\n");
+            return 1;
+          }
         }
+        BinSoA_appendBin(SoAFile, SpotsMat, 9,
+                         dataRing + (nDataRing[b * 2 + 1] - localCounter),
+                         nInBin, soaScratch);
       }
     }
-    free(data_ring);
-    free(ndata_ring);
-    free(maxndata_ring);
+    munmap(dataMap, byteEnd - mapStart);
+    localCounter += ringTotal;
+  }
+  if (nDataMap != NULL)
+    munmap(nDataMap, nDataBytes);
+  close(DataFD);
+  close(nDataFD);
+  free(hist);
+  free(ringStart);
+  free(ringRows);
+  if (SoAFile != NULL) {
+    // Data.bin is closed, so its stamp is final.
+    int64_t dataStamp[4];
+    int soaOK = BinSoA_dataStamp(DataFN, dataStamp) == 0 &&
+                BinSoA_finishFile(SoAFile, localCounter, dataStamp) == 0;
+    soaOK = fclose(SoAFile) == 0 && soaOK;
+    if (soaOK && rename(soaTmpFN, BIN_SOA_FN) == 0) {
+      printf("Wrote %s (%lld entries).\n", BIN_SOA_FN, localCounter);
+    } else {
+      printf("Warning: could not write %s, IndexerOMP will use Data.bin.\n",
+             BIN_SOA_FN);
+      remove(soaTmpFN);
+      remove(BIN_SOA_FN);
+    }
+    free(soaScratch);
   }
-
-  fclose(DataFile);
-  fclose(nDataFile);
   free(ObsSpots);
   free(SpotsMat);
   end = clock();
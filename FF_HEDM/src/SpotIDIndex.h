@@ -0,0 +1,107 @@
+/**
+ * SpotIDIndex.h - O(1) SpotID -> Spots.bin row lookup
+ *
+ * IndexerOMP, FitPosOrStrainsOMP and friends used to locate a seed spot with
+ * a linear scan over the mmapped Spots.bin (FindInMatrix), or assumed that
+ * SpotID == row + 1.  This header provides a dense int32 lookup table
+ * (rows[id], -1 where no spot has that ID) that each consumer builds in
+ * memory from the table it has mapped, with a single O(nSpots + maxID)
+ * pass.  Building it is as cheap as validating a stored copy would be, so
+ * there is no sidecar file to go stale.
+ */
+
+#ifndef SPOT_ID_INDEX_H
+#define SPOT_ID_INDEX_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct {
+  const int32_t *rows; /* rows[id] = row in Spots table, -1 if absent */
+  int32_t maxID;       /* largest valid index into rows */
+  int32_t nSpots;      /* number of rows the table was built against */
+  int32_t *owned;      /* heap table */
+} SpotIDIndex;
+
+/**
+ * Row of SpotID in the Spots table, or -1 if the ID is not present.
+ */
+static inline int SpotIDIndex_lookup(const SpotIDIndex *idx, long long id) {
+  if (idx->rows == NULL || id < 0 || id > idx->maxID)
+    return -1;
+  return idx->rows[id];
+}
+
+/**
+ * Build the table in memory from a row-major double table.
+ * The first row carrying a given ID wins, matching FindInMatrix.
+ * @param spots  nSpots x nCols doubles
+ * @param idCol  column holding the SpotID (4 for Spots.bin and ExtraInfo.bin)
+ * @return 0 on success, -1 on allocation failure
+ */
+static inline int SpotIDIndex_build(SpotIDIndex *idx, const double *spots,
+                                    int nSpots, int nCols, int idCol) {
+  memset(idx, 0, sizeof(*idx));
+  int32_t maxID = -1;
+  for (int r = 0; r < nSpots; r++) {
+    double v = spots[(size_t)r * nCols + idCol];
+    if (v >= 0 && v < INT32_MAX && (int32_t)v > maxID)
+      maxID = (int32_t)v;
+  }
+  size_t nRows = (size_t)maxID + 1 > 0 ? (size_t)maxID + 1 : 1;
+  int32_t *rows = (int32_t *)malloc(nRows * sizeof(int32_t));
+  if (rows == NULL)
+    return -1;
+  memset(rows, 0xFF, nRows * sizeof(int32_t));
+  for (int r = 0; r < nSpots; r++) {
+    double v = spots[(size_t)r * nCols + idCol];
+    if (v < 0 || v >= INT32_MAX)
+      continue;
+    int32_t id = (int32_t)v;
+    if (rows[id] == -1)
+      rows[id] = r;
+  }
+  idx->rows = rows;
+  idx->owned = rows;
+  idx->maxID = maxID;
+  idx->nSpots = nSpots;
+  return 0;
+}
+
+/**
+ * Build the table in memory from a plain list of IDs (e.g. the seed IDs in
+ * SpotsToIndex.csv): rows[id] is the first position of id in the list.
+ * @return 0 on success, -1 on allocation failure
+ */
+static inline int SpotIDIndex_buildFromIDs(SpotIDIndex *idx, const int *ids,
+                                           int nIDs) {
+  memset(idx, 0, sizeof(*idx));
+  int32_t maxID = -1;
+  for (int r = 0; r < nIDs; r++)
+    if (ids[r] > maxID)
+      maxID = ids[r];
+  size_t nRows = (size_t)maxID + 1 > 0 ? (size_t)maxID + 1 : 1;
+  int32_t *rows = (int32_t *)malloc(nRows * sizeof(int32_t));
+  if (rows == NULL)
+    return -1;
+  memset(rows, 0xFF, nRows * sizeof(int32_t));
+  for (int r = 0; r < nIDs; r++)
+    if (ids[r] >= 0 && rows[ids[r]] == -1)
+      rows[ids[r]] = r;
+  idx->rows = rows;
+  idx->owned = rows;
+  idx->maxID = maxID;
+  idx->nSpots = nIDs;
+  return 0;
+}
+
+/**
+ * Release a SpotIDIndex.
+ */
+static inline void SpotIDIndex_free(SpotIDIndex *idx) {
+  free(idx->owned);
+  memset(idx, 0, sizeof(*idx));
+}
+
+#endif /* SPOT_ID_INDEX_H */
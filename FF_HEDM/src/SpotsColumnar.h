@@ -0,0 +1,216 @@
+/**
+ * SpotsColumnar.h - Binary columnar copy of InputAllExtraInfoFittingAll.csv
+ *
+ * FitSetupParamsAllZarr writes the corrected spot table as text
+ * (InputAll.csv: 8 columns, InputAllExtraInfoFittingAll.csv: 18 columns,
+ * the first 8 being the InputAll.csv columns).  SaveBinData and
+ * ProcessGrains used to sscanf those files line by line.  With SpotsColumnar
+ * enabled FitSetupParamsAllZarr also writes this file, which consumers mmap
+ * and read column by column; the CSVs stay the fallback and are still
+ * written for the Python tools.
+ *
+ * Values are stored rounded to the 5 decimals the CSVs carry, so both paths
+ * see the same numbers.
+ *
+ * Format:
+ *   InputAllExtraInfoFittingAll.bin:
+ *     Header: [uint32 magic 'SPCL'][int32 version][int32 nCols]
+ *             [int32 dtype (8 = float64)][int64 nRows]
+ *             [int64 csvSize][int64 csvMtimeSec][int64 csvMtimeNsec]
+ *             [uint64 csvInode][int64 reserved]
+ *     Names:  [char x SPOTS_COLUMNAR_NAME_LEN] x nCols
+ *     Data:   [float64 x nRows] x nCols, column-major
+ *
+ * The csv* fields record the CSV next to the file as it was when the file
+ * was written.  If the CSV no longer has that size, mtime (ns) and inode the
+ * file is ignored, so a CSV rewritten by another tool always wins, even
+ * within the same second.  The file is written under a temporary name and
+ * renamed, so readers never map a partial table.
+ */
+
+#ifndef SPOTS_COLUMNAR_H
+#define SPOTS_COLUMNAR_H
+
+#include <fcntl.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define SPOTS_COLUMNAR_FN "InputAllExtraInfoFittingAll.bin"
+#define SPOTS_COLUMNAR_CSV_FN "InputAllExtraInfoFittingAll.csv"
+#define SPOTS_COLUMNAR_MAGIC 0x4C435053u /* "SPCL" little-endian */
+#define SPOTS_COLUMNAR_VERSION 2
+#define SPOTS_COLUMNAR_DTYPE_F64 8
+#define SPOTS_COLUMNAR_HEADER_BYTES 64
+#define SPOTS_COLUMNAR_NAME_LEN 32
+#define SPOTS_COLUMNAR_N_COLS 18
+#define SPOTS_COLUMNAR_STAMP_OFFSET 24
+
+/* Column order of InputAllExtraInfoFittingAll.csv */
+enum {
+  SPC_YLab, SPC_ZLab, SPC_Omega, SPC_GrainRadius, SPC_SpotID, SPC_RingNumber,
+  SPC_Eta, SPC_Ttheta, SPC_OmegaIni, SPC_YOrig, SPC_ZOrig, SPC_YOrigDetCor,
+  SPC_ZOrigDetCor, SPC_OmegaOrigDetCor, SPC_IntegratedIntensity,
+  SPC_RawSumIntensity, SPC_MaskTouched, SPC_FitRMSE
+};
+
+static const char *const SpotsColumnar_names[SPOTS_COLUMNAR_N_COLS] = {
+    "YLab",          "ZLab",          "Omega",
+    "GrainRadius",   "SpotID",        "RingNumber",
+    "Eta",           "Ttheta",        "OmegaIni",
+    "YOrig",         "ZOrig",         "YOrigDetCor",
+    "ZOrigDetCor",   "OmegaOrigDetCor", "IntegratedIntensity",
+    "RawSumIntensity", "maskTouched", "FitRMSE"};
+
+typedef struct {
+  int64_t nRows;
+  int nCols;
+  void *map;
+  size_t mapSize;
+} SpotsColumnar;
+
+/**
+ * Round to the 5 decimals written by "%12.5f".
+ */
+static inline double SpotsColumnar_round5(double v) {
+  return nearbyint(v * 1e5) / 1e5;
+}
+
+/**
+ * Identity of a CSV file: size, mtime (s, ns) and inode.
+ * @return 0, or -1 if fn cannot be stat'ed
+ */
+static inline int SpotsColumnar_csvStamp(const char *fn, int64_t stamp[4]) {
+  struct stat st;
+  if (stat(fn, &st) != 0)
+    return -1;
+  stamp[0] = (int64_t)st.st_size;
+  stamp[1] = (int64_t)st.st_mtime;
+#if defined(__APPLE__)
+  stamp[2] = (int64_t)st.st_mtimespec.tv_nsec;
+#else
+  stamp[2] = (int64_t)st.st_mtim.tv_nsec;
+#endif
+  stamp[3] = (int64_t)st.st_ino;
+  return 0;
+}
+
+/**
+ * Write a column-major table (cols[c][row]) as SPOTS_COLUMNAR_FN in dir,
+ * stamped with SPOTS_COLUMNAR_CSV_FN in dir (write the CSV first).
+ * @return 0 on success, -1 on failure (the old file, if any, is kept)
+ */
+static inline int SpotsColumnar_write(const char *dir, double *const *cols,
+                                      int64_t nRows) {
+  char fn[4096], tmpFN[4200], csvFN[4096];
+  int64_t stamp[4];
+  snprintf(fn, sizeof(fn), "%s/%s", dir, SPOTS_COLUMNAR_FN);
+  snprintf(tmpFN, sizeof(tmpFN), "%s.tmp.%ld", fn, (long)getpid());
+  snprintf(csvFN, sizeof(csvFN), "%s/%s", dir, SPOTS_COLUMNAR_CSV_FN);
+  if (SpotsColumnar_csvStamp(csvFN, stamp) != 0)
+    return -1;
+  FILE *f = fopen(tmpFN, "wb");
+  if (f == NULL)
+    return -1;
+  unsigned char header[SPOTS_COLUMNAR_HEADER_BYTES];
+  memset(header, 0, sizeof(header));
+  uint32_t magic = SPOTS_COLUMNAR_MAGIC;
+  int32_t ints[3] = {SPOTS_COLUMNAR_VERSION, SPOTS_COLUMNAR_N_COLS,
+                     SPOTS_COLUMNAR_DTYPE_F64};
+  memcpy(header, &magic, 4);
+  memcpy(header + 4, ints, sizeof(ints));
+  memcpy(header + 16, &nRows, sizeof(nRows));
+  memcpy(header + SPOTS_COLUMNAR_STAMP_OFFSET, stamp, sizeof(stamp));
+  int ok = fwrite(header, sizeof(header), 1, f) == 1;
+  for (int c = 0; c < SPOTS_COLUMNAR_N_COLS && ok; c++) {
+    char name[SPOTS_COLUMNAR_NAME_LEN];
+    memset(name, 0, sizeof(name));
+    strncpy(name, SpotsColumnar_names[c], sizeof(name) - 1);
+    ok = fwrite(name, sizeof(name), 1, f) == 1;
+  }
+  for (int c = 0; c < SPOTS_COLUMNAR_N_COLS && ok; c++)
+    ok = fwrite(cols[c], sizeof(double), (size_t)nRows, f) == (size_t)nRows;
+  ok = (fclose(f) == 0) && ok;
+  if (ok)
+    ok = rename(tmpFN, fn) == 0;
+  if (!ok)
+    remove(tmpFN);
+  return ok ? 0 : -1;
+}
+
+/**
+ * Map SPOTS_COLUMNAR_FN (relative to the working directory, like the CSVs)
+ * if it is valid and was written from csvFN as it is now.
+ * @return 0 if mapped, -1 if the caller should parse the CSV instead
+ */
+static inline int SpotsColumnar_open(SpotsColumnar *t, const char *csvFN) {
+  memset(t, 0, sizeof(*t));
+  int fd = open(SPOTS_COLUMNAR_FN, O_RDONLY);
+  if (fd < 0)
+    return -1;
+  struct stat s;
+  int64_t csvStamp[4];
+  if (fstat(fd, &s) != 0 || (size_t)s.st_size < SPOTS_COLUMNAR_HEADER_BYTES ||
+      SpotsColumnar_csvStamp(csvFN, csvStamp) != 0) {
+    close(fd);
+    return -1;
+  }
+  void *map = mmap(0, s.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED)
+    return -1;
+  const unsigned char *h = (const unsigned char *)map;
+  uint32_t magic;
+  int32_t ints[3];
+  int64_t nRows;
+  memcpy(&magic, h, 4);
+  memcpy(ints, h + 4, sizeof(ints));
+  memcpy(&nRows, h + 16, sizeof(nRows));
+  if (ints[0] == SPOTS_COLUMNAR_VERSION &&
+      memcmp(h + SPOTS_COLUMNAR_STAMP_OFFSET, csvStamp, sizeof(csvStamp))) {
+    printf("Warning: %s was written from another version of %s, reading the "
+           "CSV instead.\n",
+           SPOTS_COLUMNAR_FN, csvFN);
+    munmap(map, s.st_size);
+    return -1;
+  }
+  size_t expected = SPOTS_COLUMNAR_HEADER_BYTES +
+                    (size_t)ints[1] * SPOTS_COLUMNAR_NAME_LEN +
+                    (size_t)ints[1] * (size_t)nRows * sizeof(double);
+  if (magic != SPOTS_COLUMNAR_MAGIC || ints[0] != SPOTS_COLUMNAR_VERSION ||
+      ints[1] != SPOTS_COLUMNAR_N_COLS || ints[2] != SPOTS_COLUMNAR_DTYPE_F64 ||
+      nRows < 0 || (size_t)s.st_size != expected) {
+    printf("Warning: %s is not a valid spot table, reading %s instead.\n",
+           SPOTS_COLUMNAR_FN, csvFN);
+    munmap(map, s.st_size);
+    return -1;
+  }
+  t->nRows = nRows;
+  t->nCols = ints[1];
+  t->map = map;
+  t->mapSize = s.st_size;
+  madvise(map, s.st_size, MADV_SEQUENTIAL);
+  return 0;
+}
+
+/**
+ * Column c (SPC_*) as nRows contiguous doubles.
+ */
+static inline const double *SpotsColumnar_col(const SpotsColumnar *t, int c) {
+  return (const double *)((const char *)t->map + SPOTS_COLUMNAR_HEADER_BYTES +
+                          (size_t)t->nCols * SPOTS_COLUMNAR_NAME_LEN) +
+         (size_t)c * t->nRows;
+}
+
+static inline void SpotsColumnar_close(SpotsColumnar *t) {
+  if (t->map != NULL)
+    munmap(t->map, t->mapSize);
+  memset(t, 0, sizeof(*t));
+}
+
+#endif /* SPOTS_COLUMNAR_H */
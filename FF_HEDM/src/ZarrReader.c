@@ -3,6 +3,12 @@
 // See ZarrReader.h for API documentation.
 
 #include "ZarrReader.h"
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 int ReadZarrChunk(zip_t *arch, int entryIndex, void *dest, size_t destSize) {
   struct zip_stat finfo;
@@ -127,3 +133,513 @@ int ReadZarrString(zip_t *arch, int entryIndex, char **outStr, size_t maxLen) {
   *outStr = buf;
   return decompSize;
 }
+
+// ── Name index ──────────────────────────────────────────────────────
+
+struct ZarrIndex {
+  const char **names; // owned by the zip_t
+  int *slots;         // open addressing, entry index or -1
+  uint32_t mask;
+};
+
+static uint32_t zidx_hash(const char *s) {
+  uint32_t h = 2166136261u;
+  for (; *s; s++) {
+    h ^= (unsigned char)*s;
+    h *= 16777619u;
+  }
+  return h;
+}
+
+ZarrIndex *ZarrIndex_build(zip_t *arch) {
+  zip_int64_t n = zip_get_num_entries(arch, 0);
+  if (n < 0)
+    n = 0;
+  uint32_t cap = 16;
+  while (cap < 2 * (uint64_t)n)
+    cap <<= 1;
+  ZarrIndex *idx = (ZarrIndex *)calloc(1, sizeof(*idx));
+  if (idx == NULL)
+    return NULL;
+  idx->names = (const char **)calloc(n > 0 ? n : 1, sizeof(*idx->names));
+  idx->slots = (int *)malloc(cap * sizeof(*idx->slots));
+  if (idx->names == NULL || idx->slots == NULL) {
+    ZarrIndex_free(idx);
+    return NULL;
+  }
+  idx->mask = cap - 1;
+  memset(idx->slots, -1, cap * sizeof(*idx->slots));
+  for (zip_int64_t i = 0; i < n; i++) {
+    const char *name = zip_get_name(arch, i, 0);
+    if (name == NULL)
+      continue;
+    idx->names[i] = name;
+    // Duplicate names keep the last entry, as the old scans did.
+    uint32_t h = zidx_hash(name) & idx->mask;
+    while (idx->slots[h] >= 0 && strcmp(idx->names[idx->slots[h]], name) != 0)
+      h = (h + 1) & idx->mask;
+    idx->slots[h] = (int)i;
+  }
+  return idx;
+}
+
+int ZarrIndex_find(const ZarrIndex *idx, const char *name) {
+  uint32_t h = zidx_hash(name) & idx->mask;
+  while (idx->slots[h] >= 0) {
+    if (strcmp(idx->names[idx->slots[h]], name) == 0)
+      return idx->slots[h];
+    h = (h + 1) & idx->mask;
+  }
+  return -1;
+}
+
+int ZarrIndex_chunk(const ZarrIndex *idx, const char *path) {
+  char name[1024];
+  snprintf(name, sizeof(name), "%s/0", path);
+  int i = ZarrIndex_find(idx, name);
+  if (i < 0) {
+    snprintf(name, sizeof(name), "%s/0.0", path);
+    i = ZarrIndex_find(idx, name);
+  }
+  return i;
+}
+
+int ZarrIndex_readInt(zip_t *arch, const ZarrIndex *idx, const char *path,
+                      int *out) {
+  int i = ZarrIndex_chunk(idx, path);
+  return i >= 0 && ReadZarrChunk(arch, i, out, sizeof(*out)) >= 0;
+}
+
+int ZarrIndex_readDouble(zip_t *arch, const ZarrIndex *idx, const char *path,
+                         double *out) {
+  int i = ZarrIndex_chunk(idx, path);
+  return i >= 0 && ReadZarrChunk(arch, i, out, sizeof(*out)) >= 0;
+}
+
+int ZarrIndex_readString(zip_t *arch, const ZarrIndex *idx, const char *path,
+                         char **out, size_t maxLen) {
+  int i = ZarrIndex_chunk(idx, path);
+  return i >= 0 && ReadZarrString(arch, i, out, maxLen) >= 0;
+}
+
+void ZarrIndex_free(ZarrIndex *idx) {
+  if (idx == NULL)
+    return;
+  free(idx->names);
+  free(idx->slots);
+  free(idx);
+}
+
+// ── mmap of STORE entries ───────────────────────────────────────────
+
+#define ZZM_EOCD_SIG 0x06054b50u
+#define ZZM_EOCD64_LOC_SIG 0x07064b50u
+#define ZZM_EOCD64_SIG 0x06064b50u
+#define ZZM_CDIR_SIG 0x02014b50u
+#define ZZM_LOCAL_SIG 0x04034b50u
+
+struct ZarrZipMapEntry {
+  uint64_t localOffset, compSize;
+  const char *name;
+  uint16_t nameLen, method, flags;
+};
+
+struct ZarrZipMap {
+  const unsigned char *base;
+  size_t size;
+  int nEntries;
+  struct ZarrZipMapEntry *entries;
+};
+
+static uint16_t zzm_u16(const unsigned char *p) {
+  return (uint16_t)(p[0] | (p[1] << 8));
+}
+
+static uint32_t zzm_u32(const unsigned char *p) {
+  return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) |
+         ((uint32_t)p[3] << 24);
+}
+
+static uint64_t zzm_u64(const unsigned char *p) {
+  return (uint64_t)zzm_u32(p) | ((uint64_t)zzm_u32(p + 4) << 32);
+}
+
+// Parse the central directory; returns 0 on success.
+static int zzm_parse(ZarrZipMap *m) {
+  const unsigned char *b = m->base;
+  size_t n = m->size;
+  if (n < 22)
+    return -1;
+  size_t eocd = n - 22, stop = n > 22 + 65535 ? n - 22 - 65535 : 0;
+  while (zzm_u32(b + eocd) != ZZM_EOCD_SIG) {
+    if (eocd == stop)
+      return -1;
+    eocd--;
+  }
+  uint64_t nEntries = zzm_u16(b + eocd + 10);
+  uint64_t cdSize = zzm_u32(b + eocd + 12);
+  uint64_t cdOffset = zzm_u32(b + eocd + 16);
+  if (eocd >= 20 && zzm_u32(b + eocd - 20) == ZZM_EOCD64_LOC_SIG) {
+    uint64_t e64 = zzm_u64(b + eocd - 20 + 8);
+    if (e64 + 56 > n || zzm_u32(b + e64) != ZZM_EOCD64_SIG)
+      return -1;
+    nEntries = zzm_u64(b + e64 + 32);
+    cdSize = zzm_u64(b + e64 + 40);
+    cdOffset = zzm_u64(b + e64 + 48);
+  }
+  if (cdOffset + cdSize > n || nEntries > INT32_MAX)
+    return -1;
+  m->entries = (struct ZarrZipMapEntry *)calloc(
+      nEntries > 0 ? nEntries : 1, sizeof(*m->entries));
+  if (m->entries == NULL)
+    return -1;
+  uint64_t pos = cdOffset;
+  for (uint64_t i = 0; i < nEntries; i++) {
+    if (pos + 46 > cdOffset + cdSize || zzm_u32(b + pos) != ZZM_CDIR_SIG)
+      return -1;
+    struct ZarrZipMapEntry *e = &m->entries[i];
+    e->flags = zzm_u16(b + pos + 8);
+    e->method = zzm_u16(b + pos + 10);
+    e->compSize = zzm_u32(b + pos + 20);
+    uint32_t uncompSize = zzm_u32(b + pos + 24);
+    e->nameLen = zzm_u16(b + pos + 28);
+    uint16_t extraLen = zzm_u16(b + pos + 30);
+    uint16_t commentLen = zzm_u16(b + pos + 32);
+    e->localOffset = zzm_u32(b + pos + 42);
+    e->name = (const char *)b + pos + 46;
+    uint64_t next = pos + 46 + e->nameLen + extraLen + commentLen;
+    if (next > cdOffset + cdSize)
+      return -1;
+    // ZIP64 extended information: only the saturated fields are present.
+    const unsigned char *x = b + pos + 46 + e->nameLen;
+    const unsigned char *xEnd = x + extraLen;
+    while (x + 4 <= xEnd) {
+      uint16_t id = zzm_u16(x), len = zzm_u16(x + 2);
+      if (x + 4 + len > xEnd)
+        break;
+      if (id == 0x0001) {
+        const unsigned char *f = x + 4, *fEnd = x + 4 + len;
+        if (uncompSize == 0xFFFFFFFFu && f + 8 <= fEnd)
+          f += 8;
+        if (e->compSize == 0xFFFFFFFFu && f + 8 <= fEnd) {
+          e->compSize = zzm_u64(f);
+          f += 8;
+        }
+        if (e->localOffset == 0xFFFFFFFFu && f + 8 <= fEnd)
+          e->localOffset = zzm_u64(f);
+      }
+      x += 4 + len;
+    }
+    pos = next;
+  }
+  m->nEntries = (int)nEntries;
+  return 0;
+}
+
+ZarrZipMap *ZarrZipMap_open(const char *zipPath) {
+  int fd = open(zipPath, O_RDONLY);
+  if (fd < 0)
+    return NULL;
+  struct stat st;
+  if (fstat(fd, &st) != 0 || st.st_size <= 0) {
+    close(fd);
+    return NULL;
+  }
+  void *base = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (base == MAP_FAILED)
+    return NULL;
+  ZarrZipMap *m = (ZarrZipMap *)calloc(1, sizeof(*m));
+  if (m == NULL) {
+    munmap(base, st.st_size);
+    return NULL;
+  }
+  m->base = (const unsigned char *)base;
+  m->size = (size_t)st.st_size;
+  if (zzm_parse(m) != 0) {
+    ZarrZipMap_close(m);
+    return NULL;
+  }
+  return m;
+}
+
+const char *ZarrZipMap_stored(const ZarrZipMap *m, int entryIndex,
+                              const char *name, size_t *size) {
+  if (m == NULL || entryIndex < 0 || entryIndex >= m->nEntries)
+    return NULL;
+  const struct ZarrZipMapEntry *e = &m->entries[entryIndex];
+  if (e->method != ZIP_CM_STORE || (e->flags & 1))
+    return NULL;
+  if (name != NULL &&
+      (strlen(name) != e->nameLen || memcmp(name, e->name, e->nameLen) != 0))
+    return NULL;
+  uint64_t off = e->localOffset;
+  if (off + 30 > m->size || zzm_u32(m->base + off) != ZZM_LOCAL_SIG)
+    return NULL;
+  uint64_t data =
+      off + 30 + zzm_u16(m->base + off + 26) + zzm_u16(m->base + off + 28);
+  if (data + e->compSize > m->size)
+    return NULL;
+  if (size != NULL)
+    *size = (size_t)e->compSize;
+  return (const char *)m->base + data;
+}
+
+void ZarrZipMap_close(ZarrZipMap *m) {
+  if (m == NULL)
+    return;
+  munmap((void *)m->base, m->size);
+  free(m->entries);
+  free(m);
+}
+
+// Ask the kernel to start reading a mapped range.
+static void zzm_willneed(const char *p, size_t n) {
+  uintptr_t page = (uintptr_t)sysconf(_SC_PAGESIZE);
+  uintptr_t start = (uintptr_t)p & ~(page - 1);
+  madvise((void *)start, (uintptr_t)p + n - start, MADV_WILLNEED);
+}
+
+// ── Streaming chunk reader ──────────────────────────────────────────
+
+struct ZarrFrameStream {
+  ZarrZipMap *map;     // set when every chunk is a STORE entry
+  const char **mapped; // per chunk: its bytes in the mapping
+  zip_t *arch;         // owned by the reader thread
+  int firstEntry, nChunks, window;
+  size_t *sizes;   // compressed size of every chunk
+  char **buf;      // window buffers of the largest chunk size
+  int *slotChunk;  // chunk held by a slot (-1: free)
+  int *slotState;  // 0: free/being read, 1: ready, -1: read failed
+  int *slotUsers;  // consumers holding the slot
+  int *released;   // per slot: its chunk has been released
+  int stop;
+  pthread_t reader;
+  pthread_mutex_t lock;
+  pthread_cond_t changed;
+};
+
+static int zfs_read_entry(ZarrFrameStream *s, int chunk, char *dest) {
+  zip_file_t *fd = zip_fopen_index(s->arch, s->firstEntry + chunk, 0);
+  if (fd == NULL) {
+    fprintf(stderr, "ZarrReader ERROR: zip_fopen_index failed for index %d\n",
+            s->firstEntry + chunk);
+    return ZR_ERR_OPEN;
+  }
+  zip_int64_t bytesRead = zip_fread(fd, dest, s->sizes[chunk]);
+  zip_fclose(fd);
+  if (bytesRead < 0 || (zip_uint64_t)bytesRead != s->sizes[chunk]) {
+    fprintf(stderr,
+            "ZarrReader ERROR: zip_fread short read for index %d "
+            "(expected %llu, got %lld)\n",
+            s->firstEntry + chunk, (unsigned long long)s->sizes[chunk],
+            (long long)bytesRead);
+    return ZR_ERR_READ;
+  }
+  return ZR_SUCCESS;
+}
+
+static void *zfs_reader_main(void *arg) {
+  ZarrFrameStream *s = (ZarrFrameStream *)arg;
+  for (int chunk = 0; chunk < s->nChunks; chunk++) {
+    int slot = chunk % s->window;
+    pthread_mutex_lock(&s->lock);
+    // The slot is free once the chunk `window` places earlier is released.
+    while (!s->stop && s->slotChunk[slot] != -1 && !s->released[slot])
+      pthread_cond_wait(&s->changed, &s->lock);
+    if (s->stop) {
+      pthread_mutex_unlock(&s->lock);
+      break;
+    }
+    s->slotChunk[slot] = chunk;
+    s->slotState[slot] = 0;
+    s->released[slot] = 0;
+    pthread_mutex_unlock(&s->lock);
+
+    int rc = zfs_read_entry(s, chunk, s->buf[slot]);
+
+    pthread_mutex_lock(&s->lock);
+    s->slotState[slot] = rc == ZR_SUCCESS ? 1 : -1;
+    pthread_cond_broadcast(&s->changed);
+    pthread_mutex_unlock(&s->lock);
+  }
+  return NULL;
+}
+
+ZarrFrameStream *ZarrFrameStream_open(const char *zipPath, int firstEntry,
+                                      int nChunks, int window) {
+  if (window < 1)
+    window = 1;
+  if (window > nChunks && nChunks > 0)
+    window = nChunks;
+  ZarrFrameStream *s = (ZarrFrameStream *)calloc(1, sizeof(*s));
+  if (s == NULL)
+    return NULL;
+  int errorp = 0;
+  s->arch = zip_open(zipPath, 0, &errorp);
+  if (s->arch == NULL) {
+    fprintf(stderr, "ZarrReader ERROR: could not open %s (error code %d)\n",
+            zipPath, errorp);
+    free(s);
+    return NULL;
+  }
+  s->firstEntry = firstEntry;
+  s->nChunks = nChunks;
+  s->window = window;
+  s->sizes = (size_t *)calloc(nChunks > 0 ? nChunks : 1, sizeof(*s->sizes));
+  s->buf = (char **)calloc(window, sizeof(*s->buf));
+  s->slotChunk = (int *)malloc(window * sizeof(*s->slotChunk));
+  s->slotState = (int *)calloc(window, sizeof(*s->slotState));
+  s->slotUsers = (int *)calloc(window, sizeof(*s->slotUsers));
+  s->released = (int *)calloc(window, sizeof(*s->released));
+  int ok = s->sizes && s->buf && s->slotChunk && s->slotState &&
+           s->slotUsers && s->released;
+  size_t maxSize = 0;
+  s->map = ok ? ZarrZipMap_open(zipPath) : NULL;
+  if (s->map != NULL)
+    s->mapped = (const char **)calloc(nChunks > 0 ? nChunks : 1,
+                                      sizeof(*s->mapped));
+  for (int i = 0; ok && i < nChunks; i++) {
+    struct zip_stat finfo;
+    zip_stat_init(&finfo);
+    if (zip_stat_index(s->arch, firstEntry + i, 0, &finfo) != 0) {
+      fprintf(stderr,
+              "ZarrReader ERROR: zip_stat_index failed for index %d\n",
+              firstEntry + i);
+      ok = 0;
+      break;
+    }
+    s->sizes[i] = finfo.size;
+    if (finfo.size > maxSize)
+      maxSize = finfo.size;
+    size_t mappedSize = 0;
+    if (s->mapped != NULL &&
+        ((s->mapped[i] = ZarrZipMap_stored(s->map, firstEntry + i, finfo.name,
+                                           &mappedSize)) == NULL ||
+         mappedSize != finfo.size)) {
+      free(s->mapped);
+      s->mapped = NULL;
+    }
+  }
+  if (ok && s->mapped != NULL) {
+    // Zero-copy: consumers read straight from the mapping.
+    zip_close(s->arch);
+    s->arch = NULL;
+    for (int i = 0; i < window && i < nChunks; i++)
+      zzm_willneed(s->mapped[i], s->sizes[i]);
+    return s;
+  }
+  free(s->mapped);
+  s->mapped = NULL;
+  ZarrZipMap_close(s->map);
+  s->map = NULL;
+  for (int w = 0; ok && w < window; w++) {
+    s->slotChunk[w] = -1;
+    s->buf[w] = (char *)malloc(maxSize + 1);
+    if (s->buf[w] == NULL) {
+      fprintf(stderr,
+              "ZarrReader ERROR: Failed to allocate %d x %zu bytes for the "
+              "frame window\n",
+              window, maxSize + 1);
+      ok = 0;
+    }
+  }
+  if (ok) {
+    pthread_mutex_init(&s->lock, NULL);
+    pthread_cond_init(&s->changed, NULL);
+    if (pthread_create(&s->reader, NULL, zfs_reader_main, s) != 0) {
+      pthread_mutex_destroy(&s->lock);
+      pthread_cond_destroy(&s->changed);
+      ok = 0;
+    }
+  }
+  if (!ok) {
+    zip_close(s->arch);
+    for (int w = 0; s->buf && w < window; w++)
+      free(s->buf[w]);
+    free(s->buf);
+    free(s->sizes);
+    free(s->slotChunk);
+    free(s->slotState);
+    free(s->slotUsers);
+    free(s->released);
+    free(s);
+    return NULL;
+  }
+  return s;
+}
+
+const char *ZarrFrameStream_acquire(ZarrFrameStream *s, int i, size_t *size) {
+  if (i < 0 || i >= s->nChunks)
+    return NULL;
+  if (s->mapped != NULL) {
+    if (i + s->window < s->nChunks)
+      zzm_willneed(s->mapped[i + s->window], s->sizes[i + s->window]);
+    if (size != NULL)
+      *size = s->sizes[i];
+    return s->mapped[i];
+  }
+  int slot = i % s->window;
+  pthread_mutex_lock(&s->lock);
+  while (!(s->slotChunk[slot] == i && s->slotState[slot] != 0))
+    pthread_cond_wait(&s->changed, &s->lock);
+  int state = s->slotState[slot];
+  if (state == 1)
+    s->slotUsers[slot]++;
+  pthread_mutex_unlock(&s->lock);
+  if (state != 1)
+    return NULL;
+  if (size != NULL)
+    *size = s->sizes[i];
+  return s->buf[slot];
+}
+
+void ZarrFrameStream_release(ZarrFrameStream *s, int i) {
+  if (i < 0 || i >= s->nChunks || s->mapped != NULL)
+    return;
+  int slot = i % s->window;
+  pthread_mutex_lock(&s->lock);
+  if (s->slotChunk[slot] == i) {
+    if (s->slotUsers[slot] > 0)
+      s->slotUsers[slot]--;
+    if (s->slotUsers[slot] == 0) {
+      s->released[slot] = 1;
+      pthread_cond_broadcast(&s->changed);
+    }
+  }
+  pthread_mutex_unlock(&s->lock);
+}
+
+void ZarrFrameStream_close(ZarrFrameStream *s) {
+  if (s == NULL)
+    return;
+  if (s->mapped != NULL) {
+    ZarrZipMap_close(s->map);
+    free(s->mapped);
+    free(s->sizes);
+    free(s->slotChunk);
+    free(s->slotState);
+    free(s->slotUsers);
+    free(s->released);
+    free(s->buf);
+    free(s);
+    return;
+  }
+  pthread_mutex_lock(&s->lock);
+  s->stop = 1;
+  pthread_cond_broadcast(&s->changed);
+  pthread_mutex_unlock(&s->lock);
+  pthread_join(s->reader, NULL);
+  pthread_mutex_destroy(&s->lock);
+  pthread_cond_destroy(&s->changed);
+  zip_close(s->arch);
+  for (int w = 0; w < s->window; w++)
+    free(s->buf[w]);
+  free(s->buf);
+  free(s->sizes);
+  free(s->slotChunk);
+  free(s->slotState);
+  free(s->slotUsers);
+  free(s->released);
+  free(s);
+}
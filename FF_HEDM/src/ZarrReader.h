@@ -76,6 +76,131 @@ int ReadZarrRaw(zip_t *arch, int entryIndex, char **outBuf, size_t *outSize);
  */
 int ReadZarrString(zip_t *arch, int entryIndex, char **outStr, size_t maxLen);
 
+/**
+ * Name -> entry index lookup for an open archive, built in one pass over the
+ * central directory.  Replaces scanning every entry with zip_stat_index and
+ * testing it against each parameter path, which is slow for archives with
+ * tens of thousands of frame chunks.  Build it once after zip_open and pass
+ * it to every reader of that archive; it stays valid until zip_close.
+ *
+ * Lookups are exact.  Parameters are zarr arrays, so the getters below take
+ * the array path (e.g. ZARR_ANALYSIS_PARAMS "Lsd") and read its first chunk,
+ * "<path>/0", or "<path>/0.0" for 2-D arrays.  A getter leaves *out
+ * untouched when the parameter is absent, so defaults set beforehand stay.
+ */
+typedef struct ZarrIndex ZarrIndex;
+
+#define ZARR_ANALYSIS_PARAMS "analysis/process/analysis_parameters/"
+#define ZARR_SCAN_PARAMS "measurement/process/scan_parameters/"
+
+/**
+ * @return index handle, or NULL on allocation failure
+ */
+ZarrIndex *ZarrIndex_build(zip_t *arch);
+
+/**
+ * @return entry index of name, or -1 if the archive has no such entry
+ */
+int ZarrIndex_find(const ZarrIndex *idx, const char *name);
+
+/**
+ * @return entry index of the first chunk of the array at path, or -1
+ */
+int ZarrIndex_chunk(const ZarrIndex *idx, const char *path);
+
+/**
+ * Typed reads of the first element of the array at path.
+ * @return 1 if the value was read, 0 if absent or unreadable
+ */
+int ZarrIndex_readInt(zip_t *arch, const ZarrIndex *idx, const char *path,
+                      int *out);
+int ZarrIndex_readDouble(zip_t *arch, const ZarrIndex *idx, const char *path,
+                         double *out);
+
+/**
+ * String read; *out is newly allocated (caller frees) and only replaced
+ * when the value was read.
+ * @return 1 if the value was read, 0 if absent or unreadable
+ */
+int ZarrIndex_readString(zip_t *arch, const ZarrIndex *idx, const char *path,
+                         char **out, size_t maxLen);
+
+void ZarrIndex_free(ZarrIndex *idx);
+
+/**
+ * Read-only mmap of a zarr.zip archive, for zero-copy access to entries
+ * written with the ZIP STORE method (the zarr default).  Such an entry is a
+ * contiguous byte range of the file, so its bytes can be handed to blosc
+ * straight from the page cache, without libzip or a staging buffer.
+ *
+ * Entry indices follow the central directory, the same order libzip uses.
+ */
+typedef struct ZarrZipMap ZarrZipMap;
+
+/**
+ * Map zipPath and parse its central directory (ZIP64 aware).
+ * @return map handle, or NULL if the file cannot be mapped or parsed; callers
+ *         then fall back to libzip.
+ */
+ZarrZipMap *ZarrZipMap_open(const char *zipPath);
+
+/**
+ * Bytes of a STORE entry inside the mapping.
+ * @param name  if not NULL, the entry must have this name (guards against
+ *              index mismatches with a zip_t opened on the same file)
+ * @return pointer into the mapping, or NULL if the entry is out of range,
+ *         compressed, encrypted or named differently
+ */
+const char *ZarrZipMap_stored(const ZarrZipMap *m, int entryIndex,
+                              const char *name, size_t *size);
+
+void ZarrZipMap_close(ZarrZipMap *m);
+
+/**
+ * Streaming reader for a run of consecutive compressed chunks (e.g. the
+ * frames exchange/data/0.0.0 ... of a scan).
+ *
+ * A background thread with its own zip handle reads the chunks in order
+ * into a ring of `window` buffers, staying at most `window` chunks ahead of
+ * the oldest chunk still held by a consumer.  Memory is O(window x largest
+ * chunk) instead of the whole compressed dataset, and consumers can start
+ * on chunk 0 as soon as it is read.
+ *
+ * Consumers (any number of threads) call ZarrFrameStream_acquire for chunk
+ * i, which blocks until it has been read, and ZarrFrameStream_release when
+ * done with the returned bytes (also when acquire returned NULL).  Every
+ * chunk must be acquired and released exactly once, and a consumer must
+ * release its chunk before acquiring the next one; otherwise the reader
+ * cannot reuse the slot.
+ *
+ * If every chunk of the run is a STORE entry, the stream uses a ZarrZipMap
+ * instead: acquire returns a pointer into the mapping, the kernel is asked
+ * to read ahead `window` chunks, and no reader thread or buffers are used.
+ */
+typedef struct ZarrFrameStream ZarrFrameStream;
+
+/**
+ * Open zipPath and start prefetching entries firstEntry ..
+ * firstEntry + nChunks - 1.
+ * @return stream handle, or NULL on failure (message printed)
+ */
+ZarrFrameStream *ZarrFrameStream_open(const char *zipPath, int firstEntry,
+                                      int nChunks, int window);
+
+/**
+ * Wait for chunk i (0-based within the stream) and return its compressed
+ * bytes, valid until ZarrFrameStream_release(s, i).
+ * @return pointer to the chunk, or NULL if it could not be read
+ */
+const char *ZarrFrameStream_acquire(ZarrFrameStream *s, int i, size_t *size);
+
+void ZarrFrameStream_release(ZarrFrameStream *s, int i);
+
+/**
+ * Stop the reader thread and free the stream.
+ */
+void ZarrFrameStream_close(ZarrFrameStream *s);
+
 #ifdef __cplusplus
 }
 #endif
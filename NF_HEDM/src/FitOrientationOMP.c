@@ -6,6 +6,8 @@
 #include "midas_version.h"
 #include "nf_headers.h"
 #include "nf_gpu.h"
+#include "ScreenCache.h"
+#include "VoxelNeighbors.h"
 #include <ctype.h>
 #include <errno.h>
 #include <fcntl.h>
@@ -331,6 +333,11 @@ int main(int argc, char *argv[]) {
   int MinMiso = 0;
   double MinMisoNSaves = 1.0; // degrees, default
   int NrPixelsY = 2048, NrPixelsZ = 2048;
+  int spotsHugePages = 0, useSparseSpots = 0;
+  char screenCacheDir[1000];
+  screenCacheDir[0] = '\0';
+  double screenCacheTol = 0;
+  int neighborSeeding = 0;
   while (fgets(aline, 1000, fileParam) != NULL) {
     str = "ReducedFileName ";
     LowNr = strncmp(aline, str, strlen(str));
@@ -530,6 +537,36 @@ int main(int argc, char *argv[]) {
       sscanf(aline, "%s %lf", dummy, &MinMisoNSaves);
       continue;
     }
+    str = "UseSparseSpotsInfo ";
+    LowNr = strncmp(aline, str, strlen(str));
+    if (LowNr == 0) {
+      sscanf(aline, "%s %d", dummy, &useSparseSpots);
+      continue;
+    }
+    str = "NeighborSeeding ";
+    LowNr = strncmp(aline, str, strlen(str));
+    if (LowNr == 0) {
+      sscanf(aline, "%s %d", dummy, &neighborSeeding);
+      continue;
+    }
+    str = "ScreenCacheDir ";
+    LowNr = strncmp(aline, str, strlen(str));
+    if (LowNr == 0) {
+      sscanf(aline, "%s %s", dummy, screenCacheDir);
+      continue;
+    }
+    str = "ScreenCacheTol ";
+    LowNr = strncmp(aline, str, strlen(str));
+    if (LowNr == 0) {
+      sscanf(aline, "%s %lf", dummy, &screenCacheTol);
+      continue;
+    }
+    str = "SpotsInfoHugePages ";
+    LowNr = strncmp(aline, str, strlen(str));
+    if (LowNr == 0) {
+      sscanf(aline, "%s %d", dummy, &spotsHugePages);
+      continue;
+    }
     str = "NrPixels ";
     LowNr = strncmp(aline, str, strlen(str));
     if (LowNr == 0) {
@@ -653,6 +690,38 @@ int main(int argc, char *argv[]) {
   ObsSpotsInfo = mmap(0, size, PROT_READ, MAP_SHARED, descp, 0);
   check(ObsSpotsInfo == MAP_FAILED, "mmap %s failed: %s", file_name,
         strerror(errno));
+  // Coarse copies written by ProcessImagesCombined, used to reject
+  // orientations before the full-resolution test.
+  SpotsPyramid Pyramid;
+  SpotsPyramid_open(&Pyramid, outputDir, file_name, nLayers, nrFiles,
+                    NrPixelsY, NrPixelsZ);
+  printf("SpotsInfo pyramid: %d coarse level(s)%s\n", Pyramid.nLevels,
+         Pyramid.nLevels ? "" : ", screening at full resolution");
+  // Sparse or tiled copy of the same bits for the full-resolution tests;
+  // the dense mapping is then only paged in by the GPU path.
+  SpotsSparse SparseSpots;
+  memset(&SparseSpots, 0, sizeof(SparseSpots));
+  if (useSparseSpots) {
+    if (SpotsSparse_open(&SparseSpots, outputDir, file_name, nLayers, nrFiles,
+                         NrPixelsY, NrPixelsZ) == 0) {
+      g_spotsSparse = &SparseSpots;
+      printf("Using sparse SpotsInfo (%s/SpotsInfo_sparse_*.bin)\n",
+             outputDir);
+    } else {
+      printf("Warning: UseSparseSpotsInfo set but no valid sparse SpotsInfo "
+             "in %s, using SpotsInfo.bin.\n",
+             outputDir);
+    }
+  }
+  SpotsTiled TiledSpots;
+  memset(&TiledSpots, 0, sizeof(TiledSpots));
+  if (g_spotsSparse == NULL &&
+      SpotsTiled_open(&TiledSpots, outputDir, file_name, nLayers, nrFiles,
+                      NrPixelsY, NrPixelsZ, spotsHugePages) == 0) {
+    g_spotsTiled = &TiledSpots;
+    printf("Using %s/%s%s\n", outputDir, SPOTS_TILED_FN,
+           spotsHugePages ? " (huge pages)" : "");
+  }
 
   // Read DiffractionSpots
   double *SpotsMat;
@@ -832,6 +901,45 @@ int main(int argc, char *argv[]) {
       calloc(MAX_POINTS_GRID_GOOD * 10 * numProcs, sizeof(*OrientMatrixAll));
   double *ThrSpsAll;
   ThrSpsAll = calloc(numProcs * MAX_N_SPOTS * 3, sizeof(*ThrSpsAll));
+  NFHitBuffer *ScreenBufs = calloc(numProcs, sizeof(*ScreenBufs));
+  // Screening hits of earlier runs on the same reduced data (CPU path).
+  int useScreenCache = screenCacheDir[0] != '\0';
+  char *screenCacheKey = NULL;
+  ScreenCache ScreenCacheIn, *ScreenCacheNew = NULL;
+  int32_t *CacheOriAll = NULL;
+  double *CacheFracAll = NULL;
+  memset(&ScreenCacheIn, 0, sizeof(ScreenCacheIn));
+  if (useScreenCache) {
+    size_t keySize = 4096 + 128 * (size_t)nLayers;
+    screenCacheKey = calloc(keySize, 1);
+    int len = snprintf(screenCacheKey, keySize,
+                       "nrFiles %d nLayers %d OmegaStart %.17g OmegaStep "
+                       "%.17g px %.17g NrPixels %d %d tilts %.17g %.17g "
+                       "%.17g Wedge %.17g\n",
+                       nrFiles, nLayers, OmegaStart, OmegaStep, px, NrPixelsY,
+                       NrPixelsZ, tx, ty, tz, Wedge);
+    for (it = 0; it < nLayers; it++)
+      len += snprintf(screenCacheKey + len, keySize - len,
+                      "Lsd %.17g BC %.17g %.17g\n", Lsd[it], ybc[it], zbc[it]);
+    ScreenCache_keyFile(screenCacheKey, keySize, file_name);
+    ScreenCache_keyFile(screenCacheKey, keySize, spfn);
+    ScreenCache_keyFile(screenCacheKey, keySize, omfn);
+    ScreenCache_keyFile(screenCacheKey, keySize, fnKey);
+    int nCacheFiles =
+        ScreenCache_load(&ScreenCacheIn, screenCacheDir, screenCacheKey);
+    if (ScreenCache_index(&ScreenCacheIn, screenCacheTol) != 0) {
+      printf("Warning: could not index the screening cache, ignoring it.\n");
+      ScreenCache_free(&ScreenCacheIn);
+    }
+    printf("Screening cache %s: %lld voxel(s) from %d file(s), tol %.3f\n",
+           screenCacheDir, (long long)ScreenCacheIn.nVoxels, nCacheFiles,
+           screenCacheTol);
+    ScreenCacheNew = calloc(numProcs, sizeof(*ScreenCacheNew));
+    CacheOriAll = malloc((size_t)numProcs * MAX_POINTS_GRID_GOOD *
+                         sizeof(*CacheOriAll));
+    CacheFracAll = malloc((size_t)numProcs * MAX_POINTS_GRID_GOOD *
+                          sizeof(*CacheFracAll));
+  }
   printf("Number of individual diffracting planes: %d\n", n_hkls);
 
   // Precompute crystal symmetries for misorientation uniqueness check
@@ -1388,12 +1496,51 @@ cpu_fallback:
   int *cpu_diag_ori = (int *)malloc(cpu_diag_cap * sizeof(int));
   double *cpu_diag_frac = (double *)malloc(cpu_diag_cap * sizeof(double));
 
+  // Neighbour seeding: visit voxels in spatial order and try the fitted
+  // orientations of solved neighbours before the full screen.
+  VoxelNeighbors Nbrs;
+  memset(&Nbrs, 0, sizeof(Nbrs));
+  double *NbrOM = NULL, *NbrRow = NULL;
+  int *NbrSolved = NULL;
+  int cpu_seeded = 0;
+  if (neighborSeeding && !screen_only) {
+    double *vxs = malloc(nrows * sizeof(*vxs));
+    double *vys = malloc(nrows * sizeof(*vys));
+    int *vvalid = malloc(nrows * sizeof(*vvalid));
+    double gsMax = 0;
+    for (it = 0; it < nrows; it++) {
+      vxs[it] = parsed_lines[it].xs;
+      vys[it] = parsed_lines[it].ys;
+      vvalid[it] = parsed_lines[it].valid;
+      if (vvalid[it] && parsed_lines[it].gs > gsMax)
+        gsMax = parsed_lines[it].gs;
+    }
+    if (VoxelNeighbors_build(&Nbrs, nrows, vxs, vys, vvalid,
+                             NEIGHBOR_SEED_RADIUS * gsMax) == 0) {
+      NbrOM = malloc((size_t)nrows * 9 * sizeof(*NbrOM));
+      NbrRow = malloc(nrows * sizeof(*NbrRow));
+      NbrSolved = calloc(nrows, sizeof(*NbrSolved));
+      printf("Neighbor seeding: %d voxels, %d neighbor links\n", nrows,
+             Nbrs.start[nrows]);
+    } else {
+      printf("Warning: could not build voxel neighbor lists, screening "
+             "every voxel.\n");
+      VoxelNeighbors_free(&Nbrs);
+    }
+    free(vxs);
+    free(vys);
+    free(vvalid);
+  }
+
+  int wave;
 #pragma omp parallel for num_threads(numProcs) private(rown) schedule(dynamic) \
-    reduction(+:cpu_screen_accum, cpu_fit_accum, cpu_total_winners)
-  for (rown = startRowNr; rown <= endRowNr; rown++) {
+    reduction(+:cpu_screen_accum, cpu_fit_accum, cpu_total_winners, cpu_seeded)
+  for (wave = startRowNr; wave <= endRowNr; wave++) {
     //~ clock_t start, end;
     //~ double diftotal;
     //~ start = clock();
+    rown = Nbrs.order != NULL ? startRowNr + Nbrs.order[wave - startRowNr]
+                              : wave;
     int procNum = omp_get_thread_num();
     int i, j, k, m;
     int idx = rown - startRowNr;
@@ -1460,7 +1607,64 @@ cpu_fallback:
     int **InPixels;
     InPixels = allocMatrixIntF(NrPixelsGrid, 2);
     double tScreenStart = omp_get_wtime();
-    for (i = 0; i < NrOrientations; i++) {
+    // Fitted orientations of solved neighbours, one per library row,
+    // closest neighbour first.  Those reaching MinFracAccept become the
+    // phase-2 seeds and the full screen is skipped.
+    int seeded = 0;
+    if (NbrSolved != NULL) {
+      int seedFrom[NEIGHBOR_MAX_SEEDS], nSeeds = 0, s;
+      for (k = Nbrs.start[idx];
+           k < Nbrs.start[idx + 1] && nSeeds < NEIGHBOR_MAX_SEEDS; k++) {
+        int nb = Nbrs.nbr[k], solved;
+#pragma omp atomic read
+        solved = NbrSolved[nb];
+        if (!solved)
+          continue;
+#pragma omp flush
+        for (s = 0; s < nSeeds; s++)
+          if (NbrRow[seedFrom[s]] == NbrRow[nb])
+            break;
+        if (s == nSeeds)
+          seedFrom[nSeeds++] = nb;
+      }
+      for (s = 0; s < nSeeds; s++) {
+        Convert9To3x3(&NbrOM[(size_t)seedFrom[s] * 9], OrientMatIn);
+        CalcOverlapAccOrient(nrFiles, nLayers, ExcludePoleAngle, Lsd,
+                             SizeObsSpots, XG, YG, RotMatTilts, OmegaStart,
+                             OmegaStep, px, ybc, zbc, gs, hkls, n_hkls, Thetas,
+                             OmegaRanges, nOmeRang, BoxSizes, P0, NrPixelsGrid,
+                             ObsSpotsInfo, OrientMatIn, &FracOverT, ThrSps,
+                             InPixels, Gs, NrPixelsY, NrPixelsZ);
+        if (FracOverT < minFracOverlap)
+          continue;
+        for (j = 0; j < 9; j++)
+          OrientMatrix[OrientationGoodID * 10 + j] =
+              NbrOM[(size_t)seedFrom[s] * 9 + j];
+        OrientMatrix[OrientationGoodID * 10 + 9] = NbrRow[seedFrom[s]];
+        OrientationGoodID++;
+      }
+      seeded = OrientationGoodID > 0;
+      cpu_seeded += seeded;
+    }
+    // A cached voxel either gives the hits directly (exact) or a shortlist
+    // of orientations to screen (within ScreenCacheTol).
+    const ScreenCacheVoxel *cached = NULL;
+    int cachedExact = 0;
+    if (useScreenCache && !seeded)
+      cached = ScreenCache_find(&ScreenCacheIn, xs, ys, gs, y1, y2,
+                                minFracOverlap, screenCacheTol, &cachedExact);
+    int32_t *CacheOri = NULL;
+    double *CacheFrac = NULL;
+    if (useScreenCache && !seeded && cached == NULL) {
+      CacheOri = &CacheOriAll[(size_t)MAX_POINTS_GRID_GOOD * procNum];
+      CacheFrac = &CacheFracAll[(size_t)MAX_POINTS_GRID_GOOD * procNum];
+    }
+    int nCand = seeded ? 0 : cached != NULL ? cached->nHits : NrOrientations;
+    int cand;
+    for (cand = 0; cand < nCand; cand++) {
+      i = cached != NULL ? ScreenCacheIn.ori[cached->firstHit + cand] : cand;
+      if (i < 0 || i >= NrOrientations)
+        continue;
       NrSpotsThis = NrSpots[i][0];
       StartingRowNr = NrSpots[i][1];
       m = 0;
@@ -1472,19 +1676,35 @@ cpu_fallback:
       }
       m = 0;
       NormalizeMat(OrientationMatThisUnNorm, OrientationMatThis);
-      for (j = StartingRowNr; j < (StartingRowNr + NrSpotsThis); j++) {
-        ThrSps[m * 3 + 0] = SpotsMat[j * 3 + 0];
-        ThrSps[m * 3 + 1] = SpotsMat[j * 3 + 1];
-        ThrSps[m * 3 + 2] = SpotsMat[j * 3 + 2];
-        m++;
+      if (cachedExact) {
+        FracOverT = ScreenCacheIn.frac[cached->firstHit + cand];
+      } else {
+        for (j = StartingRowNr; j < (StartingRowNr + NrSpotsThis); j++) {
+          ThrSps[m * 3 + 0] = SpotsMat[j * 3 + 0];
+          ThrSps[m * 3 + 1] = SpotsMat[j * 3 + 1];
+          ThrSps[m * 3 + 2] = SpotsMat[j * 3 + 2];
+          m++;
+        }
+        Convert9To3x3(OrientationMatThis, OrientMatIn);
+        // Hoisted InPixels allocation to before loop
+        if (Pyramid.nLevels > 0)
+          ScreenFracOverlap(nrFiles, nLayers, NrSpotsThis, ThrSps, OmegaStart,
+                            OmegaStep, XG, YG, Lsd, RotMatTilts, px, ybc, zbc,
+                            gs, P0, ObsSpotsInfo, &Pyramid, minFracOverlap,
+                            &FracOverT, InPixels, NrPixelsY, NrPixelsZ,
+                            &ScreenBufs[procNum]);
+        else
+          CalcFracOverlap(nrFiles, nLayers, NrSpotsThis, ThrSps, OmegaStart,
+                          OmegaStep, XG, YG, Lsd, SizeObsSpots, RotMatTilts, px,
+                          ybc, zbc, gs, P0, NrPixelsGrid, ObsSpotsInfo,
+                          OrientMatIn, &FracOverT, InPixels, NrPixelsY,
+                          NrPixelsZ);
       }
-      Convert9To3x3(OrientationMatThis, OrientMatIn);
-      // Hoisted InPixels allocation to before loop
-      CalcFracOverlap(nrFiles, nLayers, NrSpotsThis, ThrSps, OmegaStart,
-                      OmegaStep, XG, YG, Lsd, SizeObsSpots, RotMatTilts, px,
-                      ybc, zbc, gs, P0, NrPixelsGrid, ObsSpotsInfo, OrientMatIn,
-                      &FracOverT, InPixels, NrPixelsY, NrPixelsZ);
       if (FracOverT >= minFracOverlap) {
+        if (CacheOri != NULL) {
+          CacheOri[OrientationGoodID] = i;
+          CacheFrac[OrientationGoodID] = FracOverT;
+        }
         for (j = 0; j < 9; j++) {
           OrientMatrix[OrientationGoodID * 10 + j] = OrientationMatThis[j];
         }
@@ -1510,6 +1730,23 @@ cpu_fallback:
       }
     }
     FreeMemMatrixInt(InPixels, NrPixelsGrid);
+    if (CacheOri != NULL) {
+      ScreenCacheVoxel rec;
+      memset(&rec, 0, sizeof(rec));
+      rec.xs = xs;
+      rec.ys = ys;
+      rec.gs = gs;
+      rec.y1 = y1;
+      rec.y2 = y2;
+      rec.minFrac = minFracOverlap;
+      rec.nHits = OrientationGoodID;
+      rec.truncated = OrientationGoodID >= MAX_POINTS_GRID_GOOD;
+      if (ScreenCache_add(&ScreenCacheNew[procNum], &rec, CacheOri,
+                          CacheFrac) != 0)
+        printf("Warning: out of memory for the screening cache, voxel %d "
+               "not cached.\n",
+               rown);
+    }
     double tScreenEnd = omp_get_wtime();
     cpu_screen_accum += (tScreenEnd - tScreenStart);
     cpu_total_winners += OrientationGoodID;
@@ -1647,6 +1884,17 @@ cpu_fallback:
       if (verbose) printf("No good ID found.\n");
       continue;
     }
+    if (NbrSolved != NULL && BestFrac >= minFracOverlap) {
+      double BestOM[3][3];
+      Euler2OrientMat(BestEuler, BestOM);
+      for (j = 0; j < 3; j++)
+        for (k = 0; k < 3; k++)
+          NbrOM[(size_t)idx * 9 + j * 3 + k] = BestOM[j][k];
+      NbrRow[idx] = bestRowNr;
+#pragma omp flush
+#pragma omp atomic write
+      NbrSolved[idx] = 1;
+    }
     double tFitElapsed = omp_get_wtime() - tFitStart;
     // printf("Point %d: fitting done in %.2fs, %d total nlopt evals, "
     //        "bestFrac=%.4f\n",
@@ -1728,12 +1976,38 @@ cpu_fallback:
   free(cpu_diag_vox);
   free(cpu_diag_ori);
   free(cpu_diag_frac);
+  VoxelNeighbors_free(&Nbrs);
+  free(NbrOM);
+  free(NbrRow);
+  free(NbrSolved);
+  if (useScreenCache) {
+    // One file per run: merge the per-thread records.
+    for (it = 1; it < numProcs; it++)
+      for (int v = 0; v < ScreenCacheNew[it].nVoxels; v++) {
+        const ScreenCacheVoxel *e = &ScreenCacheNew[it].voxels[v];
+        if (ScreenCache_add(&ScreenCacheNew[0], e,
+                            ScreenCacheNew[it].ori + e->firstHit,
+                            ScreenCacheNew[it].frac + e->firstHit) != 0)
+          break;
+      }
+    if (ScreenCache_write(&ScreenCacheNew[0], screenCacheDir, screenCacheKey,
+                          blockNr) != 0)
+      printf("Warning: could not write the screening cache to %s.\n",
+             screenCacheDir);
+    else
+      printf("Screening cache: %lld new voxel(s) written to %s\n",
+             (long long)ScreenCacheNew[0].nVoxels, screenCacheDir);
+  }
 
   printf("\n=== CPU PATH TIMING ===\n");
   printf("NF CPU: Phase 1 screening: %.2f s (sum of per-thread times)\n", cpu_screen_accum);
   printf("NF CPU: Phase 2 fitting:   %.2f s (sum of per-thread times)\n", cpu_fit_accum);
   printf("NF CPU: wall time:         %.2f s (%d voxels, %d orientations, %d threads)\n",
          cpu_wall_elapsed, endRowNr - startRowNr + 1, NrOrientations, numProcs);
+  if (neighborSeeding && !screen_only)
+    printf("NF CPU: neighbor-seeded:   %d of %d voxels skipped the full "
+           "screen\n",
+           cpu_seeded, endRowNr - startRowNr + 1);
   printf("NF CPU: total winners:     %d (avg %.1f/voxel)\n",
          cpu_total_winners,
          (endRowNr - startRowNr + 1) > 0 ? (double)cpu_total_winners / (endRowNr - startRowNr + 1) : 0);
@@ -1749,6 +2023,11 @@ skip_cpu_path:
   close(result2);
   munmap(ObsSpotsInfo, size);
   close(descp);
+  SpotsPyramid_close(&Pyramid);
+  g_spotsTiled = NULL;
+  SpotsTiled_close(&TiledSpots);
+  g_spotsSparse = NULL;
+  SpotsSparse_close(&SparseSpots);
   munmap(SpotsMat, size2);
   close(spf);
   munmap(OrientationMatrix, size3);
@@ -1757,6 +2036,17 @@ skip_cpu_path:
   close(keyfd);
   free(OrientMatrixAll);
   free(ThrSpsAll);
+  for (it = 0; it < numProcs; it++)
+    free(ScreenBufs[it].hits);
+  free(ScreenBufs);
+  ScreenCache_free(&ScreenCacheIn);
+  if (ScreenCacheNew != NULL)
+    for (it = 0; it < numProcs; it++)
+      ScreenCache_free(&ScreenCacheNew[it]);
+  free(ScreenCacheNew);
+  free(CacheOriAll);
+  free(CacheFracAll);
+  free(screenCacheKey);
   FreeMemMatrixInt(NrSpots, NrOrientations);
   double time = omp_get_wtime() - start_time;
   printf("Finished, time elapsed: %lf seconds.\n", time);
@@ -4,6 +4,7 @@
 //
 
 #include "midas_version.h"
+#include "SpotsSparse.h"
 #include <ctype.h>
 #include <omp.h>
 #include <stdint.h>
@@ -411,9 +412,13 @@ int main(int argc, char *argv[]) {
   fDS = fopen(DS, "wb");
   fKEY = fopen(KEY, "wb");
   fOM = fopen(OM, "wb");
-  if (skipBin == 0 && !precomputedSpotsInfo)
+  if (skipBin == 0 && !precomputedSpotsInfo) {
     if (checkFOPEN(fSI, SI))
       return 1;
+    // Sparse copies of the old SpotsInfo.bin would no longer match.
+    for (i = 0; i < nLayers; i++)
+      SpotsSparse_remove(outputDir, i);
+  }
   if (checkFOPEN(fDS, DS))
     return 1;
   if (checkFOPEN(fKEY, KEY))
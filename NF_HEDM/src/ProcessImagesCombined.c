@@ -24,6 +24,9 @@
 #include <time.h>
 #include <unistd.h>
 #include "midas_version.h"
+#include "SpotsPyramid.h"
+#include "SpotsSparse.h"
+#include "SpotsTiled.h"
 
 #define SetBit(A, k) (A[(k / 32)] |= (1 << (k % 32)))
 #define ClearBit(A, k) (A[(k / 32)] &= ~(1 << (k % 32)))
@@ -645,7 +648,7 @@ int main(int argc, char *argv[]) {
   int NrPixelsY = 0, NrPixelsZ = 0;
   int BlanketSubtraction = 0, MeanFiltRadius = 1, WriteFinImage = 0;
   int LoGMaskRadius = 4, DoLoGFilter = 1, WFImages = 0, doDeblur = 0;
-  int nDistances = 1, writeLegacyBin = 0;
+  int nDistances = 1, writeLegacyBin = 0, writeTiled = 0, writeSparse = 0;
   double sigma = 1.0;
   int nLayers = atoi(argv[2]);
 
@@ -776,6 +779,18 @@ int main(int argc, char *argv[]) {
       sscanf(aline, "%s %d", dummy, &writeLegacyBin);
       continue;
     }
+    str = "WriteSparseSpotsInfo ";
+    LowNr = strncmp(aline, str, strlen(str));
+    if (LowNr == 0) {
+      sscanf(aline, "%s %d", dummy, &writeSparse);
+      continue;
+    }
+    str = "WriteTiledSpotsInfo ";
+    LowNr = strncmp(aline, str, strlen(str));
+    if (LowNr == 0) {
+      sscanf(aline, "%s %d", dummy, &writeTiled);
+      continue;
+    }
   }
   fclose(fileParam);
 
@@ -906,6 +921,10 @@ int main(int argc, char *argv[]) {
   size_t siBytes = SizeObsSpots * sizeof(int);
   char siFN[1024];
   sprintf(siFN, "%s/SpotsInfo.bin", outputDir);
+  // Derived copies of the other distances stay valid only if nobody else
+  // changed SpotsInfo.bin since they were written.
+  struct stat siBefore;
+  int siExisted = stat(siFN, &siBefore) == 0;
   // Create file on first layer, open existing on subsequent layers
   int sifd = open(siFN, O_RDWR | O_CREAT, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
   if (sifd < 0) {
@@ -1170,9 +1189,36 @@ int main(int argc, char *argv[]) {
 
   // Sync and unmap SpotsInfo.bin
   msync(ObsSpotsInfo, siBytes, MS_SYNC);
+  printf("SpotsInfo.bin synced for layer %d.\n", nLayers);
+  // Coarse levels for orientation screening in FitOrientationOMP
+  if (SpotsPyramid_writeLayer(outputDir, (const uint32_t *)ObsSpotsInfo,
+                              siFN, siExisted ? &siBefore : NULL, nDistances,
+                              NrFilesPerLayer, NrPixelsY, NrPixelsZ,
+                              layer) == 0)
+    printf("SpotsInfo pyramid updated for layer %d.\n", nLayers);
+  if (writeTiled) {
+    if (SpotsTiled_writeLayer(outputDir, (const uint32_t *)ObsSpotsInfo,
+                              siFN, siExisted ? &siBefore : NULL, nDistances,
+                              NrFilesPerLayer, NrPixelsY, NrPixelsZ,
+                              layer) == 0)
+      printf("%s updated for layer %d.\n", SPOTS_TILED_FN, nLayers);
+    else
+      printf("Warning: could not write %s/%s.\n", outputDir, SPOTS_TILED_FN);
+  }
+  if (writeSparse) {
+    if (SpotsSparse_writeLayer(outputDir, (const uint32_t *)ObsSpotsInfo,
+                               siFN, siExisted ? &siBefore : NULL, nDistances,
+                               NrFilesPerLayer, NrPixelsY, NrPixelsZ,
+                               layer) == 0)
+      printf("Sparse SpotsInfo written for layer %d.\n", nLayers);
+    else
+      printf("Warning: could not write the sparse SpotsInfo for layer %d.\n",
+             nLayers);
+  } else {
+    SpotsSparse_remove(outputDir, layer);
+  }
   munmap(ObsSpotsInfo, siBytes);
   close(sifd);
-  printf("SpotsInfo.bin synced for layer %d.\n", nLayers);
 
   free(AllIntensities);
   free(MedianArray);
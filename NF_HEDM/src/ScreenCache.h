@@ -0,0 +1,334 @@
+//
+// Copyright (c) 2014, UChicago Argonne, LLC
+// See LICENSE file.
+//
+// ScreenCache.h - On-disk cache of FitOrientationOMP screening hits
+//
+// Phase 1 of FitOrientationOMP tests every orientation at every voxel.  When
+// a reconstruction is re-run on the same reduced data (another
+// MinFracAccept, a voxel subset, a refined grid) most voxels get exactly
+// the same hits again.  With ScreenCacheDir set, every block writes the
+// hits (orientation row and FracOverT) of the voxels it screened, and later
+// runs look voxels up before screening:
+//
+//   - same voxel (centre, size and triangle within 1e-6 um) screened with a
+//     MinFracAccept no higher than the current one: the stored hits are
+//     filtered by the current threshold, no screening at all.  This gives
+//     the same winners as a full screen.  A list cut at
+//     MAX_POINTS_GRID_GOOD is only reused at the same threshold.
+//   - otherwise, with ScreenCacheTol > 0, the nearest cached voxel whose
+//     centre lies within the tolerance supplies a shortlist: only its hit
+//     orientations are screened here.  That is an approximation (an
+//     orientation that missed there is not tried here) and is off by
+//     default.
+//
+// Entries are only valid for one set of inputs.  The cache key is a text
+// description of the reduced-data files (size, mtime, inode) and of every
+// geometry value the screen depends on; files carry the full key and are
+// named after its 64-bit FNV-1a hash, so a mismatching run neither reads
+// nor overwrites them.  Each block writes its own file through a temporary
+// name, so concurrent blocks do not interfere.
+//
+// Format:
+//   ScreenCache_<hash16>_<block>_<pid>.bin:
+//     Header: [uint32 magic 'NFSC'][int32 version][int32 keyLen]
+//             [int32 reserved][int64 nVoxels][int64 nHits]
+//             [uint8 reserved x 32]
+//     Key:    char x keyLen
+//     Voxels: ScreenCacheVoxel x nVoxels
+//     Hits:   int32 orientation x nHits, then float64 FracOverT x nHits
+
+#ifndef SCREEN_CACHE_H
+#define SCREEN_CACHE_H
+
+#include <dirent.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define SCREEN_CACHE_MAGIC 0x43534E46u /* "NFSC" little-endian */
+#define SCREEN_CACHE_VERSION 1
+#define SCREEN_CACHE_HEADER_BYTES 64
+#define SCREEN_CACHE_SAME_POS 1e-6 /* um, "same voxel" */
+
+typedef struct {
+  double xs, ys, gs, y1, y2;
+  double minFrac;    /* MinFracAccept of the run that screened it */
+  int64_t firstHit;  /* into the hit arrays */
+  int32_t nHits;
+  int32_t truncated; /* stopped at MAX_POINTS_GRID_GOOD hits */
+} ScreenCacheVoxel;
+
+typedef struct {
+  ScreenCacheVoxel *voxels;
+  int32_t *ori;
+  double *frac;
+  int64_t nVoxels, nHits, capVoxels, capHits;
+  /* lookup: chained grid cells */
+  int64_t *head, *next;
+  int64_t nBuckets;
+  double cell;
+} ScreenCache;
+
+static inline uint64_t ScreenCache_fnv1a(const char *s) {
+  uint64_t h = 14695981039346656037ULL;
+  for (; *s; s++) {
+    h ^= (unsigned char)*s;
+    h *= 1099511628211ULL;
+  }
+  return h;
+}
+
+/**
+ * Append "name size mtime inode" of fn to key.
+ */
+static inline void ScreenCache_keyFile(char *key, size_t n, const char *fn) {
+  struct stat s;
+  size_t len = strlen(key);
+  if (stat(fn, &s) != 0)
+    snprintf(key + len, n - len, "%s missing\n", fn);
+  else
+    snprintf(key + len, n - len, "%s %lld %lld %llu\n", fn,
+             (long long)s.st_size, (long long)s.st_mtime,
+             (unsigned long long)s.st_ino);
+}
+
+static inline int ScreenCache_reserve(ScreenCache *c, int64_t voxels,
+                                      int64_t hits) {
+  if (c->nVoxels + voxels > c->capVoxels) {
+    int64_t cap = 2 * c->capVoxels + voxels + 64;
+    ScreenCacheVoxel *v = (ScreenCacheVoxel *)realloc(
+        c->voxels, (size_t)cap * sizeof(*v));
+    if (v == NULL)
+      return -1;
+    c->voxels = v;
+    c->capVoxels = cap;
+  }
+  if (c->nHits + hits > c->capHits) {
+    int64_t cap = 2 * c->capHits + hits + 256;
+    int32_t *o = (int32_t *)realloc(c->ori, (size_t)cap * sizeof(*o));
+    if (o == NULL)
+      return -1;
+    c->ori = o;
+    double *f = (double *)realloc(c->frac, (size_t)cap * sizeof(*f));
+    if (f == NULL)
+      return -1;
+    c->frac = f;
+    c->capHits = cap;
+  }
+  return 0;
+}
+
+/**
+ * Add one screened voxel.  Returns 0, or -1 if out of memory.
+ */
+static inline int ScreenCache_add(ScreenCache *c, const ScreenCacheVoxel *v,
+                                  const int32_t *ori, const double *frac) {
+  if (ScreenCache_reserve(c, 1, v->nHits) != 0)
+    return -1;
+  ScreenCacheVoxel *d = &c->voxels[c->nVoxels++];
+  *d = *v;
+  d->firstHit = c->nHits;
+  memcpy(c->ori + c->nHits, ori, (size_t)v->nHits * sizeof(*ori));
+  memcpy(c->frac + c->nHits, frac, (size_t)v->nHits * sizeof(*frac));
+  c->nHits += v->nHits;
+  return 0;
+}
+
+static inline int64_t ScreenCache_bucket(const ScreenCache *c, int64_t cx,
+                                         int64_t cy) {
+  uint64_t h = (uint64_t)cx * 0x9E3779B97F4A7C15ULL ^
+               (uint64_t)cy * 0xC2B2AE3D27D4EB4FULL;
+  return (int64_t)((h ^ (h >> 29)) & (uint64_t)(c->nBuckets - 1));
+}
+
+/**
+ * Build the lookup grid; cells are tol wide (at least 1 um).
+ */
+static inline int ScreenCache_index(ScreenCache *c, double tol) {
+  free(c->head);
+  free(c->next);
+  c->cell = tol > 1.0 ? tol : 1.0;
+  c->nBuckets = 1;
+  while (c->nBuckets < 2 * c->nVoxels)
+    c->nBuckets <<= 1;
+  c->head = (int64_t *)malloc((size_t)c->nBuckets * sizeof(int64_t));
+  c->next = (int64_t *)malloc((size_t)(c->nVoxels + 1) * sizeof(int64_t));
+  if (c->head == NULL || c->next == NULL)
+    return -1;
+  for (int64_t b = 0; b < c->nBuckets; b++)
+    c->head[b] = -1;
+  for (int64_t v = 0; v < c->nVoxels; v++) {
+    int64_t b = ScreenCache_bucket(c, (int64_t)floor(c->voxels[v].xs / c->cell),
+                                   (int64_t)floor(c->voxels[v].ys / c->cell));
+    c->next[v] = c->head[b];
+    c->head[b] = v;
+  }
+  return 0;
+}
+
+/**
+ * Find a cached screen for voxel (xs, ys, gs, y1, y2) at threshold minFrac.
+ * @param exact  set to 1 if the hits can be reused as they are, 0 if they
+ *               are only a shortlist (tol > 0)
+ * @return the cached voxel or NULL
+ */
+static inline const ScreenCacheVoxel *
+ScreenCache_find(const ScreenCache *c, double xs, double ys, double gs,
+                 double y1, double y2, double minFrac, double tol,
+                 int *exact) {
+  *exact = 0;
+  if (c->nVoxels == 0 || c->head == NULL)
+    return NULL;
+  int64_t cx = (int64_t)floor(xs / c->cell), cy = (int64_t)floor(ys / c->cell);
+  const ScreenCacheVoxel *best = NULL;
+  double bestD2 = tol * tol;
+  for (int64_t dx = -1; dx <= 1; dx++) {
+    for (int64_t dy = -1; dy <= 1; dy++) {
+      for (int64_t v = c->head[ScreenCache_bucket(c, cx + dx, cy + dy)];
+           v >= 0; v = c->next[v]) {
+        const ScreenCacheVoxel *e = &c->voxels[v];
+        if (e->minFrac > minFrac)
+          continue;
+        double d2 = (e->xs - xs) * (e->xs - xs) + (e->ys - ys) * (e->ys - ys);
+        if (d2 <= SCREEN_CACHE_SAME_POS * SCREEN_CACHE_SAME_POS &&
+            fabs(e->gs - gs) <= SCREEN_CACHE_SAME_POS &&
+            fabs(e->y1 - y1) <= SCREEN_CACHE_SAME_POS &&
+            fabs(e->y2 - y2) <= SCREEN_CACHE_SAME_POS &&
+            (!e->truncated || e->minFrac == minFrac)) {
+          *exact = 1;
+          return e;
+        }
+        if (tol > 0 && d2 <= bestD2 && !e->truncated) {
+          best = e;
+          bestD2 = d2;
+        }
+      }
+    }
+  }
+  return best;
+}
+
+/**
+ * Load every cache file in dir written for key.  Unreadable or foreign
+ * files are skipped.  Returns the number of files loaded.
+ */
+static inline int ScreenCache_load(ScreenCache *c, const char *dir,
+                                   const char *key) {
+  char prefix[64];
+  snprintf(prefix, sizeof(prefix), "ScreenCache_%016llx_",
+           (unsigned long long)ScreenCache_fnv1a(key));
+  DIR *d = opendir(dir);
+  if (d == NULL)
+    return 0;
+  int nFiles = 0;
+  size_t keyLen = strlen(key);
+  char *keyBuf = (char *)malloc(keyLen + 1);
+  struct dirent *de;
+  while (keyBuf != NULL && (de = readdir(d)) != NULL) {
+    size_t nameLen = strlen(de->d_name);
+    if (strncmp(de->d_name, prefix, strlen(prefix)) != 0 || nameLen < 4 ||
+        strcmp(de->d_name + nameLen - 4, ".bin") != 0)
+      continue;
+    char fn[4096];
+    snprintf(fn, sizeof(fn), "%s/%s", dir, de->d_name);
+    FILE *f = fopen(fn, "rb");
+    if (f == NULL)
+      continue;
+    unsigned char h[SCREEN_CACHE_HEADER_BYTES];
+    uint32_t magic = 0;
+    int32_t ints[3] = {0, 0, 0};
+    int64_t counts[2] = {0, 0};
+    int ok = fread(h, sizeof(h), 1, f) == 1;
+    if (ok) {
+      memcpy(&magic, h, 4);
+      memcpy(ints, h + 4, sizeof(ints));
+      memcpy(counts, h + 16, sizeof(counts));
+      ok = magic == SCREEN_CACHE_MAGIC && ints[0] == SCREEN_CACHE_VERSION &&
+           (size_t)ints[1] == keyLen && counts[0] >= 0 && counts[1] >= 0 &&
+           fread(keyBuf, 1, keyLen, f) == keyLen &&
+           memcmp(keyBuf, key, keyLen) == 0;
+    }
+    int64_t v0 = c->nVoxels, h0 = c->nHits;
+    if (ok)
+      ok = ScreenCache_reserve(c, counts[0], counts[1]) == 0 &&
+           fread(c->voxels + v0, sizeof(ScreenCacheVoxel), counts[0], f) ==
+               (size_t)counts[0] &&
+           fread(c->ori + h0, sizeof(int32_t), counts[1], f) ==
+               (size_t)counts[1] &&
+           fread(c->frac + h0, sizeof(double), counts[1], f) ==
+               (size_t)counts[1];
+    fclose(f);
+    if (!ok)
+      continue;
+    for (int64_t v = 0; v < counts[0]; v++) {
+      ScreenCacheVoxel *e = &c->voxels[v0 + v];
+      if (e->firstHit < 0 || e->nHits < 0 ||
+          e->firstHit + e->nHits > counts[1]) {
+        ok = 0;
+        break;
+      }
+      e->firstHit += h0;
+    }
+    if (!ok)
+      continue; /* voxels past v0 are overwritten by the next file */
+    c->nVoxels += counts[0];
+    c->nHits += counts[1];
+    nFiles++;
+  }
+  free(keyBuf);
+  closedir(d);
+  return nFiles;
+}
+
+/**
+ * Write the entries of c for key as one new file in dir.
+ * @return 0 on success (or nothing to write), -1 on failure
+ */
+static inline int ScreenCache_write(const ScreenCache *c, const char *dir,
+                                    const char *key, int block) {
+  if (c->nVoxels == 0)
+    return 0;
+  char fn[4096], tmpFN[4200];
+  snprintf(fn, sizeof(fn), "%s/ScreenCache_%016llx_%d_%ld.bin", dir,
+           (unsigned long long)ScreenCache_fnv1a(key), block, (long)getpid());
+  snprintf(tmpFN, sizeof(tmpFN), "%s.tmp", fn);
+  FILE *f = fopen(tmpFN, "wb");
+  if (f == NULL)
+    return -1;
+  unsigned char h[SCREEN_CACHE_HEADER_BYTES];
+  memset(h, 0, sizeof(h));
+  uint32_t magic = SCREEN_CACHE_MAGIC;
+  int32_t ints[3] = {SCREEN_CACHE_VERSION, (int32_t)strlen(key), 0};
+  int64_t counts[2] = {c->nVoxels, c->nHits};
+  memcpy(h, &magic, 4);
+  memcpy(h + 4, ints, sizeof(ints));
+  memcpy(h + 16, counts, sizeof(counts));
+  int ok = fwrite(h, sizeof(h), 1, f) == 1 &&
+           fwrite(key, 1, strlen(key), f) == strlen(key) &&
+           fwrite(c->voxels, sizeof(ScreenCacheVoxel), c->nVoxels, f) ==
+               (size_t)c->nVoxels &&
+           fwrite(c->ori, sizeof(int32_t), c->nHits, f) == (size_t)c->nHits &&
+           fwrite(c->frac, sizeof(double), c->nHits, f) == (size_t)c->nHits;
+  ok = (fclose(f) == 0) && ok;
+  if (ok)
+    ok = rename(tmpFN, fn) == 0;
+  if (!ok)
+    remove(tmpFN);
+  return ok ? 0 : -1;
+}
+
+static inline void ScreenCache_free(ScreenCache *c) {
+  free(c->voxels);
+  free(c->ori);
+  free(c->frac);
+  free(c->head);
+  free(c->next);
+  memset(c, 0, sizeof(*c));
+}
+
+#endif /* SCREEN_CACHE_H */
@@ -22,6 +22,8 @@
 extern int Flag;
 extern double Wedge;
 int g_debugCalcFrac = 0;  // Debug: print per-spot rejection in CalcFracOverlap
+const SpotsTiled *g_spotsTiled = NULL; // Tiled SpotsInfo, replaces ObsSpotsInfo
+const SpotsSparse *g_spotsSparse = NULL; // Sparse SpotsInfo, preferred if set
 extern double Wavelength;
 extern double OmegaRang[MAX_N_OMEGA_RANGES][2];
 extern int nOmeRang;
@@ -476,6 +478,161 @@ static inline double CorrectWedge(double eta, double theta, double wl,
   return Omega;
 }
 
+/**
+ * Project spot j of TheorSpots onto the first detector distance and list the
+ * pixels of the grain triangle (relative to YZSpotsTemp) in InPixels.
+ * @return 1 if the spot falls outside the omega range or the detector
+ */
+static int SpotFootprint(const int j, const int NrOfFiles, const int nLayers,
+                         double *TheorSpots, double OmegaStart,
+                         double OmegaStep, double XGrain[3], double YGrain[3],
+                         const double Lsds[nLayers], double RotMatTilts[3][3],
+                         const double px, const double ybc, const double zbc,
+                         const double gs, double P0[3], int **InPixels,
+                         int NrPixelsY, int NrPixelsZ, int *OmeBinOut,
+                         double YZSpotsTemp[2], int *NrInPixels) {
+  int OmeBin, OutofBounds, k, l, omeRangNr;
+  double OmegaThis, ythis, zthis, XGT, YGT, Displ_Y, Displ_Z, ytemp, ztemp,
+      xyz[3], P1[3], ABC[3], outxyz[3], YZSpots[3][2], YZSpotsT[3][2];
+  double eta, RingRadius, theta, omediff, Lsd = Lsds[0];
+  ythis = TheorSpots[j * 3 + 0];
+  zthis = TheorSpots[j * 3 + 1];
+  OutofBounds = 1;
+  if (Wedge != 0) {
+    eta = CalcEta(ythis, zthis);
+    RingRadius = sqrt(ythis * ythis + zthis * zthis);
+    theta = rad2deg * atan(RingRadius / Lsds[0]);
+    omediff = CorrectWedge(eta, theta, Wavelength, Wedge);
+    OmegaThis = TheorSpots[j * 3 + 2] - omediff;
+    // Check if we just went outside the omegaRange, then make OutofBounds =
+    // 1;
+    if (OmegaThis >= 180) {
+      OmegaThis -= 360;
+    } else if (OmegaThis <= -180) {
+      OmegaThis += 360;
+    }
+    for (omeRangNr = 0; omeRangNr < nOmeRang; omeRangNr++) {
+      if (OmegaThis > OmegaRang[omeRangNr][0] &&
+          OmegaThis < OmegaRang[omeRangNr][1]) {
+        OutofBounds = 0;
+        break;
+      }
+    }
+  } else {
+    OmegaThis = TheorSpots[j * 3 + 2];
+    OutofBounds = 0;
+  }
+  OmeBin = (int)floor((-OmegaStart + OmegaThis) / OmegaStep);
+  if (OmeBin < 0 || OmeBin >= NrOfFiles) {
+    if (g_debugCalcFrac) printf("  CPU spot %d REJECTED: OmeBin=%d (omega=%.4f, start=%.4f, step=%.4f)\n",
+                                j, OmeBin, OmegaThis, OmegaStart, OmegaStep);
+    OutofBounds = 1;
+  }
+  *OmeBinOut = OmeBin;
+  double OmegaRad = deg2rad * OmegaThis;
+  double sinOme = sin(OmegaRad);
+  double cosOme = cos(OmegaRad);
+  for (k = 0; k < 3; k++) {
+    XGT = XGrain[k];
+    YGT = YGrain[k];
+    DisplacementSpotsPrecomp(XGT, YGT, Lsd, ythis, zthis, sinOme, cosOme,
+                             &Displ_Y, &Displ_Z);
+    ytemp = Displ_Y;
+    ztemp = Displ_Z;
+    xyz[0] = 0;
+    xyz[1] = ytemp;
+    xyz[2] = ztemp;
+    MatrixMultF(RotMatTilts, xyz, P1);
+    for (l = 0; l < 3; l++) {
+      ABC[l] = P1[l] - P0[l];
+    }
+    outxyz[0] = 0;
+    outxyz[1] = P0[1] - (ABC[1] * P0[0]) / (ABC[0]);
+    outxyz[2] = P0[2] - (ABC[2] * P0[0]) / (ABC[0]);
+    YZSpotsT[k][0] = (outxyz[1]) / px + ybc;
+    YZSpotsT[k][1] = (outxyz[2]) / px + zbc;
+    if (YZSpotsT[k][0] > NrPixelsY || YZSpotsT[k][0] < 0 ||
+        YZSpotsT[k][1] > NrPixelsZ || YZSpotsT[k][1] < 0) {
+      if (g_debugCalcFrac) printf("  CPU spot %d REJECTED: vertex %d OOB (Y=%.2f Z=%.2f, max=%d,%d)\n",
+                                  j, k, YZSpotsT[k][0], YZSpotsT[k][1], NrPixelsY, NrPixelsZ);
+      OutofBounds = 1;
+      break;
+    }
+    if (k == 2) {
+      xyz[0] = 0;
+      xyz[1] = ythis;
+      xyz[2] = zthis;
+      MatrixMultF(RotMatTilts, xyz, P1);
+      for (l = 0; l < 3; l++) {
+        ABC[l] = P1[l] - P0[l];
+      }
+      outxyz[0] = 0;
+      outxyz[1] = P0[1] - (ABC[1] * P0[0]) / (ABC[0]);
+      outxyz[2] = P0[2] - (ABC[2] * P0[0]) / (ABC[0]);
+      YZSpotsTemp[0] = (outxyz[1]) / px + ybc;
+      YZSpotsTemp[1] = (outxyz[2]) / px + zbc;
+      for (l = 0; l < 3; l++) {
+        YZSpots[l][0] = YZSpotsT[l][0] - YZSpotsTemp[0];
+        YZSpots[l][1] = YZSpotsT[l][1] - YZSpotsTemp[1];
+      }
+    }
+  }
+  if (OutofBounds == 1) {
+    return 1;
+  }
+  if (gs * 2 > px) {
+    CalcPixels2(YZSpots, InPixels, NrInPixels);
+  } else {
+    InPixels[0][0] =
+        (int)round((YZSpots[0][0] + YZSpots[1][0] + YZSpots[2][0]) / 3);
+    InPixels[0][1] =
+        (int)round((YZSpots[0][1] + YZSpots[1][1] + YZSpots[2][1]) / 3);
+    *NrInPixels = 1;
+  }
+  return 0;
+}
+
+/**
+ * Detector pixel of footprint pixel InPixel at distance Layer.
+ * @return 1 if it falls off the detector
+ */
+static inline int SpotPixelOnLayer(const double YZSpotsTemp[2],
+                                   const int InPixel[2], const double px,
+                                   const double Lsd, const double ybc,
+                                   const double zbc, const double LsdLayer,
+                                   const double ybcLayer,
+                                   const double zbcLayer, int NrPixelsY,
+                                   int NrPixelsZ, int *MultY, int *MultZ) {
+  *MultY = (int)floor(((((double)(YZSpotsTemp[0] - ybc)) * px) *
+                       (LsdLayer / Lsd)) /
+                          px +
+                      ybcLayer) +
+           InPixel[0];
+  *MultZ = (int)floor(((((double)(YZSpotsTemp[1] - zbc)) * px) *
+                       (LsdLayer / Lsd)) /
+                          px +
+                      zbcLayer) +
+           InPixel[1];
+  return *MultY >= NrPixelsY || *MultY < 0 || *MultZ >= NrPixelsZ ||
+         *MultZ < 0;
+}
+
+/**
+ * Observed-spot bit of pixel (MultY, MultZ) in frame OmeBin at distance
+ * Layer, from g_spotsSparse or g_spotsTiled when one is loaded.
+ */
+static inline int ObsSpotBit(const int *ObsSpotsInfo, int Layer,
+                             int NrOfFiles, int OmeBin, int MultY, int MultZ,
+                             int NrPixelsY, int NrPixelsZ) {
+  if (g_spotsSparse != NULL)
+    return SpotsSparse_test(g_spotsSparse, Layer, OmeBin, MultY, MultZ);
+  if (g_spotsTiled != NULL)
+    return SpotsTiled_test(g_spotsTiled, Layer, OmeBin, MultY, MultZ);
+  long long int BinNr = (long long)Layer * NrOfFiles + OmeBin;
+  BinNr = (BinNr * NrPixelsY + MultY) * NrPixelsZ + MultZ;
+  return TestBit(ObsSpotsInfo, BinNr) != 0;
+}
+
 void CalcFracOverlap(const int NrOfFiles, const int nLayers, const int nTspots,
                      double *TheorSpots, double OmegaStart, double OmegaStep,
                      double XGrain[3], double YGrain[3],
@@ -487,13 +644,9 @@ void CalcFracOverlap(const int NrOfFiles, const int nLayers, const int nTspots,
                      int *ObsSpotsInfo, double OrientMatIn[3][3],
                      double *FracOver, int **InPixels, int NrPixelsY,
                      int NrPixelsZ) {
-  int j, OmeBin, OutofBounds, k, l;
-  double OmegaThis, ythis, zthis, XGT, YGT, Displ_Y, Displ_Z, ytemp, ztemp,
-      xyz[3], P1[3], ABC[3], outxyz[3], YZSpots[3][2], Lsd, ybc, zbc, P0[3],
-      YZSpotsTemp[2], YZSpotsT[3][2];
-  int NrInPixels, OverlapPixels, Layer, omeRangNr;
-  double eta, RingRadius, theta, omediff;
-  long long int BinNr, TempCntr;
+  int j, OmeBin, OutofBounds, k;
+  double Lsd, ybc, zbc, P0[3], YZSpotsTemp[2];
+  int NrInPixels, OverlapPixels, Layer;
   int MultY, MultZ, AllDistsFound, TotalPixels;
   *FracOver = 0;
   // InPixels allocation hoisted to caller
@@ -506,133 +659,26 @@ void CalcFracOverlap(const int NrOfFiles, const int nLayers, const int nTspots,
   ybc = ybcs[0];
   zbc = zbcs[0];
   for (j = 0; j < nTspots; j++) {
-    ythis = TheorSpots[j * 3 + 0];
-    zthis = TheorSpots[j * 3 + 1];
-    OutofBounds = 1;
-    if (Wedge != 0) {
-      eta = CalcEta(ythis, zthis);
-      RingRadius = sqrt(ythis * ythis + zthis * zthis);
-      theta = rad2deg * atan(RingRadius / Lsds[0]);
-      omediff = CorrectWedge(eta, theta, Wavelength, Wedge);
-      OmegaThis = TheorSpots[j * 3 + 2] - omediff;
-      // Check if we just went outside the omegaRange, then make OutofBounds =
-      // 1;
-      if (OmegaThis >= 180) {
-        OmegaThis -= 360;
-      } else if (OmegaThis <= -180) {
-        OmegaThis += 360;
-      }
-      for (omeRangNr = 0; omeRangNr < nOmeRang; omeRangNr++) {
-        if (OmegaThis > OmegaRang[omeRangNr][0] &&
-            OmegaThis < OmegaRang[omeRangNr][1]) {
-          OutofBounds = 0;
-          break;
-        }
-      }
-    } else {
-      OmegaThis = TheorSpots[j * 3 + 2];
-      OutofBounds = 0;
-    }
-    OmeBin = (int)floor((-OmegaStart + OmegaThis) / OmegaStep);
-    if (OmeBin < 0 || OmeBin >= NrOfFiles) {
-      if (g_debugCalcFrac) printf("  CPU spot %d REJECTED: OmeBin=%d (omega=%.4f, start=%.4f, step=%.4f)\n",
-                                  j, OmeBin, OmegaThis, OmegaStart, OmegaStep);
-      OutofBounds = 1;
-    }
-    double OmegaRad = deg2rad * OmegaThis;
-    double sinOme = sin(OmegaRad);
-    double cosOme = cos(OmegaRad);
-    for (k = 0; k < 3; k++) {
-      XGT = XGrain[k];
-      YGT = YGrain[k];
-      DisplacementSpotsPrecomp(XGT, YGT, Lsd, ythis, zthis, sinOme, cosOme,
-                               &Displ_Y, &Displ_Z);
-      ytemp = Displ_Y;
-      ztemp = Displ_Z;
-      xyz[0] = 0;
-      xyz[1] = ytemp;
-      xyz[2] = ztemp;
-      MatrixMultF(RotMatTilts, xyz, P1);
-      for (l = 0; l < 3; l++) {
-        ABC[l] = P1[l] - P0[l];
-      }
-      outxyz[0] = 0;
-      outxyz[1] = P0[1] - (ABC[1] * P0[0]) / (ABC[0]);
-      outxyz[2] = P0[2] - (ABC[2] * P0[0]) / (ABC[0]);
-      YZSpotsT[k][0] = (outxyz[1]) / px + ybc;
-      YZSpotsT[k][1] = (outxyz[2]) / px + zbc;
-      if (YZSpotsT[k][0] > NrPixelsY || YZSpotsT[k][0] < 0 ||
-          YZSpotsT[k][1] > NrPixelsZ || YZSpotsT[k][1] < 0) {
-        if (g_debugCalcFrac) printf("  CPU spot %d REJECTED: vertex %d OOB (Y=%.2f Z=%.2f, max=%d,%d)\n",
-                                    j, k, YZSpotsT[k][0], YZSpotsT[k][1], NrPixelsY, NrPixelsZ);
-        OutofBounds = 1;
-        break;
-      }
-      if (k == 2) {
-        xyz[0] = 0;
-        xyz[1] = ythis;
-        xyz[2] = zthis;
-        MatrixMultF(RotMatTilts, xyz, P1);
-        for (l = 0; l < 3; l++) {
-          ABC[l] = P1[l] - P0[l];
-        }
-        outxyz[0] = 0;
-        outxyz[1] = P0[1] - (ABC[1] * P0[0]) / (ABC[0]);
-        outxyz[2] = P0[2] - (ABC[2] * P0[0]) / (ABC[0]);
-        YZSpotsTemp[0] = (outxyz[1]) / px + ybc;
-        YZSpotsTemp[1] = (outxyz[2]) / px + zbc;
-        for (l = 0; l < 3; l++) {
-          YZSpots[l][0] = YZSpotsT[l][0] - YZSpotsTemp[0];
-          YZSpots[l][1] = YZSpotsT[l][1] - YZSpotsTemp[1];
-        }
-      }
-    }
+    OutofBounds = SpotFootprint(j, NrOfFiles, nLayers, TheorSpots, OmegaStart,
+                                OmegaStep, XGrain, YGrain, Lsds, RotMatTilts,
+                                px, ybc, zbc, gs, P0, InPixels, NrPixelsY,
+                                NrPixelsZ, &OmeBin, YZSpotsTemp, &NrInPixels);
     if (OutofBounds == 1) {
       continue;
     }
-    if (gs * 2 > px) {
-      CalcPixels2(YZSpots, InPixels, &NrInPixels);
-    } else {
-      InPixels[0][0] =
-          (int)round((YZSpots[0][0] + YZSpots[1][0] + YZSpots[2][0]) / 3);
-      InPixels[0][1] =
-          (int)round((YZSpots[0][1] + YZSpots[1][1] + YZSpots[2][1]) / 3);
-      NrInPixels = 1;
-    }
     for (k = 0; k < NrInPixels; k++) {
       AllDistsFound = 1;
       for (Layer = 0; Layer < nLayers; Layer++) {
-        MultY = (int)floor(((((double)(YZSpotsTemp[0] - ybc)) * px) *
-                            (Lsds[Layer] / Lsd)) /
-                               px +
-                           ybcs[Layer]) +
-                InPixels[k][0];
-        MultZ = (int)floor(((((double)(YZSpotsTemp[1] - zbc)) * px) *
-                            (Lsds[Layer] / Lsd)) /
-                               px +
-                           zbcs[Layer]) +
-                InPixels[k][1];
-        if (MultY >= NrPixelsY || MultY < 0 || MultZ >= NrPixelsZ ||
-            MultZ < 0) {
+        if (SpotPixelOnLayer(YZSpotsTemp, InPixels[k], px, Lsd, ybc, zbc,
+                             Lsds[Layer], ybcs[Layer], zbcs[Layer], NrPixelsY,
+                             NrPixelsZ, &MultY, &MultZ)) {
           if (g_debugCalcFrac) printf("  CPU spot %d REJECTED: layer %d pixel OOB (MultY=%d MultZ=%d, max=%d,%d)\n",
                                       j, Layer, MultY, MultZ, NrPixelsY, NrPixelsZ);
           OutofBounds = 1;
           break;
         }
-        BinNr = Layer * NrOfFiles;
-        BinNr *= NrPixelsY;
-        BinNr *= NrPixelsZ;
-        TempCntr = OmeBin;
-        TempCntr *= NrPixelsY;
-        TempCntr *= NrPixelsZ;
-        BinNr += TempCntr;
-        TempCntr = NrPixelsZ;
-        TempCntr *= MultY;
-        BinNr += TempCntr;
-        BinNr += MultZ;
-        if (TestBit(ObsSpotsInfo, BinNr)) {
-          // Bit is set — AllDistsFound stays 1
-        } else {
+        if (!ObsSpotBit(ObsSpotsInfo, Layer, NrOfFiles, OmeBin, MultY, MultZ,
+                        NrPixelsY, NrPixelsZ)) {
           AllDistsFound = 0;
         }
       }
@@ -653,6 +699,113 @@ void CalcFracOverlap(const int NrOfFiles, const int nLayers, const int nTspots,
   // FreeMemMatrixInt(InPixels, NrPixelsGrid); // Hoisted to caller
 }
 
+void ScreenFracOverlap(const int NrOfFiles, const int nLayers,
+                       const int nTspots, double *TheorSpots,
+                       double OmegaStart, double OmegaStep, double XGrain[3],
+                       double YGrain[3], const double Lsds[nLayers],
+                       double RotMatTilts[3][3], const double px,
+                       const double ybcs[nLayers], const double zbcs[nLayers],
+                       const double gs, double P0All[nLayers][3],
+                       int *ObsSpotsInfo, const SpotsPyramid *Pyramid,
+                       double MinFrac, double *FracOver, int **InPixels,
+                       int NrPixelsY, int NrPixelsZ, NFHitBuffer *hitBuf) {
+  int j, k, Layer, OmeBin, NrInPixels, MultY, MultZ;
+  double YZSpotsTemp[2];
+  int TotalPixels = 0, nCand = 0;
+  const SpotsPyramidLevel *coarse =
+      Pyramid->nLevels > 0 ? &Pyramid->level[Pyramid->nLevels - 1] : NULL;
+  *FracOver = 0;
+  hitBuf->count = 0;
+  // Pass 1: project every spot once, count the footprint pixels and keep
+  // those that hit at the coarsest level (all distances) as candidates.
+  for (j = 0; j < nTspots; j++) {
+    if (SpotFootprint(j, NrOfFiles, nLayers, TheorSpots, OmegaStart,
+                      OmegaStep, XGrain, YGrain, Lsds, RotMatTilts, px,
+                      ybcs[0], zbcs[0], gs, P0All[0], InPixels, NrPixelsY,
+                      NrPixelsZ, &OmeBin, YZSpotsTemp, &NrInPixels))
+      continue;
+    if (hitBuf->count + NrInPixels * nLayers > hitBuf->capacity) {
+      int cap = 2 * hitBuf->capacity + NrInPixels * nLayers;
+      NFPixelHit *grown =
+          (NFPixelHit *)realloc(hitBuf->hits, (size_t)cap * sizeof(NFPixelHit));
+      if (grown == NULL) {
+        // Out of memory: fall back to the exact full-resolution test.
+        CalcFracOverlap(NrOfFiles, nLayers, nTspots, TheorSpots, OmegaStart,
+                        OmegaStep, XGrain, YGrain, Lsds, 0, RotMatTilts, px,
+                        ybcs, zbcs, gs, P0All, 0, ObsSpotsInfo, NULL, FracOver,
+                        InPixels, NrPixelsY, NrPixelsZ);
+        return;
+      }
+      hitBuf->hits = grown;
+      hitBuf->capacity = cap;
+    }
+    for (k = 0; k < NrInPixels; k++) {
+      int pixelOOB = 0, hit = 1;
+      NFPixelHit *h = hitBuf->hits + hitBuf->count;
+      for (Layer = 0; Layer < nLayers; Layer++) {
+        if (SpotPixelOnLayer(YZSpotsTemp, InPixels[k], px, Lsds[0], ybcs[0],
+                             zbcs[0], Lsds[Layer], ybcs[Layer], zbcs[Layer],
+                             NrPixelsY, NrPixelsZ, &MultY, &MultZ)) {
+          pixelOOB = 1;
+          break;
+        }
+        h[Layer].layer = (uint16_t)Layer;
+        h[Layer].omeBin = (uint16_t)OmeBin;
+        h[Layer].multY = (uint16_t)MultY;
+        h[Layer].multZ = (uint16_t)MultZ;
+        if (hit && coarse != NULL &&
+            !SpotsPyramid_test(coarse, Layer, OmeBin, MultY, MultZ))
+          hit = 0;
+      }
+      // As in CalcFracOverlap, a pixel off the detector drops the rest of
+      // the spot.
+      if (pixelOOB)
+        break;
+      TotalPixels++;
+      if (hit) {
+        hitBuf->count += nLayers;
+        nCand++;
+      }
+    }
+  }
+  if (TotalPixels == 0)
+    return;
+  // Finer levels, then full resolution, each only over the survivors of
+  // the previous one.  Every level over-counts, so stop as soon as the
+  // fraction cannot reach MinFrac.
+  for (int lv = Pyramid->nLevels >= 2 ? Pyramid->nLevels - 2 : -1; lv >= -1;
+       lv--) {
+    if ((double)nCand / (double)TotalPixels < MinFrac) {
+      *FracOver = (double)nCand / (double)TotalPixels;
+      return;
+    }
+    const SpotsPyramidLevel *level = lv >= 0 ? &Pyramid->level[lv] : NULL;
+    int kept = 0;
+    for (int c = 0; c < nCand; c++) {
+      const NFPixelHit *h = hitBuf->hits + (size_t)c * nLayers;
+      int hit = 1;
+      for (Layer = 0; Layer < nLayers && hit; Layer++) {
+        if (level != NULL) {
+          hit = SpotsPyramid_test(level, Layer, h[Layer].omeBin,
+                                  h[Layer].multY, h[Layer].multZ);
+        } else {
+          hit = ObsSpotBit(ObsSpotsInfo, Layer, NrOfFiles, h[Layer].omeBin,
+                           h[Layer].multY, h[Layer].multZ, NrPixelsY,
+                           NrPixelsZ);
+        }
+      }
+      if (hit) {
+        if (kept != c)
+          memmove(hitBuf->hits + (size_t)kept * nLayers, h,
+                  (size_t)nLayers * sizeof(NFPixelHit));
+        kept++;
+      }
+    }
+    nCand = kept;
+  }
+  *FracOver = (double)nCand / (double)TotalPixels;
+}
+
 void SimulateDiffractionImage(
     const int NrOfFiles, const int nLayers, const int nTspots,
     double *TheorSpots, double OmegaStart, double OmegaStep, double XGrain[3],
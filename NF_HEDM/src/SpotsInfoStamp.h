@@ -0,0 +1,113 @@
+//
+// Copyright (c) 2014, UChicago Argonne, LLC
+// See LICENSE file.
+//
+// SpotsInfoStamp.h - Validity of the files derived from SpotsInfo.bin
+//
+// The pyramid (SpotsPyramid.h) and tiled (SpotsTiled.h) copies of
+// SpotsInfo.bin are rebuilt one distance at a time, and SpotsInfo.bin itself
+// can be written by MMapImageInfo, the Python preprocessing or an older
+// ProcessImagesCombined that does not know about the copies.  A copy is
+// therefore only used if
+//   - SpotsInfo.bin still has the size, mtime (ns) and inode recorded when
+//     the copy was last written, and
+//   - every distance slab of the copy is marked as rebuilt.
+// When a writer finds SpotsInfo.bin changed since the recorded stamp, the
+// slabs of the other distances can no longer be trusted and are unmarked;
+// the copy stays unused until each distance has been processed again.
+//
+// Both copies share this 128-byte header layout:
+//   [0, 32):   file-specific magic, version and dimensions
+//   [32, 64):  SpotsInfoStamp of SpotsInfo.bin
+//   [64, 128): bitmap of rebuilt distances, bit d % 8 of byte d / 8
+// The sparse copy (SpotsSparse.h) has one file per distance, so it only
+// carries the stamp at [32, 64); a file's existence marks its distance.
+
+#ifndef SPOTS_INFO_STAMP_H
+#define SPOTS_INFO_STAMP_H
+
+#include <stdint.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#define SPOTS_INFO_STAMP_HEADER_BYTES 128
+#define SPOTS_INFO_STAMP_OFFSET 32
+#define SPOTS_INFO_STAMP_VALID_OFFSET 64
+#define SPOTS_INFO_STAMP_MAX_DISTANCES 512
+
+typedef struct {
+  int64_t size, mtimeSec, mtimeNsec;
+  uint64_t inode;
+} SpotsInfoStamp;
+
+static inline void SpotsInfoStamp_fromStat(SpotsInfoStamp *s,
+                                           const struct stat *st) {
+  s->size = (int64_t)st->st_size;
+  s->mtimeSec = (int64_t)st->st_mtime;
+#if defined(__APPLE__)
+  s->mtimeNsec = (int64_t)st->st_mtimespec.tv_nsec;
+#else
+  s->mtimeNsec = (int64_t)st->st_mtim.tv_nsec;
+#endif
+  s->inode = (uint64_t)st->st_ino;
+}
+
+/** Does the stamp recorded in header describe st? */
+static inline int SpotsInfoStamp_same(const unsigned char *header,
+                                      const struct stat *st) {
+  SpotsInfoStamp now, old;
+  SpotsInfoStamp_fromStat(&now, st);
+  memcpy(&old, header + SPOTS_INFO_STAMP_OFFSET, sizeof(old));
+  return memcmp(&now, &old, sizeof(now)) == 0;
+}
+
+/**
+ * Decide, before a writer rebuilds one distance of a copy, whether the
+ * slabs of the other distances stay valid: only if the copy's header was
+ * readable (headerOK) and SpotsInfo.bin, as it was before this process
+ * touched it (fineBefore, NULL if it did not exist), still matches the
+ * recorded stamp.  Otherwise all distances are unmarked.
+ */
+static inline void SpotsInfoStamp_begin(unsigned char *header, int headerOK,
+                                        const struct stat *fineBefore) {
+  if (!headerOK || fineBefore == NULL ||
+      !SpotsInfoStamp_same(header, fineBefore))
+    memset(header + SPOTS_INFO_STAMP_VALID_OFFSET, 0,
+           SPOTS_INFO_STAMP_HEADER_BYTES - SPOTS_INFO_STAMP_VALID_OFFSET);
+}
+
+/**
+ * Mark distance layer as rebuilt and record the current stamp of fineFN
+ * (call after SpotsInfo.bin has been synced).
+ * @return 0, or -1 if fineFN cannot be stat'ed
+ */
+static inline int SpotsInfoStamp_finish(unsigned char *header,
+                                        const char *fineFN, int layer) {
+  struct stat st;
+  SpotsInfoStamp s;
+  if (stat(fineFN, &st) != 0)
+    return -1;
+  SpotsInfoStamp_fromStat(&s, &st);
+  memcpy(header + SPOTS_INFO_STAMP_OFFSET, &s, sizeof(s));
+  header[SPOTS_INFO_STAMP_VALID_OFFSET + layer / 8] |=
+      (unsigned char)(1u << (layer % 8));
+  return 0;
+}
+
+/**
+ * @return 0 if the copy matches fineFN and covers all nDistances,
+ *         -1 if fineFN changed since the copy was written,
+ *         -2 if some distance has not been rebuilt
+ */
+static inline int SpotsInfoStamp_check(const unsigned char *header,
+                                       const char *fineFN, int nDistances) {
+  struct stat st;
+  if (stat(fineFN, &st) != 0 || !SpotsInfoStamp_same(header, &st))
+    return -1;
+  for (int d = 0; d < nDistances; d++)
+    if (!(header[SPOTS_INFO_STAMP_VALID_OFFSET + d / 8] & (1u << (d % 8))))
+      return -2;
+  return 0;
+}
+
+#endif /* SPOTS_INFO_STAMP_H */
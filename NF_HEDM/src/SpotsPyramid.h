@@ -0,0 +1,292 @@
+//
+// Copyright (c) 2014, UChicago Argonne, LLC
+// See LICENSE file.
+//
+// SpotsPyramid.h - OR-reduced copies of SpotsInfo.bin for orientation
+// screening
+//
+// SpotsInfo.bin holds one bit per (distance, frame, y, z).  The screening
+// loop of FitOrientationOMP tests every simulated spot pixel of every
+// candidate orientation against it, and nearly all candidates fail.  Level
+// k of the pyramid sets a bit when any of the 2^k x 2^k x 2^k fine bits
+// (frames x y x z) under it is set, so the fraction of pixels that hit at a
+// coarse level can only be larger than the true overlap.  A candidate whose
+// coarse fraction is already below MinFracAccept is rejected without
+// touching the full-resolution bits; the levels are small enough to stay in
+// cache.
+//
+// ProcessImagesCombined rebuilds the slab of one distance after each layer.
+// A level is only used when SpotsInfo.bin has not changed since and every
+// distance has been rebuilt (SpotsInfoStamp.h), so a distance written by
+// MMapImageInfo or the Python preprocessing disables the pyramid instead of
+// reading as an empty slab.
+//
+// Format:
+//   SpotsInfo_x<2^k>.bin:
+//     Header: [uint32 magic 'SPYR'][int32 version][int32 factor]
+//             [int32 nDistances][int32 nFrames][int32 NrPixelsY]
+//             [int32 NrPixelsZ][uint8 reserved x 4]
+//             [SpotsInfoStamp][uint8 rebuilt-distance bitmap x 64]
+//     Data:   nDistances slabs of layerBits bits (rounded up to whole
+//             32-bit words), bit ((ome * nY) + y) * nZ + z of a slab at
+//             the coarse indices, in the SetBit/TestBit bit order
+
+#ifndef SPOTS_PYRAMID_H
+#define SPOTS_PYRAMID_H
+
+#include "SpotsInfoStamp.h"
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define SPOTS_PYRAMID_MAGIC 0x52595053u /* "SPYR" little-endian */
+#define SPOTS_PYRAMID_VERSION 2
+#define SPOTS_PYRAMID_HEADER_BYTES SPOTS_INFO_STAMP_HEADER_BYTES
+#define SPOTS_PYRAMID_N_LEVELS 2 /* factors 2 and 4 */
+
+typedef struct {
+  const uint32_t *bits;
+  int shift;         /* log2 of the reduction factor */
+  int nO, nY, nZ;    /* coarse frames, y and z */
+  long long layerBits; /* per-distance stride, a multiple of 32 */
+  void *map;
+  size_t mapSize;
+} SpotsPyramidLevel;
+
+typedef struct {
+  int nLevels; /* levels that could be opened, finest first */
+  SpotsPyramidLevel level[SPOTS_PYRAMID_N_LEVELS];
+} SpotsPyramid;
+
+static inline void SpotsPyramid_dims(SpotsPyramidLevel *l, int shift,
+                                     int nFrames, int NrPixelsY,
+                                     int NrPixelsZ) {
+  int f = 1 << shift;
+  l->shift = shift;
+  l->nO = (nFrames + f - 1) / f;
+  l->nY = (NrPixelsY + f - 1) / f;
+  l->nZ = (NrPixelsZ + f - 1) / f;
+  l->layerBits = ((long long)l->nO * l->nY * l->nZ + 31) / 32 * 32;
+}
+
+static inline size_t SpotsPyramid_fileBytes(const SpotsPyramidLevel *l,
+                                            int nDistances) {
+  return SPOTS_PYRAMID_HEADER_BYTES +
+         (size_t)nDistances * (size_t)(l->layerBits / 8);
+}
+
+static inline void SpotsPyramid_path(char *fn, size_t n, const char *dir,
+                                     int shift) {
+  snprintf(fn, n, "%s/SpotsInfo_x%d.bin", dir, 1 << shift);
+}
+
+/**
+ * Test the bit covering fine pixel (ome, y, z) of distance layer.
+ */
+static inline int SpotsPyramid_test(const SpotsPyramidLevel *l, int layer,
+                                    int ome, int y, int z) {
+  int s = l->shift;
+  long long b = layer * l->layerBits +
+                ((long long)(ome >> s) * l->nY + (y >> s)) * l->nZ + (z >> s);
+  return (l->bits[b >> 5] >> (b & 31)) & 1u;
+}
+
+/**
+ * OR-reduce one distance of src (fine layout if srcShift is 0, otherwise a
+ * pyramid level) into dst, whose slab for that distance must be zeroed.
+ * dst is one level coarser than src, or more.
+ */
+static inline void SpotsPyramid_reduce(const uint32_t *src, int srcShift,
+                                       long long srcLayerBits, int srcNY,
+                                       int srcNZ, SpotsPyramidLevel *dst,
+                                       uint32_t *dstBits, int layer) {
+  int ds = dst->shift - srcShift;
+  long long start = layer * srcLayerBits, end = start + srcLayerBits;
+  long long w0 = start / 32, w1 = (end + 31) / 32;
+  long long perFrame = (long long)srcNY * srcNZ;
+#pragma omp parallel for schedule(static)
+  for (long long w = w0; w < w1; w++) {
+    uint32_t word = src[w];
+    while (word != 0) {
+      int bit = __builtin_ctz(word);
+      word &= word - 1;
+      long long b = w * 32 + bit;
+      if (b < start || b >= end)
+        continue;
+      b -= start;
+      int ome = (int)(b / perFrame);
+      long long rem = b - ome * perFrame;
+      int y = (int)(rem / srcNZ), z = (int)(rem - (long long)y * srcNZ);
+      long long d = layer * dst->layerBits +
+                    ((long long)(ome >> ds) * dst->nY + (y >> ds)) * dst->nZ +
+                    (z >> ds);
+#pragma omp atomic
+      dstBits[d >> 5] |= 1u << (d & 31);
+    }
+  }
+}
+
+/**
+ * Map (creating if needed) the level file for writing and zero the slab of
+ * distance layer.  The other slabs stay marked only if the file matches
+ * and SpotsInfo.bin was not changed by someone else (fineBefore).
+ * Returns the data pointer or NULL.
+ */
+static inline uint32_t *SpotsPyramid_mapForWrite(
+    const char *fn, SpotsPyramidLevel *l, const struct stat *fineBefore,
+    int nDistances, int nFrames, int NrPixelsY, int NrPixelsZ, int layer) {
+  size_t bytes = SpotsPyramid_fileBytes(l, nDistances);
+  int fd = open(fn, O_RDWR | O_CREAT, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+  if (fd < 0)
+    return NULL;
+  struct stat s;
+  int sameSize = fstat(fd, &s) == 0 && (size_t)s.st_size == bytes;
+  if (ftruncate(fd, bytes) != 0) {
+    close(fd);
+    return NULL;
+  }
+  void *map = mmap(0, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED)
+    return NULL;
+  int32_t ints[6] = {SPOTS_PYRAMID_VERSION, 1 << l->shift, nDistances,
+                     nFrames, NrPixelsY, NrPixelsZ};
+  uint32_t magic = SPOTS_PYRAMID_MAGIC;
+  int headerOK = sameSize && memcmp(map, &magic, 4) == 0 &&
+                 memcmp((char *)map + 4, ints, sizeof(ints)) == 0;
+  SpotsInfoStamp_begin((unsigned char *)map, headerOK, fineBefore);
+  memcpy(map, &magic, 4);
+  memcpy((char *)map + 4, ints, sizeof(ints));
+  uint32_t *bits =
+      (uint32_t *)((char *)map + SPOTS_PYRAMID_HEADER_BYTES);
+  memset(bits + layer * (l->layerBits / 32), 0, (size_t)(l->layerBits / 8));
+  l->map = map;
+  l->mapSize = bytes;
+  l->bits = bits;
+  return bits;
+}
+
+/**
+ * Rebuild every level for distance layer from the full-resolution bits of
+ * fineFN (already synced).  fineBefore is the stat of fineFN before this
+ * process wrote to it, NULL if it did not exist.
+ * @return 0 on success, -1 if a level could not be written
+ */
+static inline int SpotsPyramid_writeLayer(const char *dir,
+                                          const uint32_t *fine,
+                                          const char *fineFN,
+                                          const struct stat *fineBefore,
+                                          int nDistances, int nFrames,
+                                          int NrPixelsY, int NrPixelsZ,
+                                          int layer) {
+  SpotsPyramidLevel lv[SPOTS_PYRAMID_N_LEVELS];
+  memset(lv, 0, sizeof(lv));
+  if (nDistances > SPOTS_INFO_STAMP_MAX_DISTANCES)
+    return -1;
+  const uint32_t *src = fine;
+  int srcShift = 0, srcNY = NrPixelsY, srcNZ = NrPixelsZ;
+  long long srcLayerBits = (long long)nFrames * NrPixelsY * NrPixelsZ;
+  int rc = 0;
+  for (int k = 0; k < SPOTS_PYRAMID_N_LEVELS; k++) {
+    char fn[4096];
+    SpotsPyramid_dims(&lv[k], k + 1, nFrames, NrPixelsY, NrPixelsZ);
+    SpotsPyramid_path(fn, sizeof(fn), dir, k + 1);
+    uint32_t *bits =
+        SpotsPyramid_mapForWrite(fn, &lv[k], fineBefore, nDistances, nFrames,
+                                 NrPixelsY, NrPixelsZ, layer);
+    if (bits == NULL) {
+      printf("Warning: could not write %s, screening will use SpotsInfo.bin "
+             "only.\n",
+             fn);
+      rc = -1;
+      break;
+    }
+    SpotsPyramid_reduce(src, srcShift, srcLayerBits, srcNY, srcNZ, &lv[k],
+                        bits, layer);
+    src = bits;
+    srcShift = lv[k].shift;
+    srcNY = lv[k].nY;
+    srcNZ = lv[k].nZ;
+    srcLayerBits = lv[k].layerBits;
+  }
+  for (int k = 0; k < SPOTS_PYRAMID_N_LEVELS; k++) {
+    if (lv[k].map == NULL)
+      continue;
+    if (SpotsInfoStamp_finish((unsigned char *)lv[k].map, fineFN, layer) != 0)
+      rc = -1;
+    msync(lv[k].map, lv[k].mapSize, MS_SYNC);
+    munmap(lv[k].map, lv[k].mapSize);
+  }
+  return rc;
+}
+
+/**
+ * Map the levels that match this dataset and cover every distance of the
+ * current fineFN.  Levels are kept finest first; a missing level ends the
+ * list.
+ */
+static inline void SpotsPyramid_open(SpotsPyramid *p, const char *dir,
+                                     const char *fineFN, int nDistances,
+                                     int nFrames, int NrPixelsY,
+                                     int NrPixelsZ) {
+  memset(p, 0, sizeof(*p));
+  if (nDistances > SPOTS_INFO_STAMP_MAX_DISTANCES)
+    return;
+  for (int k = 0; k < SPOTS_PYRAMID_N_LEVELS; k++) {
+    SpotsPyramidLevel *l = &p->level[k];
+    char fn[4096];
+    SpotsPyramid_dims(l, k + 1, nFrames, NrPixelsY, NrPixelsZ);
+    SpotsPyramid_path(fn, sizeof(fn), dir, k + 1);
+    size_t expected = SpotsPyramid_fileBytes(l, nDistances);
+    int fd = open(fn, O_RDONLY);
+    if (fd < 0)
+      break;
+    struct stat s;
+    if (fstat(fd, &s) != 0 || (size_t)s.st_size != expected) {
+      close(fd);
+      break;
+    }
+    void *map = mmap(0, expected, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+      break;
+    uint32_t magic;
+    int32_t ints[6];
+    memcpy(&magic, map, 4);
+    memcpy(ints, (char *)map + 4, sizeof(ints));
+    if (magic != SPOTS_PYRAMID_MAGIC || ints[0] != SPOTS_PYRAMID_VERSION ||
+        ints[1] != (1 << l->shift) || ints[2] != nDistances ||
+        ints[3] != nFrames || ints[4] != NrPixelsY || ints[5] != NrPixelsZ) {
+      printf("Warning: %s does not match SpotsInfo.bin, ignoring it.\n", fn);
+      munmap(map, expected);
+      break;
+    }
+    int valid =
+        SpotsInfoStamp_check((const unsigned char *)map, fineFN, nDistances);
+    if (valid != 0) {
+      printf("Warning: %s %s, ignoring it.\n", fn,
+             valid == -1 ? "is older than SpotsInfo.bin"
+                         : "does not cover every distance");
+      munmap(map, expected);
+      break;
+    }
+    l->map = map;
+    l->mapSize = expected;
+    l->bits = (const uint32_t *)((char *)map + SPOTS_PYRAMID_HEADER_BYTES);
+    p->nLevels = k + 1;
+  }
+}
+
+static inline void SpotsPyramid_close(SpotsPyramid *p) {
+  for (int k = 0; k < SPOTS_PYRAMID_N_LEVELS; k++)
+    if (p->level[k].map != NULL)
+      munmap(p->level[k].map, p->level[k].mapSize);
+  memset(p, 0, sizeof(*p));
+}
+
+#endif /* SPOTS_PYRAMID_H */
@@ -0,0 +1,416 @@
+//
+// Copyright (c) 2014, UChicago Argonne, LLC
+// See LICENSE file.
+//
+// SpotsSparse.h - Sparse copy of SpotsInfo.bin, one file per distance
+//
+// SpotsInfo.bin is a dense bitset over distances x frames x NrPixelsY x
+// NrPixelsZ (2.2 GB for 3 distances, 1440 frames and 2048^2 pixels) of
+// which well under 1% is set.  This format keeps the 64x64-pixel tiles of
+// SpotsTiled.h but stores each tile as a container, as roaring bitmaps do:
+// nothing for an empty tile, a sorted array of 12-bit in-tile positions for
+// a sparse one and the 512-byte bitmap only when that is smaller.  A test
+// is one index lookup plus either a bit test or a binary search over at
+// most 255 positions.
+//
+// ProcessImagesCombined writes it with WriteSparseSpotsInfo 1, one file per
+// distance so that distances processed separately never write the same
+// payload.  Every file records the SpotsInfoStamp (SpotsInfoStamp.h) of
+// SpotsInfo.bin.  A writer of one distance restamps the files of the other
+// distances if SpotsInfo.bin still matched their stamp before it was
+// touched, and removes them otherwise, so a SpotsInfo.bin rewritten by any
+// other tool invalidates all of them.  FitOrientationOMP uses the files
+// with UseSparseSpotsInfo 1 when every distance is present, matches the
+// detector and carries the stamp of the current SpotsInfo.bin.
+//
+// Format:
+//   SpotsInfo_sparse_<distance>.bin:
+//     Header: [uint32 magic 'SPSP'][int32 version][int32 tile size (64)]
+//             [int32 distance][int32 nFrames][int32 NrPixelsY]
+//             [int32 NrPixelsZ][int32 reserved]
+//             [SpotsInfoStamp of SpotsInfo.bin, 32 bytes]
+//             [int64 payload uint16s][uint8 reserved x 56]
+//     Index:  SpotsSparseTile x nFrames x nTilesY x nTilesZ, tile
+//             (y / 64, z / 64) of a frame at (ome * nTilesY + ty) * nTilesZ
+//             + tz
+//     Data:   uint16 payload.  Array containers hold ((y % 64) << 6) |
+//             (z % 64) in increasing order; bitmap containers start on an
+//             8-byte boundary and hold 64 uint64 rows as in SpotsTiled.h.
+
+#ifndef SPOTS_SPARSE_H
+#define SPOTS_SPARSE_H
+
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "SpotsInfoStamp.h"
+
+#define SPOTS_SPARSE_MAGIC 0x50535053u /* "SPSP" little-endian */
+#define SPOTS_SPARSE_VERSION 2
+#define SPOTS_SPARSE_HEADER_BYTES SPOTS_INFO_STAMP_HEADER_BYTES
+#define SPOTS_SPARSE_PAYLOAD_OFFSET 64
+#define SPOTS_SPARSE_TILE 64
+#define SPOTS_SPARSE_TILE_WORDS 64 /* uint64 rows of a bitmap container */
+#define SPOTS_SPARSE_MAX_ARRAY 255 /* larger containers are bitmaps */
+
+typedef struct {
+  uint32_t offset; /* into the payload, in uint16s */
+  uint16_t count;  /* set bits, 0 = empty tile */
+  uint16_t bitmap; /* 1 = bitmap container, 0 = sorted array */
+} SpotsSparseTile;
+
+typedef struct {
+  const SpotsSparseTile *index;
+  const uint16_t *payload;
+  void *map;
+  size_t mapSize;
+} SpotsSparseLayer;
+
+typedef struct {
+  int nLayers, nFrames, nTilesY, nTilesZ;
+  SpotsSparseLayer *layer;
+} SpotsSparse;
+
+static inline void SpotsSparse_path(char *fn, size_t n, const char *dir,
+                                    int distance) {
+  snprintf(fn, n, "%s/SpotsInfo_sparse_%d.bin", dir, distance);
+}
+
+/**
+ * Drop the sparse copy of distance after its SpotsInfo.bin slab changed.
+ */
+static inline void SpotsSparse_remove(const char *dir, int distance) {
+  char fn[4096];
+  SpotsSparse_path(fn, sizeof(fn), dir, distance);
+  unlink(fn);
+}
+
+static inline int SpotsSparse_test(const SpotsSparse *s, int layer, int ome,
+                                   int y, int z) {
+  const SpotsSparseLayer *L = &s->layer[layer];
+  const SpotsSparseTile *t =
+      &L->index[((size_t)ome * s->nTilesY + (y >> 6)) * s->nTilesZ + (z >> 6)];
+  if (t->count == 0)
+    return 0;
+  const uint16_t *p = L->payload + t->offset;
+  if (t->bitmap)
+    return (((const uint64_t *)p)[y & 63] >> (z & 63)) & 1;
+  uint16_t key = (uint16_t)(((y & 63) << 6) | (z & 63));
+  int lo = 0, hi = t->count - 1;
+  while (lo <= hi) {
+    int mid = (lo + hi) >> 1;
+    if (p[mid] == key)
+      return 1;
+    if (p[mid] < key)
+      lo = mid + 1;
+    else
+      hi = mid - 1;
+  }
+  return 0;
+}
+
+/**
+ * Encode one frame (flat bits [start, start + NrPixelsY * NrPixelsZ) of
+ * fine) into index (nTilesY * nTilesZ entries, offsets relative to the
+ * frame) and a malloc'd payload padded to a multiple of 4 uint16s.
+ * plane is scratch of nTilesY * nTilesZ * 64 uint64s.
+ * @return payload length in uint16s, or -1 on allocation failure
+ */
+static inline long long SpotsSparse_encodeFrame(
+    const uint32_t *fine, long long start, int NrPixelsY, int NrPixelsZ,
+    int nTilesY, int nTilesZ, uint64_t *plane, SpotsSparseTile *index,
+    uint16_t **payloadOut) {
+  size_t nTiles = (size_t)nTilesY * nTilesZ;
+  memset(plane, 0, nTiles * SPOTS_SPARSE_TILE_WORDS * sizeof(uint64_t));
+  long long end = start + (long long)NrPixelsY * NrPixelsZ;
+  for (long long w = start / 32; w < (end + 31) / 32; w++) {
+    uint32_t word = fine[w];
+    while (word != 0) {
+      int bit = __builtin_ctz(word);
+      word &= word - 1;
+      long long b = w * 32 + bit;
+      if (b < start || b >= end)
+        continue;
+      b -= start;
+      int y = (int)(b / NrPixelsZ), z = (int)(b - (long long)y * NrPixelsZ);
+      size_t tile = (size_t)(y >> 6) * nTilesZ + (z >> 6);
+      plane[tile * SPOTS_SPARSE_TILE_WORDS + (y & 63)] |= 1ULL << (z & 63);
+    }
+  }
+  long long len = 0;
+  for (size_t t = 0; t < nTiles; t++) {
+    const uint64_t *rows = plane + t * SPOTS_SPARSE_TILE_WORDS;
+    int count = 0;
+    for (int r = 0; r < SPOTS_SPARSE_TILE_WORDS; r++)
+      count += __builtin_popcountll(rows[r]);
+    index[t].count = (uint16_t)count;
+    index[t].bitmap = count > SPOTS_SPARSE_MAX_ARRAY;
+    if (count == 0)
+      index[t].offset = 0;
+    else if (index[t].bitmap) {
+      len = (len + 3) & ~3LL;
+      index[t].offset = (uint32_t)len;
+      len += SPOTS_SPARSE_TILE_WORDS * 4;
+    } else {
+      index[t].offset = (uint32_t)len;
+      len += count;
+    }
+  }
+  len = (len + 3) & ~3LL;
+  uint16_t *payload = (uint16_t *)calloc(len ? len : 1, sizeof(uint16_t));
+  if (payload == NULL)
+    return -1;
+  for (size_t t = 0; t < nTiles; t++) {
+    const uint64_t *rows = plane + t * SPOTS_SPARSE_TILE_WORDS;
+    uint16_t *p = payload + index[t].offset;
+    if (index[t].count == 0)
+      continue;
+    if (index[t].bitmap) {
+      memcpy(p, rows, SPOTS_SPARSE_TILE_WORDS * sizeof(uint64_t));
+      continue;
+    }
+    int n = 0;
+    for (int r = 0; r < SPOTS_SPARSE_TILE_WORDS; r++) {
+      uint64_t bits = rows[r];
+      while (bits != 0) {
+        p[n++] = (uint16_t)((r << 6) | __builtin_ctzll(bits));
+        bits &= bits - 1;
+      }
+    }
+  }
+  *payloadOut = payload;
+  return len;
+}
+
+/**
+ * After distance layer of SpotsInfo.bin was rewritten, carry the sparse
+ * files of the other distances over to the new stamp (fineNow) if they
+ * matched SpotsInfo.bin as it was before (fineBefore, NULL if it did not
+ * exist); remove them otherwise, or if fineNow is NULL.
+ */
+static inline void SpotsSparse_restampOthers(const char *dir, int nDistances,
+                                             int layer,
+                                             const struct stat *fineBefore,
+                                             const SpotsInfoStamp *fineNow) {
+  for (int l = 0; l < nDistances; l++) {
+    if (l == layer)
+      continue;
+    char fn[4096];
+    SpotsSparse_path(fn, sizeof(fn), dir, l);
+    int fd = open(fn, O_RDWR);
+    if (fd < 0)
+      continue;
+    unsigned char h[SPOTS_SPARSE_HEADER_BYTES];
+    uint32_t magic;
+    int32_t ints[3];
+    int keep = pread(fd, h, sizeof(h), 0) == (ssize_t)sizeof(h);
+    if (keep) {
+      memcpy(&magic, h, 4);
+      memcpy(ints, h + 4, sizeof(ints));
+      keep = magic == SPOTS_SPARSE_MAGIC && ints[0] == SPOTS_SPARSE_VERSION &&
+             ints[2] == l && fineBefore != NULL && fineNow != NULL &&
+             SpotsInfoStamp_same(h, fineBefore);
+    }
+    if (keep)
+      keep = pwrite(fd, fineNow, sizeof(*fineNow), SPOTS_INFO_STAMP_OFFSET) ==
+             (ssize_t)sizeof(*fineNow);
+    close(fd);
+    if (!keep)
+      unlink(fn);
+  }
+}
+
+/**
+ * Write the sparse file of distance layer from the flat SpotsInfo bits,
+ * stamped with fineFN (call after SpotsInfo.bin has been synced), and update
+ * the files of the other distances (see SpotsSparse_restampOthers).
+ * @return 0 on success, -1 on failure (nothing is left behind for layer)
+ */
+static inline int SpotsSparse_writeLayer(const char *dir, const uint32_t *fine,
+                                         const char *fineFN,
+                                         const struct stat *fineBefore,
+                                         int nDistances, int nFrames,
+                                         int NrPixelsY, int NrPixelsZ,
+                                         int layer) {
+  int nTilesY = (NrPixelsY + SPOTS_SPARSE_TILE - 1) / SPOTS_SPARSE_TILE;
+  int nTilesZ = (NrPixelsZ + SPOTS_SPARSE_TILE - 1) / SPOTS_SPARSE_TILE;
+  size_t nTiles = (size_t)nTilesY * nTilesZ;
+  SpotsSparseTile *index =
+      (SpotsSparseTile *)malloc((size_t)nFrames * nTiles * sizeof(*index));
+  uint16_t **payloads = (uint16_t **)calloc(nFrames, sizeof(*payloads));
+  long long *lens = (long long *)calloc(nFrames, sizeof(*lens));
+  int failed = index == NULL || payloads == NULL || lens == NULL;
+  long long perFrame = (long long)NrPixelsY * NrPixelsZ;
+  if (!failed) {
+#pragma omp parallel reduction(| : failed)
+    {
+      uint64_t *plane = (uint64_t *)malloc(nTiles * SPOTS_SPARSE_TILE_WORDS *
+                                           sizeof(uint64_t));
+      if (plane == NULL)
+        failed = 1;
+#pragma omp for schedule(dynamic)
+      for (int ome = 0; ome < nFrames; ome++) {
+        if (plane == NULL)
+          continue;
+        lens[ome] = SpotsSparse_encodeFrame(
+            fine, ((long long)layer * nFrames + ome) * perFrame, NrPixelsY,
+            NrPixelsZ, nTilesY, nTilesZ, plane, index + (size_t)ome * nTiles,
+            &payloads[ome]);
+        if (lens[ome] < 0)
+          failed = 1;
+      }
+      free(plane);
+    }
+  }
+  // Frame payloads are concatenated; shift their tile offsets accordingly.
+  long long total = 0;
+  for (int ome = 0; ome < nFrames && !failed; ome++) {
+    if (total + lens[ome] > UINT32_MAX) {
+      failed = 1;
+      break;
+    }
+    for (size_t t = 0; t < nTiles; t++)
+      index[(size_t)ome * nTiles + t].offset += (uint32_t)total;
+    total += lens[ome];
+  }
+  struct stat fineSt;
+  SpotsInfoStamp stamp;
+  if (stat(fineFN, &fineSt) != 0)
+    failed = 1;
+  else
+    SpotsInfoStamp_fromStat(&stamp, &fineSt);
+  SpotsSparse_restampOthers(dir, nDistances, layer, fineBefore,
+                            failed ? NULL : &stamp);
+  char fn[4096], tmpFN[4200];
+  SpotsSparse_path(fn, sizeof(fn), dir, layer);
+  snprintf(tmpFN, sizeof(tmpFN), "%s.tmp.%ld", fn, (long)getpid());
+  FILE *f = failed ? NULL : fopen(tmpFN, "wb");
+  int ok = f != NULL;
+  if (ok) {
+    unsigned char header[SPOTS_SPARSE_HEADER_BYTES];
+    memset(header, 0, sizeof(header));
+    uint32_t magic = SPOTS_SPARSE_MAGIC;
+    int32_t ints[7] = {SPOTS_SPARSE_VERSION, SPOTS_SPARSE_TILE, layer,
+                       nFrames,              NrPixelsY,         NrPixelsZ, 0};
+    int64_t nPayload = total;
+    memcpy(header, &magic, 4);
+    memcpy(header + 4, ints, sizeof(ints));
+    memcpy(header + SPOTS_INFO_STAMP_OFFSET, &stamp, sizeof(stamp));
+    memcpy(header + SPOTS_SPARSE_PAYLOAD_OFFSET, &nPayload, sizeof(nPayload));
+    ok = fwrite(header, sizeof(header), 1, f) == 1 &&
+         fwrite(index, sizeof(*index), (size_t)nFrames * nTiles, f) ==
+             (size_t)nFrames * nTiles;
+    for (int ome = 0; ome < nFrames && ok; ome++)
+      ok = fwrite(payloads[ome], sizeof(uint16_t), lens[ome], f) ==
+           (size_t)lens[ome];
+    ok = (fclose(f) == 0) && ok;
+    if (ok)
+      ok = rename(tmpFN, fn) == 0;
+    if (!ok)
+      remove(tmpFN);
+  }
+  if (!ok)
+    unlink(fn);
+  if (payloads != NULL)
+    for (int ome = 0; ome < nFrames; ome++)
+      free(payloads[ome]);
+  free(payloads);
+  free(lens);
+  free(index);
+  return ok ? 0 : -1;
+}
+
+static inline void SpotsSparse_close(SpotsSparse *s) {
+  if (s->layer != NULL)
+    for (int l = 0; l < s->nLayers; l++)
+      if (s->layer[l].map != NULL)
+        munmap(s->layer[l].map, s->layer[l].mapSize);
+  free(s->layer);
+  memset(s, 0, sizeof(*s));
+}
+
+/**
+ * Map the sparse files of all nDistances distances in dir.
+ * @return 0 if all are present, valid and built from fineFN as it is now,
+ *         -1 otherwise
+ */
+static inline int SpotsSparse_open(SpotsSparse *s, const char *dir,
+                                   const char *fineFN, int nDistances,
+                                   int nFrames, int NrPixelsY, int NrPixelsZ) {
+  memset(s, 0, sizeof(*s));
+  struct stat fineSt;
+  if (stat(fineFN, &fineSt) != 0)
+    return -1;
+  s->nFrames = nFrames;
+  s->nTilesY = (NrPixelsY + SPOTS_SPARSE_TILE - 1) / SPOTS_SPARSE_TILE;
+  s->nTilesZ = (NrPixelsZ + SPOTS_SPARSE_TILE - 1) / SPOTS_SPARSE_TILE;
+  s->layer = (SpotsSparseLayer *)calloc(nDistances, sizeof(*s->layer));
+  if (s->layer == NULL)
+    return -1;
+  s->nLayers = nDistances;
+  size_t indexBytes = (size_t)nFrames * s->nTilesY * s->nTilesZ *
+                      sizeof(SpotsSparseTile);
+  for (int l = 0; l < nDistances; l++) {
+    char fn[4096];
+    SpotsSparse_path(fn, sizeof(fn), dir, l);
+    int fd = open(fn, O_RDONLY);
+    if (fd < 0) {
+      SpotsSparse_close(s);
+      return -1;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 ||
+        (size_t)st.st_size < SPOTS_SPARSE_HEADER_BYTES + indexBytes) {
+      close(fd);
+      SpotsSparse_close(s);
+      return -1;
+    }
+    void *map = mmap(0, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+      SpotsSparse_close(s);
+      return -1;
+    }
+    s->layer[l].map = map;
+    s->layer[l].mapSize = st.st_size;
+    uint32_t magic;
+    int32_t ints[7];
+    int64_t nPayload;
+    memcpy(&magic, map, 4);
+    memcpy(ints, (char *)map + 4, sizeof(ints));
+    memcpy(&nPayload, (char *)map + SPOTS_SPARSE_PAYLOAD_OFFSET,
+           sizeof(nPayload));
+    if (magic != SPOTS_SPARSE_MAGIC || ints[0] != SPOTS_SPARSE_VERSION ||
+        ints[1] != SPOTS_SPARSE_TILE || ints[2] != l || ints[3] != nFrames ||
+        ints[4] != NrPixelsY || ints[5] != NrPixelsZ ||
+        (size_t)st.st_size != SPOTS_SPARSE_HEADER_BYTES + indexBytes +
+                                  (size_t)nPayload * sizeof(uint16_t)) {
+      printf("Warning: %s does not match SpotsInfo.bin, ignoring the sparse "
+             "files.\n",
+             fn);
+      SpotsSparse_close(s);
+      return -1;
+    }
+    if (!SpotsInfoStamp_same((const unsigned char *)map, &fineSt)) {
+      printf("Warning: %s is older than SpotsInfo.bin, ignoring the sparse "
+             "files.\n",
+             fn);
+      SpotsSparse_close(s);
+      return -1;
+    }
+    s->layer[l].index =
+        (const SpotsSparseTile *)((char *)map + SPOTS_SPARSE_HEADER_BYTES);
+    s->layer[l].payload =
+        (const uint16_t *)((char *)map + SPOTS_SPARSE_HEADER_BYTES +
+                           indexBytes);
+  }
+  return 0;
+}
+
+#endif /* SPOTS_SPARSE_H */
@@ -0,0 +1,253 @@
+//
+// Copyright (c) 2014, UChicago Argonne, LLC
+// See LICENSE file.
+//
+// SpotsTiled.h - SpotsInfo.bin stored as 64x64-pixel tiles
+//
+// In SpotsInfo.bin the bits of one frame are row-major over the whole
+// detector, so the few pixels of one simulated spot are NrPixelsZ bits apart
+// from row to row and every spot of a candidate lands in a different
+// multi-MB frame plane: nearly every TestBit is a cache and TLB miss.  Here
+// each frame is cut into 64x64-pixel tiles of 64 uint64 rows (512 bytes,
+// eight cache lines), so a spot footprint is one or two lines of one page.
+// Mapping the table on transparent huge pages (SpotsInfoHugePages) further
+// cuts the TLB misses between frames.
+//
+// ProcessImagesCombined rebuilds one distance of the file per layer with
+// WriteTiledSpotsInfo 1.  FitOrientationOMP uses it when it was written for
+// the same detector, SpotsInfo.bin has not changed since and every distance
+// has been rebuilt (SpotsInfoStamp.h); the bits are the same, only their
+// order differs.
+//
+// Format:
+//   SpotsInfo_tiled.bin:
+//     Header: [uint32 magic 'SPTL'][int32 version][int32 tile size (64)]
+//             [int32 nDistances][int32 nFrames][int32 NrPixelsY]
+//             [int32 NrPixelsZ][uint8 reserved x 4]
+//             [SpotsInfoStamp][uint8 rebuilt-distance bitmap x 64]
+//     Data:   for each (distance, frame): nTilesY x nTilesZ tiles,
+//             tile (y / 64, z / 64) holds pixel (y, z) at bit z % 64 of
+//             uint64 row y % 64
+
+#ifndef SPOTS_TILED_H
+#define SPOTS_TILED_H
+
+#include "SpotsInfoStamp.h"
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define SPOTS_TILED_FN "SpotsInfo_tiled.bin"
+#define SPOTS_TILED_MAGIC 0x4C545053u /* "SPTL" little-endian */
+#define SPOTS_TILED_VERSION 2
+#define SPOTS_TILED_HEADER_BYTES SPOTS_INFO_STAMP_HEADER_BYTES
+#define SPOTS_TILED_TILE 64
+#define SPOTS_TILED_HUGE_PAGE (2UL << 20)
+
+typedef struct {
+  const uint64_t *words;
+  int nFrames, nTilesY, nTilesZ;
+  void *map;
+  size_t mapSize;
+} SpotsTiled;
+
+static inline void SpotsTiled_dims(SpotsTiled *t, int nFrames, int NrPixelsY,
+                                   int NrPixelsZ) {
+  t->nFrames = nFrames;
+  t->nTilesY = (NrPixelsY + SPOTS_TILED_TILE - 1) / SPOTS_TILED_TILE;
+  t->nTilesZ = (NrPixelsZ + SPOTS_TILED_TILE - 1) / SPOTS_TILED_TILE;
+}
+
+/** uint64 words per (distance, frame) plane. */
+static inline size_t SpotsTiled_frameWords(const SpotsTiled *t) {
+  return (size_t)t->nTilesY * t->nTilesZ * SPOTS_TILED_TILE;
+}
+
+static inline size_t SpotsTiled_dataBytes(const SpotsTiled *t,
+                                          int nDistances) {
+  return (size_t)nDistances * t->nFrames * SpotsTiled_frameWords(t) *
+         sizeof(uint64_t);
+}
+
+static inline int SpotsTiled_test(const SpotsTiled *t, int layer, int ome,
+                                  int y, int z) {
+  size_t tile = ((size_t)((size_t)layer * t->nFrames + ome) * t->nTilesY +
+                 (y >> 6)) *
+                    t->nTilesZ +
+                (z >> 6);
+  return (t->words[tile * SPOTS_TILED_TILE + (y & 63)] >> (z & 63)) & 1;
+}
+
+/**
+ * Rewrite distance layer of the tiled file in dir from the flat SpotsInfo
+ * bits of fineFN (already synced; created and sized on the first layer).
+ * fineBefore is the stat of fineFN before this process wrote to it, NULL
+ * if it did not exist.
+ * @return 0 on success, -1 on failure
+ */
+static inline int SpotsTiled_writeLayer(const char *dir, const uint32_t *fine,
+                                        const char *fineFN,
+                                        const struct stat *fineBefore,
+                                        int nDistances, int nFrames,
+                                        int NrPixelsY, int NrPixelsZ,
+                                        int layer) {
+  if (nDistances > SPOTS_INFO_STAMP_MAX_DISTANCES)
+    return -1;
+  SpotsTiled t;
+  SpotsTiled_dims(&t, nFrames, NrPixelsY, NrPixelsZ);
+  char fn[4096];
+  snprintf(fn, sizeof(fn), "%s/%s", dir, SPOTS_TILED_FN);
+  size_t bytes = SPOTS_TILED_HEADER_BYTES + SpotsTiled_dataBytes(&t, nDistances);
+  int fd = open(fn, O_RDWR | O_CREAT, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+  if (fd < 0)
+    return -1;
+  struct stat s;
+  int sameSize = fstat(fd, &s) == 0 && (size_t)s.st_size == bytes;
+  if (ftruncate(fd, bytes) != 0) {
+    close(fd);
+    return -1;
+  }
+  void *map = mmap(0, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED)
+    return -1;
+  uint32_t magic = SPOTS_TILED_MAGIC;
+  int32_t ints[6] = {SPOTS_TILED_VERSION, SPOTS_TILED_TILE, nDistances,
+                     nFrames,             NrPixelsY,        NrPixelsZ};
+  int headerOK = sameSize && memcmp(map, &magic, 4) == 0 &&
+                 memcmp((char *)map + 4, ints, sizeof(ints)) == 0;
+  SpotsInfoStamp_begin((unsigned char *)map, headerOK, fineBefore);
+  memcpy(map, &magic, 4);
+  memcpy((char *)map + 4, ints, sizeof(ints));
+  uint64_t *words = (uint64_t *)((char *)map + SPOTS_TILED_HEADER_BYTES);
+  size_t frameWords = SpotsTiled_frameWords(&t);
+  long long perFrame = (long long)NrPixelsY * NrPixelsZ;
+  // One frame per iteration: a frame owns its tiles, so no atomics.
+#pragma omp parallel for schedule(dynamic)
+  for (int ome = 0; ome < nFrames; ome++) {
+    uint64_t *plane = words + ((size_t)layer * nFrames + ome) * frameWords;
+    memset(plane, 0, frameWords * sizeof(uint64_t));
+    long long start = ((long long)layer * nFrames + ome) * perFrame;
+    long long end = start + perFrame;
+    for (long long w = start / 32; w < (end + 31) / 32; w++) {
+      uint32_t word = fine[w];
+      while (word != 0) {
+        int bit = __builtin_ctz(word);
+        word &= word - 1;
+        long long b = w * 32 + bit;
+        if (b < start || b >= end)
+          continue;
+        b -= start;
+        int y = (int)(b / NrPixelsZ), z = (int)(b - (long long)y * NrPixelsZ);
+        size_t tile = (size_t)(y >> 6) * t.nTilesZ + (z >> 6);
+        plane[tile * SPOTS_TILED_TILE + (y & 63)] |= 1ULL << (z & 63);
+      }
+    }
+  }
+  int rc = SpotsInfoStamp_finish((unsigned char *)map, fineFN, layer);
+  if (msync(map, bytes, MS_SYNC) != 0)
+    rc = -1;
+  munmap(map, bytes);
+  return rc;
+}
+
+/**
+ * Load the tiled table from dir if it matches this dataset and covers every
+ * distance of the current fineFN.  With hugePages the bits are read into anonymous memory
+ * advised for transparent huge pages; otherwise the file is mapped and huge
+ * pages are only requested.
+ * @return 0 if loaded, -1 if the caller should use SpotsInfo.bin
+ */
+static inline int SpotsTiled_open(SpotsTiled *t, const char *dir,
+                                  const char *fineFN, int nDistances,
+                                  int nFrames, int NrPixelsY, int NrPixelsZ,
+                                  int hugePages) {
+  memset(t, 0, sizeof(*t));
+  SpotsTiled_dims(t, nFrames, NrPixelsY, NrPixelsZ);
+  char fn[4096];
+  snprintf(fn, sizeof(fn), "%s/%s", dir, SPOTS_TILED_FN);
+  size_t dataBytes = SpotsTiled_dataBytes(t, nDistances);
+  size_t bytes = SPOTS_TILED_HEADER_BYTES + dataBytes;
+  int fd = open(fn, O_RDONLY);
+  if (fd < 0)
+    return -1;
+  struct stat s;
+  unsigned char h[SPOTS_TILED_HEADER_BYTES];
+  if (nDistances > SPOTS_INFO_STAMP_MAX_DISTANCES || fstat(fd, &s) != 0 ||
+      (size_t)s.st_size != bytes ||
+      pread(fd, h, sizeof(h), 0) != (ssize_t)sizeof(h)) {
+    close(fd);
+    return -1;
+  }
+  uint32_t magic;
+  int32_t ints[6];
+  memcpy(&magic, h, 4);
+  memcpy(ints, h + 4, sizeof(ints));
+  if (magic != SPOTS_TILED_MAGIC || ints[0] != SPOTS_TILED_VERSION ||
+      ints[1] != SPOTS_TILED_TILE || ints[2] != nDistances ||
+      ints[3] != nFrames || ints[4] != NrPixelsY || ints[5] != NrPixelsZ) {
+    printf("Warning: %s does not match SpotsInfo.bin, ignoring it.\n", fn);
+    close(fd);
+    return -1;
+  }
+  int valid = SpotsInfoStamp_check(h, fineFN, nDistances);
+  if (valid != 0) {
+    printf("Warning: %s %s, ignoring it.\n", fn,
+           valid == -1 ? "is older than SpotsInfo.bin"
+                       : "does not cover every distance");
+    close(fd);
+    return -1;
+  }
+  if (hugePages) {
+    size_t mapBytes = (dataBytes + SPOTS_TILED_HUGE_PAGE - 1) &
+                      ~(SPOTS_TILED_HUGE_PAGE - 1);
+    void *map = mmap(0, mapBytes, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (map != MAP_FAILED) {
+#ifdef MADV_HUGEPAGE
+      madvise(map, mapBytes, MADV_HUGEPAGE);
+#endif
+      size_t done = 0;
+      while (done < dataBytes) {
+        ssize_t n = pread(fd, (char *)map + done, dataBytes - done,
+                          SPOTS_TILED_HEADER_BYTES + done);
+        if (n <= 0)
+          break;
+        done += n;
+      }
+      if (done == dataBytes) {
+        close(fd);
+        t->map = map;
+        t->mapSize = mapBytes;
+        t->words = (const uint64_t *)map;
+        return 0;
+      }
+      munmap(map, mapBytes);
+    }
+    printf("Warning: could not load %s into huge pages, mapping it.\n", fn);
+  }
+  void *map = mmap(0, bytes, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED)
+    return -1;
+#ifdef MADV_HUGEPAGE
+  madvise(map, bytes, MADV_HUGEPAGE);
+#endif
+  t->map = map;
+  t->mapSize = bytes;
+  t->words = (const uint64_t *)((char *)map + SPOTS_TILED_HEADER_BYTES);
+  return 0;
+}
+
+static inline void SpotsTiled_close(SpotsTiled *t) {
+  if (t->map != NULL)
+    munmap(t->map, t->mapSize);
+  memset(t, 0, sizeof(*t));
+}
+
+#endif /* SPOTS_TILED_H */
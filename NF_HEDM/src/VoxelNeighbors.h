@@ -0,0 +1,163 @@
+//
+// Copyright (c) 2014, UChicago Argonne, LLC
+// See LICENSE file.
+//
+// VoxelNeighbors.h - Spatial visiting order and neighbour lists for the
+// voxels of one FitOrientationOMP block
+//
+// With NeighborSeeding, a voxel first tries the fitted orientations of
+// neighbours that are already solved and only screens the full orientation
+// list when none of them reaches MinFracAccept.  That pays off only if
+// neighbours are solved before most of the voxels next to them, so the
+// block is visited in bands of square cells (cell side = neighbour radius):
+// band by band, cell by cell within a band, so each thread's dynamic chunks
+// stay next to voxels that have just been solved.
+//
+// Neighbour lists are built once per block with the same cells: a voxel's
+// neighbours lie in the 3x3 cells around it, which are three contiguous
+// runs of the sorted order.
+
+#ifndef VOXEL_NEIGHBORS_H
+#define VOXEL_NEIGHBORS_H
+
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Triangles sharing an edge or a vertex have centroids within 4/sqrt(3)
+// gs of each other (gs = half the triangle edge).
+#define NEIGHBOR_SEED_RADIUS 2.5 /* x gs */
+#define NEIGHBOR_MAX_SEEDS 12
+
+typedef struct {
+  int n;
+  int *order; /* visiting order: valid voxels by cell band, then the rest */
+  int *start; /* n + 1 offsets into nbr */
+  int *nbr;   /* neighbours of v: nbr[start[v] .. start[v+1]), closest first */
+} VoxelNeighbors;
+
+typedef struct {
+  int64_t cy, cx;
+  double x;
+  int v;
+} VoxelNeighborsCell;
+
+static inline int VoxelNeighbors_cmp(const void *a, const void *b) {
+  const VoxelNeighborsCell *p = (const VoxelNeighborsCell *)a;
+  const VoxelNeighborsCell *q = (const VoxelNeighborsCell *)b;
+  if (p->cy != q->cy)
+    return p->cy < q->cy ? -1 : 1;
+  if (p->cx != q->cx)
+    return p->cx < q->cx ? -1 : 1;
+  if (p->x != q->x)
+    return p->x < q->x ? -1 : 1;
+  return p->v - q->v;
+}
+
+/** First sorted entry at or after cell (cy, cx). */
+static inline int VoxelNeighbors_lower(const VoxelNeighborsCell *c, int n,
+                                       int64_t cy, int64_t cx) {
+  int lo = 0, hi = n;
+  while (lo < hi) {
+    int mid = lo + (hi - lo) / 2;
+    if (c[mid].cy < cy || (c[mid].cy == cy && c[mid].cx < cx))
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return lo;
+}
+
+/**
+ * Build the visiting order and the lists of neighbours within radius of
+ * every valid voxel.
+ * @return 0 on success, -1 if out of memory
+ */
+static inline int VoxelNeighbors_build(VoxelNeighbors *g, int n,
+                                       const double *xs, const double *ys,
+                                       const int *valid, double radius) {
+  memset(g, 0, sizeof(*g));
+  g->n = n;
+  g->order = (int *)malloc((size_t)(n > 0 ? n : 1) * sizeof(int));
+  g->start = (int *)calloc((size_t)n + 1, sizeof(int));
+  VoxelNeighborsCell *c = (VoxelNeighborsCell *)malloc(
+      (size_t)(n > 0 ? n : 1) * sizeof(VoxelNeighborsCell));
+  if (g->order == NULL || g->start == NULL || c == NULL || radius <= 0) {
+    free(c);
+    return -1;
+  }
+  int nValid = 0, nOrder = 0;
+  for (int v = 0; v < n; v++) {
+    if (!valid[v])
+      continue;
+    c[nValid].cy = (int64_t)floor(ys[v] / radius);
+    c[nValid].cx = (int64_t)floor(xs[v] / radius);
+    c[nValid].x = xs[v];
+    c[nValid].v = v;
+    nValid++;
+  }
+  qsort(c, nValid, sizeof(*c), VoxelNeighbors_cmp);
+  for (int p = 0; p < nValid; p++)
+    g->order[nOrder++] = c[p].v;
+  for (int v = 0; v < n; v++)
+    if (!valid[v])
+      g->order[nOrder++] = v;
+  // Two passes over the same cells: count, then fill.
+  double r2 = radius * radius;
+  for (int pass = 0; pass < 2; pass++) {
+    for (int p = 0; p < nValid; p++) {
+      int v = c[p].v, cnt = 0;
+      int *out = pass ? g->nbr + g->start[v] : NULL;
+      for (int64_t dy = -1; dy <= 1; dy++) {
+        int q0 = VoxelNeighbors_lower(c, nValid, c[p].cy + dy, c[p].cx - 1);
+        int q1 = VoxelNeighbors_lower(c, nValid, c[p].cy + dy, c[p].cx + 2);
+        for (int q = q0; q < q1; q++) {
+          int u = c[q].v;
+          double dx = xs[u] - xs[v], dyy = ys[u] - ys[v];
+          if (u == v || dx * dx + dyy * dyy > r2)
+            continue;
+          if (pass == 0) {
+            cnt++;
+            continue;
+          }
+          // Insertion by distance; the lists are a dozen entries long.
+          double d2 = dx * dx + dyy * dyy;
+          int k = cnt++;
+          while (k > 0) {
+            int w = out[k - 1];
+            double ex = xs[w] - xs[v], ey = ys[w] - ys[v];
+            if (ex * ex + ey * ey <= d2)
+              break;
+            out[k] = w;
+            k--;
+          }
+          out[k] = u;
+        }
+      }
+      if (pass == 0)
+        g->start[v + 1] = cnt;
+    }
+    if (pass == 0) {
+      for (int v = 0; v < n; v++)
+        g->start[v + 1] += g->start[v];
+      g->nbr = (int *)malloc((size_t)(g->start[n] > 0 ? g->start[n] : 1) *
+                             sizeof(int));
+      if (g->nbr == NULL) {
+        free(c);
+        return -1;
+      }
+    }
+  }
+  free(c);
+  return 0;
+}
+
+static inline void VoxelNeighbors_free(VoxelNeighbors *g) {
+  free(g->order);
+  free(g->start);
+  free(g->nbr);
+  memset(g, 0, sizeof(*g));
+}
+
+#endif /* VOXEL_NEIGHBORS_H */
@@ -8,6 +8,9 @@
 #define rad2deg (180.0 / M_PI)
 #include "../../FF_HEDM/src/MIDAS_Limits.h"
 #include "GetMisorientation.h"
+#include "SpotsPyramid.h"
+#include "SpotsSparse.h"
+#include "SpotsTiled.h"
 #define EPS 1E-5
 #define MAX_N_SPOTS 5000
 #define MAX_N_OMEGA_RANGES 20
@@ -100,6 +103,28 @@ void CalcFracOverlap(const int NrOfFiles, const int nLayers, const int nTspots,
                      double *FracOver, int **InPixels, int NrPixelsY,
                      int NrPixelsZ);
 
+// When set (FitOrientationOMP with the sparse or tiled SpotsInfo files),
+// CalcFracOverlap and ScreenFracOverlap read observed spots from them
+// instead of ObsSpotsInfo; the sparse copy wins if both are set.
+extern const SpotsTiled *g_spotsTiled;
+extern const SpotsSparse *g_spotsSparse;
+
+// Same overlap as CalcFracOverlap for candidates that reach MinFrac.  The
+// footprint is first tested against the coarsest level of Pyramid and then
+// refined level by level; a candidate is dropped as soon as its fraction at
+// a level (an upper bound on the true one) falls below MinFrac, and
+// FracOver is then that bound.  hitBuf is per-thread scratch.
+void ScreenFracOverlap(const int NrOfFiles, const int nLayers,
+                       const int nTspots, double *TheorSpots,
+                       double OmegaStart, double OmegaStep, double XGrain[3],
+                       double YGrain[3], const double Lsds[nLayers],
+                       double RotMatTilts[3][3], const double px,
+                       const double ybcs[nLayers], const double zbcs[nLayers],
+                       const double gs, double P0All[nLayers][3],
+                       int *ObsSpotsInfo, const SpotsPyramid *Pyramid,
+                       double MinFrac, double *FracOver, int **InPixels,
+                       int NrPixelsY, int NrPixelsZ, NFHitBuffer *hitBuf);
+
 // OrientMat2Euler — now declared in GetMisorientation.h
 
 int ReadBinFiles(char FileStem[1000], char *ext, int StartNr, int EndNr,
@@ -415,6 +415,7 @@ int midas_parse_params(const char *filename, MIDASConfig *cfg) {
     if (param_double(aline, "WeightFitRMSE", &cfg->WeightFitRMSE)) continue;
     if (param_int(aline, "DoDynamicReassignment", &cfg->DoDynamicReassignment)) continue;
     if (param_int(aline, "FitAllAtOnce", &cfg->FitAllAtOnce)) continue;
+    if (param_int(aline, "GrainFitSolver", &cfg->GrainFitSolver)) continue;
 
     // ── NF/Sample parameters ──
     if (param_double(aline, "ExcludePoleAngle", &cfg->MinEta)) continue;
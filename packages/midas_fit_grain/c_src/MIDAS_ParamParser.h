@@ -214,6 +214,7 @@ typedef struct {
   double WeightMask, WeightFitRMSE;
   int    DoDynamicReassignment;
   int    FitAllAtOnce;
+  int    GrainFitSolver; // 0=Nelder-Mead (default), 1=bounded least squares
 
   // ── NF/Sample parameters ──
   double MinEta;
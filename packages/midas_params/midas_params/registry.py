@@ -786,6 +786,14 @@ PARAMS: list[ParamSpec] = [
         description="Per-frame lineout normalization (intensity/monitor scaling).",
         applies_to=frozenset({RI}), default=1, stages=S_INT,
     ),
+    ParamSpec(
+        name="PipelineFrames", type=ParamType.INT, category="Integration",
+        description="Frames decoded and integrated ahead of the writer (0 = off).",
+        applies_to=frozenset({RI}), default=0, units="count", stages=S_INT,
+        validators=("non_negative",), hidden_in_wizard=True,
+        notes="Ignored with a parameter file or benchmark iterations; capped "
+              "at the number of frames.",
+    ),
     ParamSpec(
         name="GradientCorrection", type=ParamType.BOOL, category="Integration",
         description="Apply radial gradient correction.",
@@ -861,6 +869,12 @@ PARAMS: list[ParamSpec] = [
         applies_to=FF_PF, units="counts", stages=S_PEAK,
         validators=("positive",),
     ),
+    ParamSpec(
+        name="GeometryLUTDir", type=ParamType.PATH, category="Peak search",
+        description="Directory caching the per-pixel corrected ring radius, "
+                    "keyed by a hash of the geometry (empty = recompute per job).",
+        applies_to=FF_PF, stages=S_PEAK, hidden_in_wizard=True,
+    ),
     ParamSpec(
         name="PeakFitMode", type=ParamType.INT, category="Peak search",
         description="Peak fitting model (0 = pseudo-Voigt, 1 = GSAS-II TCH).",
@@ -1249,6 +1263,45 @@ PARAMS: list[ParamSpec] = [
         applies_to=FF_PF, default=1, units="count", stages=S_INDEX,
         validators=("positive",),
     ),
+    ParamSpec(
+        name="PruneCandidates", type=ParamType.BOOL, category="Indexing",
+        description="Stop scoring a candidate position once it can no longer "
+                    "beat the seed's best match fraction.",
+        applies_to=FF_PF, default=0, stages=S_INDEX, hidden_in_wizard=True,
+    ),
+    ParamSpec(
+        name="OrderCandidates", type=ParamType.BOOL, category="Indexing",
+        description="Score the most promising orientations of a seed first so "
+                    "PruneCandidates cuts the rest sooner.",
+        applies_to=FF_PF, default=0, stages=S_INDEX, hidden_in_wizard=True,
+        notes="Ignored when VerifyPruning is set, which keeps generation order.",
+    ),
+    ParamSpec(
+        name="VerifyPruning", type=ParamType.BOOL, category="Indexing",
+        description="Rescore every pruned candidate exhaustively and count "
+                    "mismatches (debugging aid for PruneCandidates).",
+        applies_to=FF_PF, default=0, stages=S_INDEX, hidden_in_wizard=True,
+    ),
+    ParamSpec(
+        name="OrientCacheMB", type=ParamType.FLOAT, category="Indexing",
+        description="Memory budget for the indexer's cache of simulated spots "
+                    "per candidate orientation (0 = off).",
+        applies_to=FF_PF, default=0, units="MB", stages=S_INDEX,
+        validators=("non_negative",), hidden_in_wizard=True,
+    ),
+    ParamSpec(
+        name="OrientCacheQuantum", type=ParamType.FLOAT, category="Indexing",
+        description="Orientation quantum used to key the orientation cache.",
+        applies_to=FF_PF, units="deg", stages=S_INDEX, hidden_in_wizard=True,
+        notes="Unset uses StepsizeOrient / 10. A value <= 0 disables the "
+              "cache. Only read when OrientCacheMB > 0.",
+    ),
+    ParamSpec(
+        name="SeedSubTasks", type=ParamType.BOOL, category="Indexing",
+        description="Split seeds with very many (orientation, position) trials "
+                    "into sub-tasks for better thread load balance.",
+        applies_to=FF_PF, default=0, stages=S_INDEX, hidden_in_wizard=True,
+    ),
 
     # ═══════════════════════════════════════════════════════════════════════
     # Zarr-only keys (recognized by ffGenerateZipRefactor, not by central parser)
@@ -1272,6 +1325,12 @@ PARAMS: list[ParamSpec] = [
               "IntegratorZarrOMP accepts `DoPeakFit` (capital D) for the RI "
               "1D lineout fitter; treated as an alias here.",
     ),
+    ParamSpec(
+        name="PeakFitSolver", type=ParamType.INT, category="Peak search",
+        description="Peak-fit solver (0 = Nelder-Mead, 1 = Levenberg-Marquardt).",
+        applies_to=frozenset({FF, PF}), default=0, stages=S_PEAK,
+        hidden_in_wizard=True,
+    ),
     ParamSpec(
         name="UseMaximaPositions", type=ParamType.BOOL, category="Peak search",
         description="Use local-maxima positions instead of fitted centroids.",
@@ -1315,6 +1374,11 @@ PARAMS: list[ParamSpec] = [
         description="Fit all grains simultaneously vs sequentially.",
         applies_to=FF_PF, default=0, stages=S_REFINE, hidden_in_wizard=True,
     ),
+    ParamSpec(
+        name="GrainFitSolver", type=ParamType.INT, category="Refinement",
+        description="Grain refinement solver (0 = Nelder-Mead, 1 = bounded least squares).",
+        applies_to=FF_PF, default=0, stages=S_REFINE, hidden_in_wizard=True,
+    ),
     ParamSpec(
         name="Twins", type=ParamType.BOOL, category="Refinement",
         description="Enable twin analysis.",
@@ -95,6 +95,8 @@ FORCE_DOUBLE_PARAMS = {
     # transforms read these instead of p0..p14 when present).
     "iso_R2", "iso_R4", "iso_R6", "a1", "phi1", "a2", "phi2", "a3", "phi3",
     "a4", "phi4", "a5", "phi5", "a6", "phi6",
+    # IndexerOMP orientation cache size (MB) and plane-normal quantum (deg).
+    "OrientCacheMB", "OrientCacheQuantum",
 }
 FORCE_INT_PARAMS = {
     "Twins", "MaxNFrames", "DoFit", "DiscModel", "UseMaximaPositions",
@@ -110,10 +112,26 @@ FORCE_INT_PARAMS = {
     # Opt-in local background subtraction in the peak search
     # (midas_peakfit.background). BgSubtract 0 = legacy/C behaviour.
     "BgSubtract", "BgNSectors",
+    # Opt-in SoA bin file (DataSoA.bin) for IndexerOMP's CompareSpots.
+    "BinDataSoA",
+    # Opt-in binary columnar spot table next to InputAllExtraInfoFittingAll.csv.
+    "SpotsColumnar",
+    # Opt-in IndexerOMP candidate pruning / ordering.
+    "PruneCandidates", "OrderCandidates", "VerifyPruning",
+    # Opt-in splitting of expensive IndexerOMP seeds into sub-tasks.
+    "SeedSubTasks",
+    # IntegratorZarrOMP: frames decoded and integrated ahead per window.
+    "PipelineFrames",
+    # PeaksFittingOMPZarrRefactor: 1 = Levenberg-Marquardt peak fits.
+    "PeakFitSolver",
+    # FitPosOrStrainsOMP: 1 = bounded least-squares grain refinement.
+    "GrainFitSolver",
 }
 FORCE_STRING_PARAMS = {
     "GapFile", "BadPxFile", "ResultFolder", "PanelShiftsFile", "MaskFile",
     "GrainsFile", "ResidualCorrectionMap",
+    # PeaksFittingOMPZarrRefactor: directory of the cached geometry LUT.
+    "GeometryLUTDir",
 }
 RENAME_MAP = {
     "OmegaStep": "step", "Completeness": "MinMatchesToAcceptFrac",